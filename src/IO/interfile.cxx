@@ -976,7 +976,8 @@ read_interfile_PDFS_SPECT(istream& input,
        return 0;
      }
 
-   return new ProjDataFromStream(hdr.get_exam_info_sptr(), 
+   ProjDataFromStream* proj_data_ptr =
+     new ProjDataFromStream(hdr.get_exam_info_sptr(), 
 				 hdr.data_info_sptr,
 				 data_in,
 				 hdr.data_offset_each_dataset[0],
@@ -985,6 +986,8 @@ read_interfile_PDFS_SPECT(istream& input,
 				 hdr.type_of_numbers,
 				 hdr.file_byte_order,
 				 static_cast<float>(hdr.image_scaling_factors[0][0]));
+   proj_data_ptr->set_filename_for_concurrent_reading(full_data_file_name);
+   return proj_data_ptr;
 
 
 }
@@ -1018,7 +1021,8 @@ read_interfile_PDFS_Siemens(istream& input,
   if (hdr.compression)
     warning("Siemens projection data is compressed. Reading of raw data will fail.");
 
-  return new ProjDataFromStream(hdr.get_exam_info_sptr(),
+  ProjDataFromStream* proj_data_ptr =
+    new ProjDataFromStream(hdr.get_exam_info_sptr(),
     hdr.data_info_ptr->create_shared_clone(),
     data_in,
     hdr.data_offset_each_dataset[0],
@@ -1027,6 +1031,8 @@ read_interfile_PDFS_Siemens(istream& input,
     hdr.type_of_numbers,
     hdr.file_byte_order,
     1.);
+  proj_data_ptr->set_filename_for_concurrent_reading(full_data_file_name);
+  return proj_data_ptr;
 
 }
 
@@ -1092,7 +1098,8 @@ read_interfile_PDFS(istream& input,
        return 0;
      }
 
-   return new ProjDataFromStream(hdr.get_exam_info_sptr(),
+   ProjDataFromStream* proj_data_ptr =
+     new ProjDataFromStream(hdr.get_exam_info_sptr(),
 				 hdr.data_info_ptr->create_shared_clone(),
 				 data_in,
 				 hdr.data_offset_each_dataset[0],
@@ -1101,6 +1108,8 @@ read_interfile_PDFS(istream& input,
 				 hdr.type_of_numbers,
 				 hdr.file_byte_order,
 				 static_cast<float>(hdr.image_scaling_factors[0][0]));
+   proj_data_ptr->set_filename_for_concurrent_reading(full_data_file_name);
+   return proj_data_ptr;
 
 
 }
@@ -39,6 +39,7 @@
 // #include "stir/ProjDataInterfile.h"
 #include "stir/Bin.h"
 #include "stir/round.h"
+#include "stir/numerics/fourier.h"
 #include "stir/display.h"
 #include <algorithm>
 #include "stir/IO/interfile.h"
@@ -297,7 +298,7 @@ actual_reconstruct(shared_ptr<DiscretisedDensity<3,float> > const & density_ptr)
 
   // set ramp filter with appropriate sizes
   const int fft_size = 
-    round(pow(2., ceil(log((double)(pad_in_s + 1)* arc_corrected_proj_data_info_sptr->get_num_tangential_poss()) / log(2.))));
+    efficient_fourier_length((pad_in_s + 1)* arc_corrected_proj_data_info_sptr->get_num_tangential_poss());
   
   RampFilter filter(tangential_sampling,
                     fft_size, 
@@ -336,6 +337,12 @@ actual_reconstruct(shared_ptr<DiscretisedDensity<3,float> > const & density_ptr)
           continue;
 
         RelatedViewgrams<float> viewgrams;
+        if (proj_data_ptr->supports_concurrent_reading())
+          {
+            viewgrams =
+              proj_data_ptr->get_related_viewgrams(vs_num, symmetries_sptr);
+          }
+        else
 #ifdef STIR_OPENMP
 #pragma omp critical(FBP2D_get_viewgrams)
 #endif
@@ -87,6 +87,7 @@
 #include "stir/Succeeded.h"
 
 #include "stir/analytic/FBP3DRP/ColsherFilter.h" 
+#include "stir/numerics/fourier.h"
 #include "stir/display.h"
 //#include "stir/recon_buildblock/distributable.h"
 //#include "stir/FBP3DRP/process_viewgrams.h"
@@ -97,8 +98,15 @@
 #include "stir/utilities.h"
 #include "stir/recon_buildblock/BackProjectorByBinUsingInterpolation.h"
 #include "stir/recon_buildblock/ForwardProjectorByBinUsingRayTracing.h"
+#include "stir/recon_buildblock/OutputImagesForThreads.h"
 #include "stir/IO/read_from_file.h"
+#include "stir/num_threads.h"
+#include "stir/is_null_ptr.h"
 //#include "stir/mash_views.h"
+#include <boost/format.hpp>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
 
 #include <algorithm>
 #include <fstream>
@@ -125,6 +133,17 @@ START_NAMESPACE_STIR
 // should be private member, TODO
 static ofstream full_log;
 
+// write a (complete) message to full_log, such that messages from different threads are not mixed
+static void write_to_full_log(const std::string& message)
+{
+#ifdef STIR_OPENMP
+#pragma omp critical(FBP3DRP_FULL_LOG)
+#endif
+  {
+    full_log << message << std::flush;
+  }
+}
+
 // terribly ugly. can be replaced using LORCoordinates stuff (TODO)
 static void find_rmin_rmax(int& rmin, int& rmax, 
                            const ProjDataInfoCylindrical& proj_data_info_cyl,
@@ -210,6 +229,7 @@ set_defaults()
     
   display_level=0;
   save_intermediate_files=0;
+  max_num_images_for_threads=0;
 
   forward_projector_sptr.
     reset(new ForwardProjectorByBinUsingRayTracing);
@@ -257,6 +277,7 @@ FBP3DRPReconstruction::initialise_keymap()
 
   parser.add_key("Save intermediate images", &save_intermediate_files);
   parser.add_key("Display level",&display_level);
+  parser.add_key("maximum number of images for multi-threading", &max_num_images_for_threads);
 }
 
 
@@ -386,6 +407,12 @@ actual_reconstruct(shared_ptr<DiscretisedDensity<3,float> > const& target_image_
 	return Succeeded::no;
       }
     
+    if (max_num_images_for_threads<0)
+      {
+	warning("maximum number of images for multi-threading has to be non-negative");
+	return Succeeded::no;
+      }
+
     if (PadS<1 || PadZ<1)
       warning("Transaxial extension for FFT:=0 (or axial) should \n"
 	      "ONLY be used when the non-zero data\n"
@@ -661,72 +688,70 @@ void FBP3DRPReconstruction::do_3D_Reconstruction(
   shared_ptr<DataSymmetriesForViewSegmentNumbers> symmetries_sptr(
 								  back_projector_sptr->get_symmetries_used()->clone());
 
+  set_num_threads();
+#ifndef NRFFT
+  // every thread gets its own copy of the Colsher filter, see do_colsher_filter_view()
+  colsher_filters.assign(get_max_num_threads(), colsher_filter);
+  colsher_filter_segment_nums.assign(colsher_filters.size(),
+                                     proj_data_info_with_missing_data_sptr->get_min_segment_num()-1);
+#endif
+
+  // When saving intermediate images, we process one segment at a time.
+  // Otherwise, all segments are processed in one go, such that all threads are kept busy.
+  const bool process_segments_separately = save_intermediate_files && !_disable_output;
+  std::vector<ViewSegmentNumbers> vs_nums_to_process;
+
   for (int seg_num= -max_segment_num_to_process; seg_num <= max_segment_num_to_process; seg_num++) 
   {
-
-    // a bool value that will be used to determine if we are starting processing for this segment
-    bool first_view_in_segment = true;
-        
-    const int orig_min_axial_pos_num = proj_data_ptr->get_min_axial_pos_num(seg_num);
-    const int orig_max_axial_pos_num = proj_data_ptr->get_max_axial_pos_num(seg_num);
-            
+    std::vector<ViewSegmentNumbers> vs_nums_in_segment;
     for (int view_num=proj_data_ptr->get_min_view_num(); view_num <= proj_data_ptr->get_max_view_num(); ++view_num) {         
       const ViewSegmentNumbers vs_num(view_num, seg_num);
-      if (!symmetries_sptr->is_basic(vs_num))
-	continue;
-
-    const int new_min_axial_pos_num = 
-      proj_data_info_with_missing_data_sptr->get_min_axial_pos_num(seg_num);
-    const int new_max_axial_pos_num = 
-      proj_data_info_with_missing_data_sptr->get_max_axial_pos_num(seg_num);
+      if (symmetries_sptr->is_basic(vs_num))
+	vs_nums_in_segment.push_back(vs_num);
+    }
+    // do some logging etc, but only when this segment has any processing
+    // (some segment_nums might not because of the symmetries)
+    if (vs_nums_in_segment.empty())
+      continue;
 
-      if (first_view_in_segment)
-	{
-	  full_log << "\n--------------------------------\n";
-	  full_log << "PROCESSING SEGMENT  No " << seg_num << endl ;
-	  
-	  full_log << "Average delta= " <<  input_proj_data_info_cyl().get_average_ring_difference(seg_num)
-		   << " with span= " << input_proj_data_info_cyl().get_max_ring_difference(seg_num) - input_proj_data_info_cyl().get_min_ring_difference(seg_num) +1
-		   << " and extended axial position numbers: min= " << new_min_axial_pos_num << " and max= " << new_max_axial_pos_num  <<endl;
+    full_log << "\n--------------------------------\n";
+    full_log << "PROCESSING SEGMENT  No " << seg_num << endl ;
 	  
-	  first_view_in_segment = false;
-	}
+    full_log << "Average delta= " <<  input_proj_data_info_cyl().get_average_ring_difference(seg_num)
+	     << " with span= " << input_proj_data_info_cyl().get_max_ring_difference(seg_num) - input_proj_data_info_cyl().get_min_ring_difference(seg_num) +1
+	     << " and extended axial position numbers: min= " << proj_data_info_with_missing_data_sptr->get_min_axial_pos_num(seg_num)
+	     << " and max= " << proj_data_info_with_missing_data_sptr->get_max_axial_pos_num(seg_num) <<endl;
 
-      full_log << "\n*************************************************************";
-      full_log << "\n        Processing view " << vs_num.view_num()
-	       << " of segment " << vs_num.segment_num() << endl;
-	      
-      full_log << "\n  - Getting related viewgrams"  << endl;
- 
-      RelatedViewgrams<float> viewgrams = 
-	proj_data_ptr->get_related_viewgrams(vs_num, symmetries_sptr);
-        
-      do_process_viewgrams(
-			   viewgrams,
-			   new_min_axial_pos_num, new_max_axial_pos_num, orig_min_axial_pos_num, orig_max_axial_pos_num,
-			   image);
- 
-                 
-    }    
-    // do some logging etc, but only when this segment had any processing
-    // (some segment_nums might not because of the symmetries)
-    if (!first_view_in_segment)
+    if (!process_segments_separately)
       {
-	full_log << "\n*************************************************************";
-	full_log << "\nEnd of this segment. Current image values:\n"
-		 << "Min= " << image.find_min()
-		 << " Max = " << image.find_max()
-		 << " Sum = " << image.sum() << endl;
-#ifndef PARALLEL
-    if(save_intermediate_files && !_disable_output){
-	  char *file = new char[output_filename_prefix.size() + 20];
-	  sprintf(file,"%s_afterseg%d",output_filename_prefix.c_str(),seg_num);
-	  do_save_img(file, image);        
-	  delete[] file;
-	}
+	vs_nums_to_process.insert(vs_nums_to_process.end(), vs_nums_in_segment.begin(), vs_nums_in_segment.end());
+	continue;
       }
-#endif 
+
+    do_process_viewgrams_in_parallel(vs_nums_in_segment, symmetries_sptr, image);
+
+    full_log << "\n*************************************************************";
+    full_log << "\nEnd of this segment. Current image values:\n"
+	     << "Min= " << image.find_min()
+	     << " Max = " << image.find_max()
+	     << " Sum = " << image.sum() << endl;
+    char *file = new char[output_filename_prefix.size() + 20];
+    sprintf(file,"%s_afterseg%d",output_filename_prefix.c_str(),seg_num);
+    do_save_img(file, image);        
+    delete[] file;
   }
+
+  if (!vs_nums_to_process.empty())
+    {
+      do_process_viewgrams_in_parallel(vs_nums_to_process, symmetries_sptr, image);
+
+      full_log << "\n*************************************************************";
+      full_log << "\nEnd of all segments. Current image values:\n"
+	       << "Min= " << image.find_min()
+	       << " Max = " << image.find_max()
+	       << " Sum = " << image.sum() << endl;
+    }
+
   // Normalise the image
   if (dynamic_cast<BackProjectorByBinUsingInterpolation const *>(back_projector_sptr.get()) == 0)
     {
@@ -740,6 +765,77 @@ void FBP3DRPReconstruction::do_3D_Reconstruction(
 
 }
 
+void
+FBP3DRPReconstruction::
+do_process_viewgrams_in_parallel(const std::vector<ViewSegmentNumbers>& vs_nums,
+                                 const shared_ptr<DataSymmetriesForViewSegmentNumbers>& symmetries_sptr,
+                                 VoxelsOnCartesianGrid<float> &image)
+{
+  // NRFFT uses a static Colsher filter, so we cannot use threads in that case.
+  // We also avoid threads when displaying after each view.
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+  // threads back project into separate images, which are summed at the end
+  OutputImagesForThreads<VoxelsOnCartesianGrid<float> >
+    images_for_threads(&image, max_num_images_for_threads);
+#pragma omp parallel for schedule(dynamic) shared(images_for_threads) if(display_level<=2)
+#endif
+  // note: older versions of openmp need an int as loop
+  for (int i=0; i<static_cast<int>(vs_nums.size()); ++i)
+    {
+      const ViewSegmentNumbers vs_num = vs_nums[i];
+      const int seg_num = vs_num.segment_num();
+
+      write_to_full_log((boost::format("\n*************************************************************"
+                                       "\n        Processing view %1% of segment %2%\n")
+                         % vs_num.view_num() % seg_num).str());
+
+      RelatedViewgrams<float> viewgrams;
+      if (proj_data_ptr->supports_concurrent_reading())
+	{
+	  viewgrams =
+	    proj_data_ptr->get_related_viewgrams(vs_num, symmetries_sptr);
+	}
+      else
+#ifdef STIR_OPENMP
+#pragma omp critical(FBP3DRP_get_viewgrams)
+#endif
+      {
+	viewgrams =
+	  proj_data_ptr->get_related_viewgrams(vs_num, symmetries_sptr);
+      }
+
+      const int new_min_axial_pos_num = 
+	proj_data_info_with_missing_data_sptr->get_min_axial_pos_num(seg_num);
+      const int new_max_axial_pos_num = 
+	proj_data_info_with_missing_data_sptr->get_max_axial_pos_num(seg_num);
+
+      do_filter_viewgrams(viewgrams,
+			  new_min_axial_pos_num, new_max_axial_pos_num,
+			  proj_data_ptr->get_min_axial_pos_num(seg_num),
+			  proj_data_ptr->get_max_axial_pos_num(seg_num));
+
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+      int image_num;
+      VoxelsOnCartesianGrid<float>* local_image_ptr =
+	images_for_threads.get_image(image_num);
+
+      do_3D_backprojection_view(viewgrams,
+				*local_image_ptr,
+				new_min_axial_pos_num, new_max_axial_pos_num);
+
+      images_for_threads.release_image(image_num);
+#else
+      do_3D_backprojection_view(viewgrams,
+				image,
+				new_min_axial_pos_num, new_max_axial_pos_num);
+#endif
+    }
+
+#if defined(STIR_OPENMP) && !defined(NRFFT)
+  // "reduce" the images constructed by the threads
+  images_for_threads.add_to_output_image();
+#endif
+}
 
 // CL 010699 NEW function
 void FBP3DRPReconstruction::do_best_fit(const Sinogram<float> &sino_measured,const Sinogram<float> &sino_calculated)
@@ -812,10 +908,8 @@ void FBP3DRPReconstruction::do_forward_project_view(RelatedViewgrams<float> & vi
   // do not forward project if we don't need to...
   if (new_min_axial_pos_num <= orig_min_axial_pos_num-1)
     {
-      full_log << "  - Forward projection of missing data first from ring No " 
-	       << new_min_axial_pos_num
-	       << " to "
-	       << orig_min_axial_pos_num-1 << endl;
+      write_to_full_log((boost::format("  - Forward projection of missing data first from ring No %1% to %2%\n")
+			 % new_min_axial_pos_num % (orig_min_axial_pos_num-1)).str());
 
       forward_projector_sptr->forward_project(viewgrams, estimated_image(),
 					     new_min_axial_pos_num ,orig_min_axial_pos_num-1);	    
@@ -824,9 +918,8 @@ void FBP3DRPReconstruction::do_forward_project_view(RelatedViewgrams<float> & vi
 
   if (orig_max_axial_pos_num+1 <= new_max_axial_pos_num)
     {
-      full_log << "  - Forward projection from ring No "
-	       << orig_max_axial_pos_num+1
-	       << " to " << new_max_axial_pos_num << endl;
+      write_to_full_log((boost::format("  - Forward projection from ring No %1% to %2%\n")
+			 % (orig_max_axial_pos_num+1) % new_max_axial_pos_num).str());
     
       forward_projector_sptr->forward_project(viewgrams, estimated_image(),
 					     orig_max_axial_pos_num+1, new_max_axial_pos_num);
@@ -860,22 +953,42 @@ void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & vi
   assert(dynamic_cast<ProjDataInfoCylindricalArcCorr const *>
 	 (viewgrams.get_proj_data_info_ptr()));
 
-  // TODO make into object member instead of static
-  static int prev_seg_num = viewgrams.get_proj_data_info_ptr()->get_min_segment_num()-1;  
 #ifdef NRFFT
+  static int prev_seg_num = viewgrams.get_proj_data_info_ptr()->get_min_segment_num()-1;  
   static ColsherFilter colsher_filter(0,0,0,0,0,0,0,0,0,0);
+#else
+  // use the filter of the current thread, and set it up if it was used for another segment
+  if (colsher_filters.empty())
+    {
+      // we are called without do_3D_Reconstruction()
+      colsher_filters.assign(1, colsher_filter);
+      colsher_filter_segment_nums.assign(1, viewgrams.get_proj_data_info_ptr()->get_min_segment_num()-1);
+    }
+#ifdef STIR_OPENMP
+  const int thread_num = omp_get_thread_num();
+#else
+  const int thread_num = 0;
+#endif
+  assert(thread_num < static_cast<int>(colsher_filters.size()));
+  int& prev_seg_num = colsher_filter_segment_nums[thread_num];
+  ColsherFilter& colsher_filter = colsher_filters[thread_num];
 #endif
   const int seg_num = viewgrams.get_basic_segment_num();
 
   if (prev_seg_num != seg_num)
   {
     prev_seg_num = seg_num;
-    full_log << "  - Constructing Colsher filter for this segment\n";
+    write_to_full_log("  - Constructing Colsher filter for this segment\n");
     const int nrings = viewgrams.get_num_axial_poss(); 
     const int nprojs = viewgrams.get_num_tangential_poss();
     
+#ifdef NRFFT
     const int width = (int) pow(2., ((int) ceil(log((PadS + 1.) * nprojs) / log(2.))));
     const int height = (int) pow(2., ((int) ceil(log((PadZ + 1.) * nrings) / log(2.))));	
+#else
+    const int width = efficient_fourier_length((PadS + 1) * nprojs);
+    const int height = efficient_fourier_length((PadZ + 1) * nrings);
+#endif
     
     
     const float theta_max = atan(viewgrams.get_proj_data_info_ptr()->get_tantheta(Bin(max_segment_num_to_process,0,0,0)));
@@ -887,9 +1000,8 @@ void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & vi
       viewgrams.get_proj_data_info_ptr()->get_sampling_in_s(Bin(seg_num,0,0,0));
     const float sampling_in_t =
       viewgrams.get_proj_data_info_ptr()->get_sampling_in_t(Bin(seg_num,0,0,0));
-    full_log << "Colsher filter theta_max = " << theta_max << " theta = " << theta
-      << " d_a = " << sampling_in_s
-	     << " d_b = " << sampling_in_t << endl;
+    write_to_full_log((boost::format("Colsher filter theta_max = %1% theta = %2% d_a = %3% d_b = %4%\n")
+		       % theta_max % theta % sampling_in_s % sampling_in_t).str());
     
     
 #ifdef NRFFT
@@ -909,7 +1021,7 @@ void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & vi
 #endif
   }
 
-  full_log << "  - Apply Colsher filter to complete oblique sinograms" << endl;
+  write_to_full_log("  - Apply Colsher filter to complete oblique sinograms\n");
 #ifdef NRFFT
 
   assert(viewgrams.get_num_viewgrams()%2 == 0);
@@ -943,7 +1055,7 @@ void FBP3DRPReconstruction::do_colsher_filter_view( RelatedViewgrams<float> & vi
 	const int num_ring_differences = 
 	  input_proj_data_info_cyl().get_max_ring_difference(seg_num) - 
 	  input_proj_data_info_cyl().get_min_ring_difference(seg_num) + 1;
-	full_log << "  - Multiplying filtered projections by " << num_ring_differences << endl;
+	write_to_full_log((boost::format("  - Multiplying filtered projections by %1%\n") % num_ring_differences).str());
 	if (num_ring_differences != 1){
           viewgrams *= static_cast<float>(num_ring_differences);
 	}
@@ -959,7 +1071,7 @@ void FBP3DRPReconstruction::do_3D_backprojection_view(const RelatedViewgrams<flo
                                                         VoxelsOnCartesianGrid<float> &image,
                                                         int new_min_axial_pos_num, int new_max_axial_pos_num)
 { 
-    full_log << "  - Backproject the filtered Colsher complete sinograms" << endl;
+    write_to_full_log("  - Backproject the filtered Colsher complete sinograms\n");
 
     back_projector_sptr->back_project(image, viewgrams,new_min_axial_pos_num, new_max_axial_pos_num);
         
@@ -990,12 +1102,18 @@ void FBP3DRPReconstruction::do_log_file(const VoxelsOnCartesianGrid<float> &imag
              
 
 #ifndef PARALLEL
+#ifndef NRFFT
+    // sum the timers of the filters used by the threads
+    double colsher_filter_set_up_CPU_time = colsher_filter.get_CPU_timer_value();
+    for (std::size_t i=0; i<colsher_filters.size(); ++i)
+      colsher_filter_set_up_CPU_time += colsher_filters[i].get_CPU_timer_value();
+#endif
     logfile << "\n\n TIMING RESULTS :\n"    
             << "Total CPU time : " << get_CPU_timer_value() << '\n' 
             << "forward projection CPU time : " << forward_projector_sptr->get_CPU_timer_value() << '\n' 
             << "back projection CPU time : " << back_projector_sptr->get_CPU_timer_value() << '\n'
 #ifndef NRFFT
-	    << "Colsher filter set-up CPU time : " << colsher_filter.get_CPU_timer_value() << '\n'
+	    << "Colsher filter set-up CPU time : " << colsher_filter_set_up_CPU_time << '\n'
 #endif
       ;
 #endif    
@@ -1006,6 +1124,19 @@ void FBP3DRPReconstruction::do_process_viewgrams(RelatedViewgrams<float> & viewg
                                                    int new_min_axial_pos_num, int new_max_axial_pos_num,
                                                    int orig_min_axial_pos_num, int orig_max_axial_pos_num,
                                                    VoxelsOnCartesianGrid<float> &image)
+{
+        do_filter_viewgrams(viewgrams,
+                            new_min_axial_pos_num, new_max_axial_pos_num, orig_min_axial_pos_num, orig_max_axial_pos_num);
+   
+        do_3D_backprojection_view(viewgrams,
+                                  image,
+                                  new_min_axial_pos_num, new_max_axial_pos_num);
+    
+}
+
+void FBP3DRPReconstruction::do_filter_viewgrams(RelatedViewgrams<float> & viewgrams, 
+                                                  int new_min_axial_pos_num, int new_max_axial_pos_num,
+                                                  int orig_min_axial_pos_num, int orig_max_axial_pos_num)
 {
         do_arc_correction(viewgrams);
 
@@ -1033,11 +1164,6 @@ void FBP3DRPReconstruction::do_process_viewgrams(RelatedViewgrams<float> & viewg
 	{
 	  viewgrams /= 2;
 	}
-   
-        do_3D_backprojection_view(viewgrams,
-                                  image,
-                                  new_min_axial_pos_num, new_max_axial_pos_num);
-    
 }
 
 
@@ -46,6 +46,9 @@
 #include <numeric>
 #include <iostream>
 #include <fstream>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
 
 #ifndef STIR_NO_NAMESPACES
 using std::find;
@@ -67,6 +70,53 @@ using std::vector;
 #endif
 
 START_NAMESPACE_STIR
+
+namespace detail
+{
+  /* Lock used to serialise all access to the shared streams of ProjDataFromStream
+     objects. This replaces a named critical section, as reading does not need the
+     lock when it can use a stream private to the thread
+     (see ProjDataFromStream::set_filename_for_concurrent_reading()).
+     The lock is released at destruction, so also when error() throws.
+  */
+  class ProjDataFromStreamIOLock
+  {
+  public:
+    explicit ProjDataFromStreamIOLock(const bool do_lock = true)
+      : locked(do_lock)
+    {
+#ifdef STIR_OPENMP
+      if (locked)
+        omp_set_lock(&io_lock.lock);
+#endif
+    }
+    ~ProjDataFromStreamIOLock()
+    {
+#ifdef STIR_OPENMP
+      if (locked)
+        omp_unset_lock(&io_lock.lock);
+#endif
+    }
+  private:
+    const bool locked;
+#ifdef STIR_OPENMP
+    struct GlobalLock
+    {
+      omp_lock_t lock;
+      GlobalLock() { omp_init_lock(&lock); }
+      ~GlobalLock() { omp_destroy_lock(&lock); }
+    };
+    static GlobalLock io_lock;
+#endif
+  };
+
+#ifdef STIR_OPENMP
+  ProjDataFromStreamIOLock::GlobalLock ProjDataFromStreamIOLock::io_lock;
+#endif
+} // end of namespace detail
+
+typedef detail::ProjDataFromStreamIOLock IOLock;
+
 //---------------------------------------------------------
 // constructors
 //---------------------------------------------------------
@@ -122,6 +172,46 @@ ProjDataFromStream::ProjDataFromStream(shared_ptr<ExamInfo> const& exam_info_spt
   }
 }
 
+void
+ProjDataFromStream::set_filename_for_concurrent_reading(const std::string& filename)
+{
+  filename_for_concurrent_reading = filename;
+  thread_streams.clear();
+#ifdef STIR_OPENMP
+  if (!filename.empty())
+    thread_streams.resize(omp_get_max_threads());
+#endif
+}
+
+std::istream*
+ProjDataFromStream::get_stream_for_concurrent_reading() const
+{
+#ifdef STIR_OPENMP
+  // Only use thread streams at the first level of parallelism, as thread numbers
+  // are only unique within a team.
+  if (filename_for_concurrent_reading.empty() || omp_get_level() != 1)
+    return 0;
+  const int thread_num = omp_get_thread_num();
+  // thread_streams is never resized here, so this is safe without locking
+  if (thread_num >= static_cast<int>(thread_streams.size()))
+    return 0;
+  shared_ptr<std::istream>& stream_sptr = thread_streams[thread_num];
+  if (is_null_ptr(stream_sptr))
+    {
+      stream_sptr.reset(new std::ifstream(filename_for_concurrent_reading.c_str(),
+                                          ios::in | ios::binary));
+      if (! *stream_sptr)
+        error("ProjDataFromStream: error opening file %s for reading",
+              filename_for_concurrent_reading.c_str());
+    }
+  // reset any error flags (e.g. eof) from a previous read
+  stream_sptr->clear();
+  return stream_sptr.get();
+#else
+  return 0;
+#endif
+}
+
 Viewgram<float> 
 ProjDataFromStream::get_viewgram(const int view_num, const int segment_num,
                                  const bool make_num_tangential_poss_odd) const
@@ -145,14 +235,15 @@ ProjDataFromStream::get_viewgram(const int view_num, const int segment_num,
   float scale = float(1);
   Succeeded succeeded = Succeeded::yes;
   
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
   {
-    sino_stream->seekg(segment_offset, ios::beg); // start of segment
-    sino_stream->seekg(beg_view_offset, ios::cur); // start of view within segment
+    // use a stream private to this thread if possible, otherwise lock the shared stream
+    std::istream* const thread_stream_ptr = get_stream_for_concurrent_reading();
+    const IOLock lock(is_null_ptr(thread_stream_ptr));
+    std::istream& stream = is_null_ptr(thread_stream_ptr) ? *sino_stream : *thread_stream_ptr;
+    stream.seekg(segment_offset, ios::beg); // start of segment
+    stream.seekg(beg_view_offset, ios::cur); // start of view within segment
   
-    if (! *sino_stream)
+    if (! stream)
       {
         warning("ProjDataFromStream::get_viewgram: error after seekg");
         succeeded = Succeeded::no;
@@ -161,7 +252,7 @@ ProjDataFromStream::get_viewgram(const int view_num, const int segment_num,
       {    
         for (int ax_pos_num = get_min_axial_pos_num(segment_num); ax_pos_num <= get_max_axial_pos_num(segment_num); ax_pos_num++)
           {
-            if (read_data(*sino_stream, viewgram[ax_pos_num], on_disk_data_type, scale, on_disk_byte_order)
+            if (read_data(stream, viewgram[ax_pos_num], on_disk_data_type, scale, on_disk_byte_order)
                 == Succeeded::no)
               {
                 succeeded = Succeeded::no;
@@ -175,12 +266,12 @@ ProjDataFromStream::get_viewgram(const int view_num, const int segment_num,
               }
             // seek to next line unless it was the last we need to read
             if(ax_pos_num != get_max_axial_pos_num(segment_num))
-              sino_stream->seekg(intra_views_offset, ios::cur);
+              stream.seekg(intra_views_offset, ios::cur);
           }
       }    
     else if (get_storage_order() == Segment_View_AxialPos_TangPos)
       {
-        if(read_data(*sino_stream, viewgram, on_disk_data_type, scale, on_disk_byte_order)
+        if(read_data(stream, viewgram, on_disk_data_type, scale, on_disk_byte_order)
            == Succeeded::no)
           {
             succeeded = Succeeded::no;
@@ -227,20 +318,29 @@ ProjDataFromStream::get_bin_value(const Bin& this_bin) const
 
     const streamoff total_offset = offsets[0];
 
-    sino_stream->seekg(0 , ios::beg); // reset file
-    sino_stream->seekg(total_offset, ios::cur); // start of view within segment
-
-    if (! *sino_stream)
-    {
-        error("ProjDataFromStream::get_bin_value: error after seekg.");
-    }
-
    Array< 1,  float>  value(1);
     float scale = float(1);
+    Succeeded succeeded = Succeeded::yes;
+
+    {
+      std::istream* const thread_stream_ptr = get_stream_for_concurrent_reading();
+      const IOLock lock(is_null_ptr(thread_stream_ptr));
+      std::istream& stream = is_null_ptr(thread_stream_ptr) ? *sino_stream : *thread_stream_ptr;
+      stream.seekg(0 , ios::beg); // reset file
+      stream.seekg(total_offset, ios::cur); // start of view within segment
 
-    // Now the storage order is not more important. Just read.
-    if (read_data(*sino_stream, value, on_disk_data_type, scale, on_disk_byte_order)
-            == Succeeded::no)
+      if (! stream)
+      {
+        warning("ProjDataFromStream::get_bin_value: error after seekg.");
+        succeeded = Succeeded::no;
+      }
+      else
+      {
+        // Now the storage order is not more important. Just read.
+        succeeded = read_data(stream, value, on_disk_data_type, scale, on_disk_byte_order);
+      }
+    } // end of critical section
+    if (succeeded == Succeeded::no)
         error("ProjDataFromStream: error reading data\n");
     if(scale != 1.f)
         error("ProjDataFromStream: error reading data: scale factor returned by read_data should be 1\n");
@@ -379,10 +479,8 @@ ProjDataFromStream::set_viewgram(const Viewgram<float>& v)
   float scale = scale_factor;
   Succeeded succeeded = Succeeded::yes;
 
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
   {
+    const IOLock lock;
     sino_stream->seekp(segment_offset, ios::beg); // start of segment
     sino_stream->seekp(beg_view_offset, ios::cur); // start of view within segment
   
@@ -616,20 +714,20 @@ ProjDataFromStream::get_sinogram(const int ax_pos_num, const int segment_num,
 
   if (get_storage_order() == Segment_AxialPos_View_TangPos)
     {    
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
       {
-        sino_stream->seekg(segment_offset, ios::beg); // start of segment
-        sino_stream->seekg(beg_ax_pos_offset, ios::cur); // start of view within segment  
-        if (! *sino_stream)
+        std::istream* const thread_stream_ptr = get_stream_for_concurrent_reading();
+        const IOLock lock(is_null_ptr(thread_stream_ptr));
+        std::istream& stream = is_null_ptr(thread_stream_ptr) ? *sino_stream : *thread_stream_ptr;
+        stream.seekg(segment_offset, ios::beg); // start of segment
+        stream.seekg(beg_ax_pos_offset, ios::cur); // start of view within segment  
+        if (! stream)
           {
             warning("ProjDataFromStream::get_sinogram: error after seekg");
             succeeded = Succeeded::no;
           }
         else
           {
-            succeeded = read_data(*sino_stream, sinogram, on_disk_data_type, scale, on_disk_byte_order);
+            succeeded = read_data(stream, sinogram, on_disk_data_type, scale, on_disk_byte_order);
           }
       } // end of critical section
       if (succeeded == Succeeded::no)
@@ -639,20 +737,20 @@ ProjDataFromStream::get_sinogram(const int ax_pos_num, const int segment_num,
     }  
     else if (get_storage_order() == Segment_View_AxialPos_TangPos)
       {
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
         {
-          sino_stream->seekg(segment_offset, ios::beg); // start of segment
-          sino_stream->seekg(beg_ax_pos_offset, ios::cur); // start of view within segment
-          if (! *sino_stream)
+          std::istream* const thread_stream_ptr = get_stream_for_concurrent_reading();
+          const IOLock lock(is_null_ptr(thread_stream_ptr));
+          std::istream& stream = is_null_ptr(thread_stream_ptr) ? *sino_stream : *thread_stream_ptr;
+          stream.seekg(segment_offset, ios::beg); // start of segment
+          stream.seekg(beg_ax_pos_offset, ios::cur); // start of view within segment
+          if (! stream)
             {
               warning("ProjDataFromStream::get_sinogram: error after seekg");
               succeeded = Succeeded::no;              
             }
           for (int view = get_min_view_num(); view <= get_max_view_num(); view++)
             {
-              if (read_data(*sino_stream, sinogram[view], on_disk_data_type, scale, on_disk_byte_order)
+              if (read_data(stream, sinogram[view], on_disk_data_type, scale, on_disk_byte_order)
                 == Succeeded::no)
                 {
                   succeeded = Succeeded::no;
@@ -666,7 +764,7 @@ ProjDataFromStream::get_sinogram(const int ax_pos_num, const int segment_num,
                 }
               // seek to next line unless it was the last we need to read
               if(view != get_max_view_num())
-                sino_stream->seekg(intra_ax_pos_offset, ios::cur);
+                stream.seekg(intra_ax_pos_offset, ios::cur);
             }    
         } // end of critical section
       }
@@ -730,10 +828,8 @@ ProjDataFromStream::set_sinogram(const Sinogram<float>& s)
   float scale = scale_factor;
 
   Succeeded succeeded = Succeeded::yes;
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
   {
+    const IOLock lock;
     sino_stream->seekp(segment_offset, ios::beg); // start of segment
     sino_stream->seekp(beg_ax_pos_offset, ios::cur); // start of view within segment
   
@@ -837,19 +933,19 @@ ProjDataFromStream::get_segment_by_sinogram(const int segment_num) const
       SegmentBySinogram<float> segment(proj_data_info_ptr,segment_num);
       float scale = float(1);
       Succeeded succeeded = Succeeded::yes;
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
       {
-        sino_stream->seekg(segment_offset, ios::beg);
-        if (! *sino_stream)
+        std::istream* const thread_stream_ptr = get_stream_for_concurrent_reading();
+        const IOLock lock(is_null_ptr(thread_stream_ptr));
+        std::istream& stream = is_null_ptr(thread_stream_ptr) ? *sino_stream : *thread_stream_ptr;
+        stream.seekg(segment_offset, ios::beg);
+        if (! stream)
           {
             warning("ProjDataFromStream::get_segment_by_sinogram: error after seekg");
             succeeded = Succeeded::no;
           }
         else
           {
-            succeeded = read_data(*sino_stream, segment, on_disk_data_type, scale, on_disk_byte_order);
+            succeeded = read_data(stream, segment, on_disk_data_type, scale, on_disk_byte_order);
           }
       } // end of critical section
     if (succeeded == Succeeded::no)
@@ -885,19 +981,19 @@ ProjDataFromStream::get_segment_by_view(const int segment_num) const
     streamoff segment_offset = get_offset_segment(segment_num);
     float scale = float(1);
     Succeeded succeeded = Succeeded::yes;  
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
     {
-      sino_stream->seekg(segment_offset, ios::beg); 
-      if (! *sino_stream)
+      std::istream* const thread_stream_ptr = get_stream_for_concurrent_reading();
+      const IOLock lock(is_null_ptr(thread_stream_ptr));
+      std::istream& stream = is_null_ptr(thread_stream_ptr) ? *sino_stream : *thread_stream_ptr;
+      stream.seekg(segment_offset, ios::beg); 
+      if (! stream)
         {
           warning("ProjDataFromStream::get_segment_by_sinogram: error after seekg");
           succeeded = Succeeded::no;
         }
       else
         {
-          succeeded = read_data(*sino_stream, segment, on_disk_data_type, scale, on_disk_byte_order);
+          succeeded = read_data(stream, segment, on_disk_data_type, scale, on_disk_byte_order);
         }
     } // end of critical section
     if (succeeded == Succeeded::no)
@@ -951,10 +1047,8 @@ ProjDataFromStream::set_segment(const SegmentBySinogram<float>& segmentbysinogra
         }
       float scale = scale_factor;
       Succeeded succeeded = Succeeded::yes;
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
       {
+        const IOLock lock;
         sino_stream->seekp(segment_offset,ios::beg);        
         if (! *sino_stream)
           {
@@ -1024,10 +1118,8 @@ ProjDataFromStream::set_segment(const SegmentByView<float>& segmentbyview_v)
         }
         float scale = scale_factor;
         Succeeded succeeded = Succeeded::yes;
-#ifdef STIR_OPENMP
-#pragma omp critical(PROJDATAFROMSTREAMIO)
-#endif
         {
+          const IOLock lock;
           sino_stream->seekp(segment_offset,ios::beg);
           if (! *sino_stream)
             {
@@ -29,25 +29,14 @@
 #include "stir/shared_ptr.h"
 #include "stir/Succeeded.h"
 #include "stir/SegmentByView.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/Viewgram.h"
+#include "stir/Sinogram.h"
+#include "stir/IndexRange2D.h"
 #include "stir/Bin.h"
-#include <fstream>
-
-
-#ifdef STIR_USE_OLD_STRSTREAM
-#include <strstream>
-#else
-#include <sstream>
-#endif
-
-#ifndef STIR_NO_NAMESPACES
-using std::fstream;
-using std::iostream;
-using std::ios;
-#ifdef STIR_USE_OLD_STRSTREAM
-using std::strstream;
-#endif
-using std::string;
-#endif
+#include "stir/warning.h"
+#include "stir/error.h"
+#include <algorithm>
 
 START_NAMESPACE_STIR
 
@@ -59,88 +48,313 @@ ProjDataInMemory::
 ProjDataInMemory(shared_ptr<ExamInfo> const& exam_info_sptr,
 		 shared_ptr<ProjDataInfo> const& proj_data_info_ptr, const bool initialise_with_0)
   :
-  ProjDataFromStream(exam_info_sptr, proj_data_info_ptr, shared_ptr<iostream>()) // trick: first initialise sino_stream_ptr to 0
-{
-  
-#ifdef STIR_USE_OLD_STRSTREAM
-  const size_t buffer_size = get_size_of_buffer();
-  //buffer = unique_ptr<char>(new char[buffer_size]);
-  buffer.reset(new char[buffer_size]);
-  sino_stream.reset(new strstream(buffer.get(), buffer_size, ios::in | ios::out | ios::trunc | ios::binary));
-#else
-  // it would be advantageous to preallocate memory as well
-  // the only way to do this is by passing a string of the appropriate size
-  // However, if basic_string doesn't do reference counting, we would have
-  // temporarily 2 strings of a (potentially large) size in memory.
-  // todo?
-  sino_stream.reset(new std::stringstream(ios::in | ios::out | ios::binary));
-#endif
-
-  if (!*sino_stream)
-    error("ProjDataInMemory error initialising stream\n");
-
-  if (initialise_with_0)
-  {
-    for (int segment_num = proj_data_info_ptr->get_min_segment_num();
-         segment_num <= proj_data_info_ptr->get_max_segment_num();
-         ++segment_num)
-      set_segment(proj_data_info_ptr->get_empty_segment_by_view(segment_num));
-  }
+  ProjData(exam_info_sptr, proj_data_info_ptr)
+{
+  this->allocate(initialise_with_0);
 }
 
 ProjDataInMemory::
 ProjDataInMemory(const ProjData& proj_data)
-  : ProjDataFromStream(proj_data.get_exam_info_sptr(),
-		       proj_data.get_proj_data_info_ptr()->create_shared_clone(), shared_ptr<iostream>())
-{
-#ifdef STIR_USE_OLD_STRSTREAM
-  const size_t buffer_size = get_size_of_buffer();
-  //buffer = unique_ptr<char>(new char[buffer_size]);
-  buffer.reset(new char[buffer_size]);
-  sino_stream.reset(new strstream(buffer.get(), buffer_size, ios::in | ios::out | ios::binary));
-#else
-  // it would be advantageous to preallocate memory as well
-  // the only way to do this is by passing a string of the appropriate size
-  // However, if basic_string doesn't do reference counting, we would have
-  // temporarily 2 strings of a (potentially large) size in memory.
-  // todo?
-  sino_stream.reset(new std::stringstream(ios::in | ios::out | ios::binary));
-#endif
-
-  if (!*sino_stream)
-    error("ProjDataInMemory error initialising stream");
-
+  : ProjData(proj_data.get_exam_info_sptr(),
+             proj_data.get_proj_data_info_ptr()->create_shared_clone())
+{
+  this->allocate(/* initialise_with_0 = */ false);
   // copy data
   // (note: cannot use fill(projdata) as that uses virtual functions, which won't work in a constructor
   for (int segment_num = proj_data_info_ptr->get_min_segment_num();
        segment_num <= proj_data_info_ptr->get_max_segment_num();
        ++segment_num)
-    set_segment(proj_data.get_segment_by_view(segment_num));
+    ProjDataInMemory::set_segment(proj_data.get_segment_by_view(segment_num));
 }
 
-size_t
 ProjDataInMemory::
-get_size_of_buffer() const
+ProjDataInMemory(const ProjDataInMemory& proj_data)
+  : ProjData(proj_data)
 {
-  size_t num_sinograms = 0;
+  this->allocate(/* initialise_with_0 = */ false);
+  std::copy(proj_data.buffer.get(), proj_data.buffer.get() + size_of_buffer, buffer.get());
+}
+
+ProjDataInMemory&
+ProjDataInMemory::
+operator=(const ProjDataInMemory& proj_data)
+{
+  if (this == &proj_data)
+    return *this;
+  ProjData::operator=(proj_data);
+  this->allocate(/* initialise_with_0 = */ false);
+  std::copy(proj_data.buffer.get(), proj_data.buffer.get() + size_of_buffer, buffer.get());
+  return *this;
+}
+
+void
+ProjDataInMemory::
+allocate(const bool initialise_with_0)
+{
+  std::size_t size = 0;
+  segment_offsets.resize(proj_data_info_ptr->get_num_segments());
   for (int segment_num = proj_data_info_ptr->get_min_segment_num();
        segment_num <= proj_data_info_ptr->get_max_segment_num();
        ++segment_num)
-    num_sinograms += proj_data_info_ptr->get_num_axial_poss(segment_num);
+    {
+      segment_offsets[segment_num - proj_data_info_ptr->get_min_segment_num()] = size;
+      size += 
+        static_cast<std::size_t>(proj_data_info_ptr->get_num_axial_poss(segment_num)) *
+        proj_data_info_ptr->get_num_views() *
+        proj_data_info_ptr->get_num_tangential_poss();
+    }
+  size_of_buffer = size;
+  buffer.reset(new float[size]);
+  if (initialise_with_0)
+    std::fill(buffer.get(), buffer.get() + size, 0.F);
+}
+
+bool
+ProjDataInMemory::
+is_in_range(const int view_num, const int segment_num) const
+{
+  return
+    segment_num >= get_min_segment_num() && segment_num <= get_max_segment_num() &&
+    view_num >= get_min_view_num() && view_num <= get_max_view_num();
+}
+
+std::size_t
+ProjDataInMemory::
+get_index_of_viewgram(const int view_num, const int segment_num) const
+{
+  if (!is_in_range(view_num, segment_num))
+    error("ProjDataInMemory: segment_num %d or view_num %d out of range", segment_num, view_num);
+  return
+    segment_offsets[segment_num - get_min_segment_num()] +
+    static_cast<std::size_t>(view_num - get_min_view_num()) *
+    get_num_axial_poss(segment_num) * get_num_tangential_poss();
+}
+
+bool
+ProjDataInMemory::
+is_compatible(const ProjDataInfo& proj_data_info) const
+{
   return 
-    num_sinograms * 
-    proj_data_info_ptr->get_num_views() *
-    proj_data_info_ptr->get_num_tangential_poss() *
-    sizeof(float);
+    &proj_data_info == proj_data_info_ptr.get() ||
+    proj_data_info == *proj_data_info_ptr;
 }
 
-float 
-ProjDataInMemory::get_bin_value(Bin& bin)
+Viewgram<float> 
+ProjDataInMemory::
+get_viewgram(const int view_num, const int segment_num,
+             const bool make_num_tangential_poss_odd) const
 {
-   Viewgram<float> viewgram = get_viewgram(bin.view_num(),bin.segment_num()); 
-    
-   return viewgram[bin.axial_pos_num()][bin.tangential_pos_num()]; 
+  Viewgram<float> viewgram(proj_data_info_ptr, view_num, segment_num);
+  const int num_tangential_poss = get_num_tangential_poss();
+  const float * data_iter =
+    buffer.get() + get_index_of_viewgram(view_num, segment_num);
+  for (int ax_pos_num = get_min_axial_pos_num(segment_num); ax_pos_num <= get_max_axial_pos_num(segment_num); ++ax_pos_num)
+    {
+      std::copy(data_iter, data_iter + num_tangential_poss, viewgram[ax_pos_num].begin());
+      data_iter += num_tangential_poss;
+    }
 
+  if (make_num_tangential_poss_odd && (num_tangential_poss%2==0))
+    {
+      viewgram.grow(
+                    IndexRange2D(get_min_axial_pos_num(segment_num),
+                                 get_max_axial_pos_num(segment_num),
+                                 get_min_tangential_pos_num(),
+                                 get_max_tangential_pos_num() + 1));
+    }
+  return viewgram;
 }
-END_NAMESPACE_STIR
 
+Succeeded
+ProjDataInMemory::
+set_viewgram(const Viewgram<float>& v)
+{
+  if (!is_compatible(*v.get_proj_data_info_ptr()))
+    {
+      warning("ProjDataInMemory::set_viewgram: viewgram has incompatible ProjDataInfo member\n"
+              "Original ProjDataInfo: %s\n"
+              "ProjDataInfo From viewgram: %s",
+              this->get_proj_data_info_ptr()->parameter_info().c_str(),
+              v.get_proj_data_info_ptr()->parameter_info().c_str());
+      return Succeeded::no;
+    }
+  const int segment_num = v.get_segment_num();
+  if (!is_in_range(v.get_view_num(), segment_num))
+    {
+      warning("ProjDataInMemory::set_viewgram: segment_num %d or view_num %d out of range",
+              segment_num, v.get_view_num());
+      return Succeeded::no;
+    }
+  const int num_tangential_poss = get_num_tangential_poss();
+  float * data_iter =
+    buffer.get() + get_index_of_viewgram(v.get_view_num(), segment_num);
+  for (int ax_pos_num = get_min_axial_pos_num(segment_num); ax_pos_num <= get_max_axial_pos_num(segment_num); ++ax_pos_num)
+    {
+      std::copy(v[ax_pos_num].begin(), v[ax_pos_num].end(), data_iter);
+      data_iter += num_tangential_poss;
+    }
+  return Succeeded::yes;
+}
+
+Sinogram<float> 
+ProjDataInMemory::
+get_sinogram(const int ax_pos_num, const int segment_num,
+             const bool make_num_tangential_poss_odd) const
+{
+  if (ax_pos_num < get_min_axial_pos_num(segment_num) || ax_pos_num > get_max_axial_pos_num(segment_num))
+    error("ProjDataInMemory::get_sinogram: axial_pos_num %d out of range", ax_pos_num);
+  Sinogram<float> sinogram(proj_data_info_ptr, ax_pos_num, segment_num);
+  const int num_tangential_poss = get_num_tangential_poss();
+  const std::size_t view_stride =
+    static_cast<std::size_t>(get_num_axial_poss(segment_num)) * num_tangential_poss;
+  const float * data_iter =
+    buffer.get() + get_index_of_viewgram(get_min_view_num(), segment_num) +
+    static_cast<std::size_t>(ax_pos_num - get_min_axial_pos_num(segment_num)) * num_tangential_poss;
+  for (int view_num = get_min_view_num(); view_num <= get_max_view_num(); ++view_num)
+    {
+      std::copy(data_iter, data_iter + num_tangential_poss, sinogram[view_num].begin());
+      data_iter += view_stride;
+    }
+
+  if (make_num_tangential_poss_odd && (num_tangential_poss%2==0))
+    {
+      sinogram.grow(
+                    IndexRange2D(get_min_view_num(),
+                                 get_max_view_num(),
+                                 get_min_tangential_pos_num(),
+                                 get_max_tangential_pos_num() + 1));
+    }
+  return sinogram;
+}
+
+Succeeded
+ProjDataInMemory::
+set_sinogram(const Sinogram<float>& s)
+{
+  if (!is_compatible(*s.get_proj_data_info_ptr()))
+    {
+      warning("ProjDataInMemory::set_sinogram: Sinogram<float> has incompatible ProjDataInfo member.\n"
+              "Original ProjDataInfo: %s\n"
+              "ProjDataInfo from sinogram: %s",
+              this->get_proj_data_info_ptr()->parameter_info().c_str(),
+              s.get_proj_data_info_ptr()->parameter_info().c_str());
+      return Succeeded::no;
+    }
+  const int segment_num = s.get_segment_num();
+  const int ax_pos_num = s.get_axial_pos_num();
+  if (segment_num < get_min_segment_num() || segment_num > get_max_segment_num() ||
+      ax_pos_num < get_min_axial_pos_num(segment_num) || ax_pos_num > get_max_axial_pos_num(segment_num))
+    {
+      warning("ProjDataInMemory::set_sinogram: segment_num %d or axial_pos_num %d out of range",
+              segment_num, ax_pos_num);
+      return Succeeded::no;
+    }
+  const int num_tangential_poss = get_num_tangential_poss();
+  const std::size_t view_stride =
+    static_cast<std::size_t>(get_num_axial_poss(segment_num)) * num_tangential_poss;
+  float * data_iter =
+    buffer.get() + get_index_of_viewgram(get_min_view_num(), segment_num) +
+    static_cast<std::size_t>(ax_pos_num - get_min_axial_pos_num(segment_num)) * num_tangential_poss;
+  for (int view_num = get_min_view_num(); view_num <= get_max_view_num(); ++view_num)
+    {
+      std::copy(s[view_num].begin(), s[view_num].end(), data_iter);
+      data_iter += view_stride;
+    }
+  return Succeeded::yes;
+}
+
+SegmentByView<float>
+ProjDataInMemory::
+get_segment_by_view(const int segment_num) const
+{
+  SegmentByView<float> segment(proj_data_info_ptr, segment_num);
+  // data are stored in the same order as SegmentByView
+  const float * data_iter =
+    buffer.get() + get_index_of_viewgram(get_min_view_num(), segment_num);
+  std::copy(data_iter, data_iter + segment.size_all(), segment.begin_all());
+  return segment;
+}
+
+SegmentBySinogram<float>
+ProjDataInMemory::
+get_segment_by_sinogram(const int segment_num) const
+{
+  SegmentBySinogram<float> segment(proj_data_info_ptr, segment_num);
+  const int num_tangential_poss = get_num_tangential_poss();
+  const float * data_iter =
+    buffer.get() + get_index_of_viewgram(get_min_view_num(), segment_num);
+  for (int view_num = get_min_view_num(); view_num <= get_max_view_num(); ++view_num)
+    for (int ax_pos_num = get_min_axial_pos_num(segment_num); ax_pos_num <= get_max_axial_pos_num(segment_num); ++ax_pos_num)
+      {
+        std::copy(data_iter, data_iter + num_tangential_poss, segment[ax_pos_num][view_num].begin());
+        data_iter += num_tangential_poss;
+      }
+  return segment;
+}
+
+Succeeded
+ProjDataInMemory::
+set_segment(const SegmentByView<float>& segment)
+{
+  const int segment_num = segment.get_segment_num();
+  if (segment_num < get_min_segment_num() || segment_num > get_max_segment_num())
+    {
+      warning("ProjDataInMemory::set_segment: segment_num %d out of range", segment_num);
+      return Succeeded::no;
+    }
+  if (get_num_tangential_poss() != segment.get_num_tangential_poss() ||
+      get_num_views() != segment.get_num_views() ||
+      get_num_axial_poss(segment_num) != segment.get_num_axial_poss())
+    {
+      warning("ProjDataInMemory::set_segment: sizes of segment are not correct");
+      return Succeeded::no;
+    }
+  std::copy(segment.begin_all(), segment.end_all(),
+            buffer.get() + get_index_of_viewgram(get_min_view_num(), segment_num));
+  return Succeeded::yes;
+}
+
+Succeeded
+ProjDataInMemory::
+set_segment(const SegmentBySinogram<float>& segment)
+{
+  const int segment_num = segment.get_segment_num();
+  if (segment_num < get_min_segment_num() || segment_num > get_max_segment_num())
+    {
+      warning("ProjDataInMemory::set_segment: segment_num %d out of range", segment_num);
+      return Succeeded::no;
+    }
+  if (get_num_tangential_poss() != segment.get_num_tangential_poss() ||
+      get_num_views() != segment.get_num_views() ||
+      get_num_axial_poss(segment_num) != segment.get_num_axial_poss())
+    {
+      warning("ProjDataInMemory::set_segment: sizes of segment are not correct");
+      return Succeeded::no;
+    }
+  float * data_iter =
+    buffer.get() + get_index_of_viewgram(get_min_view_num(), segment_num);
+  for (int view_num = get_min_view_num(); view_num <= get_max_view_num(); ++view_num)
+    for (int ax_pos_num = get_min_axial_pos_num(segment_num); ax_pos_num <= get_max_axial_pos_num(segment_num); ++ax_pos_num)
+      {
+        std::copy(segment[ax_pos_num][view_num].begin(), segment[ax_pos_num][view_num].end(), data_iter);
+        data_iter += get_num_tangential_poss();
+      }
+  return Succeeded::yes;
+}
+
+float 
+ProjDataInMemory::
+get_bin_value(const Bin& bin) const
+{
+  const int segment_num = bin.segment_num();
+  if (!is_in_range(bin.view_num(), segment_num) ||
+      bin.axial_pos_num() < get_min_axial_pos_num(segment_num) || bin.axial_pos_num() > get_max_axial_pos_num(segment_num) ||
+      bin.tangential_pos_num() < get_min_tangential_pos_num() || bin.tangential_pos_num() > get_max_tangential_pos_num())
+    error("ProjDataInMemory::get_bin_value: bin out of range");
+  return
+    buffer[get_index_of_viewgram(bin.view_num(), segment_num) +
+           static_cast<std::size_t>(bin.axial_pos_num() - get_min_axial_pos_num(segment_num)) * get_num_tangential_poss() +
+           (bin.tangential_pos_num() - get_min_tangential_pos_num())];
+}
+
+END_NAMESPACE_STIR
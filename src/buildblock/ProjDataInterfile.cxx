@@ -80,6 +80,7 @@ create_stream(const string& filename, const ios::openmode open_mode)
   {
     error("ProjDataInterfile: error opening output file %s\n", data_name.c_str());
   }
+  this->set_filename_for_concurrent_reading(data_name);
 #if 0
   delete[] header_name;
   delete[] data_name;
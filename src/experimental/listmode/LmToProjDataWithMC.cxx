@@ -134,6 +134,12 @@ process_new_time_event(const CListTime& time_event)
 
 }
 
+bool
+LmToProjDataWithMC::get_bin_from_event_is_thread_safe() const
+{
+  return false;
+}
+
 void 
 LmToProjDataWithMC::get_bin_from_event(Bin& bin, const CListEvent& event) const
 {
@@ -151,6 +151,14 @@ get_bin_from_event(Bin& bin, const CListEvent& event) const
     bin.set_bin_value(-1);
 }
 
+template <typename LmToProjDataT> 
+bool
+LmToProjDataWithRandomRejection<LmToProjDataT>::
+get_bin_from_event_is_thread_safe() const
+{
+  return false;
+}
+
 
 // instantiation
 template class LmToProjDataWithRandomRejection<LmToProjData>;
@@ -72,6 +72,19 @@ Array inherits its numeric operators from NumericVectorWithOffset.
 In particular this means that operator+= etc. potentially grow
 the object. However, as grow() is a virtual function, Array::grow is
 called, which initialises new elements first to 0.
+
+\par Contiguous storage
+
+When constructed with an IndexRange (or when copied), all elements of the
+array are stored in a single block of memory (with the "last" index running
+fastest). Each "row" is then a VectorWithOffset that points into this block.
+This is more efficient for memory allocation and for operations on the whole
+array (such as fill(), sum() and find_max(), which then use a single loop).
+Use is_contiguous() to check, and get_full_data_ptr() to access the block.
+
+Resizing a non-empty array, or resizing/assigning one of its elements with a
+different range, allocates new memory for the affected rows, after which the
+array is no longer contiguous (but otherwise works as before).
 */
 
 template <int num_dimensions, typename elemT>
@@ -129,22 +142,46 @@ public:
   inline Array();
 
   //! Construct an Array of given range of indices, elements are initialised to 0
+  /*! The elements are stored contiguously. */
   inline explicit Array(const IndexRange<num_dimensions>&);
   
+  //! Construct an Array of given range of indices, using existing data
+  /*! \see init() */
+  inline Array(const IndexRange<num_dimensions>& range, elemT * const data_ptr, bool copy_data);
+
 #ifndef SWIG
   //! Construct an Array from an object of its base_type
   inline Array(const base_type& t);
-#else
-  // swig 2.0.4 gets confused by base_type (due to numeric template arguments)
-  // therefore, we declare this constructor using the "self" type, 
-  // i.e. it's just a copy-constructor.
+#endif
+  // note: swig 2.0.4 gets confused by base_type (due to numeric template arguments)
+  // so it only gets the copy constructor.
   // This is less powerful as in C++, but swig-generated interfaces don't need to know about the base_type anyway
+
+  //! copy constructor, the new array is stored contiguously
   inline Array(const self& t);
-#endif
-  
+
   //! virtual destructor, frees up any allocated memory
   inline virtual ~Array();
 
+  //! assignment operator
+  /*! If the current object is contiguous and has the same index range as \a t, the
+      elements are copied into the existing memory. Otherwise, new (contiguous)
+      memory is allocated.
+  */
+  inline self& operator=(const self& t);
+
+  //! (re)initialise the array to the given range, using a single block of memory
+  /*! If \a data_ptr is 0, a new block is allocated (and elements are set to 0).
+      Otherwise, if \a copy_data is \c true, a new block is allocated and the
+      data is copied from \a data_ptr. If \a copy_data is \c false, the array
+      uses the memory pointed to by \a data_ptr, which has to stay valid
+      during the life-time of the array, and is never deallocated by the array.
+
+      The data block is in the order in which a full_iterator goes through the
+      elements, and has to have <code>range.size_all()</code> elements.
+  */
+  void init(const IndexRange<num_dimensions>& range, elemT * const data_ptr, bool copy_data);
+
   /*! @name functions returning full_iterators*/
   //@{
   //! start value for iterating through all elements in the array, see full_iterator
@@ -193,6 +230,20 @@ public:
   //! Fill elements with value n (overrides VectorWithOffset::fill)
   inline void fill(const elemT &n);
 
+  //! checks if all elements are stored in one contiguous block of memory
+  /*! This is the case after construction with an IndexRange, but see the class documentation.
+   */
+  inline bool is_contiguous() const;
+
+  //! \name access to the data of a contiguous array via a pointer
+  /*! These functions call error() if the array is not contiguous, and return 0 if it is empty.
+      The order of the elements is the same as for a full_iterator.
+  */
+  //@{
+  inline elemT* get_full_data_ptr();
+  inline const elemT* get_const_full_data_ptr() const;
+  //@}
+
   //! checks if the index range is 'regular'
   /*! Implementation note: this works by calling get_index_range().is_regular().
       We cannot rely on remembering if it was a regular range at construction (or
@@ -239,6 +290,13 @@ public:
   inline const elemT&
     at(const BasicCoordinate<num_dimensions,int> &c) const;
   //@}
+
+private:
+  //! memory allocated by init(), or 0 when not owning a contiguous block
+  elemT * _allocated_full_data_ptr;
+
+  //! pointer to first element if the array is contiguous and not empty, 0 otherwise
+  inline const elemT* _get_contiguous_data_ptr() const;
 };
 
 
@@ -302,12 +360,30 @@ public:
   //! constructor given first and last indices, initialising elements to 0
   inline Array(const int min_index, const int max_index);
 
+  //! constructor given an IndexRange<1>, using existing data
+  /*! \see init() */
+  inline Array(const IndexRange<1>& range, elemT * const data_ptr, bool copy_data);
+
   //! constructor from basetype
   inline Array(const NumericVectorWithOffset<elemT,elemT> &il);
   
   //! virtual destructor
   inline virtual ~Array();
 
+  //! (re)initialise the array to the given range, using existing data
+  /*! \see VectorWithOffset::init() */
+  inline void init(const IndexRange<1>& range, elemT * const data_ptr, bool copy_data);
+
+  //! checks if all elements are stored in one contiguous block of memory (always true in 1D)
+  inline bool is_contiguous() const;
+
+  //! \name access to the data via a pointer
+  /*! For 1D arrays, these do not call get_data_ptr(), so no call to release_data_ptr() is needed. */
+  //@{
+  inline elemT* get_full_data_ptr();
+  inline const elemT* get_const_full_data_ptr() const;
+  //@}
+
   /*! @name functions returning full_iterators*/
   //@{
   //! start value for iterating through all elements in the array, see full_iterator
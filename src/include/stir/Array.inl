@@ -31,6 +31,7 @@
 // include for min,max definitions
 #include <algorithm>
 #include "stir/assign.h"
+#include "stir/error.h"
 
 START_NAMESPACE_STIR
 
@@ -38,11 +39,57 @@ START_NAMESPACE_STIR
  inlines for Array<num_dimensions, elemT>
  **********************************************/
 
+template <int num_dimensions, typename elemT>
+void
+Array<num_dimensions, elemT>::
+init(const IndexRange<num_dimensions>& range, elemT * const data_ptr, bool copy_data)
+{
+  const size_t new_size = range.size_all();
+  elemT * new_allocated_data_ptr = 0;
+  elemT * current_data_ptr = data_ptr;
+  if (new_size > 0 && (data_ptr == 0 || copy_data))
+    {
+      new_allocated_data_ptr = new elemT[new_size];
+      if (data_ptr == 0)
+        {
+          for (size_t i=0; i<new_size; ++i)
+            assign(new_allocated_data_ptr[i], 0);
+        }
+      else
+        std::copy(data_ptr, data_ptr + new_size, new_allocated_data_ptr);
+      current_data_ptr = new_allocated_data_ptr;
+    }
+  // first remove old rows, as otherwise resize() might copy them
+  if (this->get_min_index() != range.get_min_index() ||
+      this->get_max_index() != range.get_max_index())
+    {
+      base_type::recycle();
+      base_type::resize(range.get_min_index(), range.get_max_index());
+    }
+  typename base_type::iterator iter = this->begin();
+  typename IndexRange<num_dimensions>::const_iterator range_iter = range.begin();
+  for (;
+       iter != this->end(); 
+       ++iter, ++range_iter)
+    {
+      (*iter).init(*range_iter, current_data_ptr, /* copy_data = */ false);
+      current_data_ptr += (*range_iter).size_all();
+    }
+  delete[] this->_allocated_full_data_ptr;
+  this->_allocated_full_data_ptr = new_allocated_data_ptr;
+}
+
 template <int num_dimensions, typename elemT>
 void 
 Array<num_dimensions, elemT>::
 resize(const IndexRange<num_dimensions>& range)
 {
+  if (this->size() == 0)
+    {
+      // we can allocate a single block
+      this->init(range, 0, false);
+      return;
+    }
   base_type::resize(range.get_min_index(), range.get_max_index());
   typename base_type::iterator iter = this->begin();
   typename IndexRange<num_dimensions>::const_iterator range_iter = range.begin();
@@ -62,29 +109,116 @@ grow(const IndexRange<num_dimensions>& range)
 
 template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::Array()
-: base_type()
+: base_type(),
+  _allocated_full_data_ptr(0)
 {}
 
 template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::Array(const IndexRange<num_dimensions>& range)
-: base_type()
+: base_type(),
+  _allocated_full_data_ptr(0)
 {
-  grow(range);
+  this->init(range, 0, false);
 }
 
 template <int num_dimensions, typename elemT>
-#ifdef SWIG
-// swig-specific work-around (see Array.h)
-Array<num_dimensions, elemT>::Array(const self& t)
-#else
+Array<num_dimensions, elemT>::
+Array(const IndexRange<num_dimensions>& range, elemT * const data_ptr, bool copy_data)
+: base_type(),
+  _allocated_full_data_ptr(0)
+{
+  this->init(range, data_ptr, copy_data);
+}
+
+#ifndef SWIG
+template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::Array(const base_type& t)
-#endif
-:  base_type(t)
+:  base_type(t),
+   _allocated_full_data_ptr(0)
 {}
+#endif
+
+template <int num_dimensions, typename elemT>
+Array<num_dimensions, elemT>::Array(const self& t)
+:  base_type(),
+   _allocated_full_data_ptr(0)
+{
+  *this = t;
+}
 
 template <int num_dimensions, typename elemT>
 Array<num_dimensions, elemT>::~Array()
-{}
+{
+  delete[] this->_allocated_full_data_ptr;
+}
+
+template <int num_dimensions, typename elemT>
+Array<num_dimensions, elemT>&
+Array<num_dimensions, elemT>::operator=(const self& t)
+{
+  if (this == &t) return *this;
+  const IndexRange<num_dimensions> range = t.get_index_range();
+  if (!this->is_contiguous() || this->get_index_range() != range)
+    {
+      const elemT * const t_data_ptr = t._get_contiguous_data_ptr();
+      if (t_data_ptr != 0)
+        {
+          // note: const_cast is safe as the data is copied
+          this->init(range, const_cast<elemT *>(t_data_ptr), /* copy_data = */ true);
+          return *this;
+        }
+      this->init(range, 0, false);
+    }
+  std::copy(t.begin_all_const(), t.end_all_const(), this->begin_all());
+  return *this;
+}
+
+template <int num_dimensions, typename elemT>
+bool
+Array<num_dimensions, elemT>::is_contiguous() const
+{
+  const elemT * next_ptr = 0;
+  for (const_iterator iter = this->begin(); iter != this->end(); ++iter)
+    {
+      if (!(*iter).is_contiguous())
+        return false;
+      const size_t row_size = (*iter).size_all();
+      if (row_size == 0)
+        continue;
+      const elemT * const row_ptr = &(*(*iter).begin_all_const());
+      if (next_ptr != 0 && row_ptr != next_ptr)
+        return false;
+      next_ptr = row_ptr + row_size;
+    }
+  return true;
+}
+
+template <int num_dimensions, typename elemT>
+const elemT*
+Array<num_dimensions, elemT>::_get_contiguous_data_ptr() const
+{
+  if (this->size_all() == 0 || !this->is_contiguous())
+    return 0;
+  return &(*this->begin_all_const());
+}
+
+template <int num_dimensions, typename elemT>
+elemT*
+Array<num_dimensions, elemT>::get_full_data_ptr()
+{
+  if (!this->is_contiguous())
+    error("Array::get_full_data_ptr() called for a non-contiguous array");
+  return const_cast<elemT *>(this->_get_contiguous_data_ptr());
+}
+
+template <int num_dimensions, typename elemT>
+const elemT*
+Array<num_dimensions, elemT>::get_const_full_data_ptr() const
+{
+  if (!this->is_contiguous())
+    error("Array::get_const_full_data_ptr() called for a non-contiguous array");
+  return this->_get_contiguous_data_ptr();
+}
 
 
 template <int num_dimensions, typename elemT>
@@ -179,6 +313,10 @@ Array<num_dimensions, elemT>::size_all() const
 }
 
 
+/* Implementation note: functions below iterate over all elements in
+   a single loop when the array is contiguous, as this is faster. Results
+   for sum() etc can differ slightly due to the different order of additions.
+*/
 template <int num_dimensions, typename elemT>
 elemT 
 Array<num_dimensions, elemT>::sum() const 
@@ -186,6 +324,14 @@ Array<num_dimensions, elemT>::sum() const
   this->check_state();
   elemT acc;
   assign(acc,0);
+  const elemT * const data_ptr = this->_get_contiguous_data_ptr();
+  if (data_ptr != 0)
+    {
+      const elemT * const end_ptr = data_ptr + this->size_all();
+      for (const elemT * ptr = data_ptr; ptr != end_ptr; ++ptr)
+        acc += *ptr;
+      return acc;
+    }
   for(int i=this->get_min_index(); i<=this->get_max_index(); i++)
     acc += this->num[i].sum();
   return acc; 
@@ -198,6 +344,15 @@ Array<num_dimensions, elemT>::sum_positive() const
   this->check_state();
   elemT acc;
   assign(acc,0);
+  const elemT * const data_ptr = this->_get_contiguous_data_ptr();
+  if (data_ptr != 0)
+    {
+      const elemT * const end_ptr = data_ptr + this->size_all();
+      for (const elemT * ptr = data_ptr; ptr != end_ptr; ++ptr)
+        if (*ptr > 0)
+          acc += *ptr;
+      return acc;
+    }
   for(int i=this->get_min_index(); i<=this->get_max_index(); i++)
     acc += this->num[i].sum_positive();
   return acc; 
@@ -208,6 +363,9 @@ elemT
 Array<num_dimensions, elemT>::find_max() const
 {
   this->check_state();
+  const elemT * const data_ptr = this->_get_contiguous_data_ptr();
+  if (data_ptr != 0)
+    return *std::max_element(data_ptr, data_ptr + this->size_all());
   if (this->size() > 0)
   {
     elemT maxval= this->num[this->get_min_index()].find_max();
@@ -229,6 +387,9 @@ elemT
 Array<num_dimensions, elemT>::find_min() const
 {
   this->check_state();
+  const elemT * const data_ptr = this->_get_contiguous_data_ptr();
+  if (data_ptr != 0)
+    return *std::min_element(data_ptr, data_ptr + this->size_all());
   if (this->size() > 0)
   {
     elemT minval= this->num[this->get_min_index()].find_min();
@@ -254,6 +415,12 @@ void
 Array<num_dimensions, elemT>::fill(const elemT &n) 
 {
   this->check_state();
+  elemT * const data_ptr = const_cast<elemT *>(this->_get_contiguous_data_ptr());
+  if (data_ptr != 0)
+    {
+      std::fill(data_ptr, data_ptr + this->size_all(), n);
+      return;
+    }
   for(int i=this->get_min_index(); i<=this->get_max_index();  i++)
     this->num[i].fill(n);
   this->check_state();
@@ -403,11 +570,46 @@ Array<1, elemT>::Array(const int min_index, const int max_index)
 }
 
 
+template <class elemT>
+Array<1, elemT>::Array(const IndexRange<1>& range, elemT * const data_ptr, bool copy_data)
+: base_type()
+{
+  this->init(range, data_ptr, copy_data);
+}
+
 template <class elemT>
 Array<1, elemT>::Array(const base_type &il)
 : base_type(il)
 {}
 
+template <class elemT>
+void
+Array<1, elemT>::init(const IndexRange<1>& range, elemT * const data_ptr, bool copy_data)
+{
+  base_type::init(range.get_min_index(), range.get_max_index(), data_ptr, copy_data);
+}
+
+template <class elemT>
+bool
+Array<1, elemT>::is_contiguous() const
+{
+  return true;
+}
+
+template <class elemT>
+elemT*
+Array<1, elemT>::get_full_data_ptr()
+{
+  return this->size()==0 ? 0 : &(*this->begin());
+}
+
+template <class elemT>
+const elemT*
+Array<1, elemT>::get_const_full_data_ptr() const
+{
+  return this->size()==0 ? 0 : &(*this->begin());
+}
+
 template <typename elemT>
 Array<1, elemT>::~Array()
 {}
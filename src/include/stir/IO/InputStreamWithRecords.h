@@ -30,6 +30,7 @@
 
 #include "stir/shared_ptr.h"
 #include "stir/Succeeded.h"
+#include "boost/interprocess/mapped_region.hpp"
 
 #include <iostream>
 #include <string>
@@ -44,9 +45,17 @@ START_NAMESPACE_STIR
     the function to find out what the size of the record is. In that case, all IO
     handling is completely generic and is implemented in this class.
 
-    Current implementation needs a \c max_size_of_record to allocate enough memory 
-    (on the stack) before reading. This is efficient in many cases, but impractical 
-    in others.
+    Data are read from the stream in large blocks into an internal buffer, and
+    records are decoded directly from that buffer. This avoids any memory
+    allocation per record, and reduces the number of (relatively expensive)
+    calls to std::istream::read() to one per block. The buffer size can be set
+    via set_buffer_size() (the default is 8 MB).
+
+    The "get" position (used by save_get_position() etc) is tracked by this
+    class, i.e. it is the position of the next record that will be returned
+    by get_next_record(), not the position of the underlying stream (which
+    will normally be further ahead). Going back to a position which is still
+    in the buffer does not need any IO.
 
     \par Requirements
     \c RecordT needs to have the following member functions
@@ -61,7 +70,16 @@ START_NAMESPACE_STIR
                          const OptionsT options);
     \endcode
 
-    \todo Allow choosing between allocation with \c new or on the stack.
+    When constructed from a filename, the file will by default be memory-mapped
+    (if this fails, normal file IO is used). Records are then decoded directly
+    from the mapped memory, i.e. without any copying, and reset() and
+    set_get_position() are simple pointer updates. Re-reading the data (as
+    done by LmToProjData when not all segments fit in memory, or by the list
+    mode objective function for every sub-iteration) is then served from the
+    page cache of the OS.
+
+    \warning As data are read ahead, the underlying stream should not be
+    used by anyone else while this object is alive.
 */
 template <class RecordT, class OptionsT>
 class InputStreamWithRecords
@@ -80,16 +98,42 @@ public:
   //! Constructor taking a filename
   /*! File will be opened in binary mode. Data will be assumed to 
       start at \a start_of_data.
+
+      If \a use_memory_map is \c true, the file will be memory-mapped.
+      If that fails, a warning is written and normal file IO is used.
   */
   inline
     InputStreamWithRecords(const std::string& filename, 
 			   const std::size_t size_of_record_signature,
 			   const std::size_t max_size_of_record, 
 			   const OptionsT& options,
-			   const std::streampos start_of_data = 0);
+			   const std::streampos start_of_data = 0,
+			   const bool use_memory_map = true);
 
   virtual ~InputStreamWithRecords() {}
 
+  //! Set the size (in bytes) of the block that is read from the stream at once
+  /*! The size will be increased to \c max_size_of_record if necessary.
+      Calling this function discards the current contents of the buffer,
+      but does not change the current "get" position.
+  */
+  inline
+    void set_buffer_size(const std::size_t buffer_size);
+
+  //! Get the size (in bytes) of the block that is read from the stream at once
+  /*! When the file is memory-mapped, this returns the size of the file. */
+  inline
+    std::size_t get_buffer_size() const;
+
+  //! Check if the data are read from a memory-mapped file
+  inline
+    bool is_memory_mapped() const;
+
+  //! Number of records returned by get_next_record() since construction or the last reset()
+  /*! This is mainly useful for reporting reading speed. */
+  inline
+    unsigned long get_num_records_read() const;
+
   inline
   virtual 
     Succeeded get_next_record(RecordT& record) const;
@@ -126,6 +170,22 @@ public:
     void set_saved_get_positions(const std::vector<std::streampos>& );
 
 private:
+  //! move unused data to the start of the buffer and fill the rest from the stream
+  /*! \return number of bytes available from the current position in the buffer */
+  inline
+    std::size_t fill_buffer() const;
+
+  //! discard all data in the buffer and put the stream at \a pos
+  inline
+    Succeeded seek_to(const std::streampos pos);
+
+  //! pointer to the start of the current block of data (i.e. the buffer or the mapped file)
+  inline
+    const char * get_block_ptr() const;
+
+  //! check if there is anything to read from at all
+  inline
+    bool has_input() const;
 
   const std::string filename;
   shared_ptr<std::istream> stream_ptr;
@@ -136,6 +196,18 @@ private:
   const std::size_t max_size_of_record;
 
   const OptionsT options;
+
+  //! memory-mapped file (if any)
+  shared_ptr<boost::interprocess::mapped_region> mapped_region_sptr;
+  //! buffer with data read from the stream (unused when memory-mapped)
+  mutable std::vector<char> buffer;
+  //! number of valid bytes in \c buffer (or the size of the mapped file)
+  mutable std::size_t num_bytes_in_buffer;
+  //! offset in \c buffer of the next record
+  mutable std::size_t current_offset_in_buffer;
+  //! position in the stream corresponding to the start of \c buffer
+  mutable std::streampos stream_position_of_buffer;
+  mutable unsigned long num_records_read;
 };
 
 END_NAMESPACE_STIR
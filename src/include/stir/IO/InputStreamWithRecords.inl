@@ -28,10 +28,18 @@
 #include "stir/Succeeded.h"
 #include "stir/is_null_ptr.h"
 #include "stir/shared_ptr.h"
-#include "boost/shared_array.hpp"
+#include "stir/warning.h"
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/format.hpp"
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 
 START_NAMESPACE_STIR
+
+//! default size of the block that InputStreamWithRecords reads from its stream
+const std::size_t InputStreamWithRecords_default_buffer_size = 8*1024*1024;
+
 template <class RecordT, class OptionsT>
 InputStreamWithRecords<RecordT, OptionsT>::
 InputStreamWithRecords(const shared_ptr<std::istream>& stream_ptr,
@@ -41,7 +49,11 @@ InputStreamWithRecords(const shared_ptr<std::istream>& stream_ptr,
   : stream_ptr(stream_ptr),
     size_of_record_signature(size_of_record_signature),
     max_size_of_record(max_size_of_record),
-    options(options)
+    options(options),
+    buffer(std::max(InputStreamWithRecords_default_buffer_size, max_size_of_record)),
+    num_bytes_in_buffer(0),
+    current_offset_in_buffer(0),
+    num_records_read(0)
 {
   assert(size_of_record_signature<=max_size_of_record);
   if (is_null_ptr(stream_ptr))
@@ -49,6 +61,7 @@ InputStreamWithRecords(const shared_ptr<std::istream>& stream_ptr,
   starting_stream_position = stream_ptr->tellg();
   if (!stream_ptr->good())
     error("InputStreamWithRecords: error in tellg()\n");
+  stream_position_of_buffer = starting_stream_position;
 }
 
 template <class RecordT, class OptionsT>
@@ -57,95 +70,222 @@ InputStreamWithRecords(const std::string& filename,
                        const std::size_t size_of_record_signature,
                        const std::size_t max_size_of_record,
                        const OptionsT& options, 
-                       const std::streampos start_of_data)
+                       const std::streampos start_of_data,
+                       const bool use_memory_map)
   : filename(filename),
     starting_stream_position(start_of_data),
     size_of_record_signature(size_of_record_signature),
     max_size_of_record(max_size_of_record),
-    options(options)
+    options(options),
+    buffer(std::max(InputStreamWithRecords_default_buffer_size, max_size_of_record)),
+    num_bytes_in_buffer(0),
+    current_offset_in_buffer(0),
+    stream_position_of_buffer(start_of_data),
+    num_records_read(0)
 {
   assert(size_of_record_signature<=max_size_of_record);
-  std::fstream* s_ptr = new std::fstream;
-  open_read_binary(*s_ptr, filename.c_str());
-  stream_ptr.reset(s_ptr);
+  if (use_memory_map)
+    {
+      try
+        {
+          // note: the mapping stays valid after file_mapping goes out of scope
+          boost::interprocess::file_mapping mapping(filename.c_str(), boost::interprocess::read_only);
+          mapped_region_sptr.reset(new boost::interprocess::mapped_region(mapping, boost::interprocess::read_only));
+          std::vector<char>().swap(this->buffer);
+          this->num_bytes_in_buffer = mapped_region_sptr->get_size();
+          this->stream_position_of_buffer = 0;
+        }
+      catch (std::exception& e)
+        {
+          warning(boost::format("InputStreamWithRecords: cannot memory-map file %1% (%2%).\n"
+                                "Using normal file IO instead.") % filename % e.what());
+          mapped_region_sptr.reset();
+        }
+    }
+  if (is_null_ptr(mapped_region_sptr))
+    {
+      std::fstream* s_ptr = new std::fstream;
+      open_read_binary(*s_ptr, filename.c_str());
+      stream_ptr.reset(s_ptr);
+    }
   if (reset() == Succeeded::no)
     error("InputStreamWithRecords: error in reset() for filename %s\n",
 	  filename.c_str());
 }
 
+template <class RecordT, class OptionsT>
+void
+InputStreamWithRecords<RecordT, OptionsT>::
+set_buffer_size(const std::size_t buffer_size)
+{
+  const std::streampos current_pos =
+    this->stream_position_of_buffer + 
+    static_cast<std::streamoff>(this->current_offset_in_buffer);
+  if (this->is_memory_mapped())
+    return;
+  this->buffer.resize(std::max(buffer_size, this->max_size_of_record));
+  if (!is_null_ptr(stream_ptr))
+    this->seek_to(current_pos);
+}
+
+template <class RecordT, class OptionsT>
+std::size_t
+InputStreamWithRecords<RecordT, OptionsT>::
+get_buffer_size() const
+{
+  if (this->is_memory_mapped())
+    return this->num_bytes_in_buffer;
+  return this->buffer.size();
+}
+
+template <class RecordT, class OptionsT>
+bool
+InputStreamWithRecords<RecordT, OptionsT>::
+is_memory_mapped() const
+{
+  return !is_null_ptr(this->mapped_region_sptr);
+}
+
+template <class RecordT, class OptionsT>
+bool
+InputStreamWithRecords<RecordT, OptionsT>::
+has_input() const
+{
+  return !is_null_ptr(this->stream_ptr) || this->is_memory_mapped();
+}
+
+template <class RecordT, class OptionsT>
+const char *
+InputStreamWithRecords<RecordT, OptionsT>::
+get_block_ptr() const
+{
+  if (this->is_memory_mapped())
+    return static_cast<const char *>(this->mapped_region_sptr->get_address());
+  return &this->buffer[0];
+}
+
+template <class RecordT, class OptionsT>
+unsigned long
+InputStreamWithRecords<RecordT, OptionsT>::
+get_num_records_read() const
+{
+  return this->num_records_read;
+}
+
+template <class RecordT, class OptionsT>
+std::size_t
+InputStreamWithRecords<RecordT, OptionsT>::
+fill_buffer() const
+{
+  const std::size_t num_bytes_left = 
+    this->num_bytes_in_buffer - this->current_offset_in_buffer;
+  // the whole file is available already
+  if (this->is_memory_mapped())
+    return num_bytes_left;
+
+  char * const buffer_ptr = &this->buffer[0];
+  if (num_bytes_left>0 && this->current_offset_in_buffer>0)
+    std::memmove(buffer_ptr, buffer_ptr + this->current_offset_in_buffer, num_bytes_left);
+  this->stream_position_of_buffer += 
+    static_cast<std::streamoff>(this->current_offset_in_buffer);
+  this->current_offset_in_buffer = 0;
+  this->num_bytes_in_buffer = num_bytes_left;
+
+  if (stream_ptr->eof())
+    return num_bytes_left;
+  stream_ptr->read(buffer_ptr + num_bytes_left,
+                   static_cast<std::streamsize>(this->buffer.size() - num_bytes_left));
+  if (stream_ptr->bad())
+    { 
+      warning("Error after reading from list mode stream in get_next_record");
+      return num_bytes_left;
+    }
+  this->num_bytes_in_buffer += static_cast<std::size_t>(stream_ptr->gcount());
+  return this->num_bytes_in_buffer;
+}
+
 template <class RecordT, class OptionsT>
 Succeeded
 InputStreamWithRecords<RecordT, OptionsT>::
 get_next_record(RecordT& record) const
 {
-  if (is_null_ptr(stream_ptr))
+  if (!this->has_input())
     return Succeeded::no;
 
-  // rely on file caching by the C++ library or the OS
   assert(this->size_of_record_signature <= this->max_size_of_record);
-  boost::shared_array<char> data_sptr(new char[this->max_size_of_record]);
-  char * data_ptr = data_sptr.get();
-  stream_ptr->read(data_ptr, this->size_of_record_signature);
-  if (stream_ptr->gcount()<static_cast<std::streamsize>(this->size_of_record_signature))
-    return Succeeded::no; 
-  const std::size_t size_of_record = record.size_of_record_at_ptr(data_ptr, this->size_of_record_signature,options);
+  std::size_t num_bytes_left = 
+    this->num_bytes_in_buffer - this->current_offset_in_buffer;
+  if (num_bytes_left < this->size_of_record_signature)
+    {
+      num_bytes_left = this->fill_buffer();
+      if (num_bytes_left < this->size_of_record_signature)
+        return Succeeded::no; 
+    }
+  const std::size_t size_of_record = 
+    record.size_of_record_at_ptr(this->get_block_ptr() + this->current_offset_in_buffer,
+                                 this->size_of_record_signature, options);
   assert(size_of_record <= this->max_size_of_record);
-  if (size_of_record > this->size_of_record_signature)
-    stream_ptr->read(data_ptr + this->size_of_record_signature,
-                     size_of_record - this->size_of_record_signature);
-  if (stream_ptr->eof())
-    return Succeeded::no; 
-  else if (stream_ptr->bad())
-    { 
-      warning("Error after reading from list mode stream in get_next_record");
-      return Succeeded::no; 
+  if (num_bytes_left < size_of_record)
+    {
+      num_bytes_left = this->fill_buffer();
+      if (num_bytes_left < size_of_record)
+        return Succeeded::no; 
     }
+  const char * const data_ptr = this->get_block_ptr() + this->current_offset_in_buffer;
+  this->current_offset_in_buffer += size_of_record;
+  ++this->num_records_read;
   return 
     record.init_from_data_ptr(data_ptr, size_of_record,options);
 }
 
-
-
 template <class RecordT, class OptionsT>
 Succeeded
 InputStreamWithRecords<RecordT, OptionsT>::
-reset()
+seek_to(const std::streampos pos)
 {
-  if (is_null_ptr(stream_ptr))
-    return Succeeded::no;
-
+  if (this->is_memory_mapped())
+    {
+      // just move to the new position (but not beyond the end of the file)
+      this->current_offset_in_buffer =
+        static_cast<std::size_t>(std::min(static_cast<std::streamoff>(pos),
+                                          static_cast<std::streamoff>(this->num_bytes_in_buffer)));
+      return Succeeded::yes;
+    }
   // Strangely enough, once you read past EOF, even seekg(0) doesn't reset the eof flag
-  if (stream_ptr->eof()) 
-    stream_ptr->clear();
-  stream_ptr->seekg(starting_stream_position, std::ios::beg);
+  stream_ptr->clear();
+  stream_ptr->seekg(pos, std::ios::beg);
+  this->stream_position_of_buffer = pos;
+  this->num_bytes_in_buffer = 0;
+  this->current_offset_in_buffer = 0;
   if (stream_ptr->bad())
     return Succeeded::no;
   else
     return Succeeded::yes;
 }
 
+template <class RecordT, class OptionsT>
+Succeeded
+InputStreamWithRecords<RecordT, OptionsT>::
+reset()
+{
+  if (!this->has_input())
+    return Succeeded::no;
+
+  this->num_records_read = 0;
+  return this->seek_to(starting_stream_position);
+}
+
 
 template <class RecordT, class OptionsT>
 typename InputStreamWithRecords<RecordT, OptionsT>::SavedPosition
 InputStreamWithRecords<RecordT, OptionsT>::
 save_get_position() 
 {
-  assert(!is_null_ptr(stream_ptr));
-  // TODO should somehow check if tellg() worked and return an error if it didn't
-  std::streampos pos;
-  if (!stream_ptr->eof())
-    {
-      pos = stream_ptr->tellg();
-      if (!stream_ptr->good())
-	error("InputStreamWithRecords<RecordT, OptionsT>::save_get_position\n"
-	      "Error after getting position in file");
-    }
-  else
-    {
-      // use -1 to signify eof 
-      // (this is probably the behaviour of tellg anyway, but this way we're sure).
-      pos = std::streampos(-1); 
-    }
+  assert(this->has_input());
+  // note: we cannot use tellg() as the stream is normally ahead of us
+  const std::streampos pos = 
+    this->stream_position_of_buffer + 
+    static_cast<std::streamoff>(this->current_offset_in_buffer);
   saved_get_positions.push_back(pos);
   return saved_get_positions.size()-1;
 } 
@@ -155,22 +295,38 @@ Succeeded
 InputStreamWithRecords<RecordT, OptionsT>::
 set_get_position(const typename InputStreamWithRecords<RecordT, OptionsT>::SavedPosition& pos)
 {
-  if (is_null_ptr(stream_ptr))
+  if (!this->has_input())
     return Succeeded::no;
 
   assert(pos < saved_get_positions.size());
-  stream_ptr->clear();
   if (saved_get_positions[pos] == std::streampos(-1))
-    stream_ptr->seekg(0, std::ios::end); // go to eof
-  else
-    stream_ptr->seekg(saved_get_positions[pos]);
-    
-  if (!stream_ptr->good())
+    {
+      if (this->is_memory_mapped())
+        return this->seek_to(static_cast<std::streamoff>(this->num_bytes_in_buffer));
+      // -1 signifies eof (used by older versions of this class)
+      stream_ptr->clear();
+      stream_ptr->seekg(0, std::ios::end); // go to eof
+      if (!stream_ptr->good())
+        return Succeeded::no;
+      return this->seek_to(stream_ptr->tellg());
+    }
+
+  // check if the position is still in the buffer. If so, no need to do any IO.
+  const std::streamoff offset =
+    saved_get_positions[pos] - this->stream_position_of_buffer;
+  if (offset >= 0 && 
+      offset <= static_cast<std::streamoff>(this->num_bytes_in_buffer))
+    {
+      this->current_offset_in_buffer = static_cast<std::size_t>(offset);
+      return Succeeded::yes;
+    }
+
+  if (this->seek_to(saved_get_positions[pos]) == Succeeded::no ||
+      (!this->is_memory_mapped() && !stream_ptr->good()))
     return Succeeded::no;
   else
     return Succeeded::yes;
 }
-
 template <class RecordT, class OptionsT>
 std::vector<std::streampos> 
 InputStreamWithRecords<RecordT, OptionsT>::
@@ -31,6 +31,7 @@
 #include "stir/detail/test_if_1d.h"
 #include "stir/IO/read_data_1d.h"
 #include <typeinfo>
+#include <limits>
 
 START_NAMESPACE_STIR
 
@@ -70,6 +71,16 @@ namespace detail
 		 IStreamT& s, Array<num_dimensions,elemT>& data, 
 		 const ByteOrder byte_order)
   {
+    const std::size_t size_all = data.size_all();
+    if (size_all > 0 &&
+        size_all <= static_cast<std::size_t>(std::numeric_limits<int>::max()) &&
+        data.is_contiguous())
+      {
+        // read all data in one go, using a 1D array that uses the same memory
+        Array<1,elemT> data_1d(IndexRange<1>(static_cast<int>(size_all)),
+                               data.get_full_data_ptr(), /* copy_data = */ false);
+        return read_data_1d(s, data_1d, byte_order);
+      }
     for (typename Array<num_dimensions,elemT>::iterator iter= data.begin();
 	 iter != data.end();
 	 ++iter)
@@ -31,6 +31,7 @@
 #include "stir/detail/test_if_1d.h"
 #include "stir/IO/write_data_1d.h"
 #include <typeinfo>
+#include <limits>
 
 START_NAMESPACE_STIR
 
@@ -101,6 +102,20 @@ namespace detail
 					  const ByteOrder byte_order,
 					  const bool can_corrupt_data)
   {
+    const std::size_t size_all = data.size_all();
+    if (typeid(OutputType) == typeid(elemT) && scale_factor==1 &&
+        size_all > 0 &&
+        size_all <= static_cast<std::size_t>(std::numeric_limits<int>::max()) &&
+        data.is_contiguous())
+      {
+        // write all data in one go, using a 1D array that uses the same memory
+        // (const_cast is fine, as write_data_1d() restores the data unless can_corrupt_data is true)
+        const Array<1,elemT> data_1d(IndexRange<1>(static_cast<int>(size_all)),
+                                     const_cast<elemT *>(data.get_const_full_data_ptr()),
+                                     /* copy_data = */ false);
+        return 
+          write_data_1d(s, data_1d, byte_order, can_corrupt_data);
+      }
     for (typename Array<num_dimensions,elemT>::const_iterator iter= data.begin();
 	 iter != data.end();
 	 ++iter)
@@ -119,6 +119,12 @@ public:
 
   //! Destructor
   virtual ~ProjData() {}
+  //! Check if the \c get_ functions can be called from multiple threads simultaneously
+  /*! Callers can use this to avoid serialising reads (e.g. with an OpenMP critical section).
+      The default returns \c false. Derived classes should only return \c true if they
+      take care of any locking that is needed themselves.
+  */
+  virtual bool supports_concurrent_reading() const { return false; }
   //! Get proj data info pointer
   inline const ProjDataInfo* 
     get_proj_data_info_ptr() const;
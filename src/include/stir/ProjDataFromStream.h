@@ -41,6 +41,7 @@
 #include "stir/Bin.h"
 #include <iostream>
 #include <vector>
+#include <string>
 
 START_NAMESPACE_STIR
 
@@ -54,6 +55,16 @@ START_NAMESPACE_STIR
   stream isn't closed yet. This is important in an interactive context, as the object
   owning the stream might not be deleted yet before we try to read the file again.
 
+  \par Thread safety
+  All \c get_ and \c set_ functions can be called from multiple (OpenMP) threads
+  simultaneously. By default, access to the stream is serialised using a lock
+  (shared by all ProjDataFromStream objects). If the stream corresponds to a file, calling
+  set_filename_for_concurrent_reading() allows the \c get_ functions to use a stream
+  per thread (opened when first needed), such that reading does not need the lock
+  and can proceed in parallel. This is only done at the first level of parallelism
+  (i.e. not in nested parallel regions). The \c set_ functions always use the
+  shared stream.
+
   \warning Data have to be contiguous.
   \warning The parameter \c make_num_tangential_poss_odd (used in various 
   \c get_ functions) is temporary and will be removed soon.
@@ -144,6 +155,18 @@ public:
 
   //! Get the value of bin.
   float get_bin_value(const Bin& this_bin) const;
+
+  //! Allow reading via separate streams for every thread
+  /*! \a filename has to be the name of the file corresponding to the stream
+      passed to the constructor. An empty string disables concurrent reading.
+      See the class documentation.
+
+      This function should not be called from a parallel region.
+  */
+  void set_filename_for_concurrent_reading(const std::string& filename);
+
+  //! Returns \c true, as reading is safe from multiple threads
+  virtual bool supports_concurrent_reading() const { return true; }
     
 protected:
   //! the stream with the data
@@ -179,6 +202,16 @@ private:
     
   //! Calculate the offsets for specific bins.
   std::vector<std::streamoff> get_offsets_bin(const Bin) const;
+
+  //! name of the file used to open the streams for concurrent reading (empty if not used)
+  std::string filename_for_concurrent_reading;
+  //! streams for reading, one per thread (created when first needed)
+  mutable std::vector<shared_ptr<std::istream> > thread_streams;
+
+  //! Get the stream private to the current thread
+  /*! Returns 0 if the shared stream has to be used instead (with locking).
+  */
+  std::istream* get_stream_for_concurrent_reading() const;
   
 };
 
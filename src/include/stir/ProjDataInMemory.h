@@ -25,42 +25,35 @@
 #ifndef __stir_ProjDataInMemory_H__
 #define __stir_ProjDataInMemory_H__
 
-#include "stir/ProjDataFromStream.h" 
+#include "stir/ProjData.h"
 #include "boost/shared_array.hpp"
-#include <string>
-
-/* Implementation note (KT)
-   
-   I first used the std::stringstream class (when available).
-   However, this class currently has a problem that you cannot preallocate
-   a buffer size. This means that when we write to the stringstream, it will
-   grow piece by piece. For some implementations (i.e. those that keep the memory
-   contiguous), this might mean multiple reallocations and copying of data.
-   Of course, for 'smart' implementations of stringstream, this wouldn't happen.
-   Still, I've decided to not take the risk, and always use old style strstream instead.
-
-  It's not clear if strstream will ever disappear from C++, but in any case, it won't happen 
-  very soon. Still, if you no longer have strstream, or don't want to use it, you can enable 
-  the stringstream implementation by removing the next line.
-*/
-//#define STIR_USE_OLD_STRSTREAM
-
-#if defined(BOOST_NO_STRINGSTREAM) && !defined(STIR_USE_OLD_STRSTREAM)
-#define STIR_USE_OLD_STRSTREAM 
-#endif
+#include <vector>
 
 START_NAMESPACE_STIR
 
 class Succeeded;
+class Bin;
 
 /*!
   \ingroup projdata
   \brief A class which reads/writes projection data from/to memory.
 
-  Mainly useful for temporary storage of projection data.
+  Mainly useful for temporary storage of projection data, e.g. additive and
+  multiplicative terms in iterative reconstructions.
+
+  All data are stored as floats in a single contiguous array, in the order
+  segment, view, axial position, tangential position (i.e. the same as
+  ProjDataFromStream::Segment_View_AxialPos_TangPos), with segments ordered
+  from the minimum to the maximum segment number. The \c get_ and \c set_ functions
+  therefore only copy the data (without any conversion or stream operations).
+  This also makes it safe to call the \c get_ functions from multiple threads
+  simultaneously.
 
+  \warning Since STIR 3.1, this class is no longer derived from ProjDataFromStream.
+  Code that used the stream-related members (or a \c dynamic_cast to ProjDataFromStream)
+  will need to be adapted.
 */
-class ProjDataInMemory : public ProjDataFromStream
+class ProjDataInMemory : public ProjData
 {
 public: 
     
@@ -78,22 +71,57 @@ public:
   //! constructor that copies data from another ProjData
   ProjDataInMemory (const ProjData& proj_data);
 
+  //! copy constructor (copies all data)
+  ProjDataInMemory (const ProjDataInMemory& proj_data);
+
+  //! assignment operator (copies all data)
+  ProjDataInMemory& operator=(const ProjDataInMemory& proj_data);
+
   //! destructor deallocates all memory the object owns
   virtual ~ProjDataInMemory();
  
-  //! Returns a  value of a bin
-  float get_bin_value(Bin& bin);
+  Viewgram<float> get_viewgram(const int view_num, const int segment_num,
+                               const bool make_num_tangential_poss_odd=false) const;
+  Succeeded set_viewgram(const Viewgram<float>& v);
+    
+  Sinogram<float> get_sinogram(const int ax_pos_num, const int segment_num,
+                               const bool make_num_tangential_poss_odd=false) const; 
+  Succeeded set_sinogram(const Sinogram<float>& s);
+
+  SegmentBySinogram<float> get_segment_by_sinogram(const int segment_num) const;
+  SegmentByView<float> get_segment_by_view(const int segment_num) const;
+  Succeeded set_segment(const SegmentBySinogram<float>&);
+  Succeeded set_segment(const SegmentByView<float>&);
+
+  //! Returns the value of a bin
+  float get_bin_value(const Bin& bin) const;
+
+  //! Returns \c true, see the class documentation
+  virtual bool supports_concurrent_reading() const { return true; }
     
 private:
-#ifdef STIR_USE_OLD_STRSTREAM
-  // an auto_ptr doesn't work in gcc 2.95.2 because of assignment problems, so we use shared_array
-  // note however that the buffer is not shared. we just use it such that its memory gets 
-  // deallocated automatically.
-  boost::shared_array<char> buffer;
-#else
-#endif
-  
-  size_t get_size_of_buffer() const;
+  //! all data
+  /*! We do not use std::vector, as that would always initialise the data to 0. */
+  boost::shared_array<float> buffer;
+  //! number of elements in \c buffer
+  std::size_t size_of_buffer;
+  //! index in \c buffer of the start of every segment (indexed with segment_num - min_segment_num)
+  std::vector<std::size_t> segment_offsets;
+
+  //! check if \a view_num and \a segment_num are in the range of the data
+  bool is_in_range(const int view_num, const int segment_num) const;
+  //! find the index in \c buffer of the first element of a viewgram
+  /*! Calls error() if the numbers are out of range. The set_* functions should
+      therefore check the range first (and return Succeeded::no).
+  */
+  std::size_t get_index_of_viewgram(const int view_num, const int segment_num) const;
+
+  //! set up segment_offsets and allocate the buffer
+  void allocate(const bool initialise_with_0);
+
+  //! check if the ProjDataInfo of some data is compatible with ours
+  /*! This first checks if the pointers are equal, avoiding a full comparison in most cases. */
+  bool is_compatible(const ProjDataInfo& proj_data_info) const;
 };
 
 END_NAMESPACE_STIR
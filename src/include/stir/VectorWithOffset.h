@@ -228,11 +228,25 @@ public:
   inline size_t capacity() const;
 
   //! check if this object owns the memory for the data
-  /*! Will be false if one of the constructors is used that passes in a data block.
+  /*! Will be false if one of the constructors is used that passes in a data block,
+      or after calling init() with \c copy_data=false.
    */
   inline bool
     owns_memory_for_data() const;
 
+  //! (re)initialise the vector to the given range, using existing data
+  /*! If \a copy_data is \c true, the vector will own its memory, and the
+      data will be copied from \a data_ptr. Otherwise, the vector will use the 
+      memory pointed to by \a data_ptr (without initialisation), and will never
+      deallocate it (see owns_memory_for_data()). In both cases, the data block
+      has to have (at least) <code>max_index-min_index+1</code> elements.
+
+      Any memory previously owned by the vector is deallocated.
+  */
+  inline void
+    init(const int min_index, const int max_index, 
+         T * const data_ptr, bool copy_data);
+
   //! get min_index within allocated range
   /*! This value depends on get_min_index() and hence will change 
       after calling set_min_index(). 
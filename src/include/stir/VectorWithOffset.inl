@@ -74,6 +74,40 @@ VectorWithOffset<T>::check_state() const
   assert(pointer_access == false);
 }
 
+template <class T>
+void
+VectorWithOffset<T>::
+init(const int min_index, const int max_index, 
+     T * const data_ptr, bool copy_data)
+{
+  this->check_state();
+  if (copy_data)
+    {
+      // make sure we do not copy into memory owned by somebody else
+      if (!this->owns_memory_for_data())
+        this->recycle();
+      this->resize(min_index, max_index);
+      std::copy(data_ptr, data_ptr + this->size(), this->begin());
+    }
+  else
+    {
+      this->_destruct_and_deallocate();
+      this->init();
+      if (max_index >= min_index)
+        {
+          this->length = static_cast<unsigned>(max_index - min_index) + 1;
+          this->start = min_index;
+          this->begin_allocated_memory = data_ptr;
+          this->end_allocated_memory = data_ptr + this->length;
+          this->num = this->begin_allocated_memory - this->start;
+          this->_owns_memory_for_data = false;
+        }
+      else
+        this->_owns_memory_for_data = true;
+    }
+  this->check_state();
+}
+
 template <class T>
 void 
 VectorWithOffset<T>::
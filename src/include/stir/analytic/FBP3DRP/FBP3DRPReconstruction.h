@@ -40,6 +40,7 @@
 #include "stir/ArcCorrection.h"
 #include "stir/shared_ptr.h"
 #include "stir/RegisteredParsingObject.h"
+#include <vector>
 
 START_NAMESPACE_STIR
 
@@ -49,6 +50,8 @@ template <typename elemT> class SegmentBySinogram;
 template <typename elemT> class VoxelsOnCartesianGrid;
 template <int num_dimensions, typename elemT> class DiscretisedDensity;
 class Succeeded;
+class ViewSegmentNumbers;
+class DataSymmetriesForViewSegmentNumbers;
 
 /* KT 180899 forget about PETAnalyticReconstruction for the moment
  TODO Derive from PETAnalyticReconstruction when it makes any sense
@@ -90,7 +93,15 @@ class Succeeded;
 	  appropriate voxel sizes, i.e. it is up to the backprojector to perform
 	  the zooming.
 	  - So, no zooming is needed on the final image.
-     
+
+  \par Multi-threading
+  When compiled with OpenMP, the related viewgrams are processed in parallel (i.e. arc-correction,
+  forward projection of the missing data, Colsher filtering and back projection). Every thread uses
+  its own Colsher filter (set-up for the segment that it is processing) and back projects into its own
+  image. The number of these images can be limited by setting
+  <tt>maximum number of images for multi-threading</tt> (the default 0 means one image per thread). If
+  there are fewer images than threads, the images are shared between threads. When intermediate images
+  are saved, the segments are processed one after the other, otherwise all segments are processed at once.
 
 */
 class FBP3DRPReconstruction: public
@@ -175,6 +186,14 @@ protected:
     void do_3D_backprojection_view(RelatedViewgrams<float> const & viewgrams,
                                    VoxelsOnCartesianGrid<float> &image,
                                    int rmin, int rmax);
+//!  All steps of do_process_viewgrams() before the back projection
+    void do_filter_viewgrams(RelatedViewgrams<float> & viewgrams,
+                             int rmin, int rmax,
+                             int orig_min_ring, int orig_max_ring);
+//!  Process (and back project) the related viewgrams for all \a vs_nums (in parallel when using OpenMP)
+    void do_process_viewgrams_in_parallel(const std::vector<ViewSegmentNumbers>& vs_nums,
+                                          const shared_ptr<DataSymmetriesForViewSegmentNumbers>& symmetries_sptr,
+                                          VoxelsOnCartesianGrid<float> &image);
 //!  Saving CPU timing and values of reconstruction parameters into a log file.    
     void do_log_file(const VoxelsOnCartesianGrid<float> &image);
 
@@ -248,6 +267,10 @@ protected:
 
   //! =1 => apply additional fitting procedure to forward projected data (DISABLED)
   int fit_projections; 
+
+  //! Maximum number of images used by the threads for the back projection
+  /*! 0 (the default) means one image per thread. See the class documentation. */
+  int max_num_images_for_threads;
 private:
 
   virtual void set_defaults();
@@ -268,6 +291,10 @@ private:
   shared_ptr<BackProjectorByBin> back_projector_sptr;
 #ifndef NRFFT
   ColsherFilter colsher_filter;
+  //! copies of \c colsher_filter used by the threads
+  std::vector<ColsherFilter> colsher_filters;
+  //! segment number for which the corresponding element of \c colsher_filters is set up
+  std::vector<int> colsher_filter_segment_nums;
 #endif
   float alpha_fit;
   float beta_fit;
@@ -108,6 +108,28 @@ class CListTime;
     ; if you're short of RAM (i.e. a single projdata does not fit into memory),
     ; you can use this to process the list mode data in multiple passes.
     num_segments_in_memory := -1
+    ; alternatively, you can limit the memory used for the segments (in MB).
+    ; Segments are then processed in batches that fit in this amount of memory
+    ; (as estimated from the accumulator type below). 0 means no limit.
+    ; If both are set, both limits are used.
+    maximum memory for segments in MB := 0
+    ; type of storage used while histogramming (float, integer or sparse)
+    ; integer uses 16-bit counters (automatically promoted per view when necessary)
+    ; and therefore half the memory of float. sparse only stores non-zero
+    ; bins, which is useful for low-count frames. See SegmentAccumulator.
+    accumulator type := float
+    ; when compiled with OpenMP, events are assigned to bins in parallel, and
+    ; every thread histograms its part of the events in its own copy of the
+    ; segments. These are added at the end of every pass through the data.
+    ; Without normalisation, the result does not depend on this setting.
+    ; This needs up to 512 list mode records in memory, which can be large
+    ; for some scanners (about 1 MB per record for ECAT8 data).
+    parallel binning := 1
+    ; the copies of the segments used for parallel binning need memory.
+    ; You can limit their number here (threads then share them).
+    ; 0 means one per thread. The maximum memory for segments (see above)
+    ; is divided over all copies.
+    maximum number of histograms for multi-threading := 0
 
   End := 
   \endverbatim
@@ -194,6 +216,23 @@ protected:
     normalisation or angle info for a rotating scanner.*/
   virtual void get_bin_from_event(Bin& bin, const CListEvent&) const;
 
+  //! Returns \c true if get_bin_from_event() can be called for different events concurrently
+  /*! If this returns \c true (and \c parallel_binning is set), process_data() reads
+      the events in batches and calls get_bin_from_event() for all events in a batch
+      in parallel (if compiled with OpenMP). Note that all events in a batch have the
+      same \c current_time. Every thread then adds its part of the bins to its own
+      SegmentAccumulators (see OutputImagesForThreads), which are added together after
+      every pass through the data. As the values are added in a different order,
+      results can differ by rounding errors when the bin values are not integers
+      (i.e. when using normalisation).
+
+      The default returns \c false when using pre-normalisation (as the
+      normalisation object might not be thread-safe), and \c true otherwise.
+      Derived classes that keep some state in get_bin_from_event() (e.g. random
+      numbers or an iterator) have to return \c false.
+  */
+  virtual bool get_bin_from_event_is_thread_safe() const;
+
   //! A function that should return the number of uncompressed bins in the current bin
   /*! \todo it is not compatiable with e.g. HiDAC doesn't belong here anyway
       (more ProjDataInfo?)
@@ -225,6 +264,17 @@ protected:
   bool store_prompts;
   bool store_delayeds;
   int num_segments_in_memory;
+  //! maximum memory (in MB) used for the segments in one pass through the data (0 means no limit)
+  /*! \see SegmentAccumulator::get_initial_memory_usage_in_bytes() */
+  double max_memory_for_segments_in_MB;
+  //! if \c true, process_data() will call get_bin_from_event() in parallel (if possible)
+  /*! \see get_bin_from_event_is_thread_safe() */
+  bool parallel_binning;
+  //! maximum number of histograms used for parallel binning (0 means one per thread)
+  /*! \see OutputImagesForThreads */
+  int max_num_histograms_for_threads;
+  //! type of SegmentAccumulator used (\c float, \c integer or \c sparse)
+  std::string accumulator_type;
   long int num_events_to_store;
   int max_segment_num_to_process;
 
@@ -0,0 +1,276 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup listmode
+  \brief Declaration of class stir::SegmentAccumulator and derived classes,
+  and class stir::SegmentAccumulators
+*/
+
+#ifndef __stir_listmode_SegmentAccumulator_H__
+#define __stir_listmode_SegmentAccumulator_H__
+
+#include "stir/SegmentByView.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/shared_ptr.h"
+#include "stir/VectorWithOffset.h"
+#include "boost/cstdint.hpp"
+#include "boost/unordered_map.hpp"
+#include <string>
+#include <vector>
+
+START_NAMESPACE_STIR
+
+class Bin;
+
+/*!
+  \ingroup listmode
+  \brief Abstract base class for accumulating values in the bins of a segment
+
+  This is used by LmToProjData to histogram list mode data. Derived classes
+  use different storage strategies to reduce memory usage, such that more
+  segments fit in memory (and LmToProjData needs fewer passes through the data).
+
+  Use create() to construct an object of the appropriate derived class.
+*/
+class SegmentAccumulator
+{
+public:
+  //! Construct a new accumulator of the given type
+  /*! \a type has to be one of \c "float", \c "integer" or \c "sparse"
+      (calls error() otherwise).
+  */
+  static SegmentAccumulator*
+    create(const std::string& type,
+           const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+           const int segment_num);
+
+  //! Check if \a type is a valid argument for create()
+  static bool is_valid_type(const std::string& type);
+
+  //! estimate of the memory (in bytes) that a new accumulator will use
+  /*! For \c "integer", this is the memory used before any promotion to larger
+      counters. As promotion is done per view, the memory only grows for views
+      with large (or non-integer) values, and never exceeds the memory for \c "float"
+      by more than the size of one view.
+      For \c "sparse", the memory depends on the number of non-zero bins,
+      so the estimate for \c "float" is returned.
+  */
+  static std::size_t
+    get_initial_memory_usage_in_bytes(const std::string& type,
+                                      const ProjDataInfo& proj_data_info,
+                                      const int segment_num);
+
+  virtual ~SegmentAccumulator() {}
+
+  //! add \a value to the bin (the value of \a bin is ignored)
+  inline void add(const Bin& bin, const float value);
+
+  //! add all values of \a other, which has to be for the same segment
+  /*! \a other can be of a different type. Only non-zero values are added.
+      Results are independent of the order in which accumulators are added if all values
+      are integers (as long as the sums fit in a \c float without rounding).
+  */
+  SegmentAccumulator& operator+=(const SegmentAccumulator& other);
+
+  //! get the accumulated values as a segment
+  virtual SegmentByView<float> get_segment() const = 0;
+
+  //! estimate of the amount of memory (in bytes) used for storing the values
+  virtual std::size_t get_memory_usage_in_bytes() const = 0;
+
+  int get_segment_num() const { return segment_num; }
+
+protected:
+  SegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                     const int segment_num);
+
+  //! index of the bin in a 1D array (with the same order as SegmentByView)
+  inline std::size_t get_index(const Bin& bin) const;
+
+  //! add \a value to the bin with index \a index (see get_index())
+  virtual void add_at_index(const std::size_t index, const float value) = 0;
+
+  //! call add_at_index() on \a output for all non-zero values
+  virtual void add_values_to(SegmentAccumulator& output) const = 0;
+
+  //! helper function for add_values_to() in derived classes
+  static void add_to_output(SegmentAccumulator& output, const std::size_t index, const float value)
+  { output.add_at_index(index, value); }
+
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  int segment_num;
+  int min_view_num, min_axial_pos_num, min_tangential_pos_num;
+  int num_axial_poss, num_tangential_poss;
+  std::size_t num_bins;
+};
+
+/*!
+  \ingroup listmode
+  \brief Accumulates values in a SegmentByView<float>
+
+  This is the traditional (and most memory-hungry) way.
+*/
+class FloatSegmentAccumulator : public SegmentAccumulator
+{
+public:
+  FloatSegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                          const int segment_num);
+
+  virtual SegmentByView<float> get_segment() const;
+  virtual std::size_t get_memory_usage_in_bytes() const;
+
+protected:
+  virtual void add_at_index(const std::size_t index, const float value);
+  virtual void add_values_to(SegmentAccumulator& output) const;
+
+private:
+  SegmentByView<float> segment;
+  //! pointer to the data of \c segment
+  float * data_ptr;
+
+  // copying is not supported (\c data_ptr would point to the original)
+  FloatSegmentAccumulator(const FloatSegmentAccumulator&);
+  FloatSegmentAccumulator& operator=(const FloatSegmentAccumulator&);
+};
+
+/*!
+  \ingroup listmode
+  \brief Accumulates values in narrow integer counters
+
+  Values are stored as \c boost::int16_t, which uses half the memory of
+  FloatSegmentAccumulator. The storage is automatically promoted to
+  \c boost::int32_t when a value does not fit anymore, and to \c float when
+  a non-integer value is added (e.g. when using normalisation).
+
+  Promotion is done per view, such that only views with large values need
+  the larger storage. While promoting, the old and new storage of that view
+  are both in memory.
+
+  Note that signed types are used as delayed events might be subtracted.
+*/
+class IntegerSegmentAccumulator : public SegmentAccumulator
+{
+public:
+  IntegerSegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                            const int segment_num);
+
+  virtual SegmentByView<float> get_segment() const;
+  virtual std::size_t get_memory_usage_in_bytes() const;
+
+  //! number of bytes currently used per bin in a view (2, 4 or 4 for float)
+  int get_num_bytes_per_bin(const int view_num) const;
+
+protected:
+  virtual void add_at_index(const std::size_t index, const float value);
+  virtual void add_values_to(SegmentAccumulator& output) const;
+
+private:
+  enum StorageType { int16_storage, int32_storage, float_storage };
+  //! storage for one view (only the vector for the current type is non-empty)
+  struct Block
+  {
+    StorageType storage_type;
+    std::vector<boost::int16_t> values_int16;
+    std::vector<boost::int32_t> values_int32;
+    std::vector<float> values_float;
+
+    void promote_to_int32();
+    void promote_to_float();
+    float get_value(const std::size_t index_in_block) const;
+    std::size_t get_memory_usage_in_bytes() const;
+  };
+  std::vector<Block> blocks;
+  std::size_t num_bins_per_block;
+};
+
+/*!
+  \ingroup listmode
+  \brief Accumulates values in a hash-table, only storing non-zero bins
+
+  This is useful for low-count frames, where most bins will be zero. For
+  high-count frames, this uses far more memory than the other accumulators
+  (roughly 4 pointers per non-zero bin).
+*/
+class SparseSegmentAccumulator : public SegmentAccumulator
+{
+public:
+  SparseSegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                           const int segment_num);
+
+  virtual SegmentByView<float> get_segment() const;
+  virtual std::size_t get_memory_usage_in_bytes() const;
+
+protected:
+  virtual void add_at_index(const std::size_t index, const float value);
+  virtual void add_values_to(SegmentAccumulator& output) const;
+
+private:
+  typedef boost::unordered_map<boost::uint32_t, float> map_type;
+  map_type values;
+};
+
+/*!
+  \ingroup listmode
+  \brief Accumulators for a range of segments
+
+  This holds a SegmentAccumulator (of the same type) for every segment in the range.
+  It can be used with OutputImagesForThreads (where the segments play the role
+  of the planes of an image), such that threads can histogram events into
+  separate objects, which are added at the end.
+*/
+class SegmentAccumulators
+{
+public:
+  //! constructor, creating accumulators of type \a type for the segments in the range
+  /*! \see SegmentAccumulator::create() */
+  SegmentAccumulators(const std::string& type,
+                      const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                      const int min_segment_num, const int max_segment_num);
+
+  int get_min_index() const { return accumulators.get_min_index(); }
+  int get_max_index() const { return accumulators.get_max_index(); }
+
+  //! get the accumulator for a segment
+  SegmentAccumulator& operator[](const int segment_num)
+  { return *accumulators[segment_num]; }
+  const SegmentAccumulator& operator[](const int segment_num) const
+  { return *accumulators[segment_num]; }
+
+  //! add \a value to the bin (the value of \a bin is ignored)
+  inline void add(const Bin& bin, const float value);
+
+  //! create an object for the same segments and type, with all values 0
+  SegmentAccumulators* get_empty_copy() const;
+
+  //! estimate of the amount of memory (in bytes) used for storing the values
+  std::size_t get_memory_usage_in_bytes() const;
+
+private:
+  std::string type;
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  VectorWithOffset<shared_ptr<SegmentAccumulator> > accumulators;
+
+  // copying is not supported (the accumulators would be shared)
+  SegmentAccumulators(const SegmentAccumulators&);
+  SegmentAccumulators& operator=(const SegmentAccumulators&);
+};
+
+END_NAMESPACE_STIR
+
+#include "stir/listmode/SegmentAccumulator.inl"
+
+#endif
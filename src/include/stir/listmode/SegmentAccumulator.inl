@@ -0,0 +1,53 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup listmode
+  \brief Inline implementations of classes stir::SegmentAccumulator and stir::SegmentAccumulators
+*/
+
+#include "stir/Bin.h"
+
+START_NAMESPACE_STIR
+
+std::size_t
+SegmentAccumulator::
+get_index(const Bin& bin) const
+{
+  assert(bin.segment_num() == this->segment_num);
+  assert(bin.axial_pos_num() - this->min_axial_pos_num < this->num_axial_poss);
+  assert(bin.tangential_pos_num() - this->min_tangential_pos_num < this->num_tangential_poss);
+  return 
+    (static_cast<std::size_t>(bin.view_num() - this->min_view_num)*this->num_axial_poss +
+     static_cast<std::size_t>(bin.axial_pos_num() - this->min_axial_pos_num))*this->num_tangential_poss +
+    static_cast<std::size_t>(bin.tangential_pos_num() - this->min_tangential_pos_num);
+}
+
+void
+SegmentAccumulator::
+add(const Bin& bin, const float value)
+{
+  this->add_at_index(this->get_index(bin), value);
+}
+
+void
+SegmentAccumulators::
+add(const Bin& bin, const float value)
+{
+  this->accumulators[bin.segment_num()]->add(bin, value);
+}
+
+END_NAMESPACE_STIR
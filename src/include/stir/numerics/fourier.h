@@ -85,7 +85,12 @@ inline void inverse_fourier(T& c, const int sign=1)
   \param[in] sign This can be used to implement a different convention for the DFT
 
   \warning Currently, the array has to be indexed from 0.
-  \warning Currently, the length of the array has to be a power of 2.
+
+  Any length is supported. The implementation uses cached "plans" with precomputed
+  factors, and is fastest when the length only has small prime factors (2, 3 and 5
+  are best, see efficient_fourier_length()). Lengths with a prime factor larger
+  than 13 use Bluestein's algorithm, which is a few times slower. All functions
+  can be called from multiple (OpenMP) threads simultaneously.
    
   The convention used is as follows.
   For a vector of length \a n, the result is
@@ -95,17 +100,23 @@ inline void inverse_fourier(T& c, const int sign=1)
   This means that the zero-frequency will be returned in <tt>c[0]</tt>
    
   This function can be used with more general type of \a c (if instantiated in fourier.cxx).
-  The type \a T has to be such that \a T::value_type, \a T::reference and 
-  <tt> T::reference T::operator[](const int)</tt> exist. Moreover, numerical
-  operations
-  <tt>operator*=(T::reference, std::complex\<float\>)</tt>,
-  <tt>operator+=(T::reference, T::value_type)</tt> and
-  <tt>operator*=(T::reference, int)</tt>,
-   have to be defined as well.
+  The type \a T has to be a VectorWithOffset (or derived class) with \a T::value_type
+  either <code>std::complex\<float\></code>, or a type with a \c full_iterator over
+  <code>std::complex\<float\></code> elements (such as Array). In the latter case, all
+  elements of \a c have to have the same number of elements.
 */
 template <typename T>
 void fourier_1d(T& c, const int sign);
 
+/*! \ingroup DFT
+  \brief Find an even length that is at least \a min_length and for which DFTs are efficient.
+
+  This returns the smallest even number \c n (at least 2) such that <tt>n \>= min_length</tt>
+  and \c n has only prime factors 2, 3 and 5. This is useful when zero-padding data, as
+  it is often a lot smaller than the next power of 2.
+*/
+int efficient_fourier_length(const int min_length);
+
 /*! \ingroup DFT
   \brief Compute the inverse of the one-dimensional discrete fourier transform.
 
@@ -124,6 +124,17 @@ public:
   When the bin size is not equal to the voxel_size.x(), zoom_viewgrams() is first called to
   adjust the bin size, then the usual incremental backprojection is used.
 
+  \par Multi-threading
+
+  When compiled with OpenMP and called outside of a parallel region, the back projection
+  of a set of related viewgrams splits the axial positions into blocks, and back
+  projects alternate blocks in parallel into the same image (see find_ax_pos_block_size()
+  in the implementation). Inside a parallel region, it runs in the calling thread only.
+  Note that BackProjectorByBin::back_project() for ProjData and distributable_computation()
+  already call it from their own parallel loop over view/segment numbers (with an image
+  per thread), so the blocks are then not used. They are used when the caller
+  back projects related viewgrams directly.
+
   \bug Currently this implementation has problems on certain processors
   due to floating point rounding errors. Intel *86 and PowerPC give
   correct results, SunSparc has a problem at tangential_pos_num==0 (also HP
@@ -65,6 +65,7 @@ class PETCount_rebinned
 #ifdef PARALLEL
     friend PMessage& operator<<(PMessage&, PETCount_rebinned&);
     friend PMessage& operator>>(PMessage&, PETCount_rebinned&);
+#endif
 
     PETCount_rebinned & operator+= (const PETCount_rebinned &rebin)
         {
@@ -73,7 +74,6 @@ class PETCount_rebinned
             ssrb += rebin.ssrb;
             return *this;
         }
-#endif
 // Default constructor by initialising all the elements conter to null
     explicit PETCount_rebinned(int total_v=0, int miss_v =0, int ssrb_v = 0)
         :total(total_v), miss(miss_v), ssrb(ssrb_v)
@@ -116,6 +116,19 @@ class PETCount_rebinned
   Therefore the rebinned data are estimated using only the oblique sinograms with 
   a small value of d : dlim. Owing to the small value of d, the axial shift can be 
   neglected as in the SSRB approximation.
+
+  \par Implementation details
+
+  The input data are read one (pair of) oblique sinogram(s) at a time, such that the 3D data set
+  does not have to be in memory. When compiled with OpenMP, the sinograms are rebinned in parallel.
+  Every thread then uses its own copy of Pr(w,k) (and its weights), which are added at the end.
+  The memory needed is therefore proportional to the number of threads times the size of the
+  rebinned data (in Fourier space). This can be limited with the keyword
+  \verbatim
+  maximum number of arrays for multi-threading := 2
+  \endverbatim
+  (default 0, meaning one copy per thread). Threads then share the copies,
+  see OutputImagesForThreads. The inverse FFTs are also done in parallel.
 */
 
 class FourierRebinning : public   RegisteredParsingObject<
@@ -141,6 +154,8 @@ class FourierRebinning : public   RegisteredParsingObject<
     int kc;                  
 //! fore_debug_level. Setting it to >0 will produce some debug information 
     int fore_debug_level; 
+//! maximum number of copies of the rebinned data used by the threads (0 means one per thread)
+    int max_num_arrays_for_threads;
         
  public:
 //! default constructor calls set_defaults();
@@ -160,12 +175,14 @@ class FourierRebinning : public   RegisteredParsingObject<
   inline void set_deltamin(int dm){deltamin = dm;}
   inline void set_kc(int kcc) {kc = kcc;}
   inline void set_fore_debug_level(int fdebug){fore_debug_level = fdebug;}
+  inline void set_max_num_arrays_for_threads(int num){max_num_arrays_for_threads = num;}
   
   inline int get_kmin(){return kmin;}
   inline int get_wmin(){return wmin;}
   inline int get_deltamin(){return deltamin;}
   inline int get_kc() {return kc;}
   inline int get_fore_debug_level(){return fore_debug_level;}     
+  inline int get_max_num_arrays_for_threads(){return max_num_arrays_for_threads;}
  
  private:
 
@@ -173,7 +190,7 @@ class FourierRebinning : public   RegisteredParsingObject<
   \brief Fourier rebinning
 
   This method takes as input the 3D data set (Array3D) in Fourier space of one sinogram
-  for a given delta as the data dimension are (1,fft_size,nviews_pow2), the scanner informations
+  for a given delta as the data dimension are (1,fft_size,nviews_padded), the scanner informations
   and returns the updated stack of 2D rebinned sinograms still in Fourier space,
   the updated weigthing factors as well as  the new rebinned elements counter.
 
@@ -181,14 +198,14 @@ class FourierRebinning : public   RegisteredParsingObject<
 */
     void rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
        PETCount_rebinned &num_rebinned, const Array<2,std::complex<float> > &FT_current_sinogram, const float z, 
-       const float average_ring_difference_in_segment, const int num_views_pow2, const int num_tang_poss_pow2,
+       const float average_ring_difference_in_segment, const int num_views_padded, const int num_tang_poss_padded,
        const float half_distance_between_rings, const float sampling_distance_in_s, const float radial_sampling_freq_w,
        const float R_field_of_view_mm, const float ratio_ring_spacing_to_ring_radius);
 
 /*!
-  \brief This method takes as input the real 3D data set
-  (in which the number of views have been extended to a number of power of 2)
-  and  returns the rebinned sinograms in Fourier space, their weighting factors
+  \brief This method takes as input one real (merged) sinogram at axial position \a z_in_mm
+  (in which the number of views have been extended to a length suitable for the FFT)
+  and  updates the rebinned sinograms in Fourier space, their weighting factors
   as well as the counter rebinned elements
 
   \b Rebinning <BR>
@@ -198,8 +215,9 @@ class FourierRebinning : public   RegisteredParsingObject<
 */
 
     void do_rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
-                      PETCount_rebinned &count_rebinned, const SegmentBySinogram<float> &segment, const int num_tang_poss_pow2,
-                      const int num_views_pow2, const int num_planes, const float average_ring_difference_in_segment,
+                      PETCount_rebinned &count_rebinned, const Array<2,float> &sinogram, const float z_in_mm,
+                      const int num_tang_poss_padded,
+                      const int num_views_padded, const float average_ring_difference_in_segment,
                       const float half_distance_between_rings, const float sampling_distance_in_s, 
                       const float radial_sampling_freq_w, const float R_field_of_view_mm,
                       const float ratio_ring_spacing_to_ring_radius);
@@ -217,11 +235,22 @@ class FourierRebinning : public   RegisteredParsingObject<
     void do_display_count(PETCount_rebinned &num_rebinned_total);
 
 
-//! This is a function to adjust the number of views of a segment to the next power of 2
-    void do_adjust_nb_views_to_pow2(SegmentBySinogram<float> &segment) ;
+//! This is a function to adjust the number of views of a (merged) sinogram to a length suitable for the FFT
+/*! The sinogram is indexed as <tt>[view][tangential_pos]</tt> with views starting from 0.
+   \see efficient_fourier_length() */
+    void do_adjust_nb_views_for_fft(Array<2,float> &sinogram, const int num_views_padded) const;
+
+//! Read the sinograms of segments \a seg_num and \a -seg_num and merge them into one sinogram sampled over 2 pi
+/*! The result is indexed as <tt>[view][tangential_pos]</tt> and its number of views is adjusted
+    to \a num_views_padded using do_adjust_nb_views_for_fft().
+
+    This function can be called from multiple threads.
+*/
+    void get_sinogram_for_rebinning(Array<2,float>& sinogram, const int seg_num, const int axial_pos_num,
+                                    const int num_views_padded) const;
 
 //! This function checks if the steering and input paramters for FORE are inside the possible range of parameters
-    Succeeded fore_check_parameters(int num_tang_poss_pow2, int num_views_pow2, int max_segment_num_to_process);
+    Succeeded fore_check_parameters(int num_tang_poss_padded, int num_views_padded, int max_segment_num_to_process);
 
     
  protected:
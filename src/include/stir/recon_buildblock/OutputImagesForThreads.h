@@ -0,0 +1,251 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+#ifndef __stir_recon_buildblock_OutputImagesForThreads_H__
+#define __stir_recon_buildblock_OutputImagesForThreads_H__
+
+/*!
+  \file
+  \ingroup distributable
+
+  \brief Declaration and implementation of class stir::OutputImagesForThreads
+  and function stir::add_images_plane_by_plane()
+*/
+#include "stir/Array.h"
+#include "stir/shared_ptr.h"
+#include "stir/is_null_ptr.h"
+#include "stir/error.h"
+#include <vector>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
+
+START_NAMESPACE_STIR
+
+namespace detail
+{
+  //! get an empty copy of an image (i.e. an object with a get_empty_copy() member)
+  template <class ImageT>
+  inline ImageT*
+  get_empty_copy_for_threads(const ImageT& image)
+  {
+    // note: get_empty_copy() returns a pointer to the base class for some types
+    return dynamic_cast<ImageT *>(image.get_empty_copy());
+  }
+
+  //! get an empty copy of an Array (which has no get_empty_copy() member)
+  template <int num_dimensions, class elemT>
+  inline Array<num_dimensions,elemT>*
+  get_empty_copy_for_threads(const Array<num_dimensions,elemT>& array)
+  {
+    return new Array<num_dimensions,elemT>(array.get_index_range());
+  }
+}
+
+//! add images to \a output, plane by plane
+/*! \ingroup distributable
+  Null pointers in \a images are skipped. The loop over planes is run in
+  parallel when using OpenMP, as every plane of \a output is only written by one thread.
+
+  \a ImageT has to be an Array<3,elemT> (or derived from it), or another class
+  with get_min_index(), get_max_index() and an operator[] that returns
+  something with an operator+= (e.g. SegmentAccumulators).
+*/
+template <class ImageT>
+inline void
+add_images_plane_by_plane(ImageT& output,
+                          const std::vector<shared_ptr<ImageT> >& images)
+{
+  const int min_z = output.get_min_index();
+  const int max_z = output.get_max_index();
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int z=min_z; z<=max_z; ++z)
+    for (std::size_t i=0; i<images.size(); ++i)
+      if (!is_null_ptr(images[i]))
+        output[z] += (*images[i])[z];
+}
+
+/*!
+  \ingroup distributable
+  \brief Images used by threads to accumulate an output image (e.g. a back projection)
+
+  Threads cannot add to the same image simultaneously. Therefore, every
+  thread gets its own image from get_image(), and the images are added
+  to the output image at the end by add_to_output_image().
+  The first image is the output image itself. The others are allocated
+  (as empty copies of the output image) when they are first used.
+  \a ImageT can be a DiscretisedDensity (or derived class) or an Array<3,elemT>.
+  Other classes with a get_empty_copy() member can be used as well, as long as
+  add_images_plane_by_plane() works for them (e.g. SegmentAccumulators).
+
+  This needs (number of threads - 1) extra copies of the image. If this is too
+  much memory, the number of images can be limited. Threads then share the images,
+  but each image is used by only one thread at a time (using an OpenMP lock).
+  A thread first looks for an image that is not in use, and otherwise waits for
+  "its" image. Threads might therefore have to wait for each other, such that
+  the computation will be slower. A maximum of 1 uses only the output image
+  (i.e. no extra memory), but then the computation effectively runs sequentially.
+
+  Usage (from inside a parallel region):
+  \code
+  int image_num;
+  ImageT * image_ptr = images_for_threads.get_image(image_num);
+  // add something to *image_ptr
+  images_for_threads.release_image(image_num);
+  \endcode
+  and after the parallel region
+  \code
+  images_for_threads.add_to_output_image();
+  \endcode
+
+  Without OpenMP, there is only 1 image (i.e. the output image).
+*/
+template <class ImageT>
+class OutputImagesForThreads
+{
+public:
+  //! constructor
+  /*! \param output_image_ptr the output image (0 is allowed if there is no output,
+             in which case get_image() returns 0)
+      \param max_num_images maximum number of images. 0 means one image per thread
+             (as do values larger than the number of threads). Calls error() if negative.
+  */
+  OutputImagesForThreads(ImageT * const output_image_ptr, const int max_num_images)
+    : output_image_ptr(output_image_ptr)
+  {
+    if (max_num_images < 0)
+      error("OutputImagesForThreads: maximum number of images should be non-negative");
+#ifdef STIR_OPENMP
+    const int max_num_threads = omp_get_max_threads();
+#else
+    const int max_num_threads = 1;
+#endif
+    num_images =
+      max_num_images > 0 && max_num_images < max_num_threads
+      ? max_num_images : max_num_threads;
+    local_image_sptrs.resize(num_images);
+#ifdef STIR_OPENMP
+    if (output_image_ptr != 0 && num_images < max_num_threads)
+      {
+        image_locks.resize(num_images);
+        for (std::size_t i=0; i<image_locks.size(); ++i)
+          omp_init_lock(&image_locks[i]);
+      }
+#endif
+  }
+
+  ~OutputImagesForThreads()
+  {
+#ifdef STIR_OPENMP
+    for (std::size_t i=0; i<image_locks.size(); ++i)
+      omp_destroy_lock(&image_locks[i]);
+#endif
+  }
+
+  //! number of images that will be used
+  int get_num_images() const { return num_images; }
+
+  //! true if threads have to share images
+  bool uses_locks() const
+  {
+#ifdef STIR_OPENMP
+    return !image_locks.empty();
+#else
+    return false;
+#endif
+  }
+
+  //! get an image for the current thread
+  /*! If images are shared, this waits until an image is available. \a image_num
+      is set to the index of the image, which has to be passed to release_image().
+      Returns 0 if the output image pointer passed to the constructor was 0.
+  */
+  ImageT* get_image(int& image_num)
+  {
+#ifdef STIR_OPENMP
+    const int thread_num = omp_get_thread_num();
+#else
+    const int thread_num = 0;
+#endif
+    image_num = thread_num % num_images;
+    if (output_image_ptr == 0)
+      return 0;
+#ifdef STIR_OPENMP
+    if (uses_locks())
+      {
+        // find a free image, or wait for "our" image if they are all in use
+        int i=0;
+        for (; i<num_images; ++i)
+          {
+            if (omp_test_lock(&image_locks[image_num]))
+              break;
+            image_num = (image_num + 1) % num_images;
+          }
+        if (i==num_images)
+          {
+            image_num = thread_num % num_images;
+            omp_set_lock(&image_locks[image_num]);
+          }
+      }
+#endif
+    if (image_num==0)
+      return output_image_ptr;
+    // note: each image_num is only used by one thread at a time, so we can allocate without a critical section
+    if (is_null_ptr(local_image_sptrs[image_num]))
+      local_image_sptrs[image_num].reset(get_empty_copy_of_output_image());
+    return local_image_sptrs[image_num].get();
+  }
+
+  //! release the image obtained by get_image()
+  void release_image(const int image_num)
+  {
+#ifdef STIR_OPENMP
+    if (uses_locks() && output_image_ptr != 0)
+      omp_unset_lock(&image_locks[image_num]);
+#endif
+  }
+
+  //! add all images used by the threads to the output image
+  /*! Has to be called outside of a parallel region. Uses add_images_plane_by_plane(). */
+  void add_to_output_image()
+  {
+    if (output_image_ptr != 0)
+      add_images_plane_by_plane(*output_image_ptr, local_image_sptrs);
+  }
+
+private:
+  ImageT * const output_image_ptr;
+  int num_images;
+  //! images used by the threads (the first is always 0, as the output image is used instead)
+  std::vector<shared_ptr<ImageT> > local_image_sptrs;
+#ifdef STIR_OPENMP
+  std::vector<omp_lock_t> image_locks;
+#endif
+
+  ImageT * get_empty_copy_of_output_image() const
+  {
+    return detail::get_empty_copy_for_threads(*output_image_ptr);
+  }
+
+  // copying is not supported (as we have locks)
+  OutputImagesForThreads(const OutputImagesForThreads&);
+  OutputImagesForThreads& operator=(const OutputImagesForThreads&);
+};
+
+END_NAMESPACE_STIR
+
+#endif
@@ -111,8 +111,26 @@ START_NAMESPACE_STIR
   ; e.g. subsens_%d.hv
   ; boost::format is used with the pattern (which means you can use it like sprintf)
   subset sensitivity filenames:=
+  ; directory for caching (subset) sensitivities, see below
+  sensitivity cache directory:=
   \endverbatim
 
+  \par Caching sensitivities
+  If no sensitivity filename(s) are given and \c sensitivity cache directory is set,
+  the (subset) sensitivities are looked up in (and after computation written to)
+  that directory. Cache entries are identified by a hash of the text returned by
+  get_sensitivity_cache_description(), which derived classes implement to list all
+  parameters that influence the sensitivity (e.g. scanner and projection data
+  geometry, normalisation and projector parameters, number of subsets and image
+  geometry). The full text is stored in the cache as well, such that hash collisions
+  are detected. Files in the cache have names like
+  <tt>sensitivity_\<hash\>_\<subset_num\>.hv</tt> and <tt>sensitivity_\<hash\>.txt</tt>.
+  If the description is empty (the default), the cache is not used.
+
+  \warning The cache only uses the parameters, not the contents of any files they
+  refer to (e.g. the normalisation file). If those change, the cache needs to be cleared,
+  or \c recompute sensitivity set (which will overwrite the cached entry).
+
   \par Terminology
   We currently use \c sub_gradient for the gradient of the likelihood of the subset (not 
   the mathematical subgradient).
@@ -205,6 +223,10 @@ public  GeneralisedObjectiveFunction<TargetT>
  */
   std::string get_subsensitivity_filenames() const;
 
+  //! get directory used for caching sensitivities
+  /*! will be a zero string if not set (which disables the cache) */
+  std::string get_sensitivity_cache_directory() const;
+
   /*! \name Functions to set parameters
     This can be used as alternative to the parsing mechanism.
    \warning After using any of these, you have to call set_up().
@@ -229,6 +251,10 @@ public  GeneralisedObjectiveFunction<TargetT>
   Calls error() if the pattern is invalid.
  */
   void set_subsensitivity_filenames(const std::string&);
+
+  //! set directory used for caching sensitivities
+  /*! set to a zero-length string to disable the cache */
+  void set_sensitivity_cache_directory(const std::string&);
   //@}
 
   /*! The implementation checks if the sensitivity of a voxel is zero. If so,
@@ -241,6 +267,7 @@ public  GeneralisedObjectiveFunction<TargetT>
 
   std::string sensitivity_filename;
   std::string subsensitivity_filenames;
+  std::string sensitivity_cache_directory;
   bool recompute_sensitivity;
   bool use_subset_sensitivities;
 
@@ -260,6 +287,18 @@ public  GeneralisedObjectiveFunction<TargetT>
   */
   void set_total_or_subset_sensitivities();
 
+  //! get the name of the cache file with the description, without the extension
+  std::string get_sensitivity_cache_filename_prefix(const std::string& description) const;
+  //! read (subset) sensitivities from the cache if a matching entry exists
+  /*! Returns Succeeded::no if there is no matching entry.
+      Calls set_total_or_subset_sensitivities() on success.
+  */
+  Succeeded read_sensitivities_from_cache(const TargetT& target,
+                                          const std::string& description);
+  //! write (subset) sensitivities to the cache
+  /*! Only issues a warning if this fails. */
+  void write_sensitivities_to_cache(const std::string& description) const;
+
 protected:
   //! set-up specifics for the derived class 
   virtual Succeeded 
@@ -272,8 +311,18 @@ protected:
   */
   void compute_sensitivities();
 
+  //! Get a description of all parameters that influence the sensitivities
+  /*! This is used to find entries in the sensitivity cache. The default
+      implementation returns an empty string, which disables the cache.
+
+      This function is called after set_up_before_sensitivity().
+  */
+  virtual std::string
+    get_sensitivity_cache_description(const TargetT& target);
+
   //! Sets defaults for parsing 
-  /*! Resets \c sensitivity_filename, \c subset_sensitivity_filenames to empty,
+  /*! Resets \c sensitivity_filename, \c subset_sensitivity_filenames and
+     \c sensitivity_cache_directory to empty,
      \c recompute_sensitivity to \c false, and \c use_subset_sensitivities to false.
   */
   virtual void set_defaults();
@@ -37,8 +37,13 @@
 #include "stir/ProjDataInMemory.h"
 #include "stir/recon_buildblock/ProjectorByBinPairUsingProjMatrixByBin.h"
 #include "stir/ExamInfo.h"
+#include <boost/cstdint.hpp>
+#include <vector>
 START_NAMESPACE_STIR
 
+class CListRecord;
+template <class ImageT> class OutputImagesForThreads;
+
 
 /*!
   \ingroup GeneralisedObjectiveFunction
@@ -51,6 +56,44 @@ START_NAMESPACE_STIR
   If the list mode data is binned (with LmToProjData) without merging
   any bins, then the log likelihood computed from list mode data and
   projection data will be identical.
+
+  When compiled with OpenMP, the gradient computation reads the events in batches and
+  forward and back projects the events in a batch in parallel. Every thread uses its
+  own image for accumulating the back projection, so this needs (number of threads - 1)
+  extra images. The keyword <tt>maximum number of images for multi-threading</tt>
+  limits this number (see OutputImagesForThreads). The additive projection data are kept in memory (as a ProjDataInMemory
+  object) as they are needed for every event.
+
+  \par Caching events in memory
+
+  Normally, every call to compute_sub_gradient_without_penalty_plus_sensitivity() reads
+  all events of the frame from the list mode data, finds their bin and checks if it is
+  in the current subset. If the keyword <tt>cache list mode events in memory</tt> is set to 1,
+  the events of all subsets are instead stored on the first call (as a compact
+  array of bin indices per subset). Subsequent calls then only process the events of
+  the requested subset, without reading or decoding the list mode data again.
+  This needs 8 bytes per used prompt event. The cache is cleared by set_up().
+
+  The memory for the cache is limited by the keyword
+  <tt>maximum memory for list mode events cache in MB</tt>. If the events do not fit,
+  a warning is issued and the events are read from the list mode data on every call instead.
+  When \c num_events_to_use is set, this is checked before reading any events.
+
+  \par Parameters
+  \verbatim
+  PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin Parameters:=
+  ; keywords of the base class
+  max ring difference num to process:=
+  Matrix type:=
+  additive sinogram:=
+  num_events_to_use:=
+  cache list mode events in memory:= 0
+  ; 0 means no limit
+  maximum memory for list mode events cache in MB:= 1024
+  ; 0 means one image per thread
+  maximum number of images for multi-threading:= 0
+  End PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin Parameters:=
+  \endverbatim
 */
 
 template <typename TargetT>
@@ -83,6 +126,15 @@ public:
 
   int set_num_subsets(const int new_num_subsets);
 
+  //! Set if events are stored in memory on the first pass over the list mode data
+  void set_cache_lm_events(const bool);
+
+  //! Set the maximum memory (in MB) used for storing events in memory (0 means no limit)
+  void set_max_memory_for_events_cache_in_MB(const double);
+
+  //! set the maximum number of images used by the threads (see OutputImagesForThreads)
+  void set_max_num_images_for_threads(const int);
+
 protected:
   virtual double
     actual_compute_objective_function_without_penalty(const TargetT& current_estimate,
@@ -112,6 +164,17 @@ protected:
   shared_ptr<ProjDataInMemory> additive_proj_data_sptr;
  
   std::string additive_projection_data_filename ; 
+
+  //! If true, store the events (per subset) in memory on the first pass over the list mode data
+  bool cache_lm_events;
+
+  //! maximum memory (in MB) used for \c events_cache (0 means no limit)
+  double max_memory_for_events_cache_in_MB;
+
+  //! maximum number of images used to accumulate the gradient when using multiple threads
+  /*! 0 means one image per thread. */
+  int max_num_images_for_threads;
+
   //! ProjDataInfo
   shared_ptr<ProjDataInfo> proj_data_info_sptr;
 
@@ -127,6 +190,38 @@ protected:
 
   void
     add_view_seg_to_sensitivity(TargetT& sensitivity, const ViewSegmentNumbers& view_seg_nums) const;
+
+private:
+  //! Compact storage of the bin of an event in the cache
+  struct CachedEvent
+  {
+    boost::int16_t segment_num;
+    boost::int16_t view_num;
+    boost::int16_t axial_pos_num;
+    boost::int16_t tangential_pos_num;
+  };
+  //! Events in the cache, one vector per subset
+  std::vector<std::vector<CachedEvent> > events_cache;
+  bool events_cache_is_filled;
+  //! set if the events did not fit in the maximum memory for the cache (reset by set_up())
+  bool events_cache_is_too_large;
+
+  //! Finds the bin of a prompt event
+  /*! \return \c false if the record is not a prompt event, or its bin is not in the range of
+      the projection data.
+  */
+  bool get_bin_of_prompt(Bin& measured_bin, const CListRecord& record) const;
+  //! Finds the subset of a bin
+  /*! \return -1 if the basic bin cannot be found (and there is more than 1 subset) */
+  int get_subset_num_of_bin(const Bin& measured_bin) const;
+  //! Reads all events of the current frame and stores them in \c events_cache
+  /*! \return Succeeded::no (and leaves the cache empty) if the events do not fit
+      in \c max_memory_for_events_cache_in_MB */
+  Succeeded fill_events_cache();
+  //! Forward and back projects a batch of events, accumulating in the images of \a gradients_for_threads
+  void add_events_to_gradient(OutputImagesForThreads<TargetT>& gradients_for_threads,
+                              const TargetT& current_estimate,
+                              const std::vector<Bin>& measured_bins) const;
 };
 
 END_NAMESPACE_STIR
@@ -208,6 +208,8 @@ public:
   void set_proj_data_sptr(const shared_ptr<ProjData>&);
   void set_max_segment_num_to_process(const int);
   void set_zero_seg0_end_planes(const bool);
+  //! set the maximum number of images used by the threads (see setup_distributable_computation())
+  void set_max_num_images_for_threads(const int);
   //N.E. Changed to ExamData
   virtual void set_additive_proj_data_sptr(const shared_ptr<ExamData>&);
   void set_projector_pair_sptr(const shared_ptr<ProjectorByBinPair>&) ;
@@ -235,6 +237,13 @@ public:
   virtual Succeeded 
     set_up_before_sensitivity(shared_ptr <TargetT > const& target_sptr);
 
+  //! Describes projection data geometry, normalisation, projectors, subsets and image geometry
+  /*! Returns an empty string (disabling the sensitivity cache) if the normalisation
+      or the target cannot be described.
+  */
+  virtual std::string
+    get_sensitivity_cache_description(const TargetT& target);
+
   virtual double
     actual_compute_objective_function_without_penalty(const TargetT& current_estimate,
                                                       const int subset_num);
@@ -315,6 +324,10 @@ protected:
   //! signals whether to zero the data in the end planes of the projection data
   bool zero_seg0_end_planes;
 
+  //! maximum number of images used to accumulate the gradient when using multiple threads
+  /*! See setup_distributable_computation(). 0 means one image per thread. */
+  int max_num_images_for_threads;
+
   //! name of file in which additive projection data are stored
   std::string additive_projection_data_filename;
 
@@ -34,13 +34,14 @@
 #include "stir/RegisteredObject.h"
 #include "stir/ParsingObject.h"
 #include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.h"
 #include "stir/recon_buildblock/DataSymmetriesForBins.h"
 #include "stir/shared_ptr.h"
+#include "stir/unique_ptr.h"
 #include "stir/VectorWithOffset.h"
 #include "stir/TimedObject.h"
 #include <boost/cstdint.hpp>
-//#include <map>
-#include <boost/unordered_map.hpp>
+#include <vector>
 #ifdef STIR_OPENMP
 #include <omp.h>
 #endif
@@ -80,10 +81,38 @@ class Bin;
   \verbatim
   disable caching := false
   store only basic bins in cache := true
+  maximum cache size in MB := 0
   \endverbatim
   The 2nd option allows to cache the whole matrix. This results in the fastest
   behaviour IF your system does not start swapping. The default choice caches 
   only the 'basic' bins, and computes symmetry related bins from the 'basic' ones.
+
+  The maximum cache size limits the memory used by the cache (0 means no limit).
+  When the limit is reached, new rows are no longer stored in the cache, but existing
+  rows are kept. Iterative algorithms access the matrix in the same (subset) order
+  in every iteration. Therefore, evicting the least recently used rows would
+  remove precisely the rows that are needed next, such that the cache would
+  never be used. Keeping the first rows instead means that a fraction
+  (maximum size/full size) of all rows is found in the cache. It also means
+  that rows are never removed while other threads use them.
+
+  If the image passed to set_up() has a regular index range, every cached row
+  is also stored with linear offsets in that image (see ProjMatrixElemsForOneBinWithOffsets),
+  such that projectors do not need to convert the row for every projection.
+  These are included in the cache size, and need roughly as much memory as the row itself.
+
+  The number of cache hits, misses and of rows that were not stored due to the
+  size limit are counted. They are reported by report_cache_statistics(), which is
+  called by the destructor.
+
+  \par Multi-threading
+
+  The cache is organised as a table indexed by view, segment, axial and tangential
+  position. Rows of the table are allocated when the first bin in the row is stored.
+  Looking up a bin in the cache does not need any locks (pointers in the table are
+  read and written with OpenMP atomics). Storing a bin only locks the relevant
+  (view,segment) part of the cache, and only to insert a pointer, i.e. the matrix
+  elements are computed and copied outside of the lock.
 */
 class ProjMatrixByBin :  
   public RegisteredObject<ProjMatrixByBin>,  
@@ -92,7 +121,7 @@ class ProjMatrixByBin :
 {
 public:
   
-  virtual ~ProjMatrixByBin() {}
+  virtual ~ProjMatrixByBin();
 
   //! To be called before any calculation is performed
   /*! Note that get_proj_matrix_elems_for_one_bin() will expect objects of
@@ -123,6 +152,39 @@ public:
     get_proj_matrix_elems_for_one_bin(
        ProjMatrixElemsForOneBin&,
        const Bin&) STIR_MUTABLE_CONST;
+
+  //! Get a row of the matrix, avoiding a copy if it is in the cache
+  /*! If the row for \a bin is stored in the cache, a reference to the cached
+      data is returned. Otherwise, the row is computed in \a tmp (as
+      get_proj_matrix_elems_for_one_bin()) and a reference to \a tmp is returned.
+
+      This is faster than get_proj_matrix_elems_for_one_bin() when the whole
+      matrix is cached, or for 'basic' bins.
+
+      \warning The returned reference is only valid until the next call to
+      clear_cache() or set_up() (or until \a tmp is modified).
+  */
+  inline const ProjMatrixElemsForOneBin&
+    get_proj_matrix_elems_for_one_bin_ref(
+       ProjMatrixElemsForOneBin& tmp,
+       const Bin&) STIR_MUTABLE_CONST;
+
+  //! Get a row of the matrix as above, and its version with linear offsets if it is in the cache
+  /*! \a elems_with_offsets_ptr is set to the cached row with offsets for the image
+      range given to set_up() if the row is in the cache, and to 0 otherwise.
+      Use cache_stores_elems_with_offsets_for() to check if the offsets can be used for an image.
+
+      \warning The same validity rules as above apply to the returned pointer.
+  */
+  inline const ProjMatrixElemsForOneBin&
+    get_proj_matrix_elems_for_one_bin_ref(
+       ProjMatrixElemsForOneBin& tmp,
+       const ProjMatrixElemsForOneBinWithOffsets*& elems_with_offsets_ptr,
+       const Bin&) STIR_MUTABLE_CONST;
+
+  //! Check if the cache stores rows with linear offsets for an image with this index range
+  bool cache_stores_elems_with_offsets_for(const BasicCoordinate<3,int>& min_indices,
+                                           const BasicCoordinate<3,int>& max_indices) const;
   
 #if 0
   // TODO
@@ -140,7 +202,12 @@ public:
   const char * const file_name_without_extension);
   */
   
-  //void set_maximum_cache_size(const unsigned long size){;}        
+  //! Set the maximum size of the cache (in bytes). 0 means no limit.
+  void set_maximum_cache_size(const std::size_t size);
+  //! Get the maximum size of the cache (in bytes). 0 means no limit.
+  std::size_t get_maximum_cache_size() const;
+  //! Get an estimate of the memory (in bytes) currently used by the cache
+  std::size_t get_cache_size() const;
   /* TODO
   void set_subset_usage(const SubsetInfo&, const int num_access_times);
   */
@@ -152,8 +219,22 @@ public:
 
   // void reserve_num_elements_in_cache(const std::size_t);
   //! Remove all elements from the cache
+  /*! \warning This cannot be called while other threads are accessing the cache. */
   void clear_cache() STIR_MUTABLE_CONST;
 
+  //! \name Statistics on the use of the cache
+  /*! A lookup in the cache is either a hit or a miss. When the cache stores all bins,
+      a miss is followed by a lookup of the basic bin.
+  */
+  //@{
+  unsigned long get_num_cache_hits() const;
+  unsigned long get_num_cache_misses() const;
+  //! number of rows that were not stored as the cache was full
+  unsigned long get_num_cache_rejections() const;
+  void reset_cache_statistics();
+  //! write statistics to the screen (via info())
+  void report_cache_statistics() const;
+  //@}
   
 protected:
   shared_ptr<DataSymmetriesForBins> symmetries_sptr;
@@ -192,6 +273,8 @@ protected:
 
   bool cache_disabled;  
   bool cache_stores_only_basic_bins;
+  //! maximum cache size in MB (0 means no limit), used for parsing
+  double max_cache_size_in_MB;
 
   /*! \brief The method that tries to get data from the cache.
   
@@ -204,35 +287,100 @@ protected:
                  ) const;		
   
   //! The method to store data in the cache.
-  void  cache_proj_matrix_elems_for_one_bin( const ProjMatrixElemsForOneBin&)
+  /*! Returns a pointer to the data in the cache (which might have been stored
+      by another thread already), or 0 if the data could not be stored
+      (e.g. when the cache is disabled).
+  */
+  const ProjMatrixElemsForOneBin*
+    cache_proj_matrix_elems_for_one_bin( const ProjMatrixElemsForOneBin&)
     STIR_MUTABLE_CONST;
 
 private:
+
+  //! element of the cache: a row of the matrix, and the same row with linear offsets
+  struct CacheEntry
+  {
+    explicit CacheEntry(const ProjMatrixElemsForOneBin& elems)
+      : elems(elems)
+    {}
+    ProjMatrixElemsForOneBin elems;
+    //! 0 if the image passed to set_up() does not have a regular range
+    unique_ptr<ProjMatrixElemsForOneBinWithOffsets> elems_with_offsets_ptr;
+  };
   
-  typedef boost::uint32_t CacheKey;
+  //! row of the cache, indexed by tangential_pos_num
+  /*! Entries are 0 until the corresponding bin is stored. They are owned by the cache. */
+  typedef VectorWithOffset<CacheEntry *> CacheRow;
 
-	//  typedef std::map<CacheKey, ProjMatrixElemsForOneBin>   MapProjMatrixElemsForOneBin;
-  typedef boost::unordered_map<CacheKey, ProjMatrixElemsForOneBin>   MapProjMatrixElemsForOneBin;
-  typedef MapProjMatrixElemsForOneBin::iterator MapProjMatrixElemsForOneBinIterator;
-  typedef MapProjMatrixElemsForOneBin::const_iterator const_MapProjMatrixElemsForOneBinIterator;
- 
-  //! collection of  ProjMatrixElemsForOneBin (internal cache )   
+  //! collection of ProjMatrixElemsForOneBin (internal cache), indexed by [view][segment][axial_pos]
+  /*! Rows are allocated when the first element is stored. */
 #ifndef STIR_NO_MUTABLE
   mutable
 #endif
-    VectorWithOffset<VectorWithOffset<MapProjMatrixElemsForOneBin> > cache_collection;
+    VectorWithOffset<VectorWithOffset<VectorWithOffset<CacheRow *> > > cache_collection;
 #ifdef STIR_OPENMP
 #ifndef STIR_NO_MUTABLE
   mutable
 #endif
   VectorWithOffset<VectorWithOffset<omp_lock_t> > cache_locks;
 #endif
+  int cache_min_tangential_pos_num, cache_max_tangential_pos_num;
+
+  //! true if the cache stores rows with offsets (see CacheEntry)
+  bool cache_stores_elems_with_offsets;
+  //! index range of the image for the offsets
+  BasicCoordinate<3,int> offsets_min_indices, offsets_max_indices;
+
+  //! current estimate of the memory used by the cache (in bytes)
+#ifndef STIR_NO_MUTABLE
+  mutable
+#endif
+  std::size_t cache_size;
+
+  //! counters for the use of the cache
+  /*! We keep these for every thread, to avoid threads writing to the same memory. */
+  struct CacheStatistics
+  {
+    CacheStatistics() : num_hits(0), num_misses(0), num_rejections(0) {}
+    unsigned long num_hits;
+    unsigned long num_misses;
+    unsigned long num_rejections;
+    //! avoid 2 threads using the same cache-line
+    char padding[64];
+  };
+#ifndef STIR_NO_MUTABLE
+  mutable
+#endif
+  std::vector<CacheStatistics> cache_statistics;
+
+  //! get the statistics for the current thread
+  inline CacheStatistics& get_cache_statistics_for_this_thread() const;
+
+  //! check if the bin falls in the range of the cache (as set by set_up())
+  inline bool is_in_cache_range(const Bin& bin) const;
+
+  //! get a pointer to the cached data for this bin, or 0 if it is not in the cache
+  /*! Does not use any locks. */
+  inline const CacheEntry*
+    find_in_cache(const Bin& bin) const;
+
+  //! get the elements for a basic bin, either from the cache or by computing them in \a probabilities
+  /*! Returns a pointer to the cached data, or 0 if the elements were computed in
+      \a probabilities but could not be stored in the cache. */
+  inline const CacheEntry*
+    get_basic_proj_matrix_elems_for_one_bin(ProjMatrixElemsForOneBin& probabilities,
+                                            const Bin& basic_bin) STIR_MUTABLE_CONST;
+
+  //! store data in the cache (see cache_proj_matrix_elems_for_one_bin())
+  const CacheEntry*
+    add_to_cache(const ProjMatrixElemsForOneBin&) STIR_MUTABLE_CONST;
 
-  //! create the key for caching
-  // KT 15/05/2002 not static anymore as it uses cache_stores_only_basic_bins
-  CacheKey cache_key(const Bin& bin) const;
+  //! delete all cached elements and the locks
+  void delete_cache();
 
-   
+  //! copying is not supported (the cache owns its elements and the locks), so these are not implemented
+  ProjMatrixByBin(const ProjMatrixByBin&);
+  ProjMatrixByBin& operator=(const ProjMatrixByBin&);
 };
 
 
@@ -46,69 +46,180 @@ ProjMatrixByBin:: get_symmetries_sptr() const
   return  symmetries_sptr;
 }
 
+bool
+ProjMatrixByBin::
+is_in_cache_range(const Bin& bin) const
+{
+  return
+    bin.view_num() >= cache_collection.get_min_index() &&
+    bin.view_num() <= cache_collection.get_max_index() &&
+    bin.segment_num() >= cache_collection[bin.view_num()].get_min_index() &&
+    bin.segment_num() <= cache_collection[bin.view_num()].get_max_index() &&
+    bin.axial_pos_num() >= cache_collection[bin.view_num()][bin.segment_num()].get_min_index() &&
+    bin.axial_pos_num() <= cache_collection[bin.view_num()][bin.segment_num()].get_max_index() &&
+    bin.tangential_pos_num() >= cache_min_tangential_pos_num &&
+    bin.tangential_pos_num() <= cache_max_tangential_pos_num;
+}
+
+ProjMatrixByBin::CacheStatistics&
+ProjMatrixByBin::
+get_cache_statistics_for_this_thread() const
+{
+#ifdef STIR_OPENMP
+  // note: use modulo in case the number of threads was increased after set_up()
+  return cache_statistics[omp_get_thread_num() % cache_statistics.size()];
+#else
+  return cache_statistics[0];
+#endif
+}
+
+const ProjMatrixByBin::CacheEntry*
+ProjMatrixByBin::
+find_in_cache(const Bin& bin) const
+{
+  if (cache_disabled || !is_in_cache_range(bin))
+    return 0;
+
+  CacheStatistics& statistics = get_cache_statistics_for_this_thread();
+
+  // Pointers are only written once (when the data is stored), so we can
+  // read them without a lock.
+  // See also ProjDataInfoCylindrical::initialise_ring_diff_arrays_if_not_done_yet()
+  const CacheRow * row_ptr;
+#if defined(STIR_OPENMP) &&  _OPENMP >=201012
+#pragma omp atomic read
+#endif
+  row_ptr = cache_collection[bin.view_num()][bin.segment_num()][bin.axial_pos_num()];
+  if (row_ptr == 0)
+    {
+#ifdef STIR_OPENMP
+#pragma omp atomic
+#endif
+      ++statistics.num_misses;
+      return 0;
+    }
+
+  const CacheEntry * elems_ptr;
+#if defined(STIR_OPENMP) &&  _OPENMP >=201012
+#pragma omp atomic read
+#endif
+  elems_ptr = (*row_ptr)[bin.tangential_pos_num()];
+  if (elems_ptr != 0)
+    {
+#ifdef STIR_OPENMP
+      // make sure we see the data that the pointer points to
+#pragma omp flush
+#pragma omp atomic
+#endif
+      ++statistics.num_hits;
+    }
+  else
+    {
+#ifdef STIR_OPENMP
+#pragma omp atomic
+#endif
+      ++statistics.num_misses;
+    }
+  return elems_ptr;
+}
+
+const ProjMatrixByBin::CacheEntry*
+ProjMatrixByBin::
+get_basic_proj_matrix_elems_for_one_bin(ProjMatrixElemsForOneBin& probabilities,
+                                        const Bin& basic_bin) STIR_MUTABLE_CONST
+{
+  // check if basic bin is in cache
+  const CacheEntry * cached_ptr = find_in_cache(basic_bin);
+  if (cached_ptr != 0)
+    return cached_ptr;
+
+  // call 'calculate' just for the basic bin
+  probabilities.erase();
+  probabilities.set_bin(basic_bin);
+  calculate_proj_matrix_elems_for_one_bin(probabilities);
+#ifndef NDEBUG
+  probabilities.check_state();
+#endif
+  return add_to_cache(probabilities);
+}
+
 inline void 
 ProjMatrixByBin::
 get_proj_matrix_elems_for_one_bin(
                                   ProjMatrixElemsForOneBin& probabilities,
                                   const Bin& bin) STIR_MUTABLE_CONST
 {  
-  // start_timers(); TODO, can't do this in a const member
-
-  // set to empty
-  probabilities.erase();
-  
-  if (cache_stores_only_basic_bins)
+  if (!cache_stores_only_basic_bins)
   {
-    // find basic bin
-    Bin basic_bin = bin;    
-    unique_ptr<SymmetryOperation> symm_ptr = 
-      symmetries_sptr->find_symmetry_operation_from_basic_bin(basic_bin);
-    
-    probabilities.set_bin(basic_bin);
-    // check if basic bin is in cache  
-    if (get_cached_proj_matrix_elems_for_one_bin(probabilities) ==
-      Succeeded::no)
+    // check if in cache  
+    const CacheEntry * cached_ptr = find_in_cache(bin);
+    if (cached_ptr != 0)
     {
-      // call 'calculate' just for the basic bin
-      calculate_proj_matrix_elems_for_one_bin(probabilities);
-#ifndef NDEBUG
-      probabilities.check_state();
-#endif
-      cache_proj_matrix_elems_for_one_bin(probabilities);		
+      probabilities = cached_ptr->elems;
+      return;
     }
-    
-    // now transform to original bin
-    symm_ptr->transform_proj_matrix_elems_for_one_bin(probabilities);  
   }
-  else // !cache_stores_only_basic_bins
+
+  // find basic bin
+  Bin basic_bin = bin;    
+  unique_ptr<SymmetryOperation> symm_ptr = 
+    symmetries_sptr->find_symmetry_operation_from_basic_bin(basic_bin);
+
+  const CacheEntry * basic_ptr =
+    get_basic_proj_matrix_elems_for_one_bin(probabilities, basic_bin);
+  if (basic_ptr != 0)
+    probabilities = basic_ptr->elems;
+    
+  // now transform to original bin
+  symm_ptr->transform_proj_matrix_elems_for_one_bin(probabilities);  
+
+  if (!cache_stores_only_basic_bins && !symm_ptr->is_trivial())
+    cache_proj_matrix_elems_for_one_bin(probabilities);      
+}
+
+inline const ProjMatrixElemsForOneBin&
+ProjMatrixByBin::
+get_proj_matrix_elems_for_one_bin_ref(
+                                      ProjMatrixElemsForOneBin& tmp,
+                                      const Bin& bin) STIR_MUTABLE_CONST
+{
+  const ProjMatrixElemsForOneBinWithOffsets * elems_with_offsets_ptr;
+  return get_proj_matrix_elems_for_one_bin_ref(tmp, elems_with_offsets_ptr, bin);
+}
+
+inline const ProjMatrixElemsForOneBin&
+ProjMatrixByBin::
+get_proj_matrix_elems_for_one_bin_ref(
+                                      ProjMatrixElemsForOneBin& tmp,
+                                      const ProjMatrixElemsForOneBinWithOffsets*& elems_with_offsets_ptr,
+                                      const Bin& bin) STIR_MUTABLE_CONST
+{
+  const CacheEntry * cached_ptr = 0;
+  if (!cache_stores_only_basic_bins)
+    cached_ptr = find_in_cache(bin);
+  else
   {
-    probabilities.set_bin(bin);
-    // check if in cache  
-    if (get_cached_proj_matrix_elems_for_one_bin(probabilities) ==
-      Succeeded::no)
+    Bin basic_bin = bin;
+    unique_ptr<SymmetryOperation> symm_ptr = 
+      symmetries_sptr->find_symmetry_operation_from_basic_bin(basic_bin);
+    if (symm_ptr->is_trivial())
     {
-      // find basic bin
-      Bin basic_bin = bin;  
-      unique_ptr<SymmetryOperation> symm_ptr = 
-        symmetries_sptr->find_symmetry_operation_from_basic_bin(basic_bin);
-
-      probabilities.set_bin(basic_bin);
-      // check if basic bin is in cache
-      if (get_cached_proj_matrix_elems_for_one_bin(probabilities) ==
-        Succeeded::no)
+      cached_ptr = get_basic_proj_matrix_elems_for_one_bin(tmp, basic_bin);
+      if (cached_ptr == 0)
       {
-        // call 'calculate' just for the basic bin
-        calculate_proj_matrix_elems_for_one_bin(probabilities);
-#ifndef NDEBUG
-        probabilities.check_state();
-#endif
-        cache_proj_matrix_elems_for_one_bin(probabilities);
+        elems_with_offsets_ptr = 0;
+        return tmp;
       }
-      symm_ptr->transform_proj_matrix_elems_for_one_bin(probabilities);
-      cache_proj_matrix_elems_for_one_bin(probabilities);      
     }
-  }  
-  // stop_timers(); TODO, can't do this in a const member
+  }
+  if (cached_ptr != 0)
+  {
+    elems_with_offsets_ptr = cached_ptr->elems_with_offsets_ptr.get();
+    return cached_ptr->elems;
+  }
+  elems_with_offsets_ptr = 0;
+  get_proj_matrix_elems_for_one_bin(tmp, bin);
+  return tmp;
 }
 
 END_NAMESPACE_STIR
@@ -34,7 +34,12 @@
 #include "stir/CartesianCoordinate3D.h"
 #include "stir/IndexRange.h"
 #include "stir/shared_ptr.h"
+#include "stir/Bin.h"
+#include "boost/cstdint.hpp"
 #include <iostream>
+#include <vector>
+
+namespace boost { namespace interprocess { class mapped_region; } }
 
  
 
@@ -46,10 +51,36 @@ class Bin;
   \ingroup projection
   \brief Reads/writes a projection matrix from/to file
 
-  The only supported file format consists of an Interfile-type header
+  The file format consists of an Interfile-type header
   and a binary file which stores the 'basic' elements in a sparse form, 
   i.e. only the elements that cannot by constructed via symmetries.
 
+  There are 2 versions of the binary file (the version is given in the header):
+  - Version 1.0 stores for every bin its coordinates and the number of elements,
+    followed by <tt>short c3,c2,c1; float value</tt> for every element.
+    The whole file is read into the cache during set_up(), so the cache has to be
+    enabled (without size limit).
+  - Version 2.0 is compressed and indexed. Voxel coordinates of consecutive elements
+    are stored as differences (using a variable number of bytes). Values are stored
+    as 16-bit floating point numbers (after scaling with the largest value of the bin),
+    unless this leads to a relative error larger than the one specified when writing
+    the file. An index at the end of the file gives the location of every bin, such
+    that a single bin can be read directly. The file is memory-mapped (if possible).
+    By default, bins are then read when needed (i.e. when they are not in the cache).
+    Alternatively, all bins can be read (in parallel) during set_up().
+
+  The version 2.0 binary file consists of
+  - a header: 8 characters \c "STIRPM2", <tt>uint32 1</tt> (to check byte order),
+    <tt>uint32</tt> (reserved), <tt>uint64</tt> offset of the index, <tt>uint64</tt> number of bins
+  - the data for every bin: the values of all elements (<tt>uint16</tt> or \c float), followed by
+    3 zigzag-encoded variable-length integers for every element with the differences of its
+    coordinates (\c c1,c2,c3) with the previous element
+  - the index, sorted by bin: for every bin <tt>int32 segment,view,axial_pos,tangential_pos</tt>,
+    <tt>uint64</tt> offset of the data, <tt>uint32</tt> number of elements, <tt>uint32</tt> encoding
+    (0 for \c float values, 1 for 16-bit values) and <tt>float</tt> scale factor.
+
+  All numbers are stored in the native byte order.
+
   \todo this class currently only works with VoxelsOnCartesianGrid. 
   To fix this, we would need a DiscretisedDensityInfo class, and be able
   to have constructed the appropriate symmetries object by parsing the
@@ -58,7 +89,7 @@ class Bin;
   \par Example .par file
   \verbatim
     ProjMatrixByBinFromFile Parameters:=
-      Version := 1.0
+      Version := 2.0
       symmetries type := PET_CartesianGrid
         PET_CartesianGrid symmetries parameters:=
 	  do_symmetry_90degrees_min_phi:= <bool>
@@ -73,6 +104,9 @@ class Bin;
       template density filename:= <filename>
       ; binary data with projection matrix elements
       data_filename:=<filename> 
+      ; only for version 2.0: read all data during set_up (in parallel when using OpenMP)
+      ; default is to read bins when needed
+      preload all data := 0
      End ProjMatrixByBinFromFile Parameters:=
   \endverbatim
 */
@@ -92,12 +126,19 @@ public :
   /*! Currently this will write an interfile-type header, a file with the binary data,
       a template image and template sinogram. You will need all 4 to be able to read the
       matrix back in.
+
+      \param format_version has to be 1 or 2 (see the class documentation)
+      \param max_relative_quantisation_error (only for version 2) values of a bin are stored
+      with 16 bits if the relative error of every element is less than this number.
+      Use 0 to always use \c float.
   */
 static Succeeded
   write_to_file(const std::string& output_filename_prefix, 
 		const ProjMatrixByBin& proj_matrix,
 		const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
-		const DiscretisedDensity<3,float>& template_density);
+		const DiscretisedDensity<3,float>& template_density,
+		const int format_version = 2,
+		const float max_relative_quantisation_error = 1.E-3F);
  
   //! Default constructor (calls set_defaults())
   ProjMatrixByBinFromFile();
@@ -114,6 +155,7 @@ private:
   std::string template_density_filename;
   std::string template_proj_data_filename;
   std::string data_filename;
+  bool preload_all_data;
   
   std::string symmetries_type;
   // should be in symmetries
@@ -142,7 +184,35 @@ private:
   virtual bool post_processing();
 
   Succeeded read_data();
-    
+
+  //! \name members for version 2.0
+  //@{
+  //! entry in the index of the file
+  struct IndexEntry
+  {
+    Bin bin;
+    boost::uint64_t offset;
+    boost::uint32_t num_elements;
+    boost::uint32_t encoding;
+    float scale;
+    //! order by bin (ignoring its value)
+    bool operator<(const IndexEntry&) const;
+  };
+  //! index, sorted by bin
+  std::vector<IndexEntry> index;
+  //! memory-mapped data file
+  shared_ptr<boost::interprocess::mapped_region> mapped_region_sptr;
+  //! data of the file, only used if memory-mapping failed
+  std::vector<char> data_buffer;
+  const char * data_ptr;
+  std::size_t data_size;
+
+  Succeeded read_index();
+  //! find the entry for the bin (ignoring its value) in the index, returns 0 if not found
+  const IndexEntry* find_in_index(const Bin& bin) const;
+  //! read the elements for a bin from the mapped file
+  Succeeded decode_bin(ProjMatrixElemsForOneBin& lor, const IndexEntry& entry) const;
+  //@}
 };
 
 END_NAMESPACE_STIR
@@ -193,8 +193,10 @@ public:
                     const Bin&) const;
 
   //! forward project into a single bin
+  /*! \see ProjMatrixElemsForOneBinWithOffsets for faster projections into a contiguous image */
   void forward_project(Bin&,
                       const DiscretisedDensity<3,float>&) const;
+
  //! back project related bins
   void back_project(DiscretisedDensity<3,float>&,
                     const RelatedBins&) const; 
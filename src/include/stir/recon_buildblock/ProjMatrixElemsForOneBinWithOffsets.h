@@ -0,0 +1,114 @@
+//
+//
+
+#ifndef __stir_recon_buildblock_ProjMatrixElemsForOneBinWithOffsets__
+#define __stir_recon_buildblock_ProjMatrixElemsForOneBinWithOffsets__
+
+/*!
+
+  \file
+  \ingroup projection
+
+  \brief Declaration of class stir::ProjMatrixElemsForOneBinWithOffsets
+
+*/
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/BasicCoordinate.h"
+#include <vector>
+
+START_NAMESPACE_STIR
+
+class Bin;
+class ProjMatrixElemsForOneBin;
+
+/*!
+  \ingroup projection
+  \brief Structure-of-arrays storage of a ProjMatrixElemsForOneBin for a given image
+
+  ProjMatrixElemsForOneBin stores every element as its voxel coordinates and
+  value. This class stores the elements of a row as 2 separate arrays: the
+  linear offsets of the voxels in a contiguous image with a regular index range,
+  and the corresponding values. Elements outside the z-range of the image are
+  dropped (as in ProjMatrixElemsForOneBin::forward_project()).
+
+  forward_project() and back_project() are then simple loops over contiguous
+  arrays without any branches or look-ups of image rows, such that the compiler
+  can vectorise them (using gather/scatter instructions if the target supports these).
+  The back projection gives identical results to ProjMatrixElemsForOneBin::back_project().
+  The forward projection does as well, unless the compiler is allowed to reorder
+  floating point operations (e.g. with \c -ffast-math), as it then can vectorise the sum.
+
+  As the offsets depend on the image, ProjMatrixByBin stores these objects in its cache
+  for the index range of the image passed to ProjMatrixByBin::set_up()
+  (see ProjMatrixByBin::get_proj_matrix_elems_for_one_bin_ref()). Converting a row
+  is only worth it if it is used more than once.
+  Otherwise, a caller can use one object per thread, and call set_elements()
+  for every row. Memory is then only allocated when a row is larger than all previous
+  ones.
+  \code
+  BasicCoordinate<3,int> min_indices, max_indices;
+  if (density.is_contiguous() && density.get_regular_range(min_indices, max_indices))
+    {
+      ProjMatrixElemsForOneBinWithOffsets row_with_offsets(min_indices, max_indices);
+      row_with_offsets.set_elements(row);
+      row_with_offsets.forward_project(bin, density.get_const_full_data_ptr());
+    }
+  \endcode
+*/
+class ProjMatrixElemsForOneBinWithOffsets
+{
+public:
+  //! constructor, specifying the index range of the image
+  /*! Calls error() if the image has more voxels than can be stored in an \c int. */
+  ProjMatrixElemsForOneBinWithOffsets(const BasicCoordinate<3,int>& min_indices,
+                                      const BasicCoordinate<3,int>& max_indices);
+
+  //! set the offsets and values from the elements of a row
+  void set_elements(const ProjMatrixElemsForOneBin& row);
+
+  //! number of stored elements
+  inline std::size_t size() const;
+
+  //! back project a single bin into the image data
+  /*! \a data_ptr has to point to the first element of a contiguous image with
+      the index range given in the constructor. */
+  inline void back_project(float * const data_ptr, const Bin&) const;
+
+  //! forward project the image data into a single bin
+  /*! \see back_project() */
+  inline void forward_project(Bin&, const float * const data_ptr) const;
+
+private:
+  int min_z, max_z;
+  int min_y, min_x;
+  int num_y, num_x;
+
+  //! linear offsets of the voxels w.r.t. the first element of the image
+  std::vector<int> offsets;
+  //! values of the elements
+  std::vector<float> values;
+  //! number of elements used in \c offsets and \c values
+  /*! The vectors are not resized to avoid initialising their elements for every row. */
+  std::size_t num_elements;
+};
+
+END_NAMESPACE_STIR
+
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.inl"
+
+#endif
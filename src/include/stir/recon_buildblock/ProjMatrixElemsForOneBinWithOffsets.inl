@@ -0,0 +1,77 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+
+  \brief Inline implementations for class stir::ProjMatrixElemsForOneBinWithOffsets
+
+*/
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/Bin.h"
+
+START_NAMESPACE_STIR
+
+std::size_t
+ProjMatrixElemsForOneBinWithOffsets::
+size() const
+{
+  return num_elements;
+}
+
+/*
+  Implementation note: the loops use plain pointers and a local count, such that
+  the compiler knows that nothing else changes during the loop.
+  Different elements of a row have different coordinates (see
+  ProjMatrixElemsForOneBin::check_state()), so the stores in back_project()
+  never go to the same voxel.
+*/
+void
+ProjMatrixElemsForOneBinWithOffsets::
+back_project(float * const data_ptr, const Bin& single) const
+{
+  const float data = single.get_bin_value();
+  if (data == 0)
+    return;
+
+  const int num = static_cast<int>(num_elements);
+  if (num == 0)
+    return;
+  const int * const offsets_ptr = &offsets[0];
+  const float * const values_ptr = &values[0];
+  for (int i=0; i<num; ++i)
+    data_ptr[offsets_ptr[i]] += values_ptr[i] * data;
+}
+
+void
+ProjMatrixElemsForOneBinWithOffsets::
+forward_project(Bin& single, const float * const data_ptr) const
+{
+  const int num = static_cast<int>(num_elements);
+  if (num == 0)
+    return;
+  const int * const offsets_ptr = &offsets[0];
+  const float * const values_ptr = &values[0];
+  float sum = 0.F;
+  for (int i=0; i<num; ++i)
+    sum += data_ptr[offsets_ptr[i]] * values_ptr[i];
+  single += sum;
+}
+
+END_NAMESPACE_STIR
@@ -62,9 +62,21 @@ const int task_do_distributable_sensitivity_computation=44;
 //! set-up parameters before calling distributable_computation()
 /*!
     \ingroup distributable
-    Empty unless STIR_MPI is defined, in which case it sends parameters to the 
+    If STIR_MPI is defined, it sends parameters to the 
     slaves (see stir::DistributedWorker).
 
+    When using OpenMP, \a max_num_output_images sets the maximum number of images
+    that distributable_computation() uses to accumulate the output image. By default,
+    each thread back projects into its own image, and these are added at the end
+    (in parallel). This needs (number of threads - 1) extra copies of the image
+    (one thread uses the output image itself). If this is too much memory, the number
+    of images can be limited. Threads then share the images, but each image is used
+    by only one thread at a time. Threads might therefore have to wait for each other,
+    so the computation will be slower. A value of 1 uses only the output image (i.e.
+    no extra memory), but then the computation effectively runs sequentially.
+    A value of 0 (the default) uses one image per thread.
+    This parameter is ignored when not using OpenMP.
+
     \todo currently uses some global variables for configuration in the distributed
     namespace. This needs to be converted to a class, e.g. \c DistributedMaster
 */
@@ -74,7 +86,8 @@ void setup_distributable_computation(
                                      const ProjDataInfo * const proj_data_info_ptr,
                                      const shared_ptr<DiscretisedDensity<3,float> >& target_sptr,
                                      const bool zero_seg0_end_planes,
-                                     const bool distributed_cache_enabled);
+                                     const bool distributed_cache_enabled,
+                                     const int max_num_output_images = 0);
 
 //! clean-up after a sequence of computations
 /*! \ingroup distributable
@@ -113,6 +126,12 @@ typedef  void RPC_process_related_viewgrams_type (
 
   If STIR_MPI is defined, this function distributes the computation over the slaves.
 
+  When using OpenMP (version 3.0 or later), one thread reads the data (in order) and creates
+  a task for every set of related viewgrams, which is executed by one of the other threads.
+  Reading the data therefore overlaps with the computation. At most twice the number
+  of threads tasks are waiting to be executed. When this limit is reached, the reading thread
+  processes the data itself. Timing information on reading and processing is written via info().
+
   Subsets are currently defined on views. A particular \a subset_num contains all views  which are symmetry related to 
   \code 
   proj_data_ptr->min_view_num()+subset_num + n*num_subsets
@@ -104,6 +104,9 @@ class ScatterEstimationByBin : public ParsingObject
     4. apply thresholds
     5. filter scale-factors in axial direction (independently for every segment)
     6. apply scale factors using scale_sinograms()
+
+    Steps 2-6 are done one segment at a time (in parallel over sinograms or viewgrams when using
+    OpenMP), such that only the interpolated segment 0 and the current segment are kept in memory.
   */
  static void
    upsample_and_fit_scatter_estimate(ProjData& scaled_scatter_proj_data,
@@ -123,6 +126,8 @@ class ScatterEstimationByBin : public ParsingObject
 
   /*! \name functions to (re)set images or projection data
       These functions also invalidate cached activity integrals such that the cache will be recomputed.
+      (If \a use_incremental_activity_integrals is on, set_activity_image_sptr() only invalidates
+      the integrals that are affected by the change in the activity image.)
 
       The functions that read a file call error() if the reading failed.
   */
@@ -183,9 +188,31 @@ class ScatterEstimationByBin : public ParsingObject
   //! boolean to see if we need to cache the integrals
   /*! By default, we cache the integrals over the emission and attenuation image. If you run out
       of memory, you can switch this off, but performance will suffer dramatically.
+
+      The cache contains the integrals for all scatter points and detectors. It is filled
+      (in parallel when using OpenMP) by process_data() before the scatter estimate is computed.
   */
   bool use_cache;
 
+  //! boolean to see if activity integrals are only recomputed when the activity image changed
+  /*! When this is on (and \a use_cache is on as well), set_activity_image_sptr() compares the new
+      activity image with the one used for the cached integrals. Only the cached integrals
+      whose line between scatter point and detector crosses (or is close to) a voxel that changed
+      by more than \a activity_change_tolerance are recomputed. The cached integrals over the attenuation
+      image are kept as well. This is useful when the scatter estimate is recomputed with activity images from
+      successive iterations of a reconstruction, which often change very little.
+
+      Voxels that changed by less than the tolerance are not updated in the image used for the comparison,
+      such that small changes over several iterations are taken into account once they exceed the tolerance.
+      Of course, this means that the scatter estimate is only an approximation to the one computed without
+      this option.
+
+      The number of reused integrals is reported via info().
+  */
+  bool use_incremental_activity_integrals;
+  //! tolerance used for \a use_incremental_activity_integrals (relative to the maximum of the activity image)
+  float activity_change_tolerance;
+
   //! \name Parameters determining the energy detection efficiency of the scanner
   //@{
   //! reference energy used when specifying the energy resolution of the detectors (in units of keV)
@@ -257,8 +284,12 @@ class ScatterEstimationByBin : public ParsingObject
     void
     find_detectors(unsigned& det_num_A, unsigned& det_num_B, const Bin& bin) const; 
 
-  unsigned 
-    find_in_detection_points_vector(const CartesianCoordinate3D<float>& coord) const;
+  //! sets \c detection_points_vector for all detectors of the scanner
+  /*! The detector number used as index is <code>ring_num*num_detectors_per_ring + det_num</code>.
+      Uses \c shift_detector_coordinates_to_origin, so this has to be set first.
+  */
+  void
+    initialise_detection_points_vector();
   // private:
   const ProjDataInfoCylindricalNoArcCorr * proj_data_info_ptr;
   CartesianCoordinate3D<float>  shift_detector_coordinates_to_origin;
@@ -268,8 +299,7 @@ class ScatterEstimationByBin : public ParsingObject
     detection_efficiency_no_scatter(const unsigned det_num_A, 
 				    const unsigned det_num_B) const;
 
-  // next needs to be mutable because find_in_detection_points_vector is const
-  mutable std::vector<CartesianCoordinate3D<float> > detection_points_vector;
+  std::vector<CartesianCoordinate3D<float> > detection_points_vector;
  private:
   int total_detectors;
 
@@ -377,6 +407,12 @@ class ScatterEstimationByBin : public ParsingObject
  private:
   Array<2,float> cached_activity_integral_scattpoint_det;
   Array<2,float> cached_attenuation_integral_scattpoint_det;
+  //! activity image corresponding to the cached integrals (only used for \a use_incremental_activity_integrals)
+  shared_ptr<DiscretisedDensity<3,float> > activity_image_for_cache_sptr;
+
+  //! remove the cached activity integrals that are affected by the changes in the activity image
+  /*! Compares \c activity_image_sptr with \c activity_image_for_cache_sptr and updates the latter. */
+  void remove_cache_for_integrals_over_activity_through_changed_voxels();
 
 
   //! set-up cache for attenuation integrals
@@ -389,6 +425,12 @@ class ScatterEstimationByBin : public ParsingObject
       call remove_cache_for_scattpoint_det_integrals_over_activity() first. 
   */
   void initialise_cache_for_scattpoint_det_integrals_over_activity();
+  //! compute all attenuation integrals that are not in the cache yet
+  /*! Has to be called after initialise_cache_for_scattpoint_det_integrals_over_attenuation() */
+  void fill_cache_for_scattpoint_det_integrals_over_attenuation();
+  //! compute all activity integrals that are not in the cache yet
+  /*! Has to be called after initialise_cache_for_scattpoint_det_integrals_over_activity() */
+  void fill_cache_for_scattpoint_det_integrals_over_activity();
 };
 
 
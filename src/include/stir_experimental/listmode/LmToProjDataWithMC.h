@@ -39,6 +39,8 @@ public:
   LmToProjDataWithMC(const char * const par_filename);
 
   virtual void get_bin_from_event(Bin& bin, const CListEvent&) const;
+  //! returns \c false, as the motion object might not be thread-safe
+  virtual bool get_bin_from_event_is_thread_safe() const;
   virtual void process_new_time_event(const CListTime& time_event);
 
 protected: 
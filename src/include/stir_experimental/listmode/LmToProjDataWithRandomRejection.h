@@ -92,6 +92,8 @@ protected:
   virtual void start_new_time_frame(const unsigned int new_frame_num);
 
   virtual void get_bin_from_event(Bin& bin, const CListEvent&) const;
+  //! returns \c false, as get_bin_from_event() uses a random number generator
+  virtual bool get_bin_from_event_is_thread_safe() const;
 
 
   // \name parsing variables
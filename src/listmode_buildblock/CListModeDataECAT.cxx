@@ -182,14 +182,18 @@ open_lm_file(unsigned int new_lm_file) const
       sprintf(rest, "_%d.lm", new_lm_file);
       filename += rest;
       info(boost::format("CListModeDataECAT: opening file %1%") % filename);
-      shared_ptr<istream> stream_ptr(new fstream(filename.c_str(), ios::in | ios::binary));
-      if (!(*stream_ptr))
       {
-	warning("CListModeDataECAT: cannot open file %s (probably this is perfectly ok)\n ", filename.c_str());
-        return Succeeded::no;
+        // check first if we can open the file at all
+        ifstream stream(filename.c_str(), ios::in | ios::binary);
+        if (!stream)
+        {
+	  warning("CListModeDataECAT: cannot open file %s (probably this is perfectly ok)\n ", filename.c_str());
+          return Succeeded::no;
+        }
       }
+      // this will memory-map the file
       current_lm_data_ptr.reset(
-	new InputStreamWithRecords<CListRecordT, bool>(stream_ptr, 
+	new InputStreamWithRecords<CListRecordT, bool>(filename, 
                                                        sizeof(CListTimeDataECAT966), 
                                                        sizeof(CListTimeDataECAT966), 
                                                        ByteOrder::big_endian != ByteOrder::get_native_order()));
@@ -88,14 +88,18 @@ open_lm_file()
 	filename = std::string(full_data_file_name);
 
 	info(boost::format("CListModeDataECAT8_32bit: opening file %1%") % filename);
-  shared_ptr<std::istream> stream_ptr(new std::fstream(filename.c_str(), std::ios::in | std::ios::binary));
-  if (!(*stream_ptr))
-    {
-      warning("CListModeDataECAT8_32bit: cannot open file '%s'", filename.c_str());
-      return Succeeded::no;
-    }
+  {
+    // check first if we can open the file at all
+    std::ifstream stream(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!stream)
+      {
+        warning("CListModeDataECAT8_32bit: cannot open file '%s'", filename.c_str());
+        return Succeeded::no;
+      }
+  }
+  // this will memory-map the file
   current_lm_data_ptr.reset(
-                            new InputStreamWithRecords<CListRecordT, bool>(stream_ptr,  4, 4,
+                            new InputStreamWithRecords<CListRecordT, bool>(filename,  4, 4,
                                                                            ByteOrder::little_endian != ByteOrder::get_native_order()));
 
   return Succeeded::yes;
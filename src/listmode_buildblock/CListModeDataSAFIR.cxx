@@ -105,18 +105,22 @@ CListModeDataSAFIR<CListRecordT>::
 open_lm_file() const
 {
 	cerr << "CListModeDataSAFIR: opening file " << listmode_filename << endl;
-	shared_ptr<istream> stream_ptr(new fstream(listmode_filename.c_str(), ios::in | ios::binary ));
-	if(!(*stream_ptr))
 	{
-		warning("CListModeDataSAFIR: cannot open file " + listmode_filename + "\n");
-		return Succeeded::no;
+		// check first if we can open the file at all
+		ifstream stream(listmode_filename.c_str(), ios::in | ios::binary );
+		if(!stream)
+		{
+			warning("CListModeDataSAFIR: cannot open file " + listmode_filename + "\n");
+			return Succeeded::no;
+		}
 	}
-	stream_ptr->seekg((std::streamoff)32);
+	// this will memory-map the file. Data start after a header of 32 bytes.
 	current_lm_data_ptr.reset(
 			new InputStreamWithRecords<CListRecordT, bool>
-			( stream_ptr, sizeof(CListTimeDataSAFIR),
+			( listmode_filename, sizeof(CListTimeDataSAFIR),
 					sizeof(CListTimeDataSAFIR),
-					ByteOrder::little_endian !=ByteOrder::get_native_order()));
+					ByteOrder::little_endian !=ByteOrder::get_native_order(),
+					static_cast<std::streampos>(32)));
 	return Succeeded::yes;
 }
 	
@@ -70,6 +70,8 @@ FRAME_BASED_DT_CORR:
 #ifdef USE_SegmentByView
 #include "stir/ProjDataInterfile.h"
 #include "stir/SegmentByView.h"
+#include "stir/listmode/SegmentAccumulator.h"
+#include "stir/recon_buildblock/OutputImagesForThreads.h"
 #else
 #include "stir/ProjDataFromStream.h"
 #include "stir/IO/interfile.h"
@@ -80,8 +82,12 @@ FRAME_BASED_DT_CORR:
 #include "stir/ParsingObject.h"
 #include "stir/TimeFrameDefinitions.h"
 #include "stir/CPUTimer.h"
+#include "stir/HighResWallClockTimer.h"
 #include "stir/recon_buildblock/TrivialBinNormalisation.h"
 #include "stir/is_null_ptr.h"
+#include "stir/num_threads.h"
+#include "stir/info.h"
+#include "boost/format.hpp"
 
 #include <fstream>
 #include <iostream>
@@ -107,7 +113,7 @@ using std::pair;
 START_NAMESPACE_STIR
 
 #ifdef USE_SegmentByView
-typedef SegmentByView<elem_type> segment_type;
+typedef SegmentAccumulators segments_type;
 #else
 #error does not work at the moment
 #endif
@@ -115,24 +121,23 @@ typedef SegmentByView<elem_type> segment_type;
 
 
 
-static void 
-allocate_segments(VectorWithOffset<segment_type *>& segments,
-                       const int start_segment_index, 
-	               const int end_segment_index,
-                       const ProjDataInfo* proj_data_info_ptr);
+static int
+find_end_segment_index(const int start_segment_index,
+                       const ProjDataInfo& proj_data_info,
+                       const int num_segments_in_memory,
+                       const double max_memory_in_MB,
+                       const std::string& accumulator_type);
 
 // In the next 2 functions, the 'output' parameter needs to be passed 
-// because save_and_delete_segments needs it when we're not using SegmentByView
+// because save_segments needs it when we're not using SegmentByView
 
 /* last parameter only used if USE_SegmentByView
    first parameter only used when not USE_SegmentByView
  */         
 static void 
-save_and_delete_segments(shared_ptr<iostream>& output,
-			      VectorWithOffset<segment_type *>& segments,
-			      const int start_segment_index, 
-			      const int end_segment_index, 
-			      ProjData& proj_data);
+save_segments(shared_ptr<iostream>& output,
+	      const segments_type& segments,
+	      ProjData& proj_data);
 static
 shared_ptr<ProjData>
 construct_proj_data(shared_ptr<iostream>& output,
@@ -152,11 +157,15 @@ set_defaults()
   store_delayeds = true;
   interactive=false;
   num_segments_in_memory = -1;
+  max_memory_for_segments_in_MB = 0;
   normalisation_ptr.reset(new TrivialBinNormalisation);
   post_normalisation_ptr.reset(new TrivialBinNormalisation);
   do_pre_normalisation =0;
   num_events_to_store = 0L;
   do_time_frame = false; 
+  parallel_binning = true;
+  max_num_histograms_for_threads = 0;
+  accumulator_type = "float";
 }
 
 void 
@@ -174,6 +183,10 @@ initialise_keymap()
   parser.add_key("maximum absolute segment number to process", &max_segment_num_to_process); 
   parser.add_key("do pre normalisation ", &do_pre_normalisation);
   parser.add_key("num_segments_in_memory", &num_segments_in_memory);
+  parser.add_key("maximum memory for segments in MB", &max_memory_for_segments_in_MB);
+  parser.add_key("parallel binning", &parallel_binning);
+  parser.add_key("maximum number of histograms for multi-threading", &max_num_histograms_for_threads);
+  parser.add_key("accumulator type", &accumulator_type);
 
   //if (lm_data_ptr->has_delayeds()) TODO we haven't read the CListModeData yet, so cannot access has_delayeds() yet
   // one could add the next 2 keywords as part of a callback function for the 'input file' keyword.
@@ -250,6 +263,21 @@ post_processing()
       warning("LmToProjData: num_segments_in_memory cannot be 0");
       return true;
     }
+  if (max_memory_for_segments_in_MB < 0)
+    {
+      warning("LmToProjData: maximum memory for segments in MB cannot be negative");
+      return true;
+    }
+  if (max_num_histograms_for_threads < 0)
+    {
+      warning("LmToProjData: maximum number of histograms for multi-threading cannot be negative");
+      return true;
+    }
+  if (!SegmentAccumulator::is_valid_type(accumulator_type))
+    {
+      warning("LmToProjData: accumulator type has to be float, integer or sparse");
+      return true;
+    }
   
 
 
@@ -442,6 +470,14 @@ get_bin_from_event(Bin& bin, const CListEvent& event) const
 
 } 
 
+bool
+LmToProjData::
+get_bin_from_event_is_thread_safe() const
+{
+  // pre-normalisation calls normalisation_ptr, which might not be thread-safe
+  return !do_pre_normalisation;
+}
+
 /**************************************************************
  Here follows the post_normalisation related stuff. 
 ***************************************************************/
@@ -522,6 +558,8 @@ process_data()
 { 
   CPUTimer timer;
   timer.start();
+  HighResWallClockTimer wall_clock_timer;
+  wall_clock_timer.start();
 
   // assume list mode data starts at time 0
   // we have to do this because the first time tag might occur only after a
@@ -530,9 +568,9 @@ process_data()
 
   double time_of_last_stored_event = 0;
   long num_stored_events = 0;
-  VectorWithOffset<segment_type *> 
-    segments (template_proj_data_info_ptr->get_min_segment_num(), 
-	      template_proj_data_info_ptr->get_max_segment_num());
+  // total number of records read (including time and rejected events), used to report reading speed
+  unsigned long num_records_read = 0;
+  shared_ptr<segments_type> segments_sptr;
   
   VectorWithOffset<CListModeData::SavedPosition> 
     frame_start_positions(1, static_cast<int>(frame_defs.get_num_frames()));
@@ -542,6 +580,27 @@ process_data()
   if (!record.event().is_valid_template(*template_proj_data_info_ptr))
 	  error("The scanner template is not valid for LmToProjData. This might be because of unsupported arc correction.");
 
+  // set up arrays for processing batches of events (see below)
+  const bool use_parallel_binning = 
+    parallel_binning && !interactive && get_bin_from_event_is_thread_safe();
+  // Note: records can be large (e.g. an ECAT8 event stores its own uncompressed
+  // ProjDataInfo and lookup tables), so we only use a modest number per thread.
+  const int batch_size = 
+    use_parallel_binning ? min(512, 32*get_max_num_threads()) : 1;
+  // every thread histograms into its own segments (see OutputImagesForThreads)
+  const int num_histograms =
+    !use_parallel_binning ? 1 :
+    max_num_histograms_for_threads > 0 ? min(max_num_histograms_for_threads, get_max_num_threads()) :
+    get_max_num_threads();
+  // note: we need one more record to store a time record
+  vector<shared_ptr<CListRecord> > record_sptrs(batch_size+1);
+  for (int i=0; i<=batch_size; ++i)
+    record_sptrs[i] = lm_data_ptr->get_empty_record_sptr();
+  vector<Bin> bins(batch_size);
+  // bins that will be added to the segments (with their value multiplied by the event increment)
+  vector<Bin> bins_to_store;
+  bins_to_store.reserve(batch_size);
+
 
   /* Here starts the main loop which will store the listmode data. */
   for (current_frame_num = 1;
@@ -578,19 +637,28 @@ process_data()
 
       /*
 	 For each start_segment_index, we check which events occur in the
-	 segments between start_segment_index and 
-	 start_segment_index+num_segments_in_memory.
+	 segments between start_segment_index and end_segment_index, which
+	 is determined by num_segments_in_memory and max_memory_for_segments_in_MB.
        */
+       int end_segment_index;
        for (int start_segment_index = proj_data_ptr->get_min_segment_num(); 
 	    start_segment_index <= proj_data_ptr->get_max_segment_num(); 
-	    start_segment_index += num_segments_in_memory) 
+	    start_segment_index = end_segment_index + 1) 
 	 {
 	 
-	   const int end_segment_index = 
-	     min( proj_data_ptr->get_max_segment_num()+1, start_segment_index + num_segments_in_memory) - 1;
+	   // note: the memory is shared by all histograms
+	   end_segment_index = 
+	     find_end_segment_index(start_segment_index, *proj_data_ptr->get_proj_data_info_ptr(),
+				    num_segments_in_memory,
+				    interactive ? 0. : max_memory_for_segments_in_MB/num_histograms,
+				    accumulator_type);
     
 	   if (!interactive)
-	     allocate_segments(segments, start_segment_index, end_segment_index, proj_data_ptr->get_proj_data_info_ptr());
+	     segments_sptr.reset(new segments_type(accumulator_type, proj_data_ptr->get_proj_data_info_sptr(),
+						   start_segment_index, end_segment_index));
+	   // the first histogram is *segments_sptr, the others are allocated when a thread first needs them
+	   OutputImagesForThreads<segments_type>
+	     histograms_for_threads(interactive ? 0 : segments_sptr.get(), num_histograms);
 
 	   // the next variable is used to see if there are more events to store for the current segments
 	   // num_events_to_store-more_events will be the number of allowed coincidence events currently seen in the file
@@ -628,32 +696,59 @@ process_data()
 	     }
 	   {      
 	     // loop over all events in the listmode file
-	     while (more_events)
+	     // Events are read in batches of consecutive events (with the same
+	     // current_time). If parallel_binning is true, get_bin_from_event() is
+	     // called in parallel for all events in a batch. The bins are then
+	     // selected in the order of the events (such that num_events_to_store
+	     // is handled correctly), split in consecutive parts, and every thread
+	     // adds a part to its own histogram. The histograms are added after the
+	     // loop over all events.
+	     int num_events_in_batch = 0;
+	     bool end_of_data = false;
+	     while (more_events && !end_of_data)
 	       {
-		 if (lm_data_ptr->get_next_record(record) == Succeeded::no) 
-		   {
-		     // no more events in file for some reason
-		     break; //get out of while loop
-		   }
-         if (record.is_time() && end_time > 0.01) // Direct comparison within doubles is unsafe.
+		 // read events until the batch is full, or we find a time event
+		 bool found_time_record = false;
+		 while (num_events_in_batch < batch_size)
 		   {
-		     current_time = record.time().get_time_in_secs();
-		     if (do_time_frame && current_time >= end_time)
-		       break; // get out of while loop
-		     assert(current_time>=start_time);
-		     process_new_time_event(record.time());
+		     CListRecord& record = *record_sptrs[num_events_in_batch];
+		     if (lm_data_ptr->get_next_record(record) == Succeeded::no) 
+		       {
+			 // no more events in file for some reason
+			 end_of_data = true;
+			 break;
+		       }
+		     ++num_records_read;
+		     if (record.is_time() && end_time > 0.01) // Direct comparison within doubles is unsafe.
+		       {
+			 // first handle the events read so far, as they will need the previous current_time
+			 found_time_record = true;
+			 break;
+		       }
+		     if (record.is_event())
+		       ++num_events_in_batch;
 		   }
-		 // note: could do "else if" here if we would be sure that
-		 // a record can never be both timing and coincidence event
-		 // and there might be a scanner around that has them both combined.
-		 if (record.is_event())
+
+		 // find bins for all events in the batch
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static) if(use_parallel_binning && num_events_in_batch>1)
+#endif
+		 for (int i=0; i<num_events_in_batch; ++i)
 		   {
-		     assert(start_time <= current_time);
-		     Bin bin;
+		     Bin& bin = bins[i];
 		     // set value in case the event decoder doesn't touch it
 		     // otherwise it would be 0 and all events will be ignored
 		     bin.set_bin_value(1);
-                     get_bin_from_event(bin, record.event());
+		     get_bin_from_event(bin, record_sptrs[i]->event());
+		   }
+
+		 // now store them
+		 const int index_of_time_record = num_events_in_batch;
+		 for (int i=0; i<num_events_in_batch && more_events; ++i)
+		   {
+		     const CListRecord& record = *record_sptrs[i];
+		     assert(start_time <= current_time);
+		     Bin& bin = bins[i];
 		     		       
 		     // check if it's inside the range we want to store
 		     if (bin.get_bin_value()>0
@@ -696,9 +791,10 @@ process_data()
 				      bin.segment_num(), bin.view_num(), bin.axial_pos_num(), bin.tangential_pos_num(),
 				      current_time, event_increment);
 			     else
-			       (*segments[bin.segment_num()])[bin.view_num()][bin.axial_pos_num()][bin.tangential_pos_num()] += 
-			       bin.get_bin_value() * 
-			       event_increment;
+			       {
+				 bin.set_bin_value(bin.get_bin_value() * event_increment);
+				 bins_to_store.push_back(bin);
+			       }
 			   }
 		       }
 		     else 	// event is rejected for some reason
@@ -707,7 +803,46 @@ process_data()
 			   printf("Seg %4d view %4d ax_pos %4d tang_pos %4d time %8g ignored\n", 
 				  bin.segment_num(), bin.view_num(), bin.axial_pos_num(), bin.tangential_pos_num(), current_time);
 		       }     
-		   } // end of spatial event processing
+		   } // end of loop over events in batch
+		 num_events_in_batch = 0;
+
+		 // add the selected bins to the histograms
+		 {
+		   const int num_parts =
+		     static_cast<int>(min(static_cast<std::size_t>(histograms_for_threads.get_num_images()),
+					  bins_to_store.size()));
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static) if(num_parts>1)
+#endif
+		   for (int part=0; part<num_parts; ++part)
+		     {
+		       int histogram_num;
+		       segments_type& histogram = *histograms_for_threads.get_image(histogram_num);
+		       const std::size_t begin_index = bins_to_store.size()*part/num_parts;
+		       const std::size_t end_index = bins_to_store.size()*(part+1)/num_parts;
+		       for (std::size_t i=begin_index; i<end_index; ++i)
+			 histogram.add(bins_to_store[i], bins_to_store[i].get_bin_value());
+		       histograms_for_threads.release_image(histogram_num);
+		     }
+		 }
+		 bins_to_store.clear();
+
+		 if (found_time_record && more_events)
+		   {
+		     // the time record is stored after the events of the batch.
+		     // Move it to the start, such that it can be the first event of the next batch.
+		     std::swap(record_sptrs[0], record_sptrs[index_of_time_record]);
+		     CListRecord& record = *record_sptrs[0];
+		     current_time = record.time().get_time_in_secs();
+		     if (do_time_frame && current_time >= end_time)
+		       break; // get out of while loop
+		     assert(current_time>=start_time);
+		     process_new_time_event(record.time());
+		     // note: we check if the record is an event as well
+		     // as there might be a scanner around that has them both combined.
+		     if (record.is_event())
+		       num_events_in_batch = 1;
+		   }
 	       } // end of while loop over all events
 
 	     time_of_last_stored_event = 
@@ -715,9 +850,11 @@ process_data()
 	   } 
 
 	   if (!interactive)
-	   save_and_delete_segments(output, segments, 
-				    start_segment_index, end_segment_index, 
-				    *proj_data_ptr);  
+	     {
+	       histograms_for_threads.add_to_output_image();
+	       save_segments(output, *segments_sptr, *proj_data_ptr);
+	       segments_sptr.reset();
+	     }
 	 } // end of for loop for segment range
        cerr <<  "\nNumber of prompts stored in this time period : " << num_prompts_in_frame
 	    <<  "\nNumber of delayeds stored in this time period: " << num_delayeds_in_frame
@@ -725,6 +862,7 @@ process_data()
    } // end of loop over frames
 
  timer.stop();
+ wall_clock_timer.stop();
 
  cerr << "Last stored event was recorded before time-tick at " << time_of_last_stored_event << " secs\n";
  if (!do_time_frame && 
@@ -734,6 +872,9 @@ process_data()
  cerr << "Total number of counts (either prompts/trues/delayeds) stored: " << num_stored_events << endl;
 
  cerr << "\nThis took " << timer.value() << "s CPU time." << endl;
+ if (wall_clock_timer.value() > 0)
+   cerr << "Processed " << num_records_read << " list mode records at "
+        << num_records_read/wall_clock_timer.value() << " records/s (wall-clock)." << endl;
 
 }
 
@@ -742,48 +883,46 @@ process_data()
 /************************* Local helper routines *************************/
 
 
-void 
-allocate_segments( VectorWithOffset<segment_type *>& segments,
-		  const int start_segment_index, 
-		  const int end_segment_index,
-		  const ProjDataInfo* proj_data_info_ptr)
+int
+find_end_segment_index(const int start_segment_index,
+                       const ProjDataInfo& proj_data_info,
+                       const int num_segments_in_memory,
+                       const double max_memory_in_MB,
+                       const std::string& accumulator_type)
 {
-  
-  for (int seg=start_segment_index ; seg<=end_segment_index; seg++)
-  {
-#ifdef USE_SegmentByView
-    segments[seg] = new SegmentByView<elem_type>(
-    	proj_data_info_ptr->get_empty_segment_by_view (seg)); 
-#else
-    segments[seg] = 
-      new Array<3,elem_type>(IndexRange3D(0, proj_data_info_ptr->get_num_views()-1, 
-				      0, proj_data_info_ptr->get_num_axial_poss(seg)-1,
-				      -(proj_data_info_ptr->get_num_tangential_poss()/2), 
-				      proj_data_info_ptr->get_num_tangential_poss()-(proj_data_info_ptr->get_num_tangential_poss()/2)-1));
-#endif
-  }
+  const double max_memory_in_bytes = max_memory_in_MB*1024*1024;
+  double memory_in_bytes =
+    static_cast<double>(SegmentAccumulator::
+                        get_initial_memory_usage_in_bytes(accumulator_type, proj_data_info, start_segment_index));
+  if (max_memory_in_bytes > 0 && memory_in_bytes > max_memory_in_bytes)
+    warning(boost::format("LmToProjData: segment %1% needs %2% MB, which is more than the maximum memory for segments.")
+            % start_segment_index % (memory_in_bytes/1024/1024));
+  // note: we always use at least one segment
+  int end_segment_index = start_segment_index;
+  while (end_segment_index < proj_data_info.get_max_segment_num() &&
+         end_segment_index - start_segment_index + 1 < num_segments_in_memory)
+    {
+      const double memory_for_next_segment =
+        static_cast<double>(SegmentAccumulator::
+                            get_initial_memory_usage_in_bytes(accumulator_type, proj_data_info, end_segment_index + 1));
+      if (max_memory_in_bytes > 0 && memory_in_bytes + memory_for_next_segment > max_memory_in_bytes)
+        break;
+      memory_in_bytes += memory_for_next_segment;
+      ++end_segment_index;
+    }
+  return end_segment_index;
 }
 
 void 
-save_and_delete_segments(shared_ptr<iostream>& output,
-			 VectorWithOffset<segment_type *>& segments,
-			 const int start_segment_index, 
-			 const int end_segment_index, 
-			 ProjData& proj_data)
+save_segments(shared_ptr<iostream>& output,
+	      const segments_type& segments,
+	      ProjData& proj_data)
 {
-  
-  for (int seg=start_segment_index; seg<=end_segment_index; seg++)
-  {
-    {
-#ifdef USE_SegmentByView
-      proj_data.set_segment(*segments[seg]);
-#else
-      (*segments[seg]).write_data(*output);
-#endif
-      delete segments[seg];      
-    }
-    
-  }
+  for (int seg=segments.get_min_index(); seg<=segments.get_max_index(); seg++)
+    proj_data.set_segment(segments[seg].get_segment());
+  info(boost::format("LmToProjData: histogram for segments %1% to %2% used %3% MB")
+       % segments.get_min_index() % segments.get_max_index()
+       % (segments.get_memory_usage_in_bytes()/1024./1024.));
 }
 
 
@@ -245,6 +245,14 @@ get_bin_from_event(Bin& bin, const CListEvent& event) const
   ++num_times_to_replicate_iter;
 }
 
+template <typename LmToProjDataT> 
+bool
+LmToProjDataBootstrap<LmToProjDataT>::
+get_bin_from_event_is_thread_safe() const
+{
+  return false;
+}
+
 
 // instantiation
 template class LmToProjDataBootstrap<LmToProjData>;
@@ -0,0 +1,395 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup listmode
+  \brief Implementation of class stir::SegmentAccumulator and derived classes,
+  and class stir::SegmentAccumulators
+*/
+
+#include "stir/listmode/SegmentAccumulator.h"
+#include "stir/Bin.h"
+#include "stir/error.h"
+#include <cmath>
+#include <limits>
+
+START_NAMESPACE_STIR
+
+/******************* SegmentAccumulator *******************/
+
+bool
+SegmentAccumulator::
+is_valid_type(const std::string& type)
+{
+  return type == "float" || type == "integer" || type == "sparse";
+}
+
+std::size_t
+SegmentAccumulator::
+get_initial_memory_usage_in_bytes(const std::string& type,
+                                  const ProjDataInfo& proj_data_info,
+                                  const int segment_num)
+{
+  const std::size_t num_bins =
+    static_cast<std::size_t>(proj_data_info.get_num_views())*
+    proj_data_info.get_num_axial_poss(segment_num) *
+    proj_data_info.get_num_tangential_poss();
+  return num_bins * (type == "integer" ? sizeof(boost::int16_t) : sizeof(float));
+}
+
+SegmentAccumulator*
+SegmentAccumulator::
+create(const std::string& type,
+       const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+       const int segment_num)
+{
+  if (type == "float")
+    return new FloatSegmentAccumulator(proj_data_info_sptr, segment_num);
+  else if (type == "integer")
+    return new IntegerSegmentAccumulator(proj_data_info_sptr, segment_num);
+  else if (type == "sparse")
+    return new SparseSegmentAccumulator(proj_data_info_sptr, segment_num);
+  else
+    {
+      error("SegmentAccumulator::create: unknown type '%s'. Use float, integer or sparse.", type.c_str());
+      return 0;
+    }
+}
+
+SegmentAccumulator::
+SegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                   const int segment_num)
+  : proj_data_info_sptr(proj_data_info_sptr),
+    segment_num(segment_num),
+    min_view_num(proj_data_info_sptr->get_min_view_num()),
+    min_axial_pos_num(proj_data_info_sptr->get_min_axial_pos_num(segment_num)),
+    min_tangential_pos_num(proj_data_info_sptr->get_min_tangential_pos_num()),
+    num_axial_poss(proj_data_info_sptr->get_num_axial_poss(segment_num)),
+    num_tangential_poss(proj_data_info_sptr->get_num_tangential_poss())
+{
+  num_bins =
+    static_cast<std::size_t>(proj_data_info_sptr->get_num_views())*
+    num_axial_poss * num_tangential_poss;
+}
+
+SegmentAccumulator&
+SegmentAccumulator::
+operator+=(const SegmentAccumulator& other)
+{
+  if (other.segment_num != this->segment_num || other.num_bins != this->num_bins)
+    error("SegmentAccumulator::operator+=: accumulators should be for the same segment");
+  other.add_values_to(*this);
+  return *this;
+}
+
+/******************* FloatSegmentAccumulator *******************/
+
+FloatSegmentAccumulator::
+FloatSegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                        const int segment_num)
+  : SegmentAccumulator(proj_data_info_sptr, segment_num),
+    segment(proj_data_info_sptr->get_empty_segment_by_view(segment_num))
+{
+  // note: the segment is contiguous, in the order used by get_index()
+  data_ptr = segment.get_full_data_ptr();
+}
+
+void
+FloatSegmentAccumulator::
+add_at_index(const std::size_t index, const float value)
+{
+  data_ptr[index] += value;
+}
+
+void
+FloatSegmentAccumulator::
+add_values_to(SegmentAccumulator& output) const
+{
+  for (std::size_t index = 0; index < num_bins; ++index)
+    if (data_ptr[index] != 0)
+      add_to_output(output, index, data_ptr[index]);
+}
+
+SegmentByView<float>
+FloatSegmentAccumulator::
+get_segment() const
+{
+  return segment;
+}
+
+std::size_t
+FloatSegmentAccumulator::
+get_memory_usage_in_bytes() const
+{
+  return num_bins*sizeof(float);
+}
+
+/******************* IntegerSegmentAccumulator *******************/
+
+IntegerSegmentAccumulator::
+IntegerSegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                          const int segment_num)
+  : SegmentAccumulator(proj_data_info_sptr, segment_num),
+    blocks(proj_data_info_sptr->get_num_views()),
+    num_bins_per_block(static_cast<std::size_t>(num_axial_poss)*num_tangential_poss)
+{
+  for (std::size_t block_num = 0; block_num < blocks.size(); ++block_num)
+    {
+      blocks[block_num].storage_type = int16_storage;
+      blocks[block_num].values_int16.resize(num_bins_per_block, 0);
+    }
+}
+
+void
+IntegerSegmentAccumulator::Block::
+promote_to_int32()
+{
+  assert(storage_type == int16_storage);
+  values_int32.assign(values_int16.begin(), values_int16.end());
+  std::vector<boost::int16_t>().swap(values_int16);
+  storage_type = int32_storage;
+}
+
+void
+IntegerSegmentAccumulator::Block::
+promote_to_float()
+{
+  if (storage_type == int16_storage)
+    {
+      values_float.assign(values_int16.begin(), values_int16.end());
+      std::vector<boost::int16_t>().swap(values_int16);
+    }
+  else if (storage_type == int32_storage)
+    {
+      values_float.assign(values_int32.begin(), values_int32.end());
+      std::vector<boost::int32_t>().swap(values_int32);
+    }
+  storage_type = float_storage;
+}
+
+float
+IntegerSegmentAccumulator::Block::
+get_value(const std::size_t index_in_block) const
+{
+  switch (storage_type)
+    {
+    case int16_storage: return static_cast<float>(values_int16[index_in_block]);
+    case int32_storage: return static_cast<float>(values_int32[index_in_block]);
+    case float_storage: return values_float[index_in_block];
+    }
+  return 0; // never get here
+}
+
+std::size_t
+IntegerSegmentAccumulator::Block::
+get_memory_usage_in_bytes() const
+{
+  return
+    values_int16.size()*sizeof(boost::int16_t) +
+    values_int32.size()*sizeof(boost::int32_t) +
+    values_float.size()*sizeof(float);
+}
+
+void
+IntegerSegmentAccumulator::
+add_at_index(const std::size_t index, const float value)
+{
+  // note: blocks are views, see get_index()
+  Block& block = blocks[index / num_bins_per_block];
+  const std::size_t index_in_block = index % num_bins_per_block;
+
+  if (block.storage_type != float_storage && value != std::floor(value))
+    block.promote_to_float();
+
+  switch (block.storage_type)
+    {
+    case int16_storage:
+      {
+        // note: use double to avoid overflow in the check itself
+        const double new_value = static_cast<double>(block.values_int16[index_in_block]) + value;
+        if (new_value >= std::numeric_limits<boost::int16_t>::min() &&
+            new_value <= std::numeric_limits<boost::int16_t>::max())
+          {
+            block.values_int16[index_in_block] = static_cast<boost::int16_t>(new_value);
+            return;
+          }
+        // doesn't fit, so promote and continue with the int32 case
+        block.promote_to_int32();
+      }
+      // fall through
+    case int32_storage:
+      {
+        const double new_value = static_cast<double>(block.values_int32[index_in_block]) + value;
+        if (new_value >= std::numeric_limits<boost::int32_t>::min() &&
+            new_value <= std::numeric_limits<boost::int32_t>::max())
+          {
+            block.values_int32[index_in_block] = static_cast<boost::int32_t>(new_value);
+            return;
+          }
+        // doesn't fit, so promote and continue with the float case
+        block.promote_to_float();
+      }
+      // fall through
+    case float_storage:
+      block.values_float[index_in_block] += value;
+      return;
+    }
+}
+
+void
+IntegerSegmentAccumulator::
+add_values_to(SegmentAccumulator& output) const
+{
+  std::size_t index = 0;
+  for (std::size_t block_num = 0; block_num < blocks.size(); ++block_num)
+    for (std::size_t index_in_block = 0; index_in_block < num_bins_per_block; ++index_in_block, ++index)
+      {
+        const float value = blocks[block_num].get_value(index_in_block);
+        if (value != 0)
+          add_to_output(output, index, value);
+      }
+}
+
+SegmentByView<float>
+IntegerSegmentAccumulator::
+get_segment() const
+{
+  SegmentByView<float> segment =
+    proj_data_info_sptr->get_empty_segment_by_view(this->segment_num);
+  std::size_t index = 0;
+  for (SegmentByView<float>::full_iterator iter = segment.begin_all();
+       iter != segment.end_all();
+       ++iter, ++index)
+    *iter = blocks[index / num_bins_per_block].get_value(index % num_bins_per_block);
+  assert(index == num_bins);
+  return segment;
+}
+
+int
+IntegerSegmentAccumulator::
+get_num_bytes_per_bin(const int view_num) const
+{
+  switch (blocks[view_num - min_view_num].storage_type)
+    {
+    case int16_storage: return static_cast<int>(sizeof(boost::int16_t));
+    case int32_storage: return static_cast<int>(sizeof(boost::int32_t));
+    case float_storage: return static_cast<int>(sizeof(float));
+    }
+  return 0; // never get here
+}
+
+std::size_t
+IntegerSegmentAccumulator::
+get_memory_usage_in_bytes() const
+{
+  std::size_t memory_usage = 0;
+  for (std::size_t block_num = 0; block_num < blocks.size(); ++block_num)
+    memory_usage += blocks[block_num].get_memory_usage_in_bytes();
+  return memory_usage;
+}
+
+/******************* SparseSegmentAccumulator *******************/
+
+SparseSegmentAccumulator::
+SparseSegmentAccumulator(const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                         const int segment_num)
+  : SegmentAccumulator(proj_data_info_sptr, segment_num)
+{
+  if (num_bins > std::numeric_limits<boost::uint32_t>::max())
+    error("SparseSegmentAccumulator: segment %d is too large", segment_num);
+}
+
+void
+SparseSegmentAccumulator::
+add_at_index(const std::size_t index, const float value)
+{
+  // note: new entries are initialised to 0
+  values[static_cast<boost::uint32_t>(index)] += value;
+}
+
+void
+SparseSegmentAccumulator::
+add_values_to(SegmentAccumulator& output) const
+{
+  for (map_type::const_iterator iter = values.begin(); iter != values.end(); ++iter)
+    if (iter->second != 0)
+      add_to_output(output, iter->first, iter->second);
+}
+
+SegmentByView<float>
+SparseSegmentAccumulator::
+get_segment() const
+{
+  SegmentByView<float> segment =
+    proj_data_info_sptr->get_empty_segment_by_view(this->segment_num);
+  const std::size_t num_bins_per_view =
+    static_cast<std::size_t>(num_axial_poss)*num_tangential_poss;
+  for (map_type::const_iterator iter = values.begin(); iter != values.end(); ++iter)
+    {
+      // find view etc from the index (see get_index())
+      const std::size_t index = iter->first;
+      const int view_num = min_view_num + static_cast<int>(index / num_bins_per_view);
+      const std::size_t index_in_view = index % num_bins_per_view;
+      const int axial_pos_num = 
+        min_axial_pos_num + static_cast<int>(index_in_view / num_tangential_poss);
+      const int tangential_pos_num = 
+        min_tangential_pos_num + static_cast<int>(index_in_view % num_tangential_poss);
+      segment[view_num][axial_pos_num][tangential_pos_num] = iter->second;
+    }
+  return segment;
+}
+
+std::size_t
+SparseSegmentAccumulator::
+get_memory_usage_in_bytes() const
+{
+  // rough estimate of memory per node, plus the bucket array
+  return values.size()*(sizeof(map_type::value_type) + 2*sizeof(void*)) +
+    values.bucket_count()*sizeof(void*);
+}
+
+/******************* SegmentAccumulators *******************/
+
+SegmentAccumulators::
+SegmentAccumulators(const std::string& type,
+                    const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
+                    const int min_segment_num, const int max_segment_num)
+  : type(type),
+    proj_data_info_sptr(proj_data_info_sptr),
+    accumulators(min_segment_num, max_segment_num)
+{
+  for (int segment_num = min_segment_num; segment_num <= max_segment_num; ++segment_num)
+    accumulators[segment_num].reset(SegmentAccumulator::create(type, proj_data_info_sptr, segment_num));
+}
+
+SegmentAccumulators*
+SegmentAccumulators::
+get_empty_copy() const
+{
+  return new SegmentAccumulators(type, proj_data_info_sptr, get_min_index(), get_max_index());
+}
+
+std::size_t
+SegmentAccumulators::
+get_memory_usage_in_bytes() const
+{
+  std::size_t memory_usage = 0;
+  for (int segment_num = get_min_index(); segment_num <= get_max_index(); ++segment_num)
+    memory_usage += accumulators[segment_num]->get_memory_usage_in_bytes();
+  return memory_usage;
+}
+
+END_NAMESPACE_STIR
@@ -26,68 +26,433 @@
 #include "stir/round.h"
 #include "stir/modulo.h"
 #include "stir/array_index_functions.h"
+#include "stir/shared_ptr.h"
+#include "stir/error.h"
+#include <vector>
+#include <map>
+#include <algorithm>
 START_NAMESPACE_STIR
 
 
-template <typename T>
-static void bitreversal(VectorWithOffset<T>& data)
+namespace detail {
+
+/* A plan for computing 1D DFTs of a particular length.
+
+   The plan stores the factorisation of the length and all twiddle factors,
+   such that no trigonometric functions need to be evaluated during the
+   transform itself. Plans are never modified after construction, so they
+   can be used by multiple threads simultaneously.
+
+   Lengths that only contain small prime factors (up to max_radix) use a
+   mixed-radix decimation-in-time algorithm (with specialised butterflies for
+   radix 2, 3 and 4). Other lengths use Bluestein's algorithm, which rewrites
+   the DFT as a convolution that is computed with FFTs of a power-of-2 length.
+*/
+class FourierPlan
 {
-  const int n=data.get_length();
-  int   j=1;
-  for (int i=0;i<n;++i) {
-    if (j/2 > i) {
-      std::swap(data[j/2],data[i]);
+public:
+  typedef std::complex<float> complex_t;
+
+  explicit FourierPlan(const int n);
+
+  int get_length() const { return n; }
+
+  //! Compute the DFT of \a data (which has to have get_length() elements) in-place
+  /*! \a work is used as scratch space. It is resized if necessary, such that
+      it can be reused for subsequent calls.
+  */
+  void transform(complex_t * const data, const int sign,
+                 std::vector<complex_t>& work) const;
+
+  //! exp(sign*i*_PI*k/n) for k=0..n/2 (used for real data)
+  complex_t get_real_twiddle(const int k, const int sign) const
+  {
+    return sign>0 ? real_twiddles[k] : std::conj(real_twiddles[k]);
+  }
+
+private:
+  static const int max_radix = 13;
+
+  int n;
+  //! pairs of (radix, remaining length) for every stage
+  std::vector<int> factors;
+  //! twiddles[k] = exp(2*_PI*i*k/n)
+  std::vector<complex_t> twiddles;
+  std::vector<complex_t> min_twiddles;
+  std::vector<complex_t> real_twiddles;
+
+  // members for Bluestein's algorithm
+  bool use_bluestein;
+  shared_ptr<FourierPlan> bluestein_plan_sptr;
+  //! bluestein_chirp[k] = exp(i*_PI*k*k/n)
+  std::vector<complex_t> bluestein_chirp;
+  //! DFT of the (conjugated) chirp, divided by its length
+  std::vector<complex_t> bluestein_filter;
+
+  void transform_out_of_place(complex_t * const out, const complex_t * const in,
+                              const int sign) const;
+  void do_stage(complex_t * out, const complex_t * in,
+                const int fstride, const std::vector<int>::const_iterator factor_iter,
+                const complex_t * const tw, const int sign) const;
+  void butterfly_2(complex_t * const out, const int fstride, const complex_t * const tw, const int m) const;
+  void butterfly_3(complex_t * const out, const int fstride, const complex_t * const tw, const int m) const;
+  void butterfly_4(complex_t * const out, const int fstride, const complex_t * const tw, const int m,
+                   const int sign) const;
+  void butterfly_generic(complex_t * const out, const int fstride, const complex_t * const tw,
+                         const int m, const int p) const;
+};
+
+FourierPlan::
+FourierPlan(const int n)
+  : n(n), use_bluestein(false)
+{
+  assert(n>0);
+  // find factors, starting with radix 4 as this is the most efficient one
+  {
+    int remaining = n;
+    int p = 4;
+    while (remaining > 1)
+      {
+        while (remaining % p != 0)
+          {
+            switch (p)
+              {
+              case 4: p = 2; break;
+              case 2: p = 3; break;
+              default: p += 2; break;
+              }
+            if (p > max_radix || p*p > remaining)
+              p = remaining;
+          }
+        if (p > max_radix)
+          {
+            use_bluestein = true;
+            break;
+          }
+        remaining /= p;
+        factors.push_back(p);
+        factors.push_back(remaining);
+      }
+  }
+
+  // compute twiddles in double precision to avoid accumulating rounding errors
+  const int num_real_twiddles = n/2+1;
+  real_twiddles.resize(num_real_twiddles);
+  for (int k=0; k<num_real_twiddles; ++k)
+    real_twiddles[k] = complex_t(std::polar(1., (_PI*k)/n));
+
+  if (!use_bluestein)
+    {
+      twiddles.resize(n);
+      min_twiddles.resize(n);
+      for (int k=0; k<n; ++k)
+        {
+          twiddles[k] = complex_t(std::polar(1., (2*_PI*k)/n));
+          min_twiddles[k] = std::conj(twiddles[k]);
+        }
+      return;
     }
-    int m=n;
-    while (m >= 2 && j > m) {
-      j -= m;
-      m >>= 1;
+
+  factors.clear();
+  // find power of 2 that is large enough for the (non-periodic) convolution
+  int m = 1;
+  while (m < 2*n-1)
+    m *= 2;
+  bluestein_plan_sptr.reset(new FourierPlan(m));
+  bluestein_chirp.resize(n);
+  for (int k=0; k<n; ++k)
+    {
+      // avoid overflow and loss of precision by using k*k modulo 2n
+      const long k2 = (static_cast<long>(k)*k) % (2L*n);
+      bluestein_chirp[k] = complex_t(std::polar(1., (_PI*k2)/n));
     }
-    j += m;
-  }
+  bluestein_filter.assign(m, complex_t(0));
+  bluestein_filter[0] = std::conj(bluestein_chirp[0]);
+  for (int k=1; k<n; ++k)
+    bluestein_filter[k] = bluestein_filter[m-k] = std::conj(bluestein_chirp[k]);
+  std::vector<complex_t> work;
+  bluestein_plan_sptr->transform(&bluestein_filter[0], 1, work);
+  for (int k=0; k<m; ++k)
+    bluestein_filter[k] /= static_cast<float>(m);
 }
 
-/* We cache factors exp(i*_PI/pow(2,k)). They will be computed during the first
-   call of the Fourier functions, and then stored in static arrays.
+void
+FourierPlan::
+transform(complex_t * const data, const int sign,
+          std::vector<complex_t>& work) const
+{
+  if (!use_bluestein)
+    {
+      if (work.size() < static_cast<std::size_t>(n))
+        work.resize(n);
+      std::copy(data, data+n, work.begin());
+      transform_out_of_place(data, &work[0], sign);
+      return;
+    }
+
+  /* Bluestein's algorithm uses n*k = (n*n + k*k - (k-n)*(k-n))/2 to write the DFT as
+       r_k = chirp_k sum_n (c_n chirp_n) conj(chirp_(k-n))
+     For sign==-1, we use that the DFT is the complex conjugate of the DFT
+     of the complex conjugate of the data.
+  */
+  const int m = bluestein_plan_sptr->get_length();
+  if (work.size() < static_cast<std::size_t>(2*m))
+    work.resize(2*m);
+  complex_t * const a = &work[0];
+  complex_t * const fa = &work[m];
+  if (sign>0)
+    for (int k=0; k<n; ++k)
+      a[k] = data[k]*bluestein_chirp[k];
+  else
+    for (int k=0; k<n; ++k)
+      a[k] = std::conj(data[k])*bluestein_chirp[k];
+  std::fill(a+n, a+m, complex_t(0));
+  bluestein_plan_sptr->transform_out_of_place(fa, a, 1);
+  for (int k=0; k<m; ++k)
+    fa[k] *= bluestein_filter[k];
+  bluestein_plan_sptr->transform_out_of_place(a, fa, -1);
+  if (sign>0)
+    for (int k=0; k<n; ++k)
+      data[k] = a[k]*bluestein_chirp[k];
+  else
+    for (int k=0; k<n; ++k)
+      data[k] = std::conj(a[k]*bluestein_chirp[k]);
+}
+
+void
+FourierPlan::
+transform_out_of_place(complex_t * const out, const complex_t * const in,
+                       const int sign) const
+{
+  assert(!use_bluestein);
+  if (n==1)
+    {
+      out[0] = in[0];
+      return;
+    }
+  do_stage(out, in, 1, factors.begin(),
+           sign>0 ? &twiddles[0] : &min_twiddles[0], sign);
+}
+
+/* Recursive decimation-in-time.
+   The current stage splits the data (with stride fstride) into p sub-sequences
+   of length m, computes their DFTs (in consecutive blocks of out) and then
+   combines them with a radix-p butterfly.
 */
-// exparray[k][i] = exp(i*_PI/pow(2,k))
-typedef VectorWithOffset<VectorWithOffset<std::complex<float> > > exparray_t;
-static   exparray_t exparray;
+void
+FourierPlan::
+do_stage(complex_t * out, const complex_t * in,
+         const int fstride, const std::vector<int>::const_iterator factor_iter,
+         const complex_t * const tw, const int sign) const
+{
+  const int p = *factor_iter;
+  const int m = *(factor_iter+1);
+  complex_t * const out_begin = out;
+  const complex_t * const out_end = out + p*m;
+
+  if (m==1)
+    {
+      for (; out != out_end; ++out, in += fstride)
+        *out = *in;
+    }
+  else
+    {
+      for (; out != out_end; out += m, in += fstride)
+        do_stage(out, in, fstride*p, factor_iter+2, tw, sign);
+    }
+
+  switch (p)
+    {
+    case 2: butterfly_2(out_begin, fstride, tw, m); break;
+    case 3: butterfly_3(out_begin, fstride, tw, m); break;
+    case 4: butterfly_4(out_begin, fstride, tw, m, sign); break;
+    default: butterfly_generic(out_begin, fstride, tw, m, p); break;
+    }
+}
+
+void
+FourierPlan::
+butterfly_2(complex_t * const out, const int fstride, const complex_t * const tw, const int m) const
+{
+  complex_t * out2 = out + m;
+  const complex_t * tw1 = tw;
+  for (complex_t * out1 = out; out1 != out + m; ++out1, ++out2, tw1 += fstride)
+    {
+      const complex_t t = *out2 * *tw1;
+      *out2 = *out1 - t;
+      *out1 += t;
+    }
+}
 
-static void init_exparray(const int k, const int pow2k)
+void
+FourierPlan::
+butterfly_3(complex_t * const out, const int fstride, const complex_t * const tw, const int m) const
 {
-  if (exparray.get_max_index() >= k && exparray[k].size()>0)
-    return;
-
-  if (exparray.get_max_index() <k)
-    exparray.grow(0, k);
-  exparray[k].grow(0,pow2k-1);
-  for (int i=0; i< pow2k; ++i)
-    exparray[k][i]= std::exp(std::complex<float>(0, static_cast<float>((i*_PI)/pow2k)));
+  // imaginary part of exp(sign*2*_PI*i/3)
+  const float epi3 = tw[fstride*m].imag();
+  const complex_t * tw1 = tw;
+  const complex_t * tw2 = tw;
+  for (int k=0; k<m; ++k, tw1 += fstride, tw2 += 2*fstride)
+    {
+      const complex_t s1 = out[k+m] * *tw1;
+      const complex_t s2 = out[k+2*m] * *tw2;
+      const complex_t s3 = s1 + s2;
+      const complex_t s0 = (s1 - s2)*epi3;
+      const complex_t t = out[k] - s3*.5F;
+      out[k] += s3;
+      out[k+m] = complex_t(t.real() - s0.imag(), t.imag() + s0.real());
+      out[k+2*m] = complex_t(t.real() + s0.imag(), t.imag() - s0.real());
+    }
 }
 
-// expminarray[k][i] = exp(-i*_PI/pow(2,k))
-// obviously just the complex conjugate of exparray
-static   exparray_t expminarray;
+void
+FourierPlan::
+butterfly_4(complex_t * const out, const int fstride, const complex_t * const tw, const int m,
+            const int sign) const
+{
+  const complex_t * tw1 = tw;
+  const complex_t * tw2 = tw;
+  const complex_t * tw3 = tw;
+  for (int k=0; k<m; ++k, tw1 += fstride, tw2 += 2*fstride, tw3 += 3*fstride)
+    {
+      const complex_t s0 = out[k+m] * *tw1;
+      const complex_t s1 = out[k+2*m] * *tw2;
+      const complex_t s2 = out[k+3*m] * *tw3;
+      const complex_t s5 = out[k] - s1;
+      const complex_t s6 = out[k] + s1;
+      const complex_t s3 = s0 + s2;
+      // s4 multiplied with sign*i
+      const complex_t s4 = sign>0 ?
+        complex_t(-(s0-s2).imag(), (s0-s2).real()) :
+        complex_t((s0-s2).imag(), -(s0-s2).real());
+      out[k] = s6 + s3;
+      out[k+2*m] = s6 - s3;
+      out[k+m] = s5 + s4;
+      out[k+3*m] = s5 - s4;
+    }
+}
 
-static void init_expminarray(const int k, const int pow2k)
+void
+FourierPlan::
+butterfly_generic(complex_t * const out, const int fstride, const complex_t * const tw,
+                  const int m, const int p) const
 {
-  if (expminarray.get_max_index() >= k && expminarray[k].size()>0)
-    return;
-
-  if (expminarray.get_max_index() <k)
-    expminarray.grow(0, k);
-  expminarray[k].grow(0,pow2k-1);
-  for (int i=0; i< pow2k; ++i)
-    expminarray[k][i]= std::exp(std::complex<float>(0, static_cast<float>(-(i*_PI)/pow2k)));
+  assert(p <= max_radix);
+  complex_t scratch[max_radix];
+  for (int u=0; u<m; ++u)
+    {
+      for (int q=0, k=u; q<p; ++q, k+=m)
+        scratch[q] = out[k];
+
+      for (int q=0, k=u; q<p; ++q, k+=m)
+        {
+          int tw_index = 0;
+          complex_t sum = scratch[0];
+          for (int r=1; r<p; ++r)
+            {
+              tw_index += fstride*k;
+              if (tw_index >= n)
+                tw_index -= n;
+              sum += scratch[r] * tw[tw_index];
+            }
+          out[k] = sum;
+        }
+    }
 }
 
+/* Plans are cached, such that twiddles etc are only computed once for
+   every length. Access to the cache is protected by a critical section,
+   but once a plan is found, it can be used concurrently.
+*/
+typedef std::map<int, shared_ptr<FourierPlan> > FourierPlanCache;
+static FourierPlanCache fourier_plan_cache;
+
+static shared_ptr<FourierPlan>
+get_fourier_plan(const int n)
+{
+  shared_ptr<FourierPlan> plan_sptr;
+#ifdef STIR_OPENMP
+#pragma omp critical(STIRFOURIERPLANCACHE)
+#endif
+  {
+    FourierPlanCache::const_iterator iter = fourier_plan_cache.find(n);
+    if (iter != fourier_plan_cache.end())
+      plan_sptr = iter->second;
+    else
+      {
+        plan_sptr.reset(new FourierPlan(n));
+        fourier_plan_cache[n] = plan_sptr;
+      }
+  }
+  return plan_sptr;
+}
+
+/* A class that computes the 1D DFT of the outer dimension.
+
+   The general case is for a vector of arrays. The DFT is computed for every
+   "column" (i.e. fixed index in the inner dimensions), which are copied
+   into a contiguous buffer in blocks for efficient memory access.
+*/
+template <typename elemT>
+struct fourier_1d_auxiliary
+{
+  static void
+  do_fourier_1d(VectorWithOffset<elemT>& c, const int sign)
+  {
+    typedef std::complex<float> complex_t;
+    typedef typename elemT::full_iterator column_iterator;
+    const int n = c.get_length();
+    const shared_ptr<FourierPlan> plan_sptr = get_fourier_plan(n);
+    const std::size_t num_columns = c[0].size_all();
+    std::vector<column_iterator> iters(n);
+    for (int i=0; i<n; ++i)
+      {
+        if (c[i].size_all() != num_columns)
+          error("fourier_1d called with an array that is not regular");
+        iters[i] = c[i].begin_all();
+      }
+
+    static const std::size_t block_size = 16;
+    std::vector<complex_t> buffer(n*block_size);
+    std::vector<complex_t> work;
+    for (std::size_t start_column=0; start_column<num_columns; start_column+=block_size)
+      {
+        const std::size_t this_block_size = std::min(block_size, num_columns-start_column);
+        // copy a block of columns in the buffer, one after the other
+        for (int i=0; i<n; ++i)
+          {
+            column_iterator iter = iters[i];
+            for (std::size_t col=0; col<this_block_size; ++col, ++iter)
+              buffer[col*n+i] = *iter;
+          }
+        for (std::size_t col=0; col<this_block_size; ++col)
+          plan_sptr->transform(&buffer[col*n], sign, work);
+        for (int i=0; i<n; ++i)
+          {
+            column_iterator& iter = iters[i];
+            for (std::size_t col=0; col<this_block_size; ++col, ++iter)
+              *iter = buffer[col*n+i];
+          }
+      }
+  }
+};
+
+// specialisation for the one-dimensional case, where data is contiguous
+template <typename elemT>
+struct fourier_1d_auxiliary<std::complex<elemT> >
+{
+  static void
+  do_fourier_1d(VectorWithOffset<std::complex<elemT> >& c, const int sign)
+  {
+    std::vector<std::complex<elemT> > work;
+    get_fourier_plan(c.get_length())->transform(&c[0], sign, work);
+  }
+};
+
+} // end of namespace detail
 
 /* First we define 1D fourier transforms of vectors with almost arbitrary
-   element types.
-   This is almost a straightforward 1D FFT implementation. The only tricky bit
-   is to make sure that all operations are written in a way that is defined
-   (and efficient) in the case that the element type is a vector again.
+   element types, see fourier_1d_auxiliary above.
 */
 
 template <typename T>
@@ -96,48 +461,28 @@ void fourier_1d(T& c, const int sign)
   if (c.size()==0) return;
   assert(c.get_min_index()==0);
   assert(sign==1 || sign ==-1);
-  bitreversal(c);
-  // find 'nn' which is such that length==2^nn
-  const int nn=round(log(static_cast<double>(c.size()))/log(2.));
-  if (c.get_length()!= round(pow(2.,nn)))
-    error ("fourier_1d called with array length %d which is not 2^%d\n", c.size(), nn);
-
-  int k=0;
-  int pow2k = 1; // will be updated to be round(pow(2,k))
-  const int pow2nn=c.get_length(); // ==round(pow(2,nn)); 
-  for (; k<nn; ++k, pow2k*=2)
-  {
-    if (sign==1)
-      init_exparray(k,pow2k);
-    else
-      init_expminarray(k,pow2k);
-    const exparray_t& cur_exparray =
-      sign==1? exparray : expminarray;      
-    for (int j=0; j< pow2nn;j+= pow2k*2) 
-      for (int i=0; i< pow2k; ++i)
-      {
-        typename T::reference c1= c[i + j];
-        typename T::reference c2= c[i + j + pow2k];
-        
-        typename T::value_type const t1 = c1; 
-	/* here is what we have to do:
-            typename T::value_type const t2 = 
-              c2*cur_exparray[k][i];
-            c1 = t1+t2; c2 = t1-t2;
-	 however, this would create an unnecessary copy of t2, which is 
-	 potentially large.
-	 So, we rewrite it without t2, and using operations that also 
-	 work when using multi-dim arrays.
-	 Note that for multi-dimensional arrays, this code involves 4 
-	 loops over the same data.
-	 Using expression templates would speed this up.
-	*/
-        c2 *= cur_exparray[k][i];
-        c1 += c2;
-        c2 *= -1;
-        c2 += t1;
-      }
-  }
+  detail::fourier_1d_auxiliary<typename T::value_type>::do_fourier_1d(c, sign);
+}
+
+int
+efficient_fourier_length(const int min_length)
+{
+  int length = std::max(min_length, 2);
+  if (length%2 != 0)
+    ++length;
+  while (true)
+    {
+      int remaining = length;
+      while (remaining%2 == 0)
+        remaining /= 2;
+      while (remaining%3 == 0)
+        remaining /= 3;
+      while (remaining%5 == 0)
+        remaining /= 5;
+      if (remaining == 1)
+        return length;
+      length += 2;
+    }
 }
 
 namespace detail {
@@ -245,7 +590,11 @@ fourier_1d_for_real_data(const Array<1,T>& v, const int sign)
   for (int i=0; i<c.get_length(); ++i)
     c[i] =  complex_t(v[2*i]/2, v[2*i+1]/2);
 
-  fourier_1d(c, sign);
+  const shared_ptr<detail::FourierPlan> plan_sptr = detail::get_fourier_plan(n);
+  {
+    std::vector<complex_t> work;
+    plan_sptr->transform(&c[0], sign, work);
+  }
 
   //cout << "C: " << c;
   c.resize(n+1);
@@ -253,11 +602,9 @@ fourier_1d_for_real_data(const Array<1,T>& v, const int sign)
     {
       const complex_t t1 = 
 	(c[i]+std::conj(c[n-i]));
-      // TODO could get exp() from static exparray
-      // the nice thing about this code that it works even when the length is not a power of 2
-      // (but of course, the call to fourier_1d would currently abort in that case)
+      // multiply with exp(i*(sign*i*_PI/n - _PI/2))
       const complex_t t2 = 			   
-	std::exp(complex_t(0, static_cast<T>(sign*(i*_PI)/n-_PI/2)))*
+	complex_t(0,-1)*complex_t(plan_sptr->get_real_twiddle(i, sign))*
 	(c[i]-std::conj(c[n-i]));
 
       c[i] = (t1 + t2);
@@ -280,9 +627,8 @@ inverse_fourier_1d_for_real_data_corrupting_input(Array<1,std::complex<T> >& c,
   if (c.size()==0) return Array<1,T>();
   assert(c.get_min_index()==0);
   assert(sign==1 || sign ==-1);
+  // note: the real array has length 2*n, so is always even
   const int n = c.get_length()-1;
-  if (n%2!=0)
-    error("inverse_fourier_1d_of_real_data can only handle arrays of even length.\n");
 
   /* Problematic asserts to check that the imaginary part of c[0] and c[n] is 0
      Trouble is that it could be only approximately 0 (e.g. when calling 
@@ -295,12 +641,13 @@ inverse_fourier_1d_for_real_data_corrupting_input(Array<1,std::complex<T> >& c,
   */
   //assert(fabs(c[0].imag())<=.001*norm(c.begin_all(),c.end_all())/sqrt(n+1.)); // note divide by n+1 to avoid division by 0
   //assert(fabs(c[n].imag())<=.001*norm(c.begin_all(),c.end_all())/sqrt(n+1.));
+  const shared_ptr<detail::FourierPlan> plan_sptr = detail::get_fourier_plan(n);
   for (int i=1; i<=n/2; ++i)
     {
       const complex_t t1 = (c[i]+std::conj(c[n-i]));
-      // TODO could get exp() from static exparray
+      // multiply with exp(i*(-sign*i*_PI/n + _PI/2))
       const complex_t t2 = 			   
-	std::exp(complex_t(0, static_cast<T>(-sign*(i*_PI)/n+_PI/2)))*
+	complex_t(0,1)*complex_t(plan_sptr->get_real_twiddle(i, -sign))*
 	(c[i]-std::conj(c[n-i]));
 
       c[i] = (t1 + t2);
@@ -315,7 +662,11 @@ inverse_fourier_1d_for_real_data_corrupting_input(Array<1,std::complex<T> >& c,
   // now get rid of c[n] 
   c.resize(n);
   //cout << "\nC: " << c/4;
-  inverse_fourier(c, sign);
+  {
+    std::vector<complex_t> work;
+    plan_sptr->transform(&c[0], -sign, work);
+    c /= static_cast<T>(n);
+  }
   // extract real numbers.
   Array<1,T> v(2*n);
   for (int i=0; i<n; ++i)
@@ -115,8 +115,11 @@ const ProjData& proj_data, int subset_num, int num_subsets)
         const ViewSegmentNumbers vs=vs_nums_to_process[i];
 #ifdef STIR_OPENMP
         RelatedViewgrams<float> viewgrams;
+        if (proj_data.supports_concurrent_reading())
+          viewgrams = proj_data.get_related_viewgrams(vs, symmetries_sptr);
+        else
 #pragma omp critical (BACKPROJECTORBYBIN_GETVIEWGRAMS)
-        viewgrams = proj_data.get_related_viewgrams(vs, symmetries_sptr);
+          viewgrams = proj_data.get_related_viewgrams(vs, symmetries_sptr);
 #else
         const RelatedViewgrams<float> viewgrams = 
           proj_data.get_related_viewgrams(vs, symmetries_sptr);
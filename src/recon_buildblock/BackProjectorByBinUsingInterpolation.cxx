@@ -44,6 +44,9 @@
 #include <math.h>
 
 #include <algorithm>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
 using std::min;
 using std::max;
 
@@ -570,6 +573,52 @@ BackProjectorByBinUsingInterpolation::
 
 
 
+/*
+  The incremental backprojection of the beam between ax_pos and ax_pos+1 writes
+  to planes around the middle of the LOR, i.e.
+     z_centre = num_planes_per_axial_pos*(ax_pos+.5) + num_planes_per_physical_ring*delta/2 + axial_pos_to_z_offset
+  However, as the LOR is oblique, the planes extend (for the voxels inside the FOV) up to a distance
+     num_planes_per_physical_ring*delta/2 * fovrad/sqrt(R^2-fovrad^2)
+  (see find_start_values() in BackProjectorByBinUsingInterpolation_3DCho.cxx). We add the
+  axial width of the beam and a safety margin for rounding.
+
+  This function finds how many consecutive axial positions need to be grouped in a "block",
+  such that blocks that are 2 apart never write to the same plane. We can then backproject all
+  even blocks in parallel, followed by all odd blocks, without any 2 threads writing to the same voxel.
+
+  When not using OpenMP (or if we are already in a parallel region, or there are not enough
+  axial positions to make this worthwhile), the returned value is \a num_ax_poss, i.e. 
+  all axial positions are in one block.
+*/
+static int
+find_ax_pos_block_size(const ProjDataInfoCylindricalArcCorr& proj_data_info,
+                       const VoxelsOnCartesianGrid<float>& image,
+                       const float delta,
+                       const float fovrad_in_mm,
+                       const int num_planes_per_axial_pos,
+                       const int num_ax_poss)
+{
+#ifdef STIR_OPENMP
+  if (omp_in_parallel() || omp_get_max_threads() == 1)
+    return num_ax_poss;
+  const float ring_radius = proj_data_info.get_ring_radius();
+  if (ring_radius <= fovrad_in_mm)
+    return num_ax_poss;
+  const float num_planes_per_physical_ring =
+    proj_data_info.get_ring_spacing()/image.get_voxel_size().z();
+  const float max_dist_to_z_centre =
+    num_planes_per_physical_ring*fabs(delta)/2 * 
+    fovrad_in_mm/sqrt(square(ring_radius) - square(fovrad_in_mm))
+    + num_planes_per_axial_pos + 2;
+  const int block_size =
+    static_cast<int>(ceil(2*max_dist_to_z_centre/num_planes_per_axial_pos)) + 1;
+  // we need at least 2 blocks of each colour for this to be useful
+  return 4*block_size > num_ax_poss ? num_ax_poss : block_size;
+#else
+  return num_ax_poss;
+#endif
+}
+
 /****************************************************************************
  real work
  ****************************************************************************/
@@ -671,7 +720,6 @@ can only handle arc-corrected data (cast to ProjDataInfoCylindricalArcCorr)!\n")
 
   const JacobianForIntBP jacobian(proj_data_info_cyl_ptr, use_exact_Jacobian_now);
 
-  Array<4, float > Proj2424(IndexRange4D(0, 1, 0, 3, 0, 1, 1, 4));
   // a variable which will be used in the loops over s to get s_in_mm
   Bin bin(pos_view.get_segment_num(), pos_view.get_view_num(),min_axial_pos_num,0);    
 
@@ -684,7 +732,29 @@ can only handle arc-corrected data (cast to ProjDataInfoCylindricalArcCorr)!\n")
   // a 'beam', each step takes elements from ax_pos and ax_pos+1. So, data in
   // a ring influences beam ax_pos-1 and ax_pos. All this means that we
   // have to let ax_pos run from min_axial_pos_num-1 to max_axial_pos_num.
-  for (int ax_pos = min_axial_pos_num-1; ax_pos <= max_axial_pos_num; ax_pos++)
+  // The loop over axial positions is split in blocks which are backprojected in parallel.
+  // See find_ax_pos_block_size().
+  const int first_ax_pos = min_axial_pos_num-1;
+  const int block_size =
+    find_ax_pos_block_size(*proj_data_info_cyl_ptr, image,
+                           proj_data_info_cyl_ptr->get_average_ring_difference(pos_view.get_segment_num()),
+                           fovrad_in_mm,
+                           round(symmetries_ptr->get_num_planes_per_axial_pos(pos_view.get_segment_num())),
+                           max_axial_pos_num - first_ax_pos + 1);
+  const int num_blocks = (max_axial_pos_num - first_ax_pos + block_size)/block_size;
+
+  // first do all even blocks, then all odd blocks
+  for (int first_block_num = 0; first_block_num < 2; ++first_block_num)
+  {
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int block_num = first_block_num; block_num < num_blocks; block_num += 2)
+  {
+  Array<4, float > Proj2424(IndexRange4D(0, 1, 0, 3, 0, 1, 1, 4));
+  const int block_max_ax_pos = min(first_ax_pos + (block_num+1)*block_size - 1, max_axial_pos_num);
+
+  for (int ax_pos = first_ax_pos + block_num*block_size; ax_pos <= block_max_ax_pos; ax_pos++)
     {
       const int ax_pos_plus = ax_pos + 1; 
 
@@ -806,6 +876,8 @@ can only handle arc-corrected data (cast to ProjDataInfoCylindricalArcCorr)!\n")
           axial_pos_to_z_offset);
       }
     }
+  } // end of loop over blocks
+  }
   stop_timers();
 }
 
@@ -874,7 +946,6 @@ can only handle arc-corrected data (cast to ProjDataInfoCylindricalArcCorr)!\n")
 
   const JacobianForIntBP jacobian(proj_data_info_cyl_ptr, use_exact_Jacobian_now);
 
-  Array<4, float > Proj2424(IndexRange4D(0, 1, 0, 3, 0, 1, 1, 4));
 
   // a variable which will be used in the loops over s to get s_in_mm
   Bin bin(pos_view.get_segment_num(), pos_view.get_view_num(),min_axial_pos_num,0);    
@@ -919,7 +990,29 @@ can only handle arc-corrected data (cast to ProjDataInfoCylindricalArcCorr)!\n")
   // a 'beam', each step takes elements from ax_pos and ax_pos+1. So, data at
   // ax_pos influences beam ax_pos-1 and ax_pos. All this means that we
   // have to let ax_pos run from min_axial_pos_num-1 to max_axial_pos_num.
-  for (int ax_pos = min_axial_pos_num-1; ax_pos <= max_axial_pos_num; ax_pos++)
+  // The loop over axial positions is split in blocks which are backprojected in parallel.
+  // See find_ax_pos_block_size().
+  const int first_ax_pos = min_axial_pos_num-1;
+  const int block_size =
+    find_ax_pos_block_size(*proj_data_info_cyl_ptr, image,
+                           proj_data_info_cyl_ptr->get_average_ring_difference(pos_view.get_segment_num()),
+                           fovrad_in_mm,
+                           round(symmetries_ptr->get_num_planes_per_axial_pos(pos_view.get_segment_num())),
+                           max_axial_pos_num - first_ax_pos + 1);
+  const int num_blocks = (max_axial_pos_num - first_ax_pos + block_size)/block_size;
+
+  // first do all even blocks, then all odd blocks
+  for (int first_block_num = 0; first_block_num < 2; ++first_block_num)
+  {
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int block_num = first_block_num; block_num < num_blocks; block_num += 2)
+  {
+  Array<4, float > Proj2424(IndexRange4D(0, 1, 0, 3, 0, 1, 1, 4));
+  const int block_max_ax_pos = min(first_ax_pos + (block_num+1)*block_size - 1, max_axial_pos_num);
+
+  for (int ax_pos = first_ax_pos + block_num*block_size; ax_pos <= block_max_ax_pos; ax_pos++)
     {
       const int ax_pos_plus = ax_pos + 1; 
         
@@ -1004,6 +1097,8 @@ can only handle arc-corrected data (cast to ProjDataInfoCylindricalArcCorr)!\n")
 							       axial_pos_to_z_offset);
       }
     }
+  } // end of loop over blocks
+  }
   stop_timers();
 }
 
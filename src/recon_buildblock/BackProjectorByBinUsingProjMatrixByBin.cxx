@@ -40,8 +40,10 @@
      from ForwardProjectorByBinUsingProjMatrixByBin
 */
 #include "stir/recon_buildblock/BackProjectorByBinUsingProjMatrixByBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.h"
 #include "stir/Viewgram.h"
 #include "stir/RelatedViewgrams.h"
+#include "stir/DiscretisedDensity.h"
 #include "stir/is_null_ptr.h"
 
 using std::vector;
@@ -127,6 +129,13 @@ actual_back_project(DiscretisedDensity<3,float>& image,
 		    const int min_axial_pos_num, const int max_axial_pos_num,
 		    const int min_tangential_pos_num, const int max_tangential_pos_num)
 {
+  // if possible, use the rows with linear offsets in the contiguous image data that are stored in the cache
+  BasicCoordinate<3,int> min_indices, max_indices;
+  float * image_data_ptr = 0;
+  if (image.is_contiguous() && image.get_regular_range(min_indices, max_indices) &&
+      proj_matrix_ptr->cache_stores_elems_with_offsets_for(min_indices, max_indices))
+    image_data_ptr = image.get_full_data_ptr();
+
   if (proj_matrix_ptr->is_cache_enabled()/* &&
 					    !proj_matrix_ptr->does_cache_store_only_basic_bins()*/)
     {
@@ -151,8 +160,13 @@ actual_back_project(DiscretisedDensity<3,float>& image,
 		if (viewgram[ax_pos][tang_pos] == 0)
 		  continue;
 		Bin bin(segment_num, view_num, ax_pos, tang_pos, viewgram[ax_pos][tang_pos]);
-		proj_matrix_ptr->get_proj_matrix_elems_for_one_bin(proj_matrix_row, bin);
-		proj_matrix_row.back_project(image, bin);
+		const ProjMatrixElemsForOneBinWithOffsets * row_with_offsets_ptr;
+		const ProjMatrixElemsForOneBin& row =
+		  proj_matrix_ptr->get_proj_matrix_elems_for_one_bin_ref(proj_matrix_row, row_with_offsets_ptr, bin);
+		if (image_data_ptr != 0 && row_with_offsets_ptr != 0)
+		  row_with_offsets_ptr->back_project(image_data_ptr, bin);
+		else
+		  row.back_project(image, bin);
 	      }
 	  ++r_viewgrams_iter;   
 	}
@@ -182,7 +196,8 @@ actual_back_project(DiscretisedDensity<3,float>& image,
 			  tang_pos);
 	    symmetries->find_basic_bin(basic_bin);
     
-	    proj_matrix_ptr->get_proj_matrix_elems_for_one_bin(proj_matrix_row, basic_bin);
+	    const ProjMatrixElemsForOneBin& basic_proj_matrix_row =
+	      proj_matrix_ptr->get_proj_matrix_elems_for_one_bin_ref(proj_matrix_row, basic_bin);
       
 	    related_ax_tang_poss.resize(0);
 	    symmetries->get_related_bins_factorised(related_ax_tang_poss,basic_bin,
@@ -215,7 +230,7 @@ actual_back_project(DiscretisedDensity<3,float>& image,
 		    // KT 21/02/2002 added check on 0
 		    if ((*viewgram_iter)[axial_pos_tmp][tang_pos_tmp] == 0)
 		      continue;
-		    proj_matrix_row_copy = proj_matrix_row;
+		    proj_matrix_row_copy = basic_proj_matrix_row;
 		    Bin bin(viewgram_iter->get_segment_num(),
 			    viewgram_iter->get_view_num(),
 			    axial_pos_tmp,
@@ -231,6 +246,7 @@ actual_back_project(DiscretisedDensity<3,float>& image,
 		    assert(bin.tangential_pos_num() == basic_bin.tangential_pos_num());
 	      
 		    symm_op_ptr->transform_proj_matrix_elems_for_one_bin(proj_matrix_row_copy);
+		    // this row is used only once, so converting it to linear offsets would not help
 		    proj_matrix_row_copy.back_project(image, bin);
 		  }
 	      }  
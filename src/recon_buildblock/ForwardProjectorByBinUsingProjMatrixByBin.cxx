@@ -31,6 +31,7 @@
 
 
 #include "stir/recon_buildblock/ForwardProjectorByBinUsingProjMatrixByBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.h"
 #include "stir/Viewgram.h"
 #include "stir/RelatedViewgrams.h"
 #include "stir/IndexRange2D.h"
@@ -124,6 +125,13 @@ ForwardProjectorByBinUsingProjMatrixByBin::
 		  const int min_axial_pos_num, const int max_axial_pos_num,
 		  const int min_tangential_pos_num, const int max_tangential_pos_num)
 {
+  // if possible, use the rows with linear offsets in the contiguous image data that are stored in the cache
+  BasicCoordinate<3,int> min_indices, max_indices;
+  const float * image_data_ptr = 0;
+  if (image.is_contiguous() && image.get_regular_range(min_indices, max_indices) &&
+      proj_matrix_ptr->cache_stores_elems_with_offsets_for(min_indices, max_indices))
+    image_data_ptr = image.get_const_full_data_ptr();
+
   if (proj_matrix_ptr->is_cache_enabled()/* &&
 					    !proj_matrix_ptr->does_cache_store_only_basic_bins()*/)
   {
@@ -145,8 +153,13 @@ ForwardProjectorByBinUsingProjMatrixByBin::
         for ( int ax_pos = min_axial_pos_num; ax_pos <= max_axial_pos_num ;++ax_pos)
         { 
           Bin bin(segment_num, view_num, ax_pos, tang_pos, 0);
-          proj_matrix_ptr->get_proj_matrix_elems_for_one_bin(proj_matrix_row, bin);
-          proj_matrix_row.forward_project(bin,image);
+          const ProjMatrixElemsForOneBinWithOffsets * row_with_offsets_ptr;
+          const ProjMatrixElemsForOneBin& row =
+            proj_matrix_ptr->get_proj_matrix_elems_for_one_bin_ref(proj_matrix_row, row_with_offsets_ptr, bin);
+          if (image_data_ptr != 0 && row_with_offsets_ptr != 0)
+            row_with_offsets_ptr->forward_project(bin, image_data_ptr);
+          else
+            row.forward_project(bin,image);
           viewgram[ax_pos][tang_pos] = bin.get_bin_value();
         }
         ++r_viewgrams_iter; 
@@ -175,7 +188,8 @@ ForwardProjectorByBinUsingProjMatrixByBin::
         Bin basic_bin(viewgrams.get_basic_segment_num(),viewgrams.get_basic_view_num(),ax_pos,tang_pos);
         symmetries->find_basic_bin(basic_bin);
         
-        proj_matrix_ptr->get_proj_matrix_elems_for_one_bin(proj_matrix_row, basic_bin);
+        const ProjMatrixElemsForOneBin& basic_proj_matrix_row =
+          proj_matrix_ptr->get_proj_matrix_elems_for_one_bin_ref(proj_matrix_row, basic_bin);
         
         vector<AxTangPosNumbers> r_ax_poss;
         symmetries->get_related_bins_factorised(r_ax_poss,basic_bin,
@@ -206,7 +220,7 @@ ForwardProjectorByBinUsingProjMatrixByBin::
                ++viewgram_iter)
           {
             Viewgram<float>& viewgram = *viewgram_iter;
-            proj_matrix_row_copy = proj_matrix_row;
+            proj_matrix_row_copy = basic_proj_matrix_row;
             Bin bin(viewgram_iter->get_segment_num(),
                     viewgram_iter->get_view_num(),
                     axial_pos_tmp,
@@ -217,6 +231,7 @@ ForwardProjectorByBinUsingProjMatrixByBin::
             assert(bin == basic_bin);
             
             symm_op_ptr->transform_proj_matrix_elems_for_one_bin(proj_matrix_row_copy);
+            // this row is used only once, so converting it to linear offsets would not help
             proj_matrix_row_copy.forward_project(bin,image);
             
             viewgram[axial_pos_tmp][tang_pos_tmp] = bin.get_bin_value();
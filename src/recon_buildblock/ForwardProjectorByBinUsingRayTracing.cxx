@@ -69,6 +69,7 @@
 #include "stir/IndexRange4D.h"
 #include "stir/Array.h"
 #include "stir/round.h"
+#include "stir/is_null_ptr.h"
 
 #include <algorithm>
 using std::min;
@@ -190,8 +191,14 @@ actual_forward_project(RelatedViewgrams<float>& viewgrams,
 
 {
   // this will throw an exception when the cast does not work
-  const VoxelsOnCartesianGrid<float>& image = 
+  const VoxelsOnCartesianGrid<float>& input_image = 
     dynamic_cast<const VoxelsOnCartesianGrid<float>&>(density);
+  // proj_Siddon accesses the image data via a pointer, so we need a contiguous image
+  shared_ptr<VoxelsOnCartesianGrid<float> > contiguous_image_sptr;
+  if (!input_image.is_contiguous())
+    contiguous_image_sptr.reset(new VoxelsOnCartesianGrid<float>(input_image));
+  const VoxelsOnCartesianGrid<float>& image = 
+    is_null_ptr(contiguous_image_sptr) ? input_image : *contiguous_image_sptr;
 
   const int num_views = viewgrams.get_proj_data_info_ptr()->get_num_views();
 
@@ -1356,7 +1363,7 @@ forward_project_all_symmetries_2D(Viewgram<float> & pos_view,
 		      (4,
 #endif
 		      Projall2, image, proj_data_info_ptr, cphi, sphi, 
-				 delta + D, 0, R,min_axial_pos_num, max_axial_pos_num,
+				 delta + D, 0, R,min_axial_pos_num, max_axial_pos_num+1,
 				 -0.5F, num_planes_per_axial_pos, axial_pos_to_z_offset ,
 				 1.F/4,
 				 restrict_to_cylindrical_FOV))
@@ -60,6 +60,7 @@
 #include "stir/round.h"
 #include <math.h>
 #include <algorithm>
+#include <cstddef>
 #ifndef STIR_NO_NAMESPACE
 using std::min;
 using std::max;
@@ -72,6 +73,36 @@ static inline int sign(const T& t)
   return t<0 ? -1 : 1;
 }
 
+/* Find the range of "lanes" k (i.e. related axial positions) for which the plane
+   first_plane + k*lane_stride_in_planes is inside the image (i.e. between 0 and max_plane).
+   The range is empty (min_lane>max_lane) if none are.
+*/
+static inline void
+find_lanes_inside_image(int& min_lane, int& max_lane,
+                        const int first_plane, const int lane_stride_in_planes,
+                        const int num_lanes, const int max_plane)
+{
+  min_lane = 
+    first_plane>=0 ? 0 : (-first_plane + lane_stride_in_planes - 1)/lane_stride_in_planes;
+  max_lane = 
+    first_plane>max_plane ? -1 : min(num_lanes-1, (max_plane - first_plane)/lane_stride_in_planes);
+}
+
+/* Adds d*image_data_ptr[first_offset + k*lane_stride] to proj_ptr[16*k] for k in [min_lane,max_lane].
+   This loop has no dependencies between iterations, such that the compiler
+   can vectorise it (with gather instructions, if available).
+*/
+static inline void
+add_to_lanes(float * const proj_ptr, const float * const image_data_ptr,
+             const int first_offset, const int lane_stride,
+             const int min_lane, const int max_lane, const float d)
+{
+  const float * image_ptr = image_data_ptr + (first_offset + min_lane*lane_stride);
+  float * lane_ptr = proj_ptr + 16*min_lane;
+  for (int k=min_lane; k<=max_lane; ++k, image_ptr += lane_stride, lane_ptr += 16)
+    *lane_ptr += d * *image_ptr;
+}
+
 /*!
   This function uses a 3D version of Siddon's algorithm for forward projecting.
   See M. Egger's thesis for details.
@@ -82,6 +113,8 @@ static inline int sign(const T& t)
   min_axial_pos_num and max_axial_pos_num.
 
   See RayTraceVoxelsOnCartesianGrid for a shorter and clearer version of the Siddon algorithm.
+
+  The image has to be stored contiguously (see Array::is_contiguous()).
   */
 
 
@@ -312,231 +345,125 @@ proj_Siddon(
   // KT&CL 30/01/98 simplify initialisation (doing a bit too much work sometimes)
   Projptr.fill(0);
 
-  /*
-    for (ring0 = rmin; ring0 <= rmax; ring0++) {
-    if (Siddon == 2) {
-    for (i = 0; i <= 1; i++) {
-    Projptr[ring0][i][0][0] = 0.;
-    Projptr[ring0][i][0][2] = 0.;
-    }
-    } else if (Siddon == 4) {
-    for (i = 0; i <= 1; i++)
-    for (k = 0; k <= 3; k++)
-    Projptr[ring0][i][0][k] = 0.;
-    } else if (Siddon == 3) {
-    for (i = 0; i <= 1; i++)
-    for (j = 0; j <= 1; j++)
-    for (k = 0; k <= 3; k++)
-    Projptr[ring0][i][j][k] = 0.;
-    } else if (Siddon == 1) {
-    for (i = 0; i <= 1; i++)
-    for (j = 0; j <= 1; j++) {
-    Projptr[ring0][i][j][0] = 0.;
-    Projptr[ring0][i][j][2] = 0.;
-    }
-    }
-    }
-  */
   /* Now we go slowly along the LOR */
   if (zero_diff_in_x) ax = axend; else ax += inc_x;
   if (zero_diff_in_y) ay = ayend; else ay += inc_y;
   if (zero_diff_in_z) az = azend; else az += inc_z;
 
-  // these are used to check boundaries on Z
-  // We do not use get_min_index() explicitly as presumably a comparison with 0 
-  // is just a tiny bit faster...
-  // TODO remove this
-  const int maxplane = Bild.get_max_index(); 
+  /* We use direct access to the (contiguous) data of the image and Projptr.
+     The related axial positions (ring0) are handled as "lanes": for every
+     voxel on the LOR, we accumulate the image values at planes Z+k*num_planes_per_axial_pos
+     (and Q+k*num_planes_per_axial_pos) for all k. The range of valid k is computed 
+     once per plane, such that the inner loops (see add_to_lanes()) do not need
+     any boundary checks.
+
+     Elements in Projptr for ring0 are stored at offset (ring0-rmin)*16 + i*8+j*4+k
+     for Projptr[ring0][i][j][k].
+  */
   assert(Bild.get_min_index() == 0);
+  assert(Projptr.get_min_index() == rmin);
+  assert(Projptr.size_all() == static_cast<std::size_t>(16*(rmax-rmin+1)));
+  const float * const image_data_ptr = Bild.get_const_full_data_ptr();
+  float * const proj_data_ptr = Projptr.get_full_data_ptr();
+  const int row_stride = Bild.get_x_size();
+  const int plane_stride = row_stride*Bild.get_y_size();
+  // offset of the voxel with coordinates (0,0,0)
+  const int centre_offset = -Bild.get_min_y()*row_stride - Bild.get_min_x();
+  const int lane_stride = num_planes_per_axial_pos*plane_stride;
+  const int num_lanes = rmax - rmin + 1;
+  const int maxplane = Bild.get_max_index(); 
+
+  int min_lane_Z, max_lane_Z, min_lane_Q, max_lane_Q;
+  find_lanes_inside_image(min_lane_Z, max_lane_Z, Z, num_planes_per_axial_pos, num_lanes, maxplane);
+  find_lanes_inside_image(min_lane_Q, max_lane_Q, Q, num_planes_per_axial_pos, num_lanes, maxplane);
 
   while (a < amax) {
+    /* find where the LOR leaves the current voxel: 
+       0: through the yz-plane, 1: through the xz-plane, 2: through the xy-plane
+    */
+    int direction;
+    float a_next;
     if (ax < ay)
-      if (ax < az) {	/* LOR leaves voxel through yz-plane */
-	const float d = ax - a;
-	int Zdup = Z;
-	int Qdup = Q;
-        for (int ring0 = rmin; 
-	     ring0 <= rmax; 
-	     ring0++, Zdup += num_planes_per_axial_pos, Qdup +=num_planes_per_axial_pos )
-	{
-	  /* Alle Symetrien ausser s */
-	  if (Zdup >= 0 && Zdup <= maxplane) {
-	    Projptr[ring0][0][0][0] += d * Bild[Zdup][Y][X];
-	    Projptr[ring0][0][0][2] += d * Bild[Zdup][X][-Y];
-	    if ((Siddon == 4) || (Siddon == 3)) {
-	      Projptr[ring0][1][0][1] += d * Bild[Zdup][X][Y];
-	      Projptr[ring0][1][0][3] += d * Bild[Zdup][Y][-X];
-	    }
-	    if ((Siddon == 1) || (Siddon == 3)) {
-	      Projptr[ring0][1][1][0] += d * Bild[Zdup][-Y][-X];
-	      Projptr[ring0][1][1][2] += d * Bild[Zdup][-X][Y];
-	    }
-	    if (Siddon == 3) {
-	      Projptr[ring0][0][1][1] += d * Bild[Zdup][-X][-Y];
-	      Projptr[ring0][0][1][3] += d * Bild[Zdup][-Y][X];
-	    }
-	  }
-	  if (Qdup >= 0 && Qdup <= maxplane) {
-	    if ((Siddon == 4) || (Siddon == 3)) {
-	      Projptr[ring0][0][0][1] += d * Bild[Qdup][X][Y];
-	      Projptr[ring0][0][0][3] += d * Bild[Qdup][Y][-X];
-	    }
-	    if ((Siddon == 1) || (Siddon == 3)) {
-	      Projptr[ring0][0][1][0] += d * Bild[Qdup][-Y][-X];
-	      Projptr[ring0][0][1][2] += d * Bild[Qdup][-X][Y];
-	    }
-	    if (Siddon == 3) {
-	      Projptr[ring0][1][1][1] += d * Bild[Qdup][-X][-Y];
-	      Projptr[ring0][1][1][3] += d * Bild[Qdup][-Y][X];
-	    }
-	    Projptr[ring0][1][0][0] += d * Bild[Qdup][Y][X];
-	    Projptr[ring0][1][0][2] += d * Bild[Qdup][X][-Y];
-	  }
-						
-	}
-	a = ax ;  ax +=  inc_x;
-	X--;
-      } else {	/* LOR leaves voxel through xy-plane */
-	const float d = az - a;
-	int Zdup = Z;
-	int Qdup = Q;
-        for (int ring0 = rmin; 
-	     ring0 <= rmax; 
-	     ring0++, Zdup += num_planes_per_axial_pos, Qdup +=num_planes_per_axial_pos )
-	{
-	  /* all symmetries except in 's'*/
-	  if (Zdup >= 0 && Zdup <= maxplane) {
-	    Projptr[ring0][0][0][0] += d * Bild[Zdup][Y][X];
-	    Projptr[ring0][0][0][2] += d * Bild[Zdup][X][-Y];
-	    if ((Siddon == 4) || (Siddon == 3)) {
-	      Projptr[ring0][1][0][1] += d * Bild[Zdup][X][Y];
-	      Projptr[ring0][1][0][3] += d * Bild[Zdup][Y][-X];
-	    }
-	    if ((Siddon == 1) || (Siddon == 3)) {
-	      Projptr[ring0][1][1][0] += d * Bild[Zdup][-Y][-X];
-	      Projptr[ring0][1][1][2] += d * Bild[Zdup][-X][Y];
-	    }
-	    if (Siddon == 3) {
-	      Projptr[ring0][0][1][1] += d * Bild[Zdup][-X][-Y];
-	      Projptr[ring0][0][1][3] += d * Bild[Zdup][-Y][X];
-
-	    }
-	  }
-	  if (Qdup >= 0 && Qdup <= maxplane) {
-	    if ((Siddon == 4) || (Siddon == 3)) {
-	      Projptr[ring0][0][0][1] += d * Bild[Qdup][X][Y];
-	      Projptr[ring0][0][0][3] += d * Bild[Qdup][Y][-X];
-	    }
-	    if ((Siddon == 1) || (Siddon == 3)) {
-	      Projptr[ring0][0][1][0] += d * Bild[Qdup][-Y][-X];
-	      Projptr[ring0][0][1][2] += d * Bild[Qdup][-X][Y];
-	    }
-	    if (Siddon == 3) {
-	      Projptr[ring0][1][1][1] += d * Bild[Qdup][-X][-Y];
-	      Projptr[ring0][1][1][3] += d * Bild[Qdup][-Y][X];
-	    }
-	    Projptr[ring0][1][0][0] += d * Bild[Qdup][Y][X];
-	    Projptr[ring0][1][0][2] += d * Bild[Qdup][X][-Y];
-	  }
-						
-	}
-	a = az ;  az +=  inc_z;
-	Z++;
-	Q--;
-      }
-    else if (ay < az) {	/* LOR leaves voxel through xz-plane */
-      const float d = ay - a;
-      int Zdup = Z;
-      int Qdup = Q;
-      for (int ring0 = rmin; 
-           ring0 <= rmax; 
-	   ring0++, Zdup += num_planes_per_axial_pos, Qdup +=num_planes_per_axial_pos )
-	   {
-	/*   all symmetries except in 's' */
-	if (Zdup >= 0 && Zdup <= maxplane) {
-	  Projptr[ring0][0][0][0] += d * Bild[Zdup][Y][X];
-	  Projptr[ring0][0][0][2] += d * Bild[Zdup][X][-Y];
-	  if ((Siddon == 4) || (Siddon == 3)) {
-	    Projptr[ring0][1][0][1] += d * Bild[Zdup][X][Y];
-	    Projptr[ring0][1][0][3] += d * Bild[Zdup][Y][-X];
-	  }
-	  if ((Siddon == 1) || (Siddon == 3)) {
-	    Projptr[ring0][1][1][0] += d * Bild[Zdup][-Y][-X];
-	    Projptr[ring0][1][1][2] += d * Bild[Zdup][-X][Y];
-	  }
-	  if (Siddon == 3) {
-	    Projptr[ring0][0][1][1] += d * Bild[Zdup][-X][-Y];
-	    Projptr[ring0][0][1][3] += d * Bild[Zdup][-Y][X];
-	  }
-	}
-	if (Qdup >= 0 && Qdup <= maxplane) {
-	  if ((Siddon == 4) || (Siddon == 3)) {
-	    Projptr[ring0][0][0][1] += d * Bild[Qdup][X][Y];
-	    Projptr[ring0][0][0][3] += d * Bild[Qdup][Y][-X];
-	  }
-	  if ((Siddon == 1) || (Siddon == 3)) {
-	    Projptr[ring0][0][1][0] += d * Bild[Qdup][-Y][-X];
-	    Projptr[ring0][0][1][2] += d * Bild[Qdup][-X][Y];
-	  }
-	  if (Siddon == 3) {
-	    Projptr[ring0][1][1][1] += d * Bild[Qdup][-X][-Y];
-	    Projptr[ring0][1][1][3] += d * Bild[Qdup][-Y][X];
-	  }
-	  Projptr[ring0][1][0][0] += d * Bild[Qdup][Y][X];
-	  Projptr[ring0][1][0][2] += d * Bild[Qdup][X][-Y];
-	}
-					
+      if (ax < az) { direction = 0; a_next = ax; }
+      else { direction = 2; a_next = az; }
+    else if (ay < az) { direction = 1; a_next = ay; }
+    else { direction = 2; a_next = az; }
+
+    const float d = a_next - a;
+
+    // offsets in the plane for all symmetries, e.g. YmX corresponds to Bild[.][Y][-X]
+    const int YX = Y*row_stride + X;
+    const int XmY = X*row_stride - Y;
+    const int XY = X*row_stride + Y;
+    const int YmX = Y*row_stride - X;
+    const int mYmX = -Y*row_stride - X;
+    const int mXY = -X*row_stride + Y;
+    const int mXmY = -X*row_stride - Y;
+    const int mYX = -Y*row_stride + X;
+
+    if (min_lane_Z <= max_lane_Z)
+      {
+        /* all symmetries except in 's'*/
+        const int Z_offset = centre_offset + Z*plane_stride;
+#define STIR_SIDDON_ADD(index, offset) \
+        add_to_lanes(proj_data_ptr + (index), image_data_ptr, Z_offset + (offset), lane_stride, min_lane_Z, max_lane_Z, d)
+        STIR_SIDDON_ADD(0, YX);    // Projptr[ring0][0][0][0]
+        STIR_SIDDON_ADD(2, XmY);   // Projptr[ring0][0][0][2]
+        if ((Siddon == 4) || (Siddon == 3)) {
+          STIR_SIDDON_ADD(9, XY);  // Projptr[ring0][1][0][1]
+          STIR_SIDDON_ADD(11, YmX);// Projptr[ring0][1][0][3]
+        }
+        if ((Siddon == 1) || (Siddon == 3)) {
+          STIR_SIDDON_ADD(12, mYmX);// Projptr[ring0][1][1][0]
+          STIR_SIDDON_ADD(14, mXY); // Projptr[ring0][1][1][2]
+        }
+        if (Siddon == 3) {
+          STIR_SIDDON_ADD(5, mXmY); // Projptr[ring0][0][1][1]
+          STIR_SIDDON_ADD(7, mYX);  // Projptr[ring0][0][1][3]
+        }
+#undef STIR_SIDDON_ADD
       }
-      a = ay;   ay +=  inc_y;
-      Y++;
-    } else {/* LOR leaves voxel through xy-plane */
-      const float d = az - a;
-      int Zdup = Z;
-      int Qdup = Q;
-        for (int ring0 = rmin; 
-	     ring0 <= rmax; 
-	     ring0++, Zdup += num_planes_per_axial_pos, Qdup +=num_planes_per_axial_pos )
-	{
-	/*   all symmetries except in 's' */
-	if (Zdup >= 0 && Zdup <= maxplane) {
-	  Projptr[ring0][0][0][0] += d * Bild[Zdup][Y][X];
-	  Projptr[ring0][0][0][2] += d * Bild[Zdup][X][-Y];
-	  if ((Siddon == 4) || (Siddon == 3)) {
-	    Projptr[ring0][1][0][1] += d * Bild[Zdup][X][Y];
-	    Projptr[ring0][1][0][3] += d * Bild[Zdup][Y][-X];
-	  }
-	  if ((Siddon == 1) || (Siddon == 3)) {
-	    Projptr[ring0][1][1][0] += d * Bild[Zdup][-Y][-X];
-	    Projptr[ring0][1][1][2] += d * Bild[Zdup][-X][Y];
-	  }
-	  if (Siddon == 3) {
-	    Projptr[ring0][0][1][1] += d * Bild[Zdup][-X][-Y];
-	    Projptr[ring0][0][1][3] += d * Bild[Zdup][-Y][X];
-	  }
-	}
-	if (Qdup >= 0 && Qdup <= maxplane) {
-	  if ((Siddon == 4) || (Siddon == 3)) {
-	    Projptr[ring0][0][0][1] += d * Bild[Qdup][X][Y];
-	    Projptr[ring0][0][0][3] += d * Bild[Qdup][Y][-X];
-	  }
-	  if ((Siddon == 1) || (Siddon == 3)) {
-	    Projptr[ring0][0][1][0] += d * Bild[Qdup][-Y][-X];
-	    Projptr[ring0][0][1][2] += d * Bild[Qdup][-X][Y];
-	  }
-	  if (Siddon == 3) {
-	    Projptr[ring0][1][1][1] += d * Bild[Qdup][-X][-Y];
-	    Projptr[ring0][1][1][3] += d * Bild[Qdup][-Y][X];
-	  }
-	  Projptr[ring0][1][0][0] += d * Bild[Qdup][Y][X];
-	  Projptr[ring0][1][0][2] += d * Bild[Qdup][X][-Y];
-	}
-					
+    if (min_lane_Q <= max_lane_Q)
+      {
+        const int Q_offset = centre_offset + Q*plane_stride;
+#define STIR_SIDDON_ADD(index, offset) \
+        add_to_lanes(proj_data_ptr + (index), image_data_ptr, Q_offset + (offset), lane_stride, min_lane_Q, max_lane_Q, d)
+        if ((Siddon == 4) || (Siddon == 3)) {
+          STIR_SIDDON_ADD(1, XY);   // Projptr[ring0][0][0][1]
+          STIR_SIDDON_ADD(3, YmX);  // Projptr[ring0][0][0][3]
+        }
+        if ((Siddon == 1) || (Siddon == 3)) {
+          STIR_SIDDON_ADD(4, mYmX); // Projptr[ring0][0][1][0]
+          STIR_SIDDON_ADD(6, mXY);  // Projptr[ring0][0][1][2]
+        }
+        if (Siddon == 3) {
+          STIR_SIDDON_ADD(13, mXmY);// Projptr[ring0][1][1][1]
+          STIR_SIDDON_ADD(15, mYX); // Projptr[ring0][1][1][3]
+        }
+        STIR_SIDDON_ADD(8, YX);     // Projptr[ring0][1][0][0]
+        STIR_SIDDON_ADD(10, XmY);   // Projptr[ring0][1][0][2]
+#undef STIR_SIDDON_ADD
       }
-      a = az ;  az +=  inc_z;
-      Z++;
-      Q--;
-    }
 
+    a = a_next;
+    switch (direction)
+      {
+      case 0: /* LOR leaves voxel through yz-plane */
+        ax += inc_x;
+        X--;
+        break;
+      case 1: /* LOR leaves voxel through xz-plane */
+        ay += inc_y;
+        Y++;
+        break;
+      default: /* LOR leaves voxel through xy-plane */
+        az += inc_z;
+        Z++;
+        Q--;
+        find_lanes_inside_image(min_lane_Z, max_lane_Z, Z, num_planes_per_axial_pos, num_lanes, maxplane);
+        find_lanes_inside_image(min_lane_Q, max_lane_Q, Q, num_planes_per_axial_pos, num_lanes, maxplane);
+        break;
+      }
   }		/* Ende while (a<amax) */
 
   return true;
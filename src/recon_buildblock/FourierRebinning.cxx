@@ -51,6 +51,11 @@
 #include "stir/numerics/fourier.h"
 #include "stir/interpolate.h"
 #include "stir/info.h"
+#include "stir/num_threads.h"
+#include "stir/is_null_ptr.h"
+#include "stir/recon_buildblock/OutputImagesForThreads.h"
+#include <vector>
+#include <utility>
 
 #define POSITIVE_Z_SHIFT -1
 #define NEGATIVE_Z_SHIFT 1
@@ -80,6 +85,7 @@ initialise_keymap()
   parser.add_key("Delta max for small omega", &deltamin);
   parser.add_key("Index for consistency", &kc);
   parser.add_key("FORE debug level", &fore_debug_level);
+  parser.add_key("maximum number of arrays for multi-threading", &max_num_arrays_for_threads);
 
 }
  
@@ -90,6 +96,11 @@ post_processing()
 {
   if (base_type::post_processing() == true)
     return true;
+  if (max_num_arrays_for_threads < 0)
+    {
+      warning("FORE: maximum number of arrays for multi-threading should be non-negative");
+      return true;
+    }
   // TODO check other parameterssegment
   return false;
 }  
@@ -107,6 +118,7 @@ set_defaults()
   deltamin = -1;
   kc = -1;
   fore_debug_level = 0;
+  max_num_arrays_for_threads = 0;
 }
 
 FourierRebinning::
@@ -128,17 +140,16 @@ rebin()
   //CON return value 
   Succeeded success = Succeeded::yes;
     
-  //CL Find the number of views and tangential positions power of two
-  int num_views_pow2;
-  for ( num_views_pow2 = 1; num_views_pow2 < 2*proj_data_sptr->get_num_views() && num_views_pow2 < (1<<15); num_views_pow2*=2);
-  int num_tang_poss_pow2;
-  for ( num_tang_poss_pow2 = 1; num_tang_poss_pow2 < proj_data_sptr->get_num_tangential_poss() && num_tang_poss_pow2 < (1<<15); num_tang_poss_pow2*=2);
+  //CL Find the number of views and tangential positions for the FFT
+  //   these only need small prime factors, such that no interpolation is needed for most scanners
+  const int num_views_padded = efficient_fourier_length(2*proj_data_sptr->get_num_views());
+  const int num_tang_poss_padded = efficient_fourier_length(proj_data_sptr->get_num_tangential_poss());
   
   //CL Initialise the 2D Fourier transform of all rebinned sinograms P(w,k)=0
    const int num_planes = proj_data_sptr->get_proj_data_info_ptr()->get_scanner_ptr()->get_num_rings()*2-1;
 
-  Array<3,std::complex<float> > FT_rebinned_data(IndexRange3D(0, num_planes-1, 0, num_views_pow2-1, 0, num_tang_poss_pow2-1));
-  Array<3,float> Weights_for_FT_rebinned_data(IndexRange3D(0, num_planes-1, 0,num_views_pow2-1, 0,num_tang_poss_pow2-1));
+  Array<3,std::complex<float> > FT_rebinned_data(IndexRange3D(0, num_planes-1, 0, num_views_padded-1, 0, num_tang_poss_padded-1));
+  Array<3,float> Weights_for_FT_rebinned_data(IndexRange3D(0, num_planes-1, 0,num_views_padded-1, 0,num_tang_poss_padded-1));
   //CON some statistics
   PETCount_rebinned num_rebinned(0,0,0);
 
@@ -148,7 +159,7 @@ rebin()
   shared_ptr<ProjDataInfo> rebinned_proj_data_info_sptr
     ( proj_data_sptr->get_proj_data_info_ptr()->clone());
   //CON Adapt the properties that will be modified by the rebinning.
-  rebinned_proj_data_info_sptr->set_num_views(num_views_pow2/2);
+  rebinned_proj_data_info_sptr->set_num_views(num_views_padded/2);
   //CON After rebinning we have of course only "direct" sinograms left e.q only segment 0 exists 
   rebinned_proj_data_info_sptr->reduce_segment_range(0,0);
   //CON maximal ring difference a LOR in the largest segment that is going to be rebinned 
@@ -169,7 +180,7 @@ rebin()
   const Scanner* scanner = rebinned_proj_data_sptr->get_proj_data_info_ptr()->get_scanner_ptr();
   const float half_distance_between_rings = scanner->get_ring_spacing()/2.F; 
   const float sampling_distance_in_s = rebinned_proj_data_info_sptr->get_sampling_in_s(Bin(0,0,0,0));
-  const float radial_sampling_freq_w = float(2.*_PI)/sampling_distance_in_s/num_tang_poss_pow2;
+  const float radial_sampling_freq_w = float(2.*_PI)/sampling_distance_in_s/num_tang_poss_padded;
   //CON D = #bins * binsize, R = D / 2
   const float R_field_of_view_mm = ((int) (rebinned_proj_data_info_sptr->get_num_tangential_poss() / 2) - 1)*sampling_distance_in_s;
   const float scanner_space_between_rings = scanner->get_ring_spacing();
@@ -177,85 +188,100 @@ rebin()
   const float ratio_ring_spacing_to_ring_radius = scanner_space_between_rings / scanner_ring_radius;
 
   //CON Check that the user defineable FORE parameters are inside a possible range of values
-  if(fore_check_parameters(num_tang_poss_pow2,num_views_pow2,max_segment_num_to_process) != Succeeded::yes){
+  if(fore_check_parameters(num_tang_poss_padded,num_views_padded,max_segment_num_to_process) != Succeeded::yes){
     error("FORE Rebinning :: Setup failed "); 
    };
   
-  //CON Loop over all positive segments. Negative segments (those with negative (opposite) ring differences
-  //CON will be merged with the positive segment 180 degree sinograms to form a 360 degree segment.  
-   for (int seg_num=0; seg_num <=max_segment_num_to_process ; seg_num++){
-                   
-    info(boost::format("FORE Rebinning :: Processing segment No %1% *") % seg_num);
-
-     // TODO at present, the processing is done by segment. However, it's fairly easy to
-     // change this to by sinogram (the rebinning call below will do everything 
-     // as a loop over axial_pos anyway).
-     // This would save some memory overhead, and increase potential for parallelisation later.
-     // (The parallelised version of FORE in PARAPET was organised this way).
-
-     //CON get one (positive) segment 
-     SegmentBySinogram<float> segment = proj_data_sptr->get_segment_by_sinogram(seg_num);
-
-     //CON Retrieve some segment dependent properties needed for the rebinning kernel
-     const ProjDataInfoCylindrical& proj_data_info_cylindrical = dynamic_cast<const ProjDataInfoCylindrical&>(*segment.get_proj_data_info_ptr());
-     const float average_ring_difference_in_segment = proj_data_info_cylindrical.get_average_ring_difference(segment.get_segment_num());
-   
-    
-     //CL Form a 360 degree sinogram by merging two 180 degree segments  with opposite ring difference
-     //CL to get a new segment sampled over 2*pi (where 0 < view < pi)
-     //CON See DeFrise paper (exact and approximate rebinning algorithms for 3D PET data), Sec IV,C (p153)
-     //KT TODO this is currently not a good idea, as all ProjDataInfo classes assume that
-     //KT views go from 0 to Pi.
-     //CON Get the corresponding (negative) segment with the same absolute but opposite obliqueness   
-     const SegmentBySinogram<float> segment_neg = proj_data_sptr->get_segment_by_sinogram(-seg_num);
-     //CON Expand the (positive) segment such that the two segments can be merged
-     segment.grow(IndexRange3D(segment.get_min_axial_pos_num(), segment.get_max_axial_pos_num(),
-            0,2*segment.get_num_views()-1, segment.get_min_tangential_pos_num(), segment.get_max_tangential_pos_num()
-            ));
-  
-    
-     //CON merge the two segments to form "360 degrees" sinograms   
-     const int min_tangential_pos_num = std::max(segment_neg.get_min_tangential_pos_num(),
-                                                 -segment.get_max_tangential_pos_num());
-
-
-     const int max_tangential_pos_num = std::min(segment_neg.get_max_tangential_pos_num(),
-                                                -segment.get_min_tangential_pos_num());
-
-
-     for (int ring = segment.get_min_axial_pos_num(); ring <= segment.get_max_axial_pos_num(); ring++)
-       for (int view = segment_neg.get_min_view_num(); view <= segment_neg.get_max_view_num(); view++)
-         for( int tangential_pos_num = min_tangential_pos_num; tangential_pos_num<=max_tangential_pos_num; tangential_pos_num++)   
-         segment[ring][view+segment_neg.get_num_views()][tangential_pos_num] = segment_neg[ring][view][-tangential_pos_num];
-      
-    // CON in debug mode visualize the segment	     
-      if(fore_debug_level>=2)  
-	{
-	  char s[100];
-	  sprintf(s, "(extended) segment by sinogram %d",segment.get_segment_num());
-	  display(segment, segment.find_max(), s);
-	}
-	
-    //CON the sinogramm dimensions need to have a dimension which is a power of 2 (required by the FFT algorithm) 
-    //CON for s (radial coordinate) pad the sinogramm with zeros to form a larger array. 
-    //CON the phi (azimuthal cordinate (view)) coordinate is periodic. The samples need to be interpolated to the
-    //CON to the new matrix size. Do this by linear interpolation.             
-    //CON -> DeFrise p. 153 Sec IV.C
-    do_adjust_nb_views_to_pow2(segment);
+  //CON Make a list of all sinograms in the positive segments. Negative segments (those with negative (opposite)
+  //CON ring differences) will be merged with the positive segment 180 degree sinograms to form 360 degree sinograms.
+  //CON The sinograms are read and rebinned one by one, such that the 3D data never have to be in memory.
+  std::vector<std::pair<int,int> > seg_and_axial_pos_nums;
+  for (int seg_num=0; seg_num <=max_segment_num_to_process ; seg_num++)
+    for (int axial_pos_num = proj_data_sptr->get_min_axial_pos_num(seg_num);
+         axial_pos_num <= proj_data_sptr->get_max_axial_pos_num(seg_num);
+         axial_pos_num++)
+      seg_and_axial_pos_nums.push_back(std::make_pair(seg_num, axial_pos_num));
+  std::vector<PETCount_rebinned> num_rebinned_per_segment(max_segment_num_to_process+1);
+
+  set_num_threads();
+  //CON Threads rebin into separate arrays, which are summed at the end.
+  //CON The first array is FT_rebinned_data itself, the others are allocated when first used.
+  //CON The number of arrays can be limited to reduce memory (threads then share arrays).
+  //CON The weights use the same index as the rebinned data, such that they are protected by the same lock.
+  OutputImagesForThreads<Array<3,std::complex<float> > >
+    FT_rebinned_data_for_threads(&FT_rebinned_data, max_num_arrays_for_threads);
+  std::vector<shared_ptr<Array<3,float> > >
+    local_Weights_for_FT_rebinned_data_sptrs(FT_rebinned_data_for_threads.get_num_images());
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) shared(FT_rebinned_data_for_threads, local_Weights_for_FT_rebinned_data_sptrs, num_rebinned_per_segment)
+#endif
+  // note: older versions of openmp need an int as loop
+  for (int sino_num=0; sino_num<static_cast<int>(seg_and_axial_pos_nums.size()); ++sino_num)
+    {
+      const int seg_num = seg_and_axial_pos_nums[sino_num].first;
+      const int axial_pos_num = seg_and_axial_pos_nums[sino_num].second;
+
+      if (axial_pos_num == proj_data_sptr->get_min_axial_pos_num(seg_num))
+        info(boost::format("FORE Rebinning :: Processing segment No %1% *") % seg_num);
+      if(axial_pos_num%10 == 0)
+        info(boost::format("FORE Rebinning z (slice) = %1% of segment %2%") % axial_pos_num % seg_num);
+
+      //CL Form a 360 degree sinogram by merging two 180 degree sinograms with opposite ring difference
+      //CON and adjust the number of views for the FFT
+      Array<2,float> sinogram;
+      get_sinogram_for_rebinning(sinogram, seg_num, axial_pos_num, num_views_padded);
+
+      //CON Retrieve some segment dependent properties needed for the rebinning kernel
+      const ProjDataInfoCylindrical& proj_data_info_cylindrical =
+        dynamic_cast<const ProjDataInfoCylindrical&>(*proj_data_sptr->get_proj_data_info_ptr());
+      const float average_ring_difference_in_segment = proj_data_info_cylindrical.get_average_ring_difference(seg_num);
+      //CON determine the axial position of the middle of the LOR in mm relative to Bin(segment=0,view=0,axial_pos=0,tang_pos=0)  
+      const float z_in_mm = 
+        proj_data_info_cylindrical.get_m(Bin(seg_num,0,axial_pos_num,0)) - proj_data_info_cylindrical.get_m(Bin(0,0,0,0));
+
+      //CON The rebinned data is stored in a 3 dimensional array of complex numbers (FT_rebinned_data).
+      //CON FT_rebinned_data[plane][w(FT of s)][k(FT of phi)] 
+      //CON Weight has the same dimensions. It stores normalisation factors (floats)
+      //CON to take into account the variable number of contributions to each frequency.     
+      int array_num;
+      Array<3,std::complex<float> >* FT_rebinned_data_ptr = FT_rebinned_data_for_threads.get_image(array_num);
+      Array<3,float>* Weights_for_FT_rebinned_data_ptr = &Weights_for_FT_rebinned_data;
+      if (array_num != 0)
+        {
+          if (is_null_ptr(local_Weights_for_FT_rebinned_data_sptrs[array_num]))
+            local_Weights_for_FT_rebinned_data_sptrs[array_num].
+              reset(new Array<3,float>(Weights_for_FT_rebinned_data.get_index_range()));
+          Weights_for_FT_rebinned_data_ptr = local_Weights_for_FT_rebinned_data_sptrs[array_num].get();
+        }
+      PETCount_rebinned num_rebinned_this_sinogram(0,0,0);
+      do_rebinning(*FT_rebinned_data_ptr, *Weights_for_FT_rebinned_data_ptr, num_rebinned_this_sinogram, sinogram,
+                   z_in_mm, num_tang_poss_padded, num_views_padded, average_ring_difference_in_segment,
+                   half_distance_between_rings, sampling_distance_in_s, radial_sampling_freq_w, R_field_of_view_mm,
+                   ratio_ring_spacing_to_ring_radius);
+      FT_rebinned_data_for_threads.release_image(array_num);
+#ifdef STIR_OPENMP
+#pragma omp critical(FORE_COUNT)
+#endif
+      num_rebinned_per_segment[seg_num] += num_rebinned_this_sinogram;
+    }  //CON end loop over sinograms
 
-    
-    //CON The sinogramm data is now in the required format and ready for rebinning.       
-    //CON The rebinned data is stored in a 3 dimensional array of complex numbers (FT_rebinned_data).
-    //CON FT_rebinned_data[plane][w(FT of s)][k(FT of phi)] 
-    //CON Weight has the same dimensions. It stores normalisation factors (floats)
-    //CON to take into account the variable number of contributions to each frequency.     
-    do_rebinning(FT_rebinned_data, Weights_for_FT_rebinned_data, num_rebinned, segment,
-                 num_tang_poss_pow2, num_views_pow2, num_planes, average_ring_difference_in_segment,
-                 half_distance_between_rings, sampling_distance_in_s, radial_sampling_freq_w, R_field_of_view_mm,
-	         ratio_ring_spacing_to_ring_radius);
-  
- }  //CON end loop over segments.
+  //CON "reduce" the data rebinned by the threads, plane by plane, such that this can be done in parallel
+  FT_rebinned_data_for_threads.add_to_output_image();
+  add_images_plane_by_plane(Weights_for_FT_rebinned_data, local_Weights_for_FT_rebinned_data_sptrs);
 
+  for (int seg_num=0; seg_num <=max_segment_num_to_process ; seg_num++)
+    {
+      if(fore_debug_level > 0)
+        info(boost::format("FORE Rebinning :: segment %1%\n"
+                           "Total rebinned: %2%\n"
+                           "Total missed: %3%\n"
+                           "Total rebinned SSRB: %4%")
+             % seg_num
+             % num_rebinned_per_segment[seg_num].total
+             % num_rebinned_per_segment[seg_num].miss
+             % num_rebinned_per_segment[seg_num].ssrb);
+      num_rebinned += num_rebinned_per_segment[seg_num];
+    }
 
   //CON Some statistics 
   std::cout << "\nFORE Rebinning :: Total rebinning count: \n";
@@ -265,7 +291,10 @@ rebin()
   //CL now finally fill in the new sinogram s
   SegmentBySinogram<float> sino2D_rebinned = rebinned_proj_data_sptr->get_empty_segment_by_sinogram(0);
 
-  
+  //CON planes are independent, so can be done in parallel (except when displaying)
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) shared(sino2D_rebinned) if(fore_debug_level<3)
+#endif
   for (int plane=FT_rebinned_data.get_min_index();plane <= FT_rebinned_data.get_max_index(); plane++){
    
    if(plane%10==0) info(boost::format("FORE Rebinning :: Inv FFT rebinned z-position (slice) = %1%") % plane);
@@ -277,14 +306,14 @@ rebin()
   //CON the rebinning weights
   //CON before the inv. FFT can be applied this is not much overhead and it can be left like it was done when still 
   //CON using the numerical receipies FFT code.       
-   Array<2, std::complex<float> > FT_rebinned_sinogram(IndexRange2D(0,num_tang_poss_pow2-1,0,num_views_pow2/2));
+   Array<2, std::complex<float> > FT_rebinned_sinogram(IndexRange2D(0,num_tang_poss_padded-1,0,num_views_padded/2));
   //CON fourier_for_real_data will resize the array to its appropriate dimensions
    Array<2,float> rebinned_sinogram(IndexRange2D(0,1,0,1));
  
   //CON Normalise the rebinned sinograms by applying the weight factors
   //CON See DeFrise IV.D p154.   
- for (int j = 0; j < num_tang_poss_pow2; j++) {    
-   for (int i = 0; i <= num_views_pow2/2; i++) {   
+ for (int j = 0; j < num_tang_poss_padded; j++) {    
+   for (int i = 0; i <= num_views_padded/2; i++) {   
      const float Actual_Weight = (Weights_for_FT_rebinned_data[plane][i][j] == 0) ? 0 : 
        1.F/(Weights_for_FT_rebinned_data[plane][i][j]);
      FT_rebinned_sinogram[j][i] = FT_rebinned_data[plane][i][j]* Actual_Weight;
@@ -296,13 +325,13 @@ rebin()
     {
       char s[100];
       Array<2,float> real(FT_rebinned_sinogram.get_index_range());
-      for (int i = 0; i < num_views_pow2; i++) 
-	for (int j = 0; j <= num_tang_poss_pow2/2; j++) 
+      for (int i = 0; i < num_views_padded; i++) 
+	for (int j = 0; j <= num_tang_poss_padded/2; j++) 
           real[i][j] = FT_rebinned_sinogram[i][j].real();
       sprintf(s, "real part of FT of rebinned (extended) sinogram %d",plane);
       display(real, s, real.find_max());
-      for (int i = 0; i < num_views_pow2; i++) 
-	for (int j = 0; j <= num_tang_poss_pow2/2; j++) 
+      for (int i = 0; i < num_views_padded; i++) 
+	for (int j = 0; j <= num_tang_poss_padded/2; j++) 
           real[i][j] = FT_rebinned_sinogram[i][j].imag();
       sprintf(s, "imag part of FT of rebinned (extended) sinogram %d",plane);
       display(real, s, real.find_max());
@@ -312,8 +341,8 @@ rebin()
     rebinned_sinogram = inverse_fourier_for_real_data(FT_rebinned_sinogram); 
 
    //CL Keep only one half of data [o.._PI]
-    for (int i=0;i<(int)(num_views_pow2/2);i++) 
-     for (int j=0;j<num_tang_poss_pow2;j++)
+    for (int i=0;i<(int)(num_views_padded/2);i++) 
+     for (int j=0;j<num_tang_poss_padded;j++)
         if ((j+sino2D_rebinned.get_min_tangential_pos_num())<=sino2D_rebinned.get_max_tangential_pos_num()) 
           sino2D_rebinned[plane][i][j+sino2D_rebinned.get_min_tangential_pos_num()]=rebinned_sinogram[j][i];
            
@@ -344,59 +373,87 @@ rebin()
 
 
 
+void
+FourierRebinning::
+get_sinogram_for_rebinning(Array<2,float>& sinogram, const int seg_num, const int axial_pos_num,
+                           const int num_views_padded) const
+{
+  //CON Get the sinogram and the corresponding one with the same absolute but opposite obliqueness
+  //CON (for segment 0, this is the same sinogram)
+  Sinogram<float> sino_pos = proj_data_sptr->get_empty_sinogram(axial_pos_num, seg_num);
+  Sinogram<float> sino_neg = proj_data_sptr->get_empty_sinogram(axial_pos_num, -seg_num);
+  if (proj_data_sptr->supports_concurrent_reading())
+    {
+      sino_pos = proj_data_sptr->get_sinogram(axial_pos_num, seg_num);
+      sino_neg = seg_num==0 ? sino_pos : proj_data_sptr->get_sinogram(axial_pos_num, -seg_num);
+    }
+  else
+#ifdef STIR_OPENMP
+#pragma omp critical(FORE_get_sinogram)
+#endif
+    {
+      sino_pos = proj_data_sptr->get_sinogram(axial_pos_num, seg_num);
+      sino_neg = seg_num==0 ? sino_pos : proj_data_sptr->get_sinogram(axial_pos_num, -seg_num);
+    }
+
+  //CL Form a 360 degree sinogram by merging two 180 degree sinograms with opposite ring difference
+  //CL to get a new sinogram sampled over 2*pi (where 0 < view < pi)
+  //CON See DeFrise paper (exact and approximate rebinning algorithms for 3D PET data), Sec IV,C (p153)
+  //KT TODO this is currently not a good idea, as all ProjDataInfo classes assume that
+  //KT views go from 0 to Pi.
+  const int num_views = sino_pos.get_num_views();
+  sinogram = sino_pos;
+  //CON Expand the (positive) sinogram such that the two sinograms can be merged
+  sinogram.grow(IndexRange2D(0, 2*num_views-1,
+                             sino_pos.get_min_tangential_pos_num(), sino_pos.get_max_tangential_pos_num()));
+
+  //CON merge the two sinograms to form a "360 degrees" sinogram
+  const int min_tangential_pos_num = std::max(sino_neg.get_min_tangential_pos_num(),
+                                              -sino_pos.get_max_tangential_pos_num());
+  const int max_tangential_pos_num = std::min(sino_neg.get_max_tangential_pos_num(),
+                                              -sino_pos.get_min_tangential_pos_num());
+  for (int view = sino_neg.get_min_view_num(); view <= sino_neg.get_max_view_num(); view++)
+    for( int tangential_pos_num = min_tangential_pos_num; tangential_pos_num<=max_tangential_pos_num; tangential_pos_num++)   
+      sinogram[view+sino_neg.get_num_views()][tangential_pos_num] = sino_neg[view][-tangential_pos_num];
+
+  //CON the sinogramm dimensions need to have a dimension which is efficient for the FFT algorithm (see efficient_fourier_length) 
+  //CON for s (radial coordinate) pad the sinogramm with zeros to form a larger array. 
+  //CON the phi (azimuthal cordinate (view)) coordinate is periodic. The samples need to be interpolated to the
+  //CON to the new matrix size. Do this by linear interpolation.             
+  //CON -> DeFrise p. 153 Sec IV.C
+  do_adjust_nb_views_for_fft(sinogram, num_views_padded);
+}
+
 void 
 FourierRebinning::
 do_rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
              PETCount_rebinned &count_rebinned, 
-             const SegmentBySinogram<float> &segment, const int num_tang_poss_pow2,
-             const int num_views_pow2, const int num_planes, const float average_ring_difference_in_segment,
+             const Array<2,float> &sinogram, const float z_in_mm, const int num_tang_poss_padded,
+             const int num_views_padded, const float average_ring_difference_in_segment,
              const float half_distance_between_rings, const float sampling_distance_in_s, 
              const float radial_sampling_freq_w, const float R_field_of_view_mm,
              const float ratio_ring_spacing_to_ring_radius)
- 
- 
- {
-   const int local_rebinned = count_rebinned.total;
-   const int local_miss= count_rebinned.miss;
-   const int local_ssrb= count_rebinned.ssrb;
-
-//CON Loop over all slices, FFT the sinograms and call the actual rebinning kernel.
-   for (int axial_pos_num = segment.get_min_axial_pos_num(); axial_pos_num <= segment.get_max_axial_pos_num() ;axial_pos_num++)   
-     {
-
-      if(axial_pos_num%10 == 0)  info(boost::format("FORE Rebinning z (slice) = %1%") % axial_pos_num);   
-      Array<2,float> current_sinogram(IndexRange2D(0,num_tang_poss_pow2-1,0,num_views_pow2-1));
+{
+  Array<2,float> current_sinogram(IndexRange2D(0,num_tang_poss_padded-1,0,num_views_padded-1));
   
-  //CL Calculate the 2D FFT of P(w,k) of the merged segment
-  //CON copy the sinogram data of slice axial_pos_num from the segment array to slicedata
+  //CL Calculate the 2D FFT of P(w,k) of the merged sinogram
+  //CON copy the sinogram data to slicedata
   //CON the sinogram is flipped. This will taken account for in the rebinning, where the assignment of the FFT
   //CON coefficients are assigned opposite.
-     for (int j = 0; j < segment.get_num_tangential_poss(); j++) 
-      for (int i = 0; i < num_views_pow2; i++) 
-        current_sinogram[j][i] = segment[axial_pos_num][i][j + segment.get_min_tangential_pos_num()];
+  const int min_tangential_pos_num = sinogram[0].get_min_index();
+  const int num_tangential_poss = sinogram[0].get_length();
+  for (int j = 0; j < num_tangential_poss; j++) 
+    for (int i = 0; i < num_views_padded; i++) 
+      current_sinogram[j][i] = sinogram[i][j + min_tangential_pos_num];
        
   //CON FFT slicedata
-   const Array<2,std::complex<float> > FT_current_sinogram = fourier_for_real_data(current_sinogram);
-
-  //CON determine the axial position of the middle of the LOR in mm relative to Bin(segment=0,view=0,axial_pos=0,tang_pos=0)  
-    const ProjDataInfo& proj_data_info = *segment.get_proj_data_info_ptr();
-    const float z_in_mm = proj_data_info.get_m(Bin(segment.get_segment_num(),0,axial_pos_num,0)) - proj_data_info.get_m(Bin(0,0,0,0));
+  const Array<2,std::complex<float> > FT_current_sinogram = fourier_for_real_data(current_sinogram);
 
   //CON Call the rebinning kernel.                                                             
-    rebinning(FT_rebinned_data,Weights_for_FT_rebinned_data,count_rebinned,FT_current_sinogram,
-              z_in_mm, average_ring_difference_in_segment, num_views_pow2,
-              num_tang_poss_pow2,half_distance_between_rings,sampling_distance_in_s,radial_sampling_freq_w,
-              R_field_of_view_mm,ratio_ring_spacing_to_ring_radius);
-
- }//CL End of loop of axial_pos_num
-     
-    if(fore_debug_level > 0){
-      info(boost::format("Total rebinned: %1%\n"
-                         "Total missed: %2%\n"
-                         "Total rebinned SSRB: %3%") 
-           % (count_rebinned.total - local_rebinned) % (count_rebinned.miss - local_miss) % (count_rebinned.ssrb - local_ssrb) );
-   }
-
+  rebinning(FT_rebinned_data,Weights_for_FT_rebinned_data,count_rebinned,FT_current_sinogram,
+            z_in_mm, average_ring_difference_in_segment, num_views_padded,
+            num_tang_poss_padded,half_distance_between_rings,sampling_distance_in_s,radial_sampling_freq_w,
+            R_field_of_view_mm,ratio_ring_spacing_to_ring_radius);
 }
 
 
@@ -407,7 +464,7 @@ FourierRebinning::
 rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weights_for_FT_rebinned_data,
           PETCount_rebinned &num_rebinned, const Array<2,std::complex<float> > &FT_current_sinogram,
 	  const float z_in_mm, const float delta, 
-          const int num_views_pow2, const int num_tang_poss_pow2, const float half_distance_between_rings, 
+          const int num_views_padded, const int num_tang_poss_padded, const float half_distance_between_rings, 
 	  const float sampling_distance_in_s, const float radial_sampling_freq_w, const float R_field_of_view_mm, 
           const float ratio_ring_spacing_to_ring_radius)
 {
@@ -429,10 +486,10 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
   //CON The integer Fourier index "k" corresponds to the azimuthal angle "view"
 
   //CON FORE regime (rebinning)
-  //CON Iterate over all frequency tuples (w,k) starting from wmin,kmin up to num_tang_poss_pow2/2,num_views_pow2/2
+  //CON Iterate over all frequency tuples (w,k) starting from wmin,kmin up to num_tang_poss_padded/2,num_views_padded/2
 
-      for (int j = wmin; j <= num_tang_poss_pow2/2;j++) {
-        for (int i = kmin; i <= num_views_pow2/2; i++) {
+      for (int j = wmin; j <= num_tang_poss_padded/2;j++) {
+        for (int i = kmin; i <= num_views_padded/2; i++) {
 
               float w = static_cast<float>(j) * radial_sampling_freq_w;
               float k = static_cast<float>(i);     
@@ -467,7 +524,7 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
 
               int jj = j;
          
-             if(shift_direction==NEGATIVE_Z_SHIFT && j > 0)   jj = num_tang_poss_pow2 - j;
+             if(shift_direction==NEGATIVE_Z_SHIFT && j > 0)   jj = num_tang_poss_padded - j;
                 
                 //CON new_z_sl is the z-coordinate of the shifted z-position this contribution is assigned to.  	    
                 const float new_z_sl = static_cast<float>(z) + shift_direction * zshift/half_distance_between_rings;       
@@ -509,7 +566,7 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
      //CON and therefore there will be only contributions to one direct sinogram and the weights are therefore always 1. 
     
        for (int j = 0; j < wmin; j++){
-         for (int i = 0; i <= num_views_pow2/2; i++) {
+         for (int i = 0; i <= num_views_padded/2; i++) {
 	 
 	       for(int shift_direction=POSITIVE_Z_SHIFT;shift_direction<=NEGATIVE_Z_SHIFT;shift_direction+=CHANGE_Z_SHIFT){
 
@@ -517,7 +574,7 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
 
 		   // Take reverse ordering of tangential position in the negative segment into account (?)
                    if(shift_direction==NEGATIVE_Z_SHIFT && j > 0)  
-                      jj=num_tang_poss_pow2 - j;                  
+                      jj=num_tang_poss_padded - j;                  
       
                     
                     if (small_z >= 0 && small_z <= maxplane ) {      
@@ -533,8 +590,8 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
       
 
 //CL Small k :
-//CL Next treat small k's and w=wNyq=(num_tang_poss_pow2 / 2)+1, k=1..klim :
-       for (int j = wmin; j <= num_tang_poss_pow2/2; j++) {
+//CL Next treat small k's and w=wNyq=(num_tang_poss_padded / 2)+1, k=1..klim :
+       for (int j = wmin; j <= num_tang_poss_padded/2; j++) {
          for (int i = 0; i <= kmin; i++) {
           
                for(int shift_direction=POSITIVE_Z_SHIFT;shift_direction<=NEGATIVE_Z_SHIFT;shift_direction+=CHANGE_Z_SHIFT){
@@ -543,7 +600,7 @@ rebinning(Array<3,std::complex<float> > &FT_rebinned_data, Array<3,float> &Weigh
 
 		   // Take reverse ordering of tangential position in the negative segment into account (?)
                     if(shift_direction==NEGATIVE_Z_SHIFT && j > 0)  
-                       jj=num_tang_poss_pow2 - j;  
+                       jj=num_tang_poss_padded - j;  
                
                    
                     if (small_z >= 0 && small_z <= maxplane ) {            
@@ -598,39 +655,25 @@ do_display_count(PETCount_rebinned &count)
 
 void 
 FourierRebinning::
-do_adjust_nb_views_to_pow2(SegmentBySinogram<float> &segment) 
+do_adjust_nb_views_for_fft(Array<2,float> &sinogram, const int num_views_padded) const
 {
-// Adjustment of the number of views to a power of two
+// Adjustment of the number of views to a length with only small prime factors
 //CON Use the STIR overlap_interpolate method and remove the simlar private implementation (adjust_pow2) here.      
-  const int num_views_pow2 = stir::round(pow(2.,((int)ceil(log ((float)segment.get_num_views())/log(2.)))));
   const float offset_for_overlap_interpolate = 0.F;
       
-    if (num_views_pow2 == segment.get_num_views()) 
-        return; 
-
-    //CON Create the projection data info ptr for the resized segment
-    shared_ptr<ProjDataInfo> out_proj_data_info_sptr(segment.get_proj_data_info_ptr()->clone());
-    out_proj_data_info_sptr->set_num_views(num_views_pow2);
-    //CON the re-dimensioned segment      
-    SegmentBySinogram<float> out_segment = 
-      out_proj_data_info_sptr->get_empty_segment_by_sinogram(segment.get_segment_num());
-
-    for (int axial_pos_num = segment.get_min_axial_pos_num(); axial_pos_num <= segment.get_max_axial_pos_num();
-             axial_pos_num++) 
-    {
-        const Sinogram<float> sino2D = segment.get_sinogram(axial_pos_num);
-        Sinogram<float> out_sino2D = out_segment.get_sinogram(axial_pos_num);
-      
-        float extension_factor = static_cast<float>(out_sino2D.get_num_views())/ static_cast<float>(sino2D.get_num_views());
-	overlap_interpolate(out_sino2D, sino2D,extension_factor,offset_for_overlap_interpolate,true);
-   
-      out_segment.set_sinogram(out_sino2D);
-    }
-    segment = out_segment;
+  if (num_views_padded == sinogram.get_length()) 
+    return; 
+
+  //CON the re-dimensioned sinogram
+  Array<2,float> out_sinogram(IndexRange2D(0, num_views_padded-1,
+                                           sinogram[0].get_min_index(), sinogram[0].get_max_index()));
+  const float extension_factor = static_cast<float>(num_views_padded)/ static_cast<float>(sinogram.get_length());
+  overlap_interpolate(out_sinogram, sinogram, extension_factor, offset_for_overlap_interpolate, true);
+  sinogram = out_sinogram;
 }
 
 Succeeded FourierRebinning::
-fore_check_parameters(int num_tang_poss_pow2, int num_views_pow2, int max_segment_num_to_process){
+fore_check_parameters(int num_tang_poss_padded, int num_views_padded, int max_segment_num_to_process){
 
 //CON Check if the parameters given make sense.
 
@@ -648,20 +691,20 @@ fore_check_parameters(int num_tang_poss_pow2, int num_views_pow2, int max_segmen
  }
 
 
- if(wmin >= num_tang_poss_pow2/2 || kmin >= num_views_pow2/2) {
+ if(wmin >= num_tang_poss_padded/2 || kmin >= num_views_padded/2) {
    warning(boost::format("FORE initialisation :: The parameter wmin or kmin is larger than the highest frequency component computed by the FFT algorithm\n"
                          "                       Choose an value smaller than the largest frequency\n"
                          "                       kmin must be smaller than %1% and wmin must be smaller than %2%")
-           % (num_tang_poss_pow2/2) % (num_views_pow2/2));
+           % (num_tang_poss_padded/2) % (num_views_padded/2));
    return Succeeded::no; 
  }
 
 
- if(kc >= num_views_pow2/2) {
+ if(kc >= num_views_padded/2) {
    warning(boost::format("FORE initialisation :: Your parameter kc is larger than the highest frequency component in w (FTT of radial coordinate s)\n"
                          "                       Choose an value smaller than the largest frequency\n"
                          "                       kc must be smaller than %1%") 
-           % num_views_pow2);
+           % num_views_padded);
    return Succeeded::no; 
  } 
 
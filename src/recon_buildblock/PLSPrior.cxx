@@ -287,50 +287,35 @@ template <typename elemT> void PLSPrior<elemT>::set_anatomical_filename(const st
 
 template <typename elemT>
 void PLSPrior<elemT>::compute_image_gradient_element(DiscretisedDensity<3,elemT> & image_gradient_elem, int direction, const DiscretisedDensity<3,elemT> & image ){
-//std::cout<<"dentro ="<<direction<<std::endl;
 
     const int min_z = image.get_min_index();
     const int max_z = image.get_max_index();
-
-
-        for (int z=min_z; z<=max_z; z++)
+    // the last plane/row/column (depending on direction) is not modified
+    const int max_z_to_use = direction==0 ? max_z-1 : max_z;
+    const int x_offset = direction==2 ? 1 : 0;
+
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
+        for (int z=min_z; z<=max_z_to_use; z++)
           {
 
             const int min_y = image[z].get_min_index();
             const int max_y = image[z].get_max_index();
+            const int max_y_to_use = direction==1 ? max_y-1 : max_y;
 
-
-
-              for (int y=min_y;y<= max_y;y++)
+              for (int y=min_y;y<= max_y_to_use;y++)
                 {
+                  const Array<1,elemT>& row = image[z][y];
+                  const Array<1,elemT>& next_row =
+                    direction==0 ? image[z+1][y] : (direction==1 ? image[z][y+1] : row);
+                  Array<1,elemT>& gradient_row = image_gradient_elem[z][y];
 
-                  const int min_x = image[z][y].get_min_index();
-                  const int max_x = image[z][y].get_max_index();
-
+                  const int min_x = row.get_min_index();
+                  const int max_x_to_use = row.get_max_index() - x_offset;
 
-
-                    for (int x=min_x;x<= max_x;x++)
-                    {
-
-                        if(direction==0){
-                            if(z+1>max_z)
-                                continue;
-                       image_gradient_elem[z][y][x]=image[z+1][y][x]- image[z][y][x];
-
-                        }
-                        if(direction==1){
-                            if(y+1>max_y)
-                                continue;
-                       image_gradient_elem[z][y][x]=image[z][y+1][x]- image[z][y][x];
-//                       std::cout<<"grady ="<<image[z][y+1][x]- image[z][y][x]<<std::endl;
-                        }
-                        if(direction==2){
-                            if(x+1>max_x )
-                                continue;
-                       image_gradient_elem[z][y][x]=image[z][y][x+1]- image[z][y][x];
-                        }
-
-                    }
+                  for (int x=min_x;x<= max_x_to_use;x++)
+                    gradient_row[x] = next_row[x+x_offset] - row[x];
                  }
           }
 
@@ -345,35 +330,36 @@ PLSPrior<elemT>::compute_normalisation_anatomical_gradient(DiscretisedDensity<3,
 
     const int min_z = image_grad_x.get_min_index();
     const int max_z = image_grad_x.get_max_index();
+    const elemT eta2 = square(this->eta);
 
-
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
         for (int z=min_z; z<=max_z; z++)
           {
 
             const int min_y = image_grad_x[z].get_min_index();
             const int max_y = image_grad_x[z].get_max_index();
 
-
-
               for (int y=min_y;y<= max_y;y++)
                 {
+                  const Array<1,elemT>& grad_y_row = image_grad_y[z][y];
+                  const Array<1,elemT>& grad_x_row = image_grad_x[z][y];
+                  Array<1,elemT>& norm_row = norm_im_grad[z][y];
 
-                  const int min_x = image_grad_x[z][y].get_min_index();
-                  const int max_x = image_grad_x[z][y].get_max_index();
-
-
+                  const int min_x = grad_x_row.get_min_index();
+                  const int max_x = grad_x_row.get_max_index();
 
+                  if(only_2D){
                     for (int x=min_x;x<= max_x;x++)
-                    {
-                        if(only_2D){
-                     norm_im_grad[z][y][x]   = sqrt (square(image_grad_y[z][y][x]) + square(image_grad_x[z][y][x]) + square(this->eta));}
-                        else{
-                            norm_im_grad[z][y][x]   = sqrt (square(image_grad_z[z][y][x]) + square(image_grad_y[z][y][x]) +
-                                                            square(image_grad_x[z][y][x]) + square(this->eta));
-
-                        }
-                    }
-
+                      norm_row[x] = sqrt (square(grad_y_row[x]) + square(grad_x_row[x]) + eta2);
+                  }
+                  else{
+                    const Array<1,elemT>& grad_z_row = image_grad_z[z][y];
+                    for (int x=min_x;x<= max_x;x++)
+                      norm_row[x] = sqrt (square(grad_z_row[x]) + square(grad_y_row[x]) +
+                                          square(grad_x_row[x]) + eta2);
+                  }
                  }
           }
 }
@@ -396,48 +382,60 @@ compute_inner_product_and_penalty(DiscretisedDensity<3,elemT> &inner_product,
     compute_image_gradient_element (pet_im_grad_y,1,pet_image);
     compute_image_gradient_element (pet_im_grad_x,2,pet_image);
 
+    const DiscretisedDensity<3,elemT>& norm = *this->get_norm_sptr();
+    const elemT alpha2 = square(this->alpha);
 
     const int min_z = pet_image.get_min_index();
     const int max_z = pet_image.get_max_index();
 
-
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
         for (int z=min_z; z<=max_z; z++)
           {
 
             const int min_y = pet_image[z].get_min_index();
             const int max_y = pet_image[z].get_max_index();
 
-
-
               for (int y=min_y;y<= max_y;y++)
                 {
+                  const Array<1,elemT>& pet_grad_y_row = pet_im_grad_y[z][y];
+                  const Array<1,elemT>& pet_grad_x_row = pet_im_grad_x[z][y];
+                  const Array<1,elemT>& anatomical_grad_y_row = (*anatomical_grad_y_sptr)[z][y];
+                  const Array<1,elemT>& anatomical_grad_x_row = (*anatomical_grad_x_sptr)[z][y];
+                  const Array<1,elemT>& norm_row = norm[z][y];
+                  Array<1,elemT>& inner_product_row = inner_product[z][y];
+                  Array<1,elemT>& penalty_row = penalty[z][y];
 
                   const int min_x = pet_image[z][y].get_min_index();
                   const int max_x = pet_image[z][y].get_max_index();
 
-
-
+                  if(only_2D){
                     for (int x=min_x;x<= max_x;x++)
-                    {
-                        if(only_2D){
-                            inner_product[z][y][x]   = ((pet_im_grad_y[z][y][x]*(*anatomical_grad_y_sptr)[z][y][x]/(*get_norm_sptr())[z][y][x]) +
-                                                        (pet_im_grad_x[z][y][x]*(*anatomical_grad_x_sptr)[z][y][x]/(*get_norm_sptr())[z][y][x]));
-
-                            penalty[z][y][x]= sqrt (square(this->alpha) + square(pet_im_grad_y[z][y][x]) +
-                                                                              square(pet_im_grad_x[z][y][x]) -
-                                                                              square(inner_product[z][y][x]));
-                        }
-                        else{
-                     inner_product[z][y][x]   = (pet_im_grad_z[z][y][x]*(*anatomical_grad_z_sptr)[z][y][x] +
-                                                 pet_im_grad_y[z][y][x]*(*anatomical_grad_y_sptr)[z][y][x] +
-                                                 pet_im_grad_x[z][y][x]*(*anatomical_grad_x_sptr)[z][y][x])/(*get_norm_sptr())[z][y][x];
-
-                     penalty[z][y][x]= sqrt (square(this->alpha) + square(pet_im_grad_z[z][y][x]) +
-                                                                       square(pet_im_grad_y[z][y][x]) +
-                                                                       square(pet_im_grad_x[z][y][x]) -
-                                                                       square(inner_product[z][y][x]));
-                        }
-                    }
+                      {
+                        inner_product_row[x] = ((pet_grad_y_row[x]*anatomical_grad_y_row[x]/norm_row[x]) +
+                                                (pet_grad_x_row[x]*anatomical_grad_x_row[x]/norm_row[x]));
+
+                        penalty_row[x] = sqrt (alpha2 + square(pet_grad_y_row[x]) +
+                                               square(pet_grad_x_row[x]) -
+                                               square(inner_product_row[x]));
+                      }
+                  }
+                  else{
+                    const Array<1,elemT>& pet_grad_z_row = pet_im_grad_z[z][y];
+                    const Array<1,elemT>& anatomical_grad_z_row = (*anatomical_grad_z_sptr)[z][y];
+                    for (int x=min_x;x<= max_x;x++)
+                      {
+                        inner_product_row[x] = (pet_grad_z_row[x]*anatomical_grad_z_row[x] +
+                                                pet_grad_y_row[x]*anatomical_grad_y_row[x] +
+                                                pet_grad_x_row[x]*anatomical_grad_x_row[x])/norm_row[x];
+
+                        penalty_row[x] = sqrt (alpha2 + square(pet_grad_z_row[x]) +
+                                               square(pet_grad_y_row[x]) +
+                                               square(pet_grad_x_row[x]) -
+                                               square(inner_product_row[x]));
+                      }
+                  }
                  }
           }
 
@@ -478,9 +476,16 @@ compute_value(const DiscretisedDensity<3,elemT> &current_image_estimate)
     error("PLSPrior: kappa image has not the same index range as the reconstructed image\n");
 
 
+  /* formula:
+     sum_x,y,z
+       (penalty[z][y][x]) * (*kappa_ptr)[z][y][x];
+  */
   double result = 0.;
   const int min_z = current_image_estimate.get_min_index();
   const int max_z = current_image_estimate.get_max_index();
+#ifdef STIR_OPENMP
+#pragma omp parallel for reduction(+:result)
+#endif
   for (int z=min_z; z<=max_z; z++)
     {
 
@@ -489,33 +494,37 @@ compute_value(const DiscretisedDensity<3,elemT> &current_image_estimate)
 
         for (int y=min_y;y<= max_y;y++)
           {
-
+            const Array<1,elemT>& penalty_row = (*penalty_sptr)[z][y];
             const int min_x = current_image_estimate[z][y].get_min_index();
             const int max_x = current_image_estimate[z][y].get_max_index();
 
-            for (int x=min_x;x<= max_x;x++)
+            if (do_kappa)
               {
-
-                /* formula:
-                  sum_x,y,z
-
-                   (penalty[z][y][x]) * (*kappa_ptr)[z][y][x];
-                */
-
-                        elemT current = (*penalty_sptr)[z][y][x];
-
-                        if (do_kappa)
-                          current *=
-                            (*kappa_ptr)[z][y][x] ;
-
-                        result += static_cast<double>(current);
-
+                const Array<1,elemT>& kappa_row = (*kappa_ptr)[z][y];
+                for (int x=min_x;x<= max_x;x++)
+                  result += static_cast<double>(penalty_row[x] * kappa_row[x]);
+              }
+            else
+              {
+                for (int x=min_x;x<= max_x;x++)
+                  result += static_cast<double>(penalty_row[x]);
               }
           }
     }
   return result * this->penalisation_factor;
 }
 
+/* term in the divergence used for the gradient of the PLS prior, i.e.
+   (pet_im_grad - anatomical_im_grad*inner_product/norm)/penalty
+*/
+template <typename elemT>
+static inline elemT
+get_divergence_term(const elemT pet_im_grad, const elemT anatomical_im_grad,
+                    const elemT inner_product, const elemT norm, const elemT penalty)
+{
+  return (pet_im_grad - anatomical_im_grad*inner_product/norm)/penalty;
+}
+
 template <typename elemT>
 void
 PLSPrior<elemT>::
@@ -560,69 +569,90 @@ compute_gradient(DiscretisedDensity<3,elemT>& prior_gradient,
     error("PLSPrior: kappa image has not the same index range as the reconstructed image\n");
  shared_ptr<DiscretisedDensity<3,elemT> > gradient_sptr(this->anatomical_sptr->get_empty_copy ());
 
+  const DiscretisedDensity<3,elemT>& norm = *this->get_norm_sptr();
   const int min_z = current_image_estimate.get_min_index();
   const int max_z = current_image_estimate.get_max_index();
+  // the last plane is not used for the gradient in 3D
+  const int max_z_to_use = only_2D ? max_z : max_z-1;
 
-  for (int z=min_z; z<=max_z; z++)
+  /* formula:
+     sum_x,y,z
+       div * (pet_im_grad[z][y][x]-inner_product[z][y][x]*anatomical_im_grad[z][y][x]/(*get_norm_sptr ())[z][y][x])*
+       (*kappa_ptr)[z][y][x] /penalty[z][y][x];
+
+     The divergence is computed as the difference of the terms in neighbouring voxels.
+     The last voxel in every direction is not used.
+  */
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
+  for (int z=min_z; z<=max_z_to_use; z++)
     {
 
       const int min_y = current_image_estimate[z].get_min_index();
       const int max_y = current_image_estimate[z].get_max_index();
 
-      for (int y=min_y;y<= max_y;y++)
+      for (int y=min_y;y<= max_y-1;y++)
         {
-
+          const Array<1,elemT>& inner_product_row = (*inner_product_sptr)[z][y];
+          const Array<1,elemT>& penalty_row = (*penalty_sptr)[z][y];
+          const Array<1,elemT>& norm_row = norm[z][y];
+          const Array<1,elemT>& pet_grad_x_row = (*pet_im_grad_x_sptr)[z][y];
+          const Array<1,elemT>& pet_grad_y_row = (*pet_im_grad_y_sptr)[z][y];
+          const Array<1,elemT>& anatomical_grad_x_row = (*anatomical_grad_x_sptr)[z][y];
+          const Array<1,elemT>& anatomical_grad_y_row = (*anatomical_grad_y_sptr)[z][y];
+          // next row in y
+          const Array<1,elemT>& inner_product_next_y_row = (*inner_product_sptr)[z][y+1];
+          const Array<1,elemT>& penalty_next_y_row = (*penalty_sptr)[z][y+1];
+          const Array<1,elemT>& norm_next_y_row = norm[z][y+1];
+          const Array<1,elemT>& pet_grad_y_next_y_row = (*pet_im_grad_y_sptr)[z][y+1];
+          const Array<1,elemT>& anatomical_grad_y_next_y_row = (*anatomical_grad_y_sptr)[z][y+1];
+
+          Array<1,elemT>& gradientx_row = (*gradientx_sptr)[z][y];
+          Array<1,elemT>& gradienty_next_y_row = (*gradienty_sptr)[z][y+1];
 
           const int min_x = current_image_estimate[z][y].get_min_index();
           const int max_x = current_image_estimate[z][y].get_max_index();
 
-          for (int x=min_x;x<= max_x;x++)
+          for (int x=min_x;x<= max_x-1;x++)
             {
+              const elemT term_x =
+                get_divergence_term(pet_grad_x_row[x], anatomical_grad_x_row[x], inner_product_row[x], norm_row[x], penalty_row[x]);
+              const elemT term_y =
+                get_divergence_term(pet_grad_y_row[x], anatomical_grad_y_row[x], inner_product_row[x], norm_row[x], penalty_row[x]);
+              gradientx_row[x+1] =
+                get_divergence_term(pet_grad_x_row[x+1], anatomical_grad_x_row[x+1], inner_product_row[x+1], norm_row[x+1], penalty_row[x+1])
+                - term_x;
+              gradienty_next_y_row[x] =
+                get_divergence_term(pet_grad_y_next_y_row[x], anatomical_grad_y_next_y_row[x], inner_product_next_y_row[x],
+                                    norm_next_y_row[x], penalty_next_y_row[x])
+                - term_y;
+            }
+
+          if (!only_2D)
+            {
+              const Array<1,elemT>& pet_grad_z_row = (*pet_im_grad_z_sptr)[z][y];
+              const Array<1,elemT>& anatomical_grad_z_row = (*anatomical_grad_z_sptr)[z][y];
+              // next plane
+              const Array<1,elemT>& inner_product_next_z_row = (*inner_product_sptr)[z+1][y];
+              const Array<1,elemT>& penalty_next_z_row = (*penalty_sptr)[z+1][y];
+              const Array<1,elemT>& norm_next_z_row = norm[z+1][y];
+              const Array<1,elemT>& pet_grad_z_next_z_row = (*pet_im_grad_z_sptr)[z+1][y];
+              const Array<1,elemT>& anatomical_grad_z_next_z_row = (*anatomical_grad_z_sptr)[z+1][y];
+              Array<1,elemT>& gradientz_next_z_row = (*gradientz_sptr)[z+1][y];
+
+              for (int x=min_x;x<= max_x-1;x++)
+                gradientz_next_z_row[x] =
+                  get_divergence_term(pet_grad_z_next_z_row[x], anatomical_grad_z_next_z_row[x], inner_product_next_z_row[x],
+                                      norm_next_z_row[x], penalty_next_z_row[x])
+                  - get_divergence_term(pet_grad_z_row[x], anatomical_grad_z_row[x], inner_product_row[x], norm_row[x], penalty_row[x]);
+            }
+        }
+    }
 
-              if(x+1>max_x || y+1>max_y ||(z+1>max_z && !only_2D))
-                  continue;
-
-                /* formula:
-                  sum_x,y,z
-                   div * (pet_im_grad[z][y][x]-inner_product[z][y][x]*anatomical_im_grad[z][y][x]/(*get_norm_sptr ())[z][y][x])*
-                   (*kappa_ptr)[z][y][x] /penalty[z][y][x];
-                */
-
-              if(only_2D){
-                  (*gradientx_sptr)[z][y][x+1] =
-                     (((*pet_im_grad_x_sptr)[z][y][x+1]-(*anatomical_grad_x_sptr)[z][y][x+1]*(*inner_product_sptr)[z][y][x+1]/
-                          (*get_norm_sptr ())[z][y][x+1])/(*penalty_sptr)[z][y][x+1] -
-                     (((*pet_im_grad_x_sptr)[z][y][x]-(*anatomical_grad_x_sptr)[z][y][x]*(*inner_product_sptr)[z][y][x]/(*get_norm_sptr ())[z][y][x])/
-                      (*penalty_sptr)[z][y][x]) );
-
-                  (*gradienty_sptr)[z][y+1][x] =
-                      (((*pet_im_grad_y_sptr)[z][y+1][x]-(*anatomical_grad_y_sptr)[z][y+1][x]*(*inner_product_sptr)[z][y+1][x]/
-                          (*get_norm_sptr ())[z][y+1][x])/(*penalty_sptr)[z][y+1][x] -
-                      (((*pet_im_grad_y_sptr)[z][y][x]-(*anatomical_grad_y_sptr)[z][y][x]*(*inner_product_sptr)[z][y][x]/(*get_norm_sptr ())[z][y][x])/
-                       (*penalty_sptr)[z][y][x]) );
-              }
-              else{
-
-                  (*gradientx_sptr)[z][y][x+1] =
-                          (((*pet_im_grad_x_sptr)[z][y][x+1]-(*anatomical_grad_x_sptr)[z][y][x+1]*(*inner_product_sptr)[z][y][x+1]/(*get_norm_sptr ())[z][y][x+1])/
-                          (*penalty_sptr)[z][y][x+1] -
-                          ((*pet_im_grad_x_sptr)[z][y][x]-(*anatomical_grad_x_sptr)[z][y][x]*(*inner_product_sptr)[z][y][x]/(*get_norm_sptr ())[z][y][x])/
-                          (*penalty_sptr)[z][y][x]);
-
-                  (*gradienty_sptr)[z][y+1][x] =
-                          (((*pet_im_grad_y_sptr)[z][y+1][x]-(*anatomical_grad_y_sptr)[z][y+1][x]*(*inner_product_sptr)[z][y+1][x]/
-                          (*get_norm_sptr ())[z][y+1][x])/(*penalty_sptr)[z][y+1][x] -
-                          (((*pet_im_grad_y_sptr)[z][y][x]-(*anatomical_grad_y_sptr)[z][y][x]*(*inner_product_sptr)[z][y][x]/
-                            (*get_norm_sptr ())[z][y][x])/(*penalty_sptr)[z][y][x]) );
-
-                  (*gradientz_sptr)[z+1][y][x] =
-                      (((*pet_im_grad_z_sptr)[z+1][y][x]-(*anatomical_grad_z_sptr)[z+1][y][x]*(*inner_product_sptr)[z+1][y][x]/
-                          (*get_norm_sptr ())[z+1][y][x])/(*penalty_sptr)[z+1][y][x] -
-                          (((*pet_im_grad_z_sptr)[z][y][x]-(*anatomical_grad_z_sptr)[z][y][x]*(*inner_product_sptr)[z][y][x]/
-                            (*get_norm_sptr ())[z][y][x])/(*penalty_sptr)[z][y][x]) );
-              }
-              }}}
-
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
   for (int z=min_z; z<=max_z; z++)
     {
 
@@ -631,32 +661,35 @@ compute_gradient(DiscretisedDensity<3,elemT>& prior_gradient,
 
       for (int y=min_y;y<= max_y;y++)
         {
-
+          const Array<1,elemT>& gradienty_row = (*gradienty_sptr)[z][y];
+          const Array<1,elemT>& gradientx_row = (*gradientx_sptr)[z][y];
+          Array<1,elemT>& gradient_row = (*gradient_sptr)[z][y];
+          Array<1,elemT>& prior_gradient_row = prior_gradient[z][y];
 
           const int min_x = current_image_estimate[z][y].get_min_index();
           const int max_x = current_image_estimate[z][y].get_max_index();
 
-          for (int x=min_x;x<= max_x;x++)
-            {
-              if(only_2D){
-
-              (*gradient_sptr)[z][y][x] = -((*gradienty_sptr)[z][y][x] + (*gradientx_sptr)[z][y][x]);
-
-              }
-              else{
-
-              (*gradient_sptr)[z][y][x] = -((*gradientz_sptr)[z][y][x] + (*gradienty_sptr)[z][y][x] + (*gradientx_sptr)[z][y][x]);
-
-              }
-
-              if (do_kappa)
-                  (*gradient_sptr)[z][y][x] *=
-                  (*kappa_ptr)[z][y][x] ;
-
+          if(only_2D){
+            for (int x=min_x;x<= max_x;x++)
+              gradient_row[x] = -(gradienty_row[x] + gradientx_row[x]);
+          }
+          else{
+            const Array<1,elemT>& gradientz_row = (*gradientz_sptr)[z][y];
+            for (int x=min_x;x<= max_x;x++)
+              gradient_row[x] = -(gradientz_row[x] + gradienty_row[x] + gradientx_row[x]);
+          }
 
+          if (do_kappa)
+            {
+              const Array<1,elemT>& kappa_row = (*kappa_ptr)[z][y];
+              for (int x=min_x;x<= max_x;x++)
+                gradient_row[x] *= kappa_row[x];
+            }
 
-                        prior_gradient[z][y][x]= (*gradient_sptr)[z][y][x] * this->penalisation_factor;
-            }}}
+          for (int x=min_x;x<= max_x;x++)
+            prior_gradient_row[x]= gradient_row[x] * this->penalisation_factor;
+        }
+    }
 
   info(boost::format("Prior gradient max %1%, min %2%\n") % prior_gradient.find_max() % prior_gradient.find_min());
 
@@ -35,13 +35,34 @@
 #include "stir/modelling/ParametricDiscretisedDensity.h"
 #include "stir/modelling/KineticParameters.h"
 #include "stir/info.h"
+#include "stir/warning.h"
+#include "stir/FilePath.h"
 #include "boost/format.hpp"
 #include "boost/lexical_cast.hpp"
+#include "boost/cstdint.hpp"
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <cstdio>
 
 using std::string;
 
 START_NAMESPACE_STIR
 
+//! 64-bit FNV-1a hash of a string, used for the names of files in the sensitivity cache
+/*! We use our own hash function as the result has to be the same across runs and platforms. */
+static std::string
+get_hash_as_string(const std::string& text)
+{
+  boost::uint64_t hash = 14695981039346656037ULL;
+  for (std::string::const_iterator iter = text.begin(); iter != text.end(); ++iter)
+    {
+      hash ^= static_cast<unsigned char>(*iter);
+      hash *= 1099511628211ULL;
+    }
+  return boost::str(boost::format("%016x") % hash);
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
@@ -51,6 +72,7 @@ set_defaults()
 
   this->sensitivity_filename = "";  
   this->subsensitivity_filenames = "";  
+  this->sensitivity_cache_directory = "";
   this->recompute_sensitivity = false;
   this->use_subset_sensitivities = true;
   this->subsensitivity_sptrs.resize(0);
@@ -65,6 +87,7 @@ initialise_keymap()
 
   this->parser.add_key("sensitivity filename", &this->sensitivity_filename);
   this->parser.add_key("subset sensitivity filenames", &this->subsensitivity_filenames);
+  this->parser.add_key("sensitivity cache directory", &this->sensitivity_cache_directory);
   this->parser.add_key("recompute sensitivity", &this->recompute_sensitivity);
   this->parser.add_key("use_subset_sensitivities", &this->use_subset_sensitivities);
 
@@ -97,6 +120,22 @@ get_subsensitivity_filenames() const
   return this->subsensitivity_filenames;
 }
 
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_sensitivity_cache_directory() const
+{
+  return this->sensitivity_cache_directory;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+set_sensitivity_cache_directory(const std::string& directory)
+{
+  this->sensitivity_cache_directory = directory;
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
@@ -199,13 +238,21 @@ set_up(shared_ptr<TargetT> const& target_sptr)
 
   this->subsensitivity_sptrs.resize(this->num_subsets);
 
+  const bool sensitivity_filenames_not_set =
+    is_null_ptr(this->subsensitivity_sptrs[0]) &&
+    ((this->get_use_subset_sensitivities() && this->subsensitivity_filenames=="") ||
+     (!this->get_use_subset_sensitivities() && this->sensitivity_filename==""));
+  // the cache is only used if no filenames are set
+  const bool use_cache =
+    !this->sensitivity_cache_directory.empty() && sensitivity_filenames_not_set;
+  const bool recompute_sensitivity_requested = this->recompute_sensitivity;
+
   if(!this->recompute_sensitivity)
     {      
-      if(is_null_ptr(this->subsensitivity_sptrs[0]) &&
-         ((this->get_use_subset_sensitivities() && this->subsensitivity_filenames=="") ||
-          (!this->get_use_subset_sensitivities() && this->sensitivity_filename=="")))
+      if(sensitivity_filenames_not_set)
         {
-          info("(subset)sensitivity filename(s) not set so I will compute the (subset)sensitivities", 2);
+          if (!use_cache)
+            info("(subset)sensitivity filename(s) not set so I will compute the (subset)sensitivities", 2);
           this->recompute_sensitivity = true;
           // initialisation of pointers will be done below
         }
@@ -308,6 +355,17 @@ set_up(shared_ptr<TargetT> const& target_sptr)
       return Succeeded::no;
     }
 
+  std::string cache_description;
+  if (use_cache)
+    {
+      cache_description = this->get_sensitivity_cache_description(*target_sptr);
+      if (cache_description.empty())
+        warning("'sensitivity cache directory' is set, but the sensitivity cache is not supported by this objective function. Ignoring.");
+      else if (!recompute_sensitivity_requested &&
+               this->read_sensitivities_from_cache(*target_sptr, cache_description) == Succeeded::yes)
+        this->recompute_sensitivity = false;
+    }
+
   if(this->recompute_sensitivity)
     {
       info("Computing sensitivity");
@@ -354,11 +412,137 @@ set_up(shared_ptr<TargetT> const& target_sptr)
           error("Error writing sensitivity to file:\n%s", e.what());
           return Succeeded::no;
         }
+
+      if (!cache_description.empty())
+        this->write_sensitivities_to_cache(cache_description);
     }
       
   return Succeeded::yes;
 }
 
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_sensitivity_cache_description(const TargetT&)
+{
+  return std::string();
+}
+
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+get_sensitivity_cache_filename_prefix(const std::string& description) const
+{
+  std::string prefix = this->sensitivity_cache_directory;
+  FilePath::append_separator(prefix);
+  return prefix + "sensitivity_" + get_hash_as_string(description);
+}
+
+/* The file with the description contains the number of images, followed by 
+   their filenames (one per line), followed by the description itself.
+   It is written after the images, such that an interrupted write does not
+   leave a valid entry.
+*/
+template<typename TargetT>
+Succeeded
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+read_sensitivities_from_cache(const TargetT& target, const std::string& description)
+{
+  const std::string description_filename =
+    this->get_sensitivity_cache_filename_prefix(description) + ".txt";
+  std::ifstream description_file(description_filename.c_str());
+  if (!description_file)
+    {
+      info(boost::format("No entry found in the sensitivity cache (looked for '%1%')") % description_filename, 2);
+      return Succeeded::no;
+    }
+  int num_images = 0;
+  description_file >> num_images;
+  description_file.ignore(1); // skip end-of-line
+  std::vector<std::string> filenames(num_images >= 0 ? num_images : 0);
+  for (std::vector<std::string>::iterator iter = filenames.begin(); iter != filenames.end(); ++iter)
+    std::getline(description_file, *iter);
+  const std::string description_in_cache((std::istreambuf_iterator<char>(description_file)),
+                                         std::istreambuf_iterator<char>());
+  const int expected_num_images = this->get_use_subset_sensitivities() ? this->num_subsets : 1;
+  if (num_images != expected_num_images || description_in_cache != description)
+    {
+      warning(boost::format("Sensitivity cache entry '%1%' does not match the current parameters "
+                            "(hash collision or corrupt entry). It will be recomputed.") % description_filename);
+      return Succeeded::no;
+    }
+
+  try
+    {
+      for (int i=0; i<num_images; ++i)
+        {
+          info(boost::format("Reading sensitivity from cache '%1%'") % filenames[i]);
+          shared_ptr<TargetT> sensitivity_sptr(read_from_file<TargetT>(filenames[i]));
+          string explanation;
+          if (!target.has_same_characteristics(*sensitivity_sptr, explanation))
+            {
+              warning(boost::format("Sensitivity in cache '%1%' does not match the target. It will be recomputed.\n%2%") 
+                      % filenames[i] % explanation);
+              return Succeeded::no;
+            }
+          if (this->get_use_subset_sensitivities())
+            this->subsensitivity_sptrs[i] = sensitivity_sptr;
+          else
+            this->sensitivity_sptr = sensitivity_sptr;
+        }
+    }
+  catch (std::exception& e)
+    {
+      warning(boost::format("Error reading sensitivity from cache. It will be recomputed.\n%1%") % e.what());
+      return Succeeded::no;
+    }
+  // compute total from subsensitivity or vice versa
+  this->set_total_or_subset_sensitivities();
+  return Succeeded::yes;
+}
+
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
+write_sensitivities_to_cache(const std::string& description) const
+{
+  const std::string prefix = this->get_sensitivity_cache_filename_prefix(description);
+  std::vector<std::string> filenames;
+  try
+    {
+      if (this->get_use_subset_sensitivities())
+        {
+          for (int subset=0; subset<this->get_num_subsets(); ++subset)
+            filenames.push_back(write_to_file(boost::str(boost::format("%1%_%2%") % prefix % subset),
+                                              this->get_subset_sensitivity(subset)));
+        }
+      else
+        {
+          filenames.push_back(write_to_file(prefix, this->get_sensitivity()));
+        }
+    }
+  catch (std::exception& e)
+    {
+      warning(boost::format("Error writing sensitivity to cache directory '%1%'. Continuing.\n%2%")
+              % this->sensitivity_cache_directory % e.what());
+      return;
+    }
+  const std::string description_filename = prefix + ".txt";
+  std::ofstream description_file(description_filename.c_str());
+  description_file << filenames.size() << '\n';
+  for (std::vector<std::string>::const_iterator iter = filenames.begin(); iter != filenames.end(); ++iter)
+    description_file << *iter << '\n';
+  description_file << description;
+  if (!description_file)
+    {
+      warning(boost::format("Error writing '%1%'. The sensitivity will not be cached.") % description_filename);
+      description_file.close();
+      std::remove(description_filename.c_str());
+    }
+  else
+    info(boost::format("Sensitivity written to cache '%1%'") % description_filename);
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMean<TargetT>::
@@ -28,6 +28,8 @@
 #include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin.h" 
 #include "stir/recon_buildblock/ProjMatrixByBinUsingRayTracing.h" 
 #include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.h"
+#include "stir/recon_buildblock/OutputImagesForThreads.h"
 #include "stir/recon_buildblock/ProjectorByBinPairUsingProjMatrixByBin.h"
 #include "stir/ProjDataInfoCylindricalNoArcCorr.h"
 #include "stir/ProjData.h"
@@ -41,9 +43,11 @@
 #include "stir/RelatedViewgrams.h"
 #include "stir/ViewSegmentNumbers.h"
 #include "stir/recon_array_functions.h"
+#include "stir/error.h"
 
 #include <iostream>
 #include <algorithm>
+#include <limits>
 #include <sstream>
 #include "stir/stream.h"
 
@@ -86,6 +90,12 @@ set_defaults()
 
   this->normalisation_sptr.reset(new TrivialBinNormalisation);
   this->do_time_frame = false;
+  this->cache_lm_events = false;
+  this->max_memory_for_events_cache_in_MB = 1024;
+  this->max_num_images_for_threads = 0;
+  this->events_cache.clear();
+  this->events_cache_is_filled = false;
+  this->events_cache_is_too_large = false;
 } 
  
 template <typename TargetT> 
@@ -101,6 +111,9 @@ initialise_keymap()
   this->parser.add_key("additive sinogram",&this->additive_projection_data_filename); 
  
   this->parser.add_key("num_events_to_use",&this->num_events_to_use);
+  this->parser.add_key("cache list mode events in memory", &this->cache_lm_events);
+  this->parser.add_key("maximum memory for list mode events cache in MB", &this->max_memory_for_events_cache_in_MB);
+  this->parser.add_key("maximum number of images for multi-threading", &this->max_num_images_for_threads);
 } 
 template <typename TargetT> 
 int 
@@ -108,9 +121,34 @@ PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<Tar
 set_num_subsets(const int new_num_subsets)
 {
   this->num_subsets = new_num_subsets;
+  this->events_cache_is_filled = false;
   return this->num_subsets;
 }
 
+template <typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+set_cache_lm_events(const bool arg)
+{
+  this->cache_lm_events = arg;
+}
+
+template <typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+set_max_memory_for_events_cache_in_MB(const double arg)
+{
+  this->max_memory_for_events_cache_in_MB = arg;
+}
+
+template <typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+set_max_num_images_for_threads(const int arg)
+{
+  this->max_num_images_for_threads = arg;
+}
+
 template<typename TargetT>
 bool
 PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
@@ -211,6 +249,16 @@ set_up_before_sensitivity(shared_ptr <TargetT > const& target_sptr)
                 proj_data_info_sptr->create_shared_clone()) == Succeeded::no)
         return Succeeded::no;
 
+    // get_bin_value() is called for every event, so make sure this is fast
+    if (!is_null_ptr(this->additive_proj_data_sptr) &&
+        is_null_ptr(dynamic_pointer_cast<ProjDataInMemory>(this->additive_proj_data_sptr)))
+        this->additive_proj_data_sptr.reset(new ProjDataInMemory(*this->additive_proj_data_sptr));
+
+    // the frame, subsets etc might have changed
+    this->events_cache.clear();
+    this->events_cache_is_filled = false;
+    this->events_cache_is_too_large = false;
+
     if (this->current_frame_num<=0)
     {
         warning("frame_num should be >= 1");
@@ -241,6 +289,12 @@ PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<Tar
 
     { warning("You need to specify a projection matrix"); return true; } 
 
+  if (this->max_num_images_for_threads < 0)
+    { warning("maximum number of images for multi-threading has to be non-negative"); return true; }
+
+  if (this->max_memory_for_events_cache_in_MB < 0)
+    { warning("maximum memory for list mode events cache in MB has to be non-negative"); return true; }
+
 #else
   if(is_null_ptr(this->projector_pair_sptr->get_forward_projector_sptr()))
     {
@@ -412,42 +466,88 @@ construct_target_ptr() const
 
 } 
  
-template <typename TargetT> 
-void 
-PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>:: 
-compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,  
-                                                      const TargetT &current_estimate,
-                                                      const int subset_num)
-{ 
+template <typename TargetT>
+bool
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+get_bin_of_prompt(Bin& measured_bin, const CListRecord& record) const
+{
+    if (!record.is_event() || !record.event().is_prompt())
+        return false;
+
+    measured_bin.set_bin_value(1.0f);
+    record.event().get_bin(measured_bin, *proj_data_info_sptr);
+
+    if (measured_bin.get_bin_value() != 1.0f
+            || measured_bin.segment_num() < proj_data_info_sptr->get_min_segment_num()
+            || measured_bin.segment_num()  > proj_data_info_sptr->get_max_segment_num()
+            || measured_bin.tangential_pos_num() < proj_data_info_sptr->get_min_tangential_pos_num()
+            || measured_bin.tangential_pos_num() > proj_data_info_sptr->get_max_tangential_pos_num()
+            || measured_bin.axial_pos_num() < proj_data_info_sptr->get_min_axial_pos_num(measured_bin.segment_num())
+            || measured_bin.axial_pos_num() > proj_data_info_sptr->get_max_axial_pos_num(measured_bin.segment_num()))
+    {
+        return false;
+    }
 
-    assert(subset_num>=0);
-    assert(subset_num<this->num_subsets);
+    measured_bin.set_bin_value(1.0f);
+    return true;
+}
+
+template <typename TargetT>
+int
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+get_subset_num_of_bin(const Bin& measured_bin) const
+{
+    if (this->num_subsets == 1)
+        return 0;
+
+    Bin basic_bin = measured_bin;
+    if (!this->PM_sptr->get_symmetries_ptr()->find_basic_bin(basic_bin))
+        return -1;
+    return static_cast<int>(basic_bin.view_num() % this->num_subsets);
+}
+
+template <typename TargetT>
+Succeeded
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+fill_events_cache()
+{
+    // 0 means no limit
+    const double max_num_events_in_cache =
+      this->max_memory_for_events_cache_in_MB > 0
+      ? this->max_memory_for_events_cache_in_MB*1024*1024/sizeof(CachedEvent)
+      : std::numeric_limits<double>::max();
+    // if we know the number of events, check before reading anything
+    if (!this->do_time_frame &&
+        static_cast<double>(this->num_events_to_use)*this->num_subsets > max_num_events_in_cache)
+    {
+        warning(boost::format("The list mode events (%1% per subset) do not fit in the maximum memory for the cache (%2% MB). "
+                              "They will be read from the list mode data instead.")
+                % this->num_events_to_use % this->max_memory_for_events_cache_in_MB);
+        return Succeeded::no;
+    }
+
+    info("Storing list mode events in memory");
 
     const double start_time = this->frame_defs.get_start_time(this->current_frame_num);
     const double end_time = this->frame_defs.get_end_time(this->current_frame_num);
 
-    long num_used_events = 0;
-    const float max_quotient = 10000.F;
+    this->events_cache.clear();
+    this->events_cache.resize(this->num_subsets);
 
-    //go to the beginning of this frame
-    //  list_mode_data_sptr->set_get_position(start_time);
-    // TODO implement function that will do this for a random time
     this->list_mode_data_sptr->reset();
     double current_time = 0.;
-    ProjMatrixElemsForOneBin proj_matrix_row;
 
     shared_ptr<CListRecord> record_sptr = this->list_mode_data_sptr->get_empty_record_sptr();
     CListRecord& record = *record_sptr;
 
-    VectorWithOffset<CListModeData::SavedPosition>
-            frame_start_positions(1, static_cast<int>(this->frame_defs.get_num_frames()));
+    // as in compute_sub_gradient_without_penalty_plus_sensitivity, num_events_to_use is per subset
+    std::vector<long int> more_events(this->num_subsets,
+                                      this->do_time_frame? 1 : this->num_events_to_use);
+    int num_subsets_to_fill = this->num_subsets;
+    long num_stored_events = 0;
 
-    long int more_events =
-            this->do_time_frame? 1 : this->num_events_to_use;
-
-    while (more_events)//this->list_mode_data_sptr->get_next_record(record) == Succeeded::yes)
+    while (num_subsets_to_fill > 0)
     {
-
         if (this->list_mode_data_sptr->get_next_record(record) == Succeeded::no)
         {
             info("End of file!");
@@ -463,39 +563,100 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
                 continue;
         }
 
-        if (record.is_event() && record.event().is_prompt())
+        Bin measured_bin;
+        if (!this->get_bin_of_prompt(measured_bin, record))
+            continue;
+
+        const int subset_num = this->get_subset_num_of_bin(measured_bin);
+        if (subset_num < 0 || more_events[subset_num] == 0)
+            continue;
+
+        if (num_stored_events + 1 > max_num_events_in_cache)
         {
-            Bin measured_bin;
-            measured_bin.set_bin_value(1.0f);
-            record.event().get_bin(measured_bin, *proj_data_info_sptr);
-
-            if (measured_bin.get_bin_value() != 1.0f
-                    || measured_bin.segment_num() < proj_data_info_sptr->get_min_segment_num()
-                    || measured_bin.segment_num()  > proj_data_info_sptr->get_max_segment_num()
-                    || measured_bin.tangential_pos_num() < proj_data_info_sptr->get_min_tangential_pos_num()
-                    || measured_bin.tangential_pos_num() > proj_data_info_sptr->get_max_tangential_pos_num()
-                    || measured_bin.axial_pos_num() < proj_data_info_sptr->get_min_axial_pos_num(measured_bin.segment_num())
-                    || measured_bin.axial_pos_num() > proj_data_info_sptr->get_max_axial_pos_num(measured_bin.segment_num()))
-            {
-                continue;
-            }
+            warning(boost::format("The list mode events do not fit in the maximum memory for the cache (%1% MB). "
+                                  "They will be read from the list mode data instead.")
+                    % this->max_memory_for_events_cache_in_MB);
+            std::vector<std::vector<CachedEvent> >().swap(this->events_cache);
+            return Succeeded::no;
+        }
 
-            measured_bin.set_bin_value(1.0f);
-            // If more than 1 subsets, check if the current bin belongs to
-            // the current.
-            if (this->num_subsets > 1)
-            {
-                Bin basic_bin = measured_bin;
-                if (!this->PM_sptr->get_symmetries_ptr()->find_basic_bin(basic_bin) ||
-                        subset_num != static_cast<int>(basic_bin.view_num() % this->num_subsets))
-                    continue;
-            }
+        CachedEvent event;
+        event.segment_num = static_cast<boost::int16_t>(measured_bin.segment_num());
+        event.view_num = static_cast<boost::int16_t>(measured_bin.view_num());
+        event.axial_pos_num = static_cast<boost::int16_t>(measured_bin.axial_pos_num());
+        event.tangential_pos_num = static_cast<boost::int16_t>(measured_bin.tangential_pos_num());
+        if (event.segment_num != measured_bin.segment_num() ||
+            event.view_num != measured_bin.view_num() ||
+            event.axial_pos_num != measured_bin.axial_pos_num() ||
+            event.tangential_pos_num != measured_bin.tangential_pos_num())
+            error("PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin: "
+                  "bin indices are too large to be stored in the cache of list mode events");
+        this->events_cache[subset_num].push_back(event);
+
+        if (!this->do_time_frame)
+        {
+            more_events[subset_num] -= 1;
+            if (more_events[subset_num] == 0)
+                --num_subsets_to_fill;
+        }
+
+        num_stored_events += 1;
+
+        if (num_stored_events%200000L==0)
+            info( boost::format("Stored Events: %1% ") % num_stored_events);
+    }
 
-            this->PM_sptr->get_proj_matrix_elems_for_one_bin(proj_matrix_row, measured_bin);
-            //in_the_range++;
+    this->events_cache_is_filled = true;
+    info(boost::format("Stored %1% events in memory (%2% MB)")
+         % num_stored_events % (num_stored_events*sizeof(CachedEvent)/1024./1024.));
+    return Succeeded::yes;
+}
+
+template <typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+add_events_to_gradient(OutputImagesForThreads<TargetT>& gradients_for_threads,
+                       const TargetT& current_estimate,
+                       const std::vector<Bin>& measured_bins) const
+{
+    const float max_quotient = 10000.F;
+    const int num_bins_in_batch = static_cast<int>(measured_bins.size());
+    // if possible, use the rows with linear offsets in the contiguous image data that are
+    // stored in the cache of the matrix (see ProjMatrixElemsForOneBinWithOffsets)
+    BasicCoordinate<3,int> min_indices, max_indices;
+    const bool use_image_data_ptrs =
+      current_estimate.is_contiguous() &&
+      current_estimate.get_regular_range(min_indices, max_indices) &&
+      this->PM_sptr->cache_stores_elems_with_offsets_for(min_indices, max_indices);
+    const float * const estimate_data_ptr =
+      use_image_data_ptrs ? current_estimate.get_const_full_data_ptr() : 0;
+#ifdef STIR_OPENMP
+#pragma omp parallel if(num_bins_in_batch>1)
+#endif
+    {
+        ProjMatrixElemsForOneBin proj_matrix_row;
+        // data pointers of the images in gradients_for_threads (0 if they cannot be used).
+        // These are found when the thread uses an image for the first time.
+        std::vector<float *> gradient_data_ptrs(gradients_for_threads.get_num_images(), 0);
+        std::vector<bool> gradient_data_ptr_is_found(gradients_for_threads.get_num_images(), false);
+#ifdef STIR_OPENMP
+#pragma omp for schedule(dynamic, 64)
+#endif
+        for (int i=0; i<num_bins_in_batch; ++i)
+        {
+            Bin measured_bin = measured_bins[i];
+            // note: avoids a copy if the row is in the cache
+            const ProjMatrixElemsForOneBinWithOffsets * row_with_offsets_ptr;
+            const ProjMatrixElemsForOneBin& row =
+              this->PM_sptr->get_proj_matrix_elems_for_one_bin_ref(proj_matrix_row, row_with_offsets_ptr, measured_bin);
+            if (estimate_data_ptr == 0)
+              row_with_offsets_ptr = 0;
             Bin fwd_bin;
             fwd_bin.set_bin_value(0.0f);
-            proj_matrix_row.forward_project(fwd_bin,current_estimate);
+            if (row_with_offsets_ptr != 0)
+              row_with_offsets_ptr->forward_project(fwd_bin, estimate_data_ptr);
+            else
+              row.forward_project(fwd_bin,current_estimate);
             // additive sinogram
             if (!is_null_ptr(this->additive_proj_data_sptr))
             {
@@ -503,26 +664,143 @@ compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
                 float value= fwd_bin.get_bin_value()+add_value;
                 fwd_bin.set_bin_value(value);
             }
-            float  measured_div_fwd = 0.0f;
 
-            if(!this->do_time_frame)
-                more_events -=1 ;
+            if ( measured_bin.get_bin_value() <= max_quotient *fwd_bin.get_bin_value())
+            {
+                measured_bin.set_bin_value(1.0f /fwd_bin.get_bin_value());
+                int image_num;
+                TargetT& gradient_image = *gradients_for_threads.get_image(image_num);
+                if (!gradient_data_ptr_is_found[image_num])
+                {
+                    BasicCoordinate<3,int> gradient_min_indices, gradient_max_indices;
+                    if (use_image_data_ptrs && gradient_image.is_contiguous() &&
+                        gradient_image.get_regular_range(gradient_min_indices, gradient_max_indices) &&
+                        gradient_min_indices == min_indices && gradient_max_indices == max_indices)
+                      gradient_data_ptrs[image_num] = gradient_image.get_full_data_ptr();
+                    gradient_data_ptr_is_found[image_num] = true;
+                }
+                if (row_with_offsets_ptr != 0 && gradient_data_ptrs[image_num] != 0)
+                  row_with_offsets_ptr->back_project(gradient_data_ptrs[image_num], measured_bin);
+                else
+                  row.back_project(gradient_image, measured_bin);
+                gradients_for_threads.release_image(image_num);
+            }
+        }
+    } // end of parallel region
+}
 
-            num_used_events += 1;
+template <typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<TargetT>::
+compute_sub_gradient_without_penalty_plus_sensitivity(TargetT& gradient,
+                                                      const TargetT &current_estimate,
+                                                      const int subset_num)
+{
 
-            if (num_used_events%200000L==0)
-                info( boost::format("Stored Events: %1% ") % num_used_events);
+    assert(subset_num>=0);
+    assert(subset_num<this->num_subsets);
 
-            if ( measured_bin.get_bin_value() <= max_quotient *fwd_bin.get_bin_value())
-                measured_div_fwd = 1.0f /fwd_bin.get_bin_value();
-            else
-                continue;
+    long num_used_events = 0;
 
-            measured_bin.set_bin_value(measured_div_fwd);
-            proj_matrix_row.back_project(gradient, measured_bin);
+    // Events are processed in batches. The forward and back projection of the events in a batch
+    // is done in parallel (if compiled with OpenMP). The threads accumulate into the images
+    // of gradients_for_threads (the first is gradient itself), and these are added at the end.
+    const std::size_t batch_size = 65536;
+    std::vector<Bin> measured_bins;
+    measured_bins.reserve(batch_size);
+    OutputImagesForThreads<TargetT> gradients_for_threads(&gradient, this->max_num_images_for_threads);
 
+    if (this->cache_lm_events && !this->events_cache_is_filled && !this->events_cache_is_too_large)
+    {
+        if (this->fill_events_cache() == Succeeded::no)
+            this->events_cache_is_too_large = true;
+    }
+
+    if (this->cache_lm_events && !this->events_cache_is_too_large)
+    {
+
+        const std::vector<CachedEvent>& events = this->events_cache[subset_num];
+        for (std::size_t start = 0; start < events.size(); start += batch_size)
+        {
+            measured_bins.clear();
+            const std::size_t end = std::min(start + batch_size, events.size());
+            for (std::size_t i = start; i < end; ++i)
+                measured_bins.push_back(Bin(events[i].segment_num, events[i].view_num,
+                                            events[i].axial_pos_num, events[i].tangential_pos_num,
+                                            1.0f));
+            this->add_events_to_gradient(gradients_for_threads, current_estimate, measured_bins);
         }
+        num_used_events = static_cast<long>(events.size());
     }
+    else
+    {
+        const double start_time = this->frame_defs.get_start_time(this->current_frame_num);
+        const double end_time = this->frame_defs.get_end_time(this->current_frame_num);
+
+        //go to the beginning of this frame
+        //  list_mode_data_sptr->set_get_position(start_time);
+        // TODO implement function that will do this for a random time
+        this->list_mode_data_sptr->reset();
+        double current_time = 0.;
+
+        shared_ptr<CListRecord> record_sptr = this->list_mode_data_sptr->get_empty_record_sptr();
+        CListRecord& record = *record_sptr;
+
+        long int more_events =
+                this->do_time_frame? 1 : this->num_events_to_use;
+
+        // Events are read (and checked if they are in the current subset) sequentially.
+        bool end_of_events = false;
+        while (more_events && !end_of_events)
+        {
+            // read next batch
+            measured_bins.clear();
+            while (more_events && measured_bins.size() < batch_size)
+            {
+                if (this->list_mode_data_sptr->get_next_record(record) == Succeeded::no)
+                {
+                    info("End of file!");
+                    end_of_events = true;
+                    break; //get out of while loop
+                }
+
+                if(record.is_time() && end_time > 0.01)
+                {
+                    current_time = record.time().get_time_in_secs();
+                    if (this->do_time_frame && current_time >= end_time)
+                    {
+                        end_of_events = true;
+                        break; // get out of while loop
+                    }
+                    if (current_time < start_time)
+                        continue;
+                }
+
+                Bin measured_bin;
+                if (!this->get_bin_of_prompt(measured_bin, record))
+                    continue;
+
+                // If more than 1 subsets, check if the current bin belongs to
+                // the current.
+                if (this->get_subset_num_of_bin(measured_bin) != subset_num)
+                    continue;
+
+                measured_bins.push_back(measured_bin);
+
+                if(!this->do_time_frame)
+                    more_events -=1 ;
+
+                num_used_events += 1;
+
+                if (num_used_events%200000L==0)
+                    info( boost::format("Stored Events: %1% ") % num_used_events);
+            }
+
+            this->add_events_to_gradient(gradients_for_threads, current_estimate, measured_bins);
+        }
+    }
+
+    gradients_for_threads.add_to_output_image();
     info(boost::format("Number of used events: %1%") % num_used_events);
 }
 
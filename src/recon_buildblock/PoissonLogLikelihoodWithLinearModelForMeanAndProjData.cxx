@@ -102,6 +102,7 @@ set_defaults()
   //num_views_to_add=1;  
   this->proj_data_sptr.reset(); //MJ added
   this->zero_seg0_end_planes = 0;
+  this->max_num_images_for_threads = 0;
 
   this->additive_projection_data_filename = "0";
   this->additive_proj_data_sptr.reset();
@@ -162,6 +163,7 @@ initialise_keymap()
 
   this->parser.add_key("maximum absolute segment number to process", &this->max_segment_num_to_process);
   this->parser.add_key("zero end planes of segment 0", &this->zero_seg0_end_planes);
+  this->parser.add_key("maximum number of images for multi-threading", &this->max_num_images_for_threads);
 
   // image stuff
 
@@ -446,6 +448,14 @@ set_zero_seg0_end_planes(const bool arg)
   this->zero_seg0_end_planes = arg;
 }
 
+template<typename TargetT>
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::
+set_max_num_images_for_threads(const int arg)
+{
+  this->max_num_images_for_threads = arg;
+}
+
 template<typename TargetT>
 void
 PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::
@@ -596,7 +606,8 @@ set_up_before_sensitivity(shared_ptr<TargetT > const& target_sptr)
                                   this->proj_data_sptr->get_proj_data_info_ptr(),
                                   target_sptr,
                                   zero_seg0_end_planes,
-                                  distributed_cache_enabled);
+                                  distributed_cache_enabled,
+                                  this->max_num_images_for_threads);
         
 #ifdef STIR_MPI
   //set up distributed caching object
@@ -642,6 +653,39 @@ set_up_before_sensitivity(shared_ptr<TargetT > const& target_sptr)
   return Succeeded::yes;
 }
 
+template<typename TargetT>
+std::string
+PoissonLogLikelihoodWithLinearModelForMeanAndProjData<TargetT>::
+get_sensitivity_cache_description(const TargetT& target)
+{
+  ParsingObject * const normalisation_parsing_ptr =
+    dynamic_cast<ParsingObject *>(this->normalisation_sptr.get());
+  const DiscretisedDensityOnCartesianGrid<3,float> * const image_ptr =
+    dynamic_cast<const DiscretisedDensityOnCartesianGrid<3,float> *>(&target);
+  BasicCoordinate<3,int> min_indices, max_indices;
+  if (normalisation_parsing_ptr == 0 || image_ptr == 0 ||
+      !image_ptr->get_regular_range(min_indices, max_indices))
+    return std::string();
+
+  std::ostringstream s;
+  s << "PoissonLogLikelihoodWithLinearModelForMeanAndProjData sensitivity\n"
+    << "number of subsets: " << this->num_subsets << '\n'
+    << "use subset sensitivities: " << this->get_use_subset_sensitivities() << '\n'
+    << "maximum absolute segment number to process: " << this->max_segment_num_to_process << '\n'
+    << "zero end planes of segment 0: " << this->zero_seg0_end_planes << '\n'
+    << "time frame: " << this->get_time_frame_definitions().get_start_time(this->get_time_frame_num())
+    << ' ' << this->get_time_frame_definitions().get_end_time(this->get_time_frame_num()) << '\n'
+    << "image: min indices " << min_indices
+    << " max indices " << max_indices
+    << " origin " << image_ptr->get_origin()
+    << " grid spacing " << image_ptr->get_grid_spacing() << '\n'
+    << "projection data:\n" << this->proj_data_sptr->get_proj_data_info_ptr()->parameter_info() << '\n'
+    << "normalisation:\n" << normalisation_parsing_ptr->parameter_info() << '\n'
+    << "forward projector:\n" << this->projector_pair_ptr->get_forward_projector_sptr()->parameter_info() << '\n'
+    << "back projector:\n" << this->projector_pair_ptr->get_back_projector_sptr()->parameter_info() << '\n';
+  return s.str();
+}
+
 /***************************************************************
   functions that compute the value/gradient of the objective function etc
 ***************************************************************/
@@ -32,6 +32,12 @@
 
 #include "stir/recon_buildblock/ProjMatrixByBin.h"
 #include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/DiscretisedDensity.h"
+#include "stir/num_threads.h"
+#include "stir/is_null_ptr.h"
+#include "stir/info.h"
+#include "stir/warning.h"
+#include <boost/format.hpp>
 
 // define a local preprocessor symbol to keep code relatively clean
 #ifdef STIR_NO_MUTABLE
@@ -46,6 +52,7 @@ void ProjMatrixByBin::set_defaults()
 {
   cache_disabled=false;
   cache_stores_only_basic_bins=true;
+  max_cache_size_in_MB=0;
 }
 
 void 
@@ -53,18 +60,36 @@ ProjMatrixByBin::initialise_keymap()
 {
   parser.add_key("disable caching", &cache_disabled);
   parser.add_key("store_only_basic_bins_in_cache", &cache_stores_only_basic_bins);
+  parser.add_key("maximum cache size in MB", &max_cache_size_in_MB);
 }
 
 bool
 ProjMatrixByBin::post_processing()
 {
+  if (max_cache_size_in_MB < 0)
+    {
+      warning(boost::format("ProjMatrixByBin: maximum cache size in MB should not be negative, but is %1%")
+              % max_cache_size_in_MB);
+      return true;
+    }
   return false;
 }
 
 ProjMatrixByBin::ProjMatrixByBin()
+  : cache_min_tangential_pos_num(0), cache_max_tangential_pos_num(-1),
+    cache_stores_elems_with_offsets(false),
+    cache_size(0),
+    cache_statistics(1)
 { 
   set_defaults();
 }
+
+ProjMatrixByBin::~ProjMatrixByBin()
+{
+  if (!cache_disabled && get_num_cache_hits() + get_num_cache_misses() > 0)
+    report_cache_statistics();
+  delete_cache();
+}
  
 void 
 ProjMatrixByBin::
@@ -86,6 +111,84 @@ ProjMatrixByBin::
 does_cache_store_only_basic_bins() const
 { return cache_stores_only_basic_bins; }
 
+void
+ProjMatrixByBin::
+set_maximum_cache_size(const std::size_t size)
+{ max_cache_size_in_MB = static_cast<double>(size)/(1024*1024); }
+
+std::size_t
+ProjMatrixByBin::
+get_maximum_cache_size() const
+{ return static_cast<std::size_t>(max_cache_size_in_MB*1024*1024); }
+
+std::size_t
+ProjMatrixByBin::
+get_cache_size() const
+{ return cache_size; }
+
+bool
+ProjMatrixByBin::
+cache_stores_elems_with_offsets_for(const BasicCoordinate<3,int>& min_indices,
+                                    const BasicCoordinate<3,int>& max_indices) const
+{
+  return
+    cache_stores_elems_with_offsets &&
+    min_indices == offsets_min_indices &&
+    max_indices == offsets_max_indices;
+}
+
+unsigned long
+ProjMatrixByBin::
+get_num_cache_hits() const
+{
+  unsigned long num = 0;
+  for (std::size_t i=0; i<cache_statistics.size(); ++i)
+    num += cache_statistics[i].num_hits;
+  return num;
+}
+
+unsigned long
+ProjMatrixByBin::
+get_num_cache_misses() const
+{
+  unsigned long num = 0;
+  for (std::size_t i=0; i<cache_statistics.size(); ++i)
+    num += cache_statistics[i].num_misses;
+  return num;
+}
+
+unsigned long
+ProjMatrixByBin::
+get_num_cache_rejections() const
+{
+  unsigned long num = 0;
+  for (std::size_t i=0; i<cache_statistics.size(); ++i)
+    num += cache_statistics[i].num_rejections;
+  return num;
+}
+
+void
+ProjMatrixByBin::
+reset_cache_statistics()
+{
+  for (std::size_t i=0; i<cache_statistics.size(); ++i)
+    cache_statistics[i] = CacheStatistics();
+}
+
+void
+ProjMatrixByBin::
+report_cache_statistics() const
+{
+  const unsigned long num_hits = get_num_cache_hits();
+  const unsigned long num_misses = get_num_cache_misses();
+  info(boost::format("ProjMatrixByBin cache: %1% hits, %2% misses (hit rate %3$.1f%%), "
+                     "%4% rows not stored because the cache was full. Cache size %5$.1f MB")
+       % num_hits % num_misses
+       % (num_hits+num_misses == 0 ? 0. : 100.*num_hits/(num_hits+num_misses))
+       % get_num_cache_rejections()
+       % (static_cast<double>(get_cache_size())/(1024*1024)));
+}
+
 void 
 ProjMatrixByBin::
 clear_cache() STIR_MUTABLE_CONST
@@ -101,9 +204,38 @@ clear_cache() STIR_MUTABLE_CONST
            j<=this->cache_collection[i].get_max_index();
            ++j)
         {
-          this->cache_collection[i][j].clear();
+          VectorWithOffset<CacheRow *>& rows = this->cache_collection[i][j];
+          for (int a=rows.get_min_index(); a<=rows.get_max_index(); ++a)
+            {
+              if (rows[a] == 0)
+                continue;
+              CacheRow& row = *rows[a];
+              for (int t=row.get_min_index(); t<=row.get_max_index(); ++t)
+                delete row[t];
+              delete rows[a];
+              rows[a] = 0;
+            }
         }
     }
+  this->cache_size = 0;
+}
+
+void
+ProjMatrixByBin::
+delete_cache()
+{
+  this->clear_cache();
+  this->cache_collection.recycle();
+#ifdef STIR_OPENMP
+  for (int i=this->cache_locks.get_min_index();
+       i<=this->cache_locks.get_max_index();
+       ++i)
+    for (int j=this->cache_locks[i].get_min_index();
+         j<=this->cache_locks[i].get_max_index();
+         ++j)
+      omp_destroy_lock(&this->cache_locks[i][j]);
+  this->cache_locks.recycle();
+#endif
 }
 
 /*
@@ -121,7 +253,7 @@ void
 ProjMatrixByBin::
 set_up(		 
     const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
-    const shared_ptr<DiscretisedDensity<3,float> >& /*density_info_ptr*/ // TODO should be Info only
+    const shared_ptr<DiscretisedDensity<3,float> >& density_info_ptr // TODO should be Info only
     )
 {
   const int min_view_num = proj_data_info_sptr->get_min_view_num();
@@ -129,16 +261,30 @@ set_up(
   const int min_segment_num = proj_data_info_sptr->get_min_segment_num();
   const int max_segment_num = proj_data_info_sptr->get_max_segment_num();
 
-  this->cache_collection.recycle();
+  // delete any data from a previous call to set_up
+  this->delete_cache();
+
   this->cache_collection.resize(min_view_num, max_view_num);
 #ifdef STIR_OPENMP
-  this->cache_locks.recycle();
   this->cache_locks.resize(min_view_num, max_view_num);
 #endif
+  this->cache_statistics.resize(get_max_num_threads());
+  this->cache_min_tangential_pos_num = proj_data_info_sptr->get_min_tangential_pos_num();
+  this->cache_max_tangential_pos_num = proj_data_info_sptr->get_max_tangential_pos_num();
+  this->cache_stores_elems_with_offsets =
+    !is_null_ptr(density_info_ptr) &&
+    density_info_ptr->get_regular_range(this->offsets_min_indices, this->offsets_max_indices);
 
   for (int view_num=min_view_num; view_num<=max_view_num; ++view_num)
     {
       this->cache_collection[view_num].resize(min_segment_num, max_segment_num);
+      for (int seg_num = min_segment_num; seg_num <=max_segment_num; ++seg_num)
+        {
+          // rows will be allocated when necessary
+          this->cache_collection[view_num][seg_num].resize(proj_data_info_sptr->get_min_axial_pos_num(seg_num),
+                                                            proj_data_info_sptr->get_max_axial_pos_num(seg_num));
+          this->cache_collection[view_num][seg_num].fill(0);
+        }
 #ifdef STIR_OPENMP
       this->cache_locks[view_num].resize(min_segment_num, max_segment_num);
       for (int seg_num = min_segment_num; seg_num <=max_segment_num; ++seg_num)
@@ -148,42 +294,110 @@ set_up(
 }
 
 
-/*!
-    \warning Preconditions
-    <li>abs(axial_pos_num) fits in 17 bits
-    <li>abs(tangential_pos_num) fits in 11 bits   
-  */
-ProjMatrixByBin::CacheKey
-ProjMatrixByBin::cache_key(const Bin& bin) const
-{
-  assert(static_cast<boost::uint32_t>(abs(bin.axial_pos_num())) < (static_cast<boost::uint32_t>(1)<<18));
-  assert(abs(bin.tangential_pos_num()) < (1<<12));
-  return (CacheKey)( 
-                    (static_cast<boost::uint32_t>(bin.axial_pos_num()>=0?0:1) << 31)
-                    | (static_cast<boost::uint32_t>(bin.axial_pos_num())<<13) 
-                    | (static_cast<boost::uint32_t>(bin.tangential_pos_num()>=0?0:1) << 12)
-                    |  static_cast<boost::uint32_t>(abs(bin.tangential_pos_num())) );    	
-} 
-
-
-void  
+const ProjMatrixElemsForOneBin*
 ProjMatrixByBin::
 cache_proj_matrix_elems_for_one_bin(
                                     const ProjMatrixElemsForOneBin& probabilities) STIR_MUTABLE_CONST
+{
+  const CacheEntry * cached_ptr = add_to_cache(probabilities);
+  return cached_ptr == 0 ? 0 : &cached_ptr->elems;
+}
+
+const ProjMatrixByBin::CacheEntry*
+ProjMatrixByBin::
+add_to_cache(const ProjMatrixElemsForOneBin& probabilities) STIR_MUTABLE_CONST
 { 
-  if ( cache_disabled ) return;
+  if ( cache_disabled ) return 0;
   
-  //std::cerr << "cached lor size " << probabilities.size() << " capacity " << probabilities.capacity() << std::endl;    
-  // insert probabilities into the collection	
   const Bin bin = probabilities.get_bin();
+  if (!is_in_cache_range(bin))
+    return 0;
+
+  // estimate of the memory needed for the copy
+  std::size_t elems_size =
+    sizeof(CacheEntry) + 
+    probabilities.size()*sizeof(ProjMatrixElemsForOneBin::value_type);
+  if (cache_stores_elems_with_offsets)
+    elems_size +=
+      sizeof(ProjMatrixElemsForOneBinWithOffsets) +
+      probabilities.size()*(sizeof(int) + sizeof(float));
+  const std::size_t max_cache_size = this->get_maximum_cache_size();
+  if (max_cache_size > 0)
+    {
+      std::size_t current_cache_size;
+#if defined(STIR_OPENMP) &&  _OPENMP >=201012
+#pragma omp atomic read
+#endif
+      current_cache_size = this->cache_size;
+      if (current_cache_size + elems_size > max_cache_size)
+        {
+          // cache is full. We keep what is in there (see class documentation).
+          CacheStatistics& statistics = get_cache_statistics_for_this_thread();
+#ifdef STIR_OPENMP
+#pragma omp atomic
+#endif
+          ++statistics.num_rejections;
+          return 0;
+        }
+    }
+
+  // make the copy outside of the lock
+  CacheEntry * new_elems_ptr = new CacheEntry(probabilities);
+  if (cache_stores_elems_with_offsets)
+    {
+      new_elems_ptr->elems_with_offsets_ptr.reset(
+        new ProjMatrixElemsForOneBinWithOffsets(offsets_min_indices, offsets_max_indices));
+      new_elems_ptr->elems_with_offsets_ptr->set_elements(probabilities);
+    }
+  const CacheEntry * cached_ptr;
+
+  // Pointers are only written while holding the lock, so we can read them here
+  // without atomics. However, other threads read them without the lock (see find_in_cache()),
+  // so we have to make sure that the data is complete before writing the pointer.
 #ifdef STIR_OPENMP
   omp_set_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
 #endif
-  cache_collection[bin.view_num()][bin.segment_num()].insert(MapProjMatrixElemsForOneBin::value_type( cache_key(bin), 
-                                                                                                      probabilities));  
+  {
+    std::size_t added_size = 0;
+    CacheRow *& row_ptr = cache_collection[bin.view_num()][bin.segment_num()][bin.axial_pos_num()];
+    if (row_ptr == 0)
+      {
+        CacheRow * new_row_ptr = new CacheRow(cache_min_tangential_pos_num, cache_max_tangential_pos_num);
+        new_row_ptr->fill(0);
+#ifdef STIR_OPENMP
+#pragma omp flush
+#if _OPENMP >=201012
+#pragma omp atomic write
+#endif
+#endif
+        row_ptr = new_row_ptr;
+        added_size += sizeof(CacheRow) + new_row_ptr->size()*sizeof(CacheEntry *);
+      }
+    CacheEntry *& elems_ptr = (*row_ptr)[bin.tangential_pos_num()];
+    if (elems_ptr == 0)
+      {
+#ifdef STIR_OPENMP
+#pragma omp flush
+#if _OPENMP >=201012
+#pragma omp atomic write
+#endif
+#endif
+        elems_ptr = new_elems_ptr;
+        new_elems_ptr = 0;
+        added_size += elems_size;
+      }
+    // else another thread stored it already. We keep the first one.
+    cached_ptr = elems_ptr;
+#ifdef STIR_OPENMP
+#pragma omp atomic
+#endif
+    this->cache_size += added_size;
+  }
 #ifdef STIR_OPENMP
   omp_unset_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
 #endif
+  delete new_elems_ptr;
+  return cached_ptr;
 }
 
 
@@ -195,45 +409,21 @@ get_cached_proj_matrix_elems_for_one_bin(
   if ( cache_disabled ) 
     return Succeeded::no;
   
-  const Bin bin = probabilities.get_bin();
-
 #ifndef NDEBUG
   if (cache_stores_only_basic_bins)
   {
     // Check that this is a 'basic' coordinate
-    Bin bin_copy = bin; 
+    Bin bin_copy = probabilities.get_bin(); 
     assert ( symmetries_sptr->find_basic_bin(bin_copy) == 0);
   }
 #endif         
   
-  bool found=false;
-#ifdef STIR_OPENMP
-  omp_set_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
-#endif
+  const CacheEntry * cached_ptr = find_in_cache(probabilities.get_bin());
+  if (cached_ptr == 0)
+    return Succeeded::no;
 
-  {
-    const_MapProjMatrixElemsForOneBinIterator pos = 
-      cache_collection[bin.view_num()][bin.segment_num()].find(cache_key( bin));
-  
-    if ( pos != cache_collection[bin.view_num()][bin.segment_num()]. end())
-      { 
-	//cout << Key << " =========>> entry found in cache " <<  endl;
-	probabilities = pos->second;
-	// note: cannot return from inside an OPENMP critical section
-	//return Succeeded::yes;	
-	found=true;
-      } 
-  }
-#ifdef STIR_OPENMP
-  omp_unset_lock(&this->cache_locks[bin.view_num()][bin.segment_num()]);
-#endif
-  if (found)
-    return Succeeded::yes;	
-  else
-    {
-      //cout << " This entry  is not in the cache :" << Key << endl;	
-      return Succeeded::no;
-    }
+  probabilities = cached_ptr->elems;
+  return Succeeded::yes;	
 }
 
 
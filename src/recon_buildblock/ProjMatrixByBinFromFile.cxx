@@ -40,12 +40,18 @@
 #include "stir/Succeeded.h"
 #include "stir/is_null_ptr.h"
 #include "stir/Coordinate3D.h"
-//#include "boost/format.hpp"
-//#include "stir/info.h"
+#include "stir/info.h"
+#include "stir/warning.h"
+#include "stir/error.h"
+#include "boost/format.hpp"
 #include "boost/cstdint.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/interprocess/mapped_region.hpp"
 #include <fstream>
 #include <algorithm>
+#include <cstring>
+#include <cmath>
 
 using std::string;
 
@@ -58,6 +64,7 @@ ProjMatrixByBinFromFile::registered_name =
 
 ProjMatrixByBinFromFile::
 ProjMatrixByBinFromFile()
+  : data_ptr(0), data_size(0)
 {
   set_defaults();
 }
@@ -72,6 +79,7 @@ initialise_keymap()
   parser.add_key("template_density_filename", &template_density_filename);
   parser.add_key("template_proj_data_filename", &template_proj_data_filename);
   parser.add_key("data_filename", &data_filename);
+  parser.add_key("preload all data", &preload_all_data);
 
   parser.add_key("Version", &this->parsed_version);
   parser.add_key("symmetries type", &this->symmetries_type) ;
@@ -96,6 +104,7 @@ ProjMatrixByBinFromFile::set_defaults()
   template_density_filename="";
   template_proj_data_filename="";
   data_filename="";
+  preload_all_data = false;
 
   do_symmetry_90degrees_min_phi = true;
   do_symmetry_180degrees_min_phi = true;
@@ -111,9 +120,9 @@ ProjMatrixByBinFromFile::post_processing()
   if (ProjMatrixByBin::post_processing() == true)
     return true;
 
-  if (this->parsed_version != "1.0")
+  if (this->parsed_version != "1.0" && this->parsed_version != "2.0")
     { 
-      warning("version has to be 1.0");
+      warning("version has to be 1.0 or 2.0");
       return true;
     }
   this->symmetries_type = standardise_interfile_keyword(this->symmetries_type);
@@ -200,9 +209,12 @@ set_up(
   // TODO allow for smaller range
   if (densel_range != image_info_ptr->get_index_range())
     error("ProjMatrixByBinFromFile set-up with image with wrong index range\n");
-  if (voxel_size != image_info_ptr->get_voxel_size())
+  // allow for rounding errors, as the template image is stored with limited precision
+  const float tolerance =
+    .001F*std::min(voxel_size.z(), std::min(voxel_size.y(), voxel_size.x()));
+  if (norm(voxel_size - image_info_ptr->get_voxel_size()) > tolerance)
     error("ProjMatrixByBinFromFile set-up with image with wrong voxel size\n");
-  if (origin != image_info_ptr->get_origin())
+  if (norm(origin - image_info_ptr->get_origin()) > tolerance)
     error("ProjMatrixByBinFromFile set-up with image with wrong origin\n");
 
   /* do consistency checks on projection data.
@@ -328,15 +340,192 @@ namespace {
       }  
     return readReturnType::ok;
   }
+
+  /************** functions for version 2.0 ******************/
+
+  // size (in bytes) of the header of the binary file
+  const std::size_t v2_header_size = 32;
+  // size (in bytes) of an entry in the index
+  const std::size_t v2_index_entry_size = 36;
+  const char v2_magic[8] = "STIRPM2";
+
+  template <class T>
+  static inline void
+  append_to_buffer(std::vector<char>& buffer, const T& value)
+  {
+    const char * const ptr = reinterpret_cast<const char *>(&value);
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(T));
+  }
+
+  template <class T>
+  static inline T
+  get_from_buffer(const char * const ptr)
+  {
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    return value;
+  }
+
+  // append an integer using "zigzag" encoding (small negative numbers become small positive ones)
+  // and a variable number of bytes (7 bits per byte, highest bit indicates if there are more bytes)
+  static inline void
+  append_varint(std::vector<char>& buffer, const boost::int32_t value)
+  {
+    boost::uint32_t z =
+      (static_cast<boost::uint32_t>(value) << 1) ^ static_cast<boost::uint32_t>(value >> 31);
+    while (z >= 0x80)
+      {
+        buffer.push_back(static_cast<char>((z & 0x7f) | 0x80));
+        z >>= 7;
+      }
+    buffer.push_back(static_cast<char>(z));
+  }
+
+  // read an integer written by append_varint, returns false if we get to the end of the data
+  static inline bool
+  read_varint(const char *& ptr, const char * const end, boost::int32_t& value)
+  {
+    boost::uint32_t z = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+      {
+        if (ptr == end || shift > 28)
+          return false;
+        byte = static_cast<unsigned char>(*ptr++);
+        z |= static_cast<boost::uint32_t>(byte & 0x7f) << shift;
+        shift += 7;
+      }
+    while (byte & 0x80);
+    value = static_cast<boost::int32_t>(z >> 1) ^ -static_cast<boost::int32_t>(z & 1);
+    return true;
+  }
+
+  // convert to IEEE half precision, with rounding to nearest (overflow goes to infinity)
+  static inline boost::uint16_t
+  float_to_half(const float f)
+  {
+    const boost::uint32_t x = get_from_buffer<boost::uint32_t>(reinterpret_cast<const char *>(&f));
+    const boost::uint32_t sign = (x >> 16) & 0x8000;
+    const int exponent = static_cast<int>((x >> 23) & 0xff) - 127 + 15;
+    boost::uint32_t mantissa = x & 0x7fffff;
+    if (((x >> 23) & 0xff) == 0xff) // infinity or NaN
+      return static_cast<boost::uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    if (exponent >= 31)
+      return static_cast<boost::uint16_t>(sign | 0x7c00);
+    if (exponent <= 0)
+      {
+        // denormalised half
+        if (exponent < -10)
+          return static_cast<boost::uint16_t>(sign);
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+        boost::uint32_t half_mantissa = mantissa >> shift;
+        if ((mantissa >> (shift-1)) & 1)
+          ++half_mantissa;
+        return static_cast<boost::uint16_t>(sign | half_mantissa);
+      }
+    boost::uint32_t half = sign | (static_cast<boost::uint32_t>(exponent) << 10) | (mantissa >> 13);
+    // round (a carry into the exponent gives the correct result)
+    if (mantissa & 0x1000)
+      ++half;
+    return static_cast<boost::uint16_t>(half);
+  }
+
+  static inline float
+  half_to_float(const boost::uint16_t half)
+  {
+    const boost::uint32_t sign = static_cast<boost::uint32_t>(half & 0x8000) << 16;
+    const boost::uint32_t exponent = (half >> 10) & 0x1f;
+    const boost::uint32_t mantissa = half & 0x3ff;
+    if (exponent == 0)
+      {
+        const float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+      }
+    boost::uint32_t x;
+    if (exponent == 31)
+      x = sign | 0x7f800000 | (mantissa << 13);
+    else
+      x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    return get_from_buffer<float>(reinterpret_cast<const char *>(&x));
+  }
+
+  // encode the elements of the lor, see ProjMatrixByBinFromFile class documentation
+  static void
+  encode_lor(std::vector<char>& buffer, boost::uint32_t& encoding, float& scale,
+             const ProjMatrixElemsForOneBin& lor,
+             const float max_relative_quantisation_error)
+  {
+    buffer.resize(0);
+    scale = 0.F;
+    for (ProjMatrixElemsForOneBin::const_iterator iter = lor.begin(); iter != lor.end(); ++iter)
+      scale = std::max(scale, std::fabs(iter->get_value()));
+    if (scale == 0.F)
+      scale = 1.F;
+
+    // check if we can use 16 bits
+    encoding = max_relative_quantisation_error > 0 ? 1 : 0;
+    for (ProjMatrixElemsForOneBin::const_iterator iter = lor.begin();
+         encoding==1 && iter != lor.end(); ++iter)
+      {
+        const float value = iter->get_value();
+        const float quantised_value = half_to_float(float_to_half(value/scale))*scale;
+        if (std::fabs(quantised_value - value) > max_relative_quantisation_error*std::fabs(value))
+          encoding = 0;
+      }
+
+    // values
+    for (ProjMatrixElemsForOneBin::const_iterator iter = lor.begin(); iter != lor.end(); ++iter)
+      {
+        if (encoding == 1)
+          append_to_buffer(buffer, float_to_half(iter->get_value()/scale));
+        else
+          append_to_buffer(buffer, iter->get_value());
+      }
+    // coordinate differences
+    int c1=0, c2=0, c3=0;
+    for (ProjMatrixElemsForOneBin::const_iterator iter = lor.begin(); iter != lor.end(); ++iter)
+      {
+        append_varint(buffer, iter->coord1() - c1);
+        append_varint(buffer, iter->coord2() - c2);
+        append_varint(buffer, iter->coord3() - c3);
+        c1 = iter->coord1(); c2 = iter->coord2(); c3 = iter->coord3();
+      }
+  }
+
 } // end of anonymous namespace
+
+bool
+ProjMatrixByBinFromFile::IndexEntry::
+operator<(const IndexEntry& e) const
+{
+  const Bin& b = e.bin;
+  return
+    bin.segment_num() < b.segment_num() ||
+    (bin.segment_num() == b.segment_num() &&
+     (bin.view_num() < b.view_num() ||
+      (bin.view_num() == b.view_num() &&
+       (bin.axial_pos_num() < b.axial_pos_num() ||
+        (bin.axial_pos_num() == b.axial_pos_num() &&
+         bin.tangential_pos_num() < b.tangential_pos_num())))));
+}
     
 Succeeded
 ProjMatrixByBinFromFile::
 write_to_file(const std::string& output_filename_prefix, 
 	      const ProjMatrixByBin& proj_matrix,
 	      const shared_ptr<ProjDataInfo>& proj_data_info_sptr,
-	      const DiscretisedDensity<3,float>& template_density)
+	      const DiscretisedDensity<3,float>& template_density,
+	      const int format_version,
+	      const float max_relative_quantisation_error)
 {
+  if (format_version != 1 && format_version != 2)
+    {
+      warning(boost::format("ProjMatrixByBinFromFile::write_to_file: format version %1% is not supported")
+              % format_version);
+      return Succeeded::no;
+    }
 
   string template_density_filename =
     output_filename_prefix + "_template_density";
@@ -358,6 +547,8 @@ write_to_file(const std::string& output_filename_prefix,
 					proj_data_info_sptr,
 					template_proj_data_filename);
   }
+  // ProjDataInterfile appends the extension for the header
+  add_extension(template_proj_data_filename, ".hs");
 
   string header_filename = output_filename_prefix;
   replace_extension(header_filename, ".hpm");
@@ -374,7 +565,7 @@ write_to_file(const std::string& output_filename_prefix,
       }
 
     header << "Projection Matrix By Bin From File Parameters:=\n"
-	   << "Version := 1.0\n";
+	   << "Version := " << format_version << ".0\n";
     // TODO symmetries should not be hard-coded
     if (!is_null_ptr(dynamic_cast<const DataSymmetriesForBins_PET_CartesianGrid * const>(proj_matrix.get_symmetries_ptr())))
       {
@@ -412,6 +603,17 @@ write_to_file(const std::string& output_filename_prefix,
 
   std::ofstream fst;
   open_write_binary(fst, data_filename.c_str());
+
+  // for version 2: index and buffer for encoded data
+  std::vector<IndexEntry> index;
+  std::vector<char> buffer;
+  boost::uint64_t current_offset = v2_header_size;
+  if (format_version == 2)
+    {
+      // write header later, when we know where the index is
+      const std::vector<char> empty_header(v2_header_size, 0);
+      fst.write(&empty_header[0], v2_header_size);
+    }
   
   // loop over bins
   // the complication here is that we cannot just test if each bin in the range is 'basic'
@@ -496,10 +698,62 @@ write_to_file(const std::string& output_filename_prefix,
 	    //  continue;
 	    
 	    proj_matrix.get_proj_matrix_elems_for_one_bin(lor,bin);
-	    if (write_lor(fst, lor) == Succeeded::no)
+	    if (format_version == 1)
+	      {
+		if (write_lor(fst, lor) == Succeeded::no)
+		  return Succeeded::no;
+		continue;
+	      }
+	    IndexEntry entry;
+	    entry.bin = lor.get_bin();
+	    entry.offset = current_offset;
+	    entry.num_elements = static_cast<boost::uint32_t>(lor.size());
+	    encode_lor(buffer, entry.encoding, entry.scale, lor, max_relative_quantisation_error);
+	    if (!buffer.empty())
+	      fst.write(&buffer[0], buffer.size());
+	    if (!fst)
 	      return Succeeded::no;
+	    current_offset += buffer.size();
+	    index.push_back(entry);
 	  }
   }
+  if (format_version == 1)
+    return Succeeded::yes;
+
+  // write index, sorted by bin such that we can find entries quickly
+  std::sort(index.begin(), index.end());
+  for (std::vector<IndexEntry>::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+    {
+      buffer.resize(0);
+      append_to_buffer(buffer, static_cast<boost::int32_t>(iter->bin.segment_num()));
+      append_to_buffer(buffer, static_cast<boost::int32_t>(iter->bin.view_num()));
+      append_to_buffer(buffer, static_cast<boost::int32_t>(iter->bin.axial_pos_num()));
+      append_to_buffer(buffer, static_cast<boost::int32_t>(iter->bin.tangential_pos_num()));
+      append_to_buffer(buffer, iter->offset);
+      append_to_buffer(buffer, iter->num_elements);
+      append_to_buffer(buffer, iter->encoding);
+      append_to_buffer(buffer, iter->scale);
+      assert(buffer.size() == v2_index_entry_size);
+      fst.write(&buffer[0], buffer.size());
+    }
+  // header
+  buffer.assign(v2_magic, v2_magic + sizeof(v2_magic));
+  append_to_buffer(buffer, static_cast<boost::uint32_t>(1));
+  append_to_buffer(buffer, static_cast<boost::uint32_t>(0));
+  append_to_buffer(buffer, current_offset);
+  append_to_buffer(buffer, static_cast<boost::uint64_t>(index.size()));
+  assert(buffer.size() == v2_header_size);
+  fst.seekp(0);
+  fst.write(&buffer[0], buffer.size());
+  if (!fst)
+    return Succeeded::no;
+
+  std::size_t num_quantised = 0;
+  for (std::vector<IndexEntry>::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+    if (iter->encoding == 1)
+      ++num_quantised;
+  info(boost::format("ProjMatrixByBinFromFile: wrote %1% bins (%2% with 16-bit values)")
+       % index.size() % num_quantised);
   return Succeeded::yes;
 }
 
@@ -507,6 +761,43 @@ Succeeded
 ProjMatrixByBinFromFile::
 read_data()
 {
+  this->index.resize(0);
+  this->mapped_region_sptr.reset();
+  std::vector<char>().swap(this->data_buffer);
+
+  if (this->parsed_version == "2.0")
+    {
+      if (read_index() == Succeeded::no)
+        return Succeeded::no;
+      if (!this->preload_all_data)
+        return Succeeded::yes;
+      if (!this->is_cache_enabled())
+        {
+          warning("ProjMatrixByBinFromFile: ignoring \"preload all data\" as caching is disabled");
+          return Succeeded::yes;
+        }
+
+      // read all data into the cache (the cache is thread-safe)
+      const int num_entries = static_cast<int>(this->index.size());
+      bool all_ok = true;
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic, 64) reduction(&&:all_ok)
+#endif
+      for (int i=0; i<num_entries; ++i)
+        {
+          ProjMatrixElemsForOneBin lor;
+          lor.set_bin(this->index[i].bin);
+          if (decode_bin(lor, this->index[i]) == Succeeded::no)
+            all_ok = false;
+          else
+            this->cache_proj_matrix_elems_for_one_bin(lor);
+        }
+      return all_ok ? Succeeded::yes : Succeeded::no;
+    }
+
+  if (!this->is_cache_enabled() || this->get_maximum_cache_size() > 0)
+    warning("ProjMatrixByBinFromFile: version 1.0 files need the cache to be enabled without size limit.\n"
+            "Some (or all) matrix elements will be zero.");
   std::ifstream fst;
   open_read_binary(fst, data_filename.c_str());
   
@@ -525,13 +816,148 @@ read_data()
 }
 
 
+Succeeded
+ProjMatrixByBinFromFile::
+read_index()
+{
+  // map the file into memory, or read it if this fails
+  try
+    {
+      // note: the mapping stays valid after file_mapping goes out of scope
+      boost::interprocess::file_mapping mapping(data_filename.c_str(), boost::interprocess::read_only);
+      this->mapped_region_sptr.reset(new boost::interprocess::mapped_region(mapping, boost::interprocess::read_only));
+      this->data_ptr = static_cast<const char *>(this->mapped_region_sptr->get_address());
+      this->data_size = this->mapped_region_sptr->get_size();
+    }
+  catch (std::exception& e)
+    {
+      warning(boost::format("ProjMatrixByBinFromFile: cannot memory-map file %1% (%2%).\n"
+                            "Reading the whole file instead.") % data_filename % e.what());
+      this->mapped_region_sptr.reset();
+      std::ifstream fst;
+      open_read_binary(fst, data_filename.c_str());
+      fst.seekg(0, std::ios::end);
+      this->data_buffer.resize(static_cast<std::size_t>(fst.tellg()));
+      fst.seekg(0, std::ios::beg);
+      if (!this->data_buffer.empty())
+        fst.read(&this->data_buffer[0], this->data_buffer.size());
+      if (!fst)
+        {
+          warning(boost::format("ProjMatrixByBinFromFile: error reading %1%") % data_filename);
+          return Succeeded::no;
+        }
+      this->data_ptr = this->data_buffer.empty() ? 0 : &this->data_buffer[0];
+      this->data_size = this->data_buffer.size();
+    }
+
+  if (this->data_size < v2_header_size ||
+      std::strncmp(this->data_ptr, v2_magic, sizeof(v2_magic)) != 0)
+    {
+      warning(boost::format("ProjMatrixByBinFromFile: %1% is not a version 2.0 file") % data_filename);
+      return Succeeded::no;
+    }
+  if (get_from_buffer<boost::uint32_t>(this->data_ptr + 8) != 1)
+    {
+      warning(boost::format("ProjMatrixByBinFromFile: %1% was written with a different byte order") % data_filename);
+      return Succeeded::no;
+    }
+  const boost::uint64_t index_offset = get_from_buffer<boost::uint64_t>(this->data_ptr + 16);
+  const boost::uint64_t num_entries = get_from_buffer<boost::uint64_t>(this->data_ptr + 24);
+  if (index_offset > this->data_size ||
+      num_entries > (this->data_size - index_offset)/v2_index_entry_size)
+    {
+      warning(boost::format("ProjMatrixByBinFromFile: %1% is too short") % data_filename);
+      return Succeeded::no;
+    }
+
+  this->index.resize(static_cast<std::size_t>(num_entries));
+  const char * ptr = this->data_ptr + index_offset;
+  for (std::size_t i=0; i<this->index.size(); ++i, ptr += v2_index_entry_size)
+    {
+      IndexEntry& entry = this->index[i];
+      entry.bin = Bin(get_from_buffer<boost::int32_t>(ptr),
+                      get_from_buffer<boost::int32_t>(ptr+4),
+                      get_from_buffer<boost::int32_t>(ptr+8),
+                      get_from_buffer<boost::int32_t>(ptr+12),
+                      0.F);
+      entry.offset = get_from_buffer<boost::uint64_t>(ptr+16);
+      entry.num_elements = get_from_buffer<boost::uint32_t>(ptr+24);
+      entry.encoding = get_from_buffer<boost::uint32_t>(ptr+28);
+      entry.scale = get_from_buffer<float>(ptr+32);
+      if (i>0 && !(this->index[i-1] < entry))
+        {
+          warning(boost::format("ProjMatrixByBinFromFile: index in %1% is not sorted") % data_filename);
+          return Succeeded::no;
+        }
+    }
+  info(boost::format("ProjMatrixByBinFromFile: found %1% bins in %2%") % this->index.size() % data_filename, 2);
+  return Succeeded::yes;
+}
+
+const ProjMatrixByBinFromFile::IndexEntry*
+ProjMatrixByBinFromFile::
+find_in_index(const Bin& bin) const
+{
+  IndexEntry key;
+  key.bin = bin;
+  std::vector<IndexEntry>::const_iterator iter =
+    std::lower_bound(this->index.begin(), this->index.end(), key);
+  if (iter == this->index.end() || key < *iter)
+    return 0;
+  return &(*iter);
+}
+
+Succeeded
+ProjMatrixByBinFromFile::
+decode_bin(ProjMatrixElemsForOneBin& lor, const IndexEntry& entry) const
+{
+  lor.erase();
+  const std::size_t size_of_value = entry.encoding == 1 ? sizeof(boost::uint16_t) : sizeof(float);
+  const char * const end = this->data_ptr + this->data_size;
+  if (entry.offset > this->data_size ||
+      entry.num_elements > (this->data_size - entry.offset)/size_of_value)
+    return Succeeded::no;
+  const char * value_ptr = this->data_ptr + entry.offset;
+  const char * coord_ptr = value_ptr + entry.num_elements*size_of_value;
+
+  lor.reserve(entry.num_elements);
+  boost::int32_t c1=0, c2=0, c3=0;
+  for (boost::uint32_t i=0; i<entry.num_elements; ++i, value_ptr += size_of_value)
+    {
+      boost::int32_t d1, d2, d3;
+      if (!read_varint(coord_ptr, end, d1) ||
+          !read_varint(coord_ptr, end, d2) ||
+          !read_varint(coord_ptr, end, d3))
+        return Succeeded::no;
+      c1 += d1; c2 += d2; c3 += d3;
+      const float value =
+        entry.encoding == 1 ?
+        half_to_float(get_from_buffer<boost::uint16_t>(value_ptr))*entry.scale :
+        get_from_buffer<float>(value_ptr);
+      lor.push_back(ProjMatrixElemsForOneBin::value_type(Coordinate3D<int>(c1,c2,c3), value));
+    }
+  return Succeeded::yes;
+}
+
 void 
 ProjMatrixByBinFromFile::
 calculate_proj_matrix_elems_for_one_bin(ProjMatrixElemsForOneBin& lor
 					) const
 {
-  //error("ProjMatrixByBinFromFile element not found in cache (and hence file)");
   lor.erase();
+  // for version 1.0, all elements are in the cache already. If not, they are zero.
+  //error("ProjMatrixByBinFromFile element not found in cache (and hence file)");
+  if (this->index.empty())
+    return;
+  // find in index and read it from the (mapped) file
+  const IndexEntry * const entry_ptr = find_in_index(lor.get_bin());
+  if (entry_ptr == 0)
+    return;
+  if (decode_bin(lor, *entry_ptr) == Succeeded::no)
+    error(boost::format("ProjMatrixByBinFromFile: error reading data for bin (s:%1%,v:%2%,a:%3%,t:%4%) from %5%")
+          % entry_ptr->bin.segment_num() % entry_ptr->bin.view_num()
+          % entry_ptr->bin.axial_pos_num() % entry_ptr->bin.tangential_pos_num()
+          % data_filename);
 }
 END_NAMESPACE_STIR
 
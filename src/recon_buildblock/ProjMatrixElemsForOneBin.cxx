@@ -344,28 +344,59 @@ void ProjMatrixElemsForOneBin::read(   fstream&fst )
 #endif
 
 /////////////////// projection  operations ////////////////////////////////// 
+/*
+  Implementation note: indexing the density as density[z][y][x] involves 3 indirections
+  (as every dimension of an Array is a separately allocated VectorWithOffset).
+  Elements of a row are generally stored in the order in which the LOR traverses the
+  image, such that consecutive elements are often in the same plane and/or image row.
+  The loops below therefore keep references to the current plane and row, and only
+  look them up again when they change. Finally, the range check on the plane is done
+  once per plane.
+  For the forward projection, the sum is accumulated in a local variable such that
+  the compiler can keep it in a register.
+*/
 void 
 ProjMatrixElemsForOneBin::
 back_project(DiscretisedDensity<3,float>& density,   
              const Bin& single) const
 {   
-  {  
-    const float data = single.get_bin_value() ;     
-    // KT 21/02/2002 added check on 0
-    if (data == 0)
-      return;
-    
-    BasicCoordinate<3,int> coords;
-    const_iterator element_ptr = 
-      begin();
-    while (element_ptr != end())
+  const float data = single.get_bin_value() ;     
+  // KT 21/02/2002 added check on 0
+  if (data == 0)
+    return;
+
+  const int min_z = density.get_min_index();
+  const int max_z = density.get_max_index();
+  // initialise to out-of-range values such that the first element triggers a look-up
+  int current_z = max_z + 1;
+  int current_y = 0;
+  bool current_z_in_range = false;
+  Array<2,float>* plane_ptr = 0;
+  Array<1,float>* row_ptr = 0;
+
+  for (const_iterator element_ptr = begin(); element_ptr != end(); ++element_ptr)
     {
-      coords = element_ptr->get_coords();
-      if (coords[1] >= density.get_min_index() && coords[1] <= density.get_max_index())
-        density[coords[1]][coords[2]][coords[3]] += element_ptr->get_value() * data;		
-      element_ptr++;            
-    }    
-  }    
+      const int z = element_ptr->coord1();
+      const int y = element_ptr->coord2();
+      if (z != current_z)
+        {
+          current_z = z;
+          current_z_in_range = z >= min_z && z <= max_z;
+          if (!current_z_in_range)
+            continue;
+          plane_ptr = &density[z];
+          current_y = y;
+          row_ptr = &(*plane_ptr)[y];
+        }
+      else if (!current_z_in_range)
+        continue;
+      else if (y != current_y)
+        {
+          current_y = y;
+          row_ptr = &(*plane_ptr)[y];
+        }
+      (*row_ptr)[element_ptr->coord3()] += element_ptr->get_value() * data;
+    }
 }
 
 
@@ -374,23 +405,42 @@ ProjMatrixElemsForOneBin::
 forward_project(Bin& single,
                 const DiscretisedDensity<3,float>& density) const
 {
-  {  
-    
-    BasicCoordinate<3,int> coords;
-    const_iterator element_ptr = begin();
-    
-    while (element_ptr != end())
+  const int min_z = density.get_min_index();
+  const int max_z = density.get_max_index();
+  // initialise to out-of-range values such that the first element triggers a look-up
+  int current_z = max_z + 1;
+  int current_y = 0;
+  bool current_z_in_range = false;
+  const Array<2,float>* plane_ptr = 0;
+  const Array<1,float>* row_ptr = 0;
+  float sum = 0.F;
+
+  for (const_iterator element_ptr = begin(); element_ptr != end(); ++element_ptr)
     {
-      coords = element_ptr->get_coords();
-      
-      if (coords[1] >= density.get_min_index() && coords[1] <= density.get_max_index())
-        single += density[coords[1]][coords[2]][coords[3]] * element_ptr->get_value();
-      ++element_ptr;		
-    }	      
-  }   
+      const int z = element_ptr->coord1();
+      const int y = element_ptr->coord2();
+      if (z != current_z)
+        {
+          current_z = z;
+          current_z_in_range = z >= min_z && z <= max_z;
+          if (!current_z_in_range)
+            continue;
+          plane_ptr = &density[z];
+          current_y = y;
+          row_ptr = &(*plane_ptr)[y];
+        }
+      else if (!current_z_in_range)
+        continue;
+      else if (y != current_y)
+        {
+          current_y = y;
+          row_ptr = &(*plane_ptr)[y];
+        }
+      sum += (*row_ptr)[element_ptr->coord3()] * element_ptr->get_value();
+    }
+  single += sum;
 }
 
-
 void 
 ProjMatrixElemsForOneBin::
 back_project(DiscretisedDensity<3,float>& density,
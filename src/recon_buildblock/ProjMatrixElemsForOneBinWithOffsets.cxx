@@ -0,0 +1,76 @@
+//
+//
+/*!
+
+  \file
+  \ingroup projection
+
+  \brief Non-inline implementations for class stir::ProjMatrixElemsForOneBinWithOffsets
+
+*/
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/error.h"
+#include <limits>
+
+START_NAMESPACE_STIR
+
+ProjMatrixElemsForOneBinWithOffsets::
+ProjMatrixElemsForOneBinWithOffsets(const BasicCoordinate<3,int>& min_indices,
+                                    const BasicCoordinate<3,int>& max_indices)
+  : min_z(min_indices[1]), max_z(max_indices[1]),
+    min_y(min_indices[2]), min_x(min_indices[3]),
+    num_y(max_indices[2] - min_indices[2] + 1),
+    num_x(max_indices[3] - min_indices[3] + 1),
+    num_elements(0)
+{
+  const double num_voxels =
+    static_cast<double>(max_z - min_z + 1) * num_y * num_x;
+  if (num_voxels > std::numeric_limits<int>::max())
+    error("ProjMatrixElemsForOneBinWithOffsets: image is too large (%g voxels)", num_voxels);
+}
+
+void
+ProjMatrixElemsForOneBinWithOffsets::
+set_elements(const ProjMatrixElemsForOneBin& row)
+{
+  if (offsets.size() < row.size())
+    {
+      offsets.resize(row.size());
+      values.resize(row.size());
+    }
+
+  std::size_t i = 0;
+  for (ProjMatrixElemsForOneBin::const_iterator element_ptr = row.begin();
+       element_ptr != row.end();
+       ++element_ptr)
+    {
+      const int z = element_ptr->coord1();
+      if (z < min_z || z > max_z)
+        continue;
+      offsets[i] =
+        ((z - min_z)*num_y + (element_ptr->coord2() - min_y))*num_x +
+        (element_ptr->coord3() - min_x);
+      values[i] = element_ptr->get_value();
+      ++i;
+    }
+  num_elements = i;
+}
+
+END_NAMESPACE_STIR
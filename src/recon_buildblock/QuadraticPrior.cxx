@@ -35,6 +35,7 @@
 #include "stir/is_null_ptr.h"
 #include "stir/info.h"
 #include <algorithm>
+#include <vector>
 using std::min;
 using std::max;
 
@@ -222,6 +223,21 @@ compute_weights(Array<3,float>& weights, const CartesianCoordinate3D<float>& gri
         }
 }
 
+/* Find the range of indices i in a row of length num_x such that the neighbour at i+dx
+   is in the row as well, i.e. first_i <= i < end_i.
+
+   Using this, the loops below first run over all neighbours, and then over all voxels in the row
+   for which that neighbour exists. This avoids any checks in the inner loop (such that it can 
+   be vectorised by the compiler).
+   Note that the image has to have a regular index range for this.
+*/
+static inline void
+get_range_with_neighbour_in_row(int& first_i, int& end_i, const int dx, const int num_x)
+{
+  first_i = max(0, -dx);
+  end_i = min(num_x, num_x - dx);
+}
+
 template <typename elemT>
 double
 QuadraticPrior<elemT>::
@@ -248,9 +264,18 @@ compute_value(const DiscretisedDensity<3,elemT> &current_image_estimate)
     error("QuadraticPrior: kappa image has not the same index range as the reconstructed image\n");
 
 
+  /* formula:
+     sum_x,y,z sum_dx,dy,dz
+       1/4 weights[dz][dy][dx] *
+       (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx])^2 *
+       (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+  */
   double result = 0.;
   const int min_z = current_image_estimate.get_min_index(); 
   const int max_z = current_image_estimate.get_max_index(); 
+#ifdef STIR_OPENMP
+#pragma omp parallel for reduction(+:result)
+#endif
   for (int z=min_z; z<=max_z; z++)
     {
       const int min_dz = max(weights.get_min_index(), min_z-z);
@@ -259,41 +284,50 @@ compute_value(const DiscretisedDensity<3,elemT> &current_image_estimate)
       const int min_y = current_image_estimate[z].get_min_index();
       const int max_y = current_image_estimate[z].get_max_index();
 
-        for (int y=min_y;y<= max_y;y++)
-          {
-            const int min_dy = max(weights[0].get_min_index(), min_y-y);
-            const int max_dy = min(weights[0].get_max_index(), max_y-y);            
+      for (int y=min_y;y<= max_y;y++)
+        {
+          const int min_dy = max(weights[0].get_min_index(), min_y-y);
+          const int max_dy = min(weights[0].get_max_index(), max_y-y);            
 
-            const int min_x = current_image_estimate[z][y].get_min_index(); 
-            const int max_x = current_image_estimate[z][y].get_max_index(); 
+          const int min_x = current_image_estimate[z][y].get_min_index(); 
+          const int num_x = current_image_estimate[z][y].get_length(); 
+          const elemT * const image_row = &current_image_estimate[z][y][min_x];
+          const elemT * const kappa_row = do_kappa ? &(*kappa_ptr)[z][y][min_x] : 0;
 
-            for (int x=min_x;x<= max_x;x++)       
+          for (int dz=min_dz;dz<=max_dz;++dz)
+            for (int dy=min_dy;dy<=max_dy;++dy)
               {
-                const int min_dx = max(weights[0][0].get_min_index(), min_x-x);
-                const int max_dx = min(weights[0][0].get_max_index(), max_x-x);
-                
-                /* formula:
-                  sum_dx,dy,dz
-                   1/4 weights[dz][dy][dx] *
-                   (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx])^2 *
-                   (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-                */
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
+                const elemT * const neighbour_row = &current_image_estimate[z+dz][y+dy][min_x];
+                const elemT * const neighbour_kappa_row = do_kappa ? &(*kappa_ptr)[z+dz][y+dy][min_x] : 0;
+                for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+                  {
+                    const float weight = weights[dz][dy][dx];
+                    if (weight == 0)
+                      continue;
+                    int first_i, end_i;
+                    get_range_with_neighbour_in_row(first_i, end_i, dx, num_x);
+                    if (do_kappa)
                       {
-                        elemT current =
-                          weights[dz][dy][dx] *
-                          square(current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx])/4;
-
-                        if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-
-                        result += static_cast<double>(current);
+                        for (int i=first_i; i<end_i; ++i)
+                          {
+                            elemT current =
+                              weight * square(image_row[i] - neighbour_row[i+dx])/4;
+                            current *= kappa_row[i] * neighbour_kappa_row[i+dx];
+                            result += static_cast<double>(current);
+                          }
+                      }
+                    else
+                      {
+                        for (int i=first_i; i<end_i; ++i)
+                          {
+                            const elemT current =
+                              weight * square(image_row[i] - neighbour_row[i+dx])/4;
+                            result += static_cast<double>(current);
+                          }
                       }
-              }              
-          }
+                  }
+              }
+        }
     }
   return result * this->penalisation_factor;
 }
@@ -328,8 +362,17 @@ compute_gradient(DiscretisedDensity<3,elemT>& prior_gradient,
   if (do_kappa && !kappa_ptr->has_same_characteristics(current_image_estimate))
     error("QuadraticPrior: kappa image has not the same index range as the reconstructed image\n");
 
+  /* formula:
+     sum_dx,dy,dz
+       weights[dz][dy][dx] *
+       (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx]) *
+       (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+  */
   const int min_z = current_image_estimate.get_min_index();  
   const int max_z = current_image_estimate.get_max_index();  
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
   for (int z=min_z; z<=max_z; z++) 
     { 
       const int min_dz = max(weights.get_min_index(), min_z-z); 
@@ -344,84 +387,43 @@ compute_gradient(DiscretisedDensity<3,elemT>& prior_gradient,
           const int max_dy = min(weights[0].get_max_index(), max_y-y);             
           
           const int min_x = current_image_estimate[z][y].get_min_index();
-          const int max_x = current_image_estimate[z][y].get_max_index();  
-          
-          for (int x=min_x;x<= max_x;x++)
-            {
-              const int min_dx = max(weights[0][0].get_min_index(), min_x-x);
-              const int max_dx = min(weights[0][0].get_max_index(), max_x-x);
-                
-                /* formula:
-                  sum_dx,dy,dz
-                   weights[dz][dy][dx] *
-                   (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx]) *
-                   (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-                */
-#if 1
-                elemT gradient = 0;
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
+          const int num_x = current_image_estimate[z][y].get_length();
+          const elemT * const image_row = &current_image_estimate[z][y][min_x];
+          const elemT * const kappa_row = do_kappa ? &(*kappa_ptr)[z][y][min_x] : 0;
+          elemT * const gradient_row = &prior_gradient[z][y][min_x];
+          std::fill(gradient_row, gradient_row + num_x, elemT(0));
+
+          for (int dz=min_dz;dz<=max_dz;++dz)
+            for (int dy=min_dy;dy<=max_dy;++dy)
+              {
+                const elemT * const neighbour_row = &current_image_estimate[z+dz][y+dy][min_x];
+                const elemT * const neighbour_kappa_row = do_kappa ? &(*kappa_ptr)[z+dz][y+dy][min_x] : 0;
+                for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+                  {
+                    const float weight = weights[dz][dy][dx];
+                    if (weight == 0)
+                      continue;
+                    int first_i, end_i;
+                    get_range_with_neighbour_in_row(first_i, end_i, dx, num_x);
+                    if (do_kappa)
                       {
-                        elemT current =
-                          weights[dz][dy][dx] *
-                          (current_image_estimate[z][y][x] - current_image_estimate[z+dz][y+dy][x+dx]);
-
-                        if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-
-                        gradient += current;
+                        for (int i=first_i; i<end_i; ++i)
+                          {
+                            elemT current = weight * (image_row[i] - neighbour_row[i+dx]);
+                            current *= kappa_row[i] * neighbour_kappa_row[i+dx];
+                            gradient_row[i] += current;
+                          }
                       }
-#else
-                // attempt to speed up by precomputing the sum of weights.
-                // The current code gives identical results but is actually slower
-                // than the above, at least when kappas are present.
-
-
-                // precompute sum of weights
-                // TODO without kappas, this is just weights.sum() most of the time, 
-                // but not near edges
-                float sum_of_weights = 0;
-                {
-                  if (do_kappa)
-                    {                
-                      for (int dz=min_dz;dz<=max_dz;++dz)
-                        for (int dy=min_dy;dy<=max_dy;++dy)
-                          for (int dx=min_dx;dx<=max_dx;++dx)
-                            sum_of_weights +=  weights[dz][dy][dx]*(*kappa_ptr)[z+dz][y+dy][x+dx];
-                    }
-                  else
-                    {
-                      for (int dz=min_dz;dz<=max_dz;++dz)
-                        for (int dy=min_dy;dy<=max_dy;++dy)
-                          for (int dx=min_dx;dx<=max_dx;++dx)
-                            sum_of_weights +=  weights[dz][dy][dx];
-                    }
-                }
-                // now compute contribution of central term
-                elemT gradient = sum_of_weights * current_image_estimate[z][y][x] ;
-
-                // subtract the rest
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
+                    else
                       {
-                        elemT current =
-                          weights[dz][dy][dx] * current_image_estimate[z+dz][y+dy][x+dx];
-
-                        if (do_kappa)
-                          current *= (*kappa_ptr)[z+dz][y+dy][x+dx];
-
-                        gradient -= current;
+                        for (int i=first_i; i<end_i; ++i)
+                          gradient_row[i] += weight * (image_row[i] - neighbour_row[i+dx]);
                       }
-                // multiply with central kappa
-                if (do_kappa)
-                  gradient *= (*kappa_ptr)[z][y][x];
-#endif
-                prior_gradient[z][y][x]= gradient * this->penalisation_factor;
-              }              
-          }
+                  }
+              }
+          for (int i=0; i<num_x; ++i)
+            gradient_row[i] *= this->penalisation_factor;
+        }
     }
 
   info(boost::format("Prior gradient max %1%, min %2%\n") % prior_gradient.find_max() % prior_gradient.find_min());
@@ -532,6 +534,9 @@ QuadraticPrior<elemT>::parabolic_surrogate_curvature(DiscretisedDensity<3,elemT>
 
   const int min_z = current_image_estimate.get_min_index();   
   const int max_z = current_image_estimate.get_max_index();   
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
   for (int z=min_z; z<=max_z; z++)  
     {  
       const int min_dz = max(weights.get_min_index(), min_z-z);  
@@ -546,31 +551,38 @@ QuadraticPrior<elemT>::parabolic_surrogate_curvature(DiscretisedDensity<3,elemT>
           const int max_dy = min(weights[0].get_max_index(), max_y-y);              
            
           const int min_x = current_image_estimate[z][y].get_min_index(); 
-          const int max_x = current_image_estimate[z][y].get_max_index();   
-          for (int x=min_x;x<= max_x;x++) 
-            { 
-              const int min_dx = max(weights[0][0].get_min_index(), min_x-x); 
-              const int max_dx = min(weights[0][0].get_max_index(), max_x-x); 
-                
-                elemT gradient = 0;
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
-                      {
-                        // 1 comes from omega = psi'(t)/t = 2*t/2t =1                  
-                        elemT current =
-                          weights[dz][dy][dx] *1;
-
-                         if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+          const int num_x = current_image_estimate[z][y].get_length(); 
+          const elemT * const kappa_row = do_kappa ? &(*kappa_ptr)[z][y][min_x] : 0;
+          elemT * const curvature_row = &parabolic_surrogate_curvature[z][y][min_x];
+          std::fill(curvature_row, curvature_row + num_x, elemT(0));
 
-                        gradient += current;
+          for (int dz=min_dz;dz<=max_dz;++dz)
+            for (int dy=min_dy;dy<=max_dy;++dy)
+              {
+                const elemT * const neighbour_kappa_row = do_kappa ? &(*kappa_ptr)[z+dz][y+dy][min_x] : 0;
+                for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+                  {
+                    // 1 comes from omega = psi'(t)/t = 2*t/2t =1                  
+                    const float weight = weights[dz][dy][dx];
+                    if (weight == 0)
+                      continue;
+                    int first_i, end_i;
+                    get_range_with_neighbour_in_row(first_i, end_i, dx, num_x);
+                    if (do_kappa)
+                      {
+                        for (int i=first_i; i<end_i; ++i)
+                          curvature_row[i] += weight * (kappa_row[i] * neighbour_kappa_row[i+dx]);
                       }
-                
-                parabolic_surrogate_curvature[z][y][x]= gradient * this->penalisation_factor;
-              }              
-          }
+                    else
+                      {
+                        for (int i=first_i; i<end_i; ++i)
+                          curvature_row[i] += weight;
+                      }
+                  }
+              }
+          for (int i=0; i<num_x; ++i)
+            curvature_row[i] *= this->penalisation_factor;
+        }
     }
 
   info(boost::format("parabolic_surrogate_curvature max %1%, min %2%\n") % parabolic_surrogate_curvature.find_max() % parabolic_surrogate_curvature.find_min());
@@ -615,6 +627,9 @@ add_multiplication_with_approximate_Hessian(DiscretisedDensity<3,elemT>& output,
 
   const int min_z = output.get_min_index();   
   const int max_z = output.get_max_index();   
+#ifdef STIR_OPENMP
+#pragma omp parallel for
+#endif
   for (int z=min_z; z<=max_z; z++)  
     {  
       const int min_dz = max(weights.get_min_index(), min_z-z);  
@@ -622,6 +637,9 @@ add_multiplication_with_approximate_Hessian(DiscretisedDensity<3,elemT>& output,
       
       const int min_y = output[z].get_min_index();  
       const int max_y = output[z].get_max_index();  
+
+      // temporary storage for the result for one row
+      std::vector<elemT> result_row(output[z][min_y].get_length());
        
       for (int y=min_y;y<= max_y;y++)  
         {  
@@ -629,29 +647,41 @@ add_multiplication_with_approximate_Hessian(DiscretisedDensity<3,elemT>& output,
           const int max_dy = min(weights[0].get_max_index(), max_y-y);              
            
           const int min_x = output[z][y].get_min_index(); 
-          const int max_x = output[z][y].get_max_index();   
-
-          for (int x=min_x;x<= max_x;x++) 
-            { 
-              const int min_dx = max(weights[0][0].get_min_index(), min_x-x); 
-              const int max_dx = min(weights[0][0].get_max_index(), max_x-x); 
-                
-                elemT result = 0;
-                for (int dz=min_dz;dz<=max_dz;++dz)
-                  for (int dy=min_dy;dy<=max_dy;++dy)
-                    for (int dx=min_dx;dx<=max_dx;++dx)
-                      {
-                        elemT current =
-                          weights[dz][dy][dx] * input[z+dz][y+dy][x+dx];
+          const int num_x = output[z][y].get_length(); 
+          const elemT * const kappa_row = do_kappa ? &(*kappa_ptr)[z][y][min_x] : 0;
+          result_row.assign(num_x, elemT(0));
 
-                         if (do_kappa)
-                          current *= 
-                            (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
-                         result += current;
+          for (int dz=min_dz;dz<=max_dz;++dz)
+            for (int dy=min_dy;dy<=max_dy;++dy)
+              {
+                const elemT * const neighbour_input_row = &input[z+dz][y+dy][min_x];
+                const elemT * const neighbour_kappa_row = do_kappa ? &(*kappa_ptr)[z+dz][y+dy][min_x] : 0;
+                for (int dx=weights[0][0].get_min_index(); dx<=weights[0][0].get_max_index(); ++dx)
+                  {
+                    const float weight = weights[dz][dy][dx];
+                    if (weight == 0)
+                      continue;
+                    int first_i, end_i;
+                    get_range_with_neighbour_in_row(first_i, end_i, dx, num_x);
+                    if (do_kappa)
+                      {
+                        for (int i=first_i; i<end_i; ++i)
+                          {
+                            elemT current = weight * neighbour_input_row[i+dx];
+                            current *= kappa_row[i] * neighbour_kappa_row[i+dx];
+                            result_row[i] += current;
+                          }
+                      }
+                    else
+                      {
+                        for (int i=first_i; i<end_i; ++i)
+                          result_row[i] += weight * neighbour_input_row[i+dx];
                       }
-                
-                output[z][y][x] += result * this->penalisation_factor;
-            }              
+                  }
+              }
+          elemT * const output_row = &output[z][y][min_x];
+          for (int i=0; i<num_x; ++i)
+            output_row[i] += result_row[i] * this->penalisation_factor;
         }
     }
   return Succeeded::yes;
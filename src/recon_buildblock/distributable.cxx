@@ -54,10 +54,13 @@
 #include "stir/recon_buildblock/BackProjectorByBin.h"
 #include "stir/recon_buildblock/BinNormalisation.h"
 #include "stir/recon_buildblock/find_basic_vs_nums_in_subsets.h"
+#include "stir/recon_buildblock/OutputImagesForThreads.h"
 #include "stir/is_null_ptr.h"
 #include "stir/info.h"
+#include "stir/error.h"
 #include <boost/format.hpp>
 #include <algorithm>
+#include <numeric>
 
 #ifdef STIR_MPI
 #include "stir/recon_buildblock/distributableMPICacheEnabled.h"
@@ -70,11 +73,20 @@
 #    error Cannot use both OPENMP and MP
 #  endif
 #include <omp.h>
+// we need tasks (from OpenMP 3.0) to read data in advance
+#  if _OPENMP >= 200805
+#    define STIR_PREFETCH_VIEWGRAMS
+#  endif
 #endif
 #include "stir/num_threads.h"
 
 START_NAMESPACE_STIR
 
+#ifdef STIR_OPENMP
+//! maximum number of images used by the threads, see setup_distributable_computation()
+static int max_num_output_images_for_threads = 0;
+#endif
+
 /* WARNING: the sequence of steps here has to match what is on the receiving end 
    in DistributedWorker */
 void setup_distributable_computation(
@@ -83,12 +95,19 @@ void setup_distributable_computation(
                                      const ProjDataInfo * const proj_data_info_ptr,
                                      const shared_ptr<DiscretisedDensity<3,float> >& target_sptr,
                                      const bool zero_seg0_end_planes,
-                                     const bool distributed_cache_enabled)
+                                     const bool distributed_cache_enabled,
+                                     const int max_num_output_images)
 {
   set_num_threads();
 #ifdef STIR_OPENMP
   info(boost::format("Using distributable_computation with %d threads on %d processors.")
        % omp_get_max_threads() % omp_get_num_procs());
+  if (max_num_output_images < 0)
+    error("setup_distributable_computation: maximum number of output images should be non-negative");
+  max_num_output_images_for_threads = max_num_output_images;
+  if (max_num_output_images > 0 && max_num_output_images < omp_get_max_threads())
+    info(boost::format("Threads will share %d images for accumulating the output.")
+         % max_num_output_images);
 #endif
 
 #ifdef STIR_MPI
@@ -408,10 +427,27 @@ void distributable_computation(
   //double total_seq_rpc_time=0.0; //sums up times used for RPC_process_related_viewgrams
 
 #ifdef STIR_OPENMP
-  std::vector< shared_ptr<DiscretisedDensity<3,float> > > local_output_image_sptrs;
-  std::vector<double> local_log_likelihoods;
-  std::vector<int> local_counts, local_count2s;
-#pragma omp parallel shared(local_output_image_sptrs, local_log_likelihoods, local_counts, local_count2s)
+  // threads accumulate the output in separate images, which are summed at the end
+  OutputImagesForThreads<DiscretisedDensity<3,float> >
+    output_images_for_threads(output_image_ptr, max_num_output_images_for_threads);
+  const int max_num_threads = omp_get_max_threads();
+  std::vector<double> local_log_likelihoods(max_num_threads, 0.);
+  std::vector<int> local_counts(max_num_threads, 0), local_count2s(max_num_threads, 0);
+#ifdef STIR_PREFETCH_VIEWGRAMS
+  /* One thread reads all data (in order), and creates a task to process each set of related viewgrams,
+     which are executed by the other threads. The reading thread can therefore read ahead while the 
+     others are projecting. To limit memory usage, there can only be a limited number of 
+     tasks waiting in the "queue". When the queue is full, the reading thread processes the data itself.
+  */
+  int num_threads = 1;
+  int num_queued = 0;
+  int max_num_queued = 0;
+  int num_processed_by_reading_thread = 0;
+  double reading_time = 0.;
+  std::vector<double> local_processing_times(max_num_threads, 0.);
+  const double loop_start_time = omp_get_wtime();
+#endif
+#pragma omp parallel shared(output_images_for_threads, local_log_likelihoods, local_counts, local_count2s)
 #endif
   // start of threaded section if openmp
   { 
@@ -419,12 +455,16 @@ void distributable_computation(
 #pragma omp single
     {
       std::cerr << "Starting loop with " << omp_get_num_threads() << " threads\n"; 
-      local_output_image_sptrs.resize(omp_get_max_threads(), shared_ptr<DiscretisedDensity<3,float> >());
-      local_log_likelihoods.resize(omp_get_max_threads(), 0.);
-      local_counts.resize(omp_get_max_threads(), 0);
-      local_count2s.resize(omp_get_max_threads(), 0);
+#ifdef STIR_PREFETCH_VIEWGRAMS
+      num_threads = omp_get_num_threads();
+      max_num_queued = 2*num_threads;
+#endif
     }
+#ifdef STIR_PREFETCH_VIEWGRAMS
+#pragma omp single
+#else
 #pragma omp for schedule(runtime)  
+#endif
 #endif
     // note: older versions of openmp need an int as loop
     for (int i=0; i<static_cast<int>(vs_nums_to_process.size()); ++i)
@@ -435,12 +475,27 @@ void distributable_computation(
         shared_ptr<RelatedViewgrams<float> > additive_binwise_correction_viewgrams;
         shared_ptr<RelatedViewgrams<float> > mult_viewgrams_sptr;
 
+#ifdef STIR_PREFETCH_VIEWGRAMS
+        const double start_reading_time = omp_get_wtime();
+#endif
         get_viewgrams(y, additive_binwise_correction_viewgrams, mult_viewgrams_sptr,
                       proj_dat_ptr, read_from_proj_dat,
                       zero_seg0_end_planes,
                       binwise_correction,
                       normalisation_sptr, start_time_of_frame, end_time_of_frame,
                       symmetries_ptr, view_segment_num);
+#ifdef STIR_PREFETCH_VIEWGRAMS
+        reading_time += omp_get_wtime() - start_reading_time;
+        bool put_in_queue;
+#pragma omp critical(DISTRIBUTABLE_PREFETCH_QUEUE)
+        {
+          put_in_queue = num_queued < max_num_queued;
+          if (put_in_queue)
+            ++num_queued;
+        }
+        if (!put_in_queue)
+          ++num_processed_by_reading_thread;
+#endif
 #ifdef STIR_MPI     
 
           //send viewgrams, the slave will immediatelly start calculation
@@ -466,8 +521,18 @@ void distributable_computation(
             }
 #else // STIR_MPI
 
+#ifdef STIR_PREFETCH_VIEWGRAMS
+        // if the queue is full, the task is executed immediately by the current thread
+#pragma omp task if(put_in_queue) firstprivate(y, additive_binwise_correction_viewgrams, mult_viewgrams_sptr)
+#endif
+        {
 #ifdef STIR_OPENMP
           const int thread_num=omp_get_thread_num();
+#endif
+#ifdef STIR_PREFETCH_VIEWGRAMS
+          const double start_processing_time = omp_get_wtime();
+#endif
+#ifdef STIR_OPENMP
           info(boost::format("Thread %d/%d calculating segment_num: %d, view_num: %d")
                % thread_num % omp_get_num_threads()
                % view_segment_num.segment_num() % view_segment_num.view_num());
@@ -476,20 +541,19 @@ void distributable_computation(
                % view_segment_num.segment_num() % view_segment_num.view_num());
 #endif
 #ifdef STIR_OPENMP
-          if (output_image_ptr != NULL)
-            {
-              if(is_null_ptr(local_output_image_sptrs[thread_num]))
-                local_output_image_sptrs[thread_num].reset(output_image_ptr->get_empty_copy());
-            }
-            
+          int image_num;
+          DiscretisedDensity<3,float>* local_output_image_ptr =
+            output_images_for_threads.get_image(image_num);
+
           RPC_process_related_viewgrams(forward_projector_ptr,
                                         back_projector_ptr,
-                                        local_output_image_sptrs[thread_num].get(), input_image_ptr, y.get(), 
+                                        local_output_image_ptr, input_image_ptr, y.get(), 
                                         local_counts[thread_num], local_count2s[thread_num], 
                                         is_null_ptr(log_likelihood_ptr)? NULL : &local_log_likelihoods[thread_num], 
                                         additive_binwise_correction_viewgrams.get(),
                                         mult_viewgrams_sptr.get());
-            
+
+          output_images_for_threads.release_image(image_num);
 #else
           RPC_process_related_viewgrams(forward_projector_ptr,
                                         back_projector_ptr,
@@ -497,6 +561,15 @@ void distributable_computation(
                                         additive_binwise_correction_viewgrams.get(),
                                         mult_viewgrams_sptr.get());
 #endif // OPENMP                                    
+#ifdef STIR_PREFETCH_VIEWGRAMS
+          local_processing_times[thread_num] += omp_get_wtime() - start_processing_time;
+          if (put_in_queue)
+            {
+#pragma omp critical(DISTRIBUTABLE_PREFETCH_QUEUE)
+              --num_queued;
+            }
+#endif
+        } // end of task
 #endif // MPI
       } // end of for-loop 
   } // end of parallel section of openmp
@@ -504,12 +577,7 @@ void distributable_computation(
 #ifdef STIR_OPENMP
   // "reduce" data constructed by threads
   {
-    if (output_image_ptr != NULL)
-      {
-        for (int i=0; i<static_cast<int>(local_output_image_sptrs.size()); ++i)
-	  if(!is_null_ptr(local_output_image_sptrs[i])) // only accumulate if a thread filled something in
-	    *output_image_ptr += *(local_output_image_sptrs[i]);
-      }
+    output_images_for_threads.add_to_output_image();
     if (log_likelihood_ptr != NULL)
       {
         for (int i=0; i<static_cast<int>(local_log_likelihoods.size()); ++i)
@@ -518,6 +586,20 @@ void distributable_computation(
     count += std::accumulate(local_counts.begin(), local_counts.end(), 0);
     count2 += std::accumulate(local_count2s.begin(), local_count2s.end(), 0);
   }
+#ifdef STIR_PREFETCH_VIEWGRAMS
+  {
+    // threads that are not reading or processing are waiting for data (or for the last tasks to finish)
+    const double total_processing_time =
+      std::accumulate(local_processing_times.begin(), local_processing_times.end(), 0.);
+    const double waiting_time =
+      std::max(num_threads*(omp_get_wtime() - loop_start_time) - reading_time - total_processing_time, 0.);
+    info(boost::format("Reading data took %1%s (wall-clock), processing %2%s (total over all threads), "
+                       "threads were idle for %3%s (total).\n"
+                       "%4% out of %5% related viewgrams were processed by the reading thread as the queue (of size %6%) was full.")
+         % reading_time % total_processing_time % waiting_time
+         % num_processed_by_reading_thread % vs_nums_to_process.size() % max_num_queued);
+  }
+#endif
 #endif
 #ifdef STIR_MPI
   //end of iteration processing
@@ -0,0 +1,133 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+  \file
+  \ingroup test
+
+  \brief Timing program for the multi-threaded accumulation of images in stir::distributable_computation
+
+  Computes the gradient of the Poisson log-likelihood (for data and image filled with 1)
+  with different values for the maximum number of images used by the threads
+  (see stir::setup_distributable_computation()). Prints the wall-clock time, an estimate
+  of the extra memory used, and the maximum difference with the result using one
+  image per thread.
+
+  \par Usage
+  <pre>
+  distributable_computation_timing [num_views [num_tangential_poss [max_num_images ...]]]
+  </pre>
+  If no values for \a max_num_images are given, 0 (i.e. one image per thread), the
+  number of threads divided by 2 and 1 are used.
+
+  This program is only useful when STIR is compiled with OpenMP.
+*/
+
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ExamInfo.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/Scanner.h"
+#include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndProjData.h"
+#include "stir/recon_buildblock/ProjMatrixByBinUsingRayTracing.h"
+#include "stir/recon_buildblock/ProjectorByBinPairUsingProjMatrixByBin.h"
+#include "stir/HighResWallClockTimer.h"
+#include "stir/Succeeded.h"
+#include "stir/num_threads.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+USING_NAMESPACE_STIR
+
+typedef DiscretisedDensity<3,float> target_type;
+
+int main(int argc, char **argv)
+{
+  const int num_views = argc>1 ? atoi(argv[1]) : 96;
+  const int num_tang_poss = argc>2 ? atoi(argv[2]) : 128;
+  set_num_threads();
+  const int num_threads = get_max_num_threads();
+  std::vector<int> max_num_images;
+  if (argc>3)
+    {
+      for (int i=3; i<argc; ++i)
+        max_num_images.push_back(atoi(argv[i]));
+    }
+  else
+    {
+      max_num_images.push_back(0);
+      if (num_threads>2)
+        max_num_images.push_back(num_threads/2);
+      max_num_images.push_back(1);
+    }
+
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr, /*span=*/3, /*max_delta=*/5,
+                                  num_views, num_tang_poss));
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  shared_ptr<ProjData> proj_data_sptr(new ProjDataInMemory(exam_info_sptr, proj_data_info_sptr));
+  proj_data_sptr->fill(1.F);
+
+  shared_ptr<target_type> image_sptr(new VoxelsOnCartesianGrid<float>(*proj_data_info_sptr));
+  image_sptr->fill(1.F);
+  const double image_size_in_MB = image_sptr->size_all()*sizeof(float)/1024./1024.;
+
+  // use the same projectors for all runs, such that the cache of the matrix is filled only once
+  shared_ptr<ProjMatrixByBin> proj_matrix_sptr(new ProjMatrixByBinUsingRayTracing);
+  shared_ptr<ProjectorByBinPair> proj_pair_sptr(new ProjectorByBinPairUsingProjMatrixByBin(proj_matrix_sptr));
+
+  shared_ptr<target_type> reference_sptr;
+  // the first run uses one image per thread and computes the reference
+  for (int run=-1; run<static_cast<int>(max_num_images.size()); ++run)
+    {
+      const int max_num = run<0 ? 0 : max_num_images[run];
+      PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type> objective_function;
+      objective_function.set_proj_data_sptr(proj_data_sptr);
+      objective_function.set_projector_pair_sptr(proj_pair_sptr);
+      objective_function.set_num_subsets(1);
+      objective_function.set_max_num_images_for_threads(max_num);
+      if (objective_function.set_up(image_sptr) != Succeeded::yes)
+        error("set-up of objective function failed");
+
+      shared_ptr<target_type> gradient_sptr(image_sptr->get_empty_copy());
+      HighResWallClockTimer timer;
+      timer.start();
+      objective_function.compute_sub_gradient_without_penalty_plus_sensitivity(*gradient_sptr, *image_sptr, 0);
+      timer.stop();
+      if (run<0)
+        {
+          reference_sptr = gradient_sptr;
+          continue;
+        }
+
+      const int num_images = max_num<=0 || max_num>num_threads ? num_threads : max_num;
+      float max_diff = 0.F;
+      target_type::const_full_iterator ref_iter = reference_sptr->begin_all_const();
+      for (target_type::const_full_iterator iter = gradient_sptr->begin_all_const();
+           iter != gradient_sptr->end_all_const();
+           ++iter, ++ref_iter)
+        max_diff = std::max(max_diff, std::fabs(*iter - *ref_iter));
+
+      std::cout << boost::format("maximum number of images %1%: wall-clock time %2%s, extra memory %3% MB, max difference %4%\n")
+        % max_num % timer.value() % ((num_images-1)*image_size_in_MB) % max_diff;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup recon_test
+
+  \brief Test program for multi-threading in stir::BackProjectorByBinUsingInterpolation
+*/
+
+#include "stir/recon_buildblock/BackProjectorByBinUsingInterpolation.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/Viewgram.h"
+#include "stir/RelatedViewgrams.h"
+#include "stir/ViewSegmentNumbers.h"
+#include "stir/DataSymmetriesForViewSegmentNumbers.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/num_threads.h"
+#include "stir/RunTests.h"
+#include <iostream>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for multi-threading in BackProjectorByBinUsingInterpolation
+
+  When called outside of a parallel region, BackProjectorByBinUsingInterpolation
+  back projects blocks of axial positions in parallel. This test back projects
+  all related viewgrams in this way with 1 thread and with several threads
+  (if OpenMP is enabled), and checks that the results agree. It also compares
+  with BackProjectorByBin::back_project() for the whole projection data, which
+  uses a separate image per thread.
+
+  This is done for ordinary and piecewise linear interpolation.
+*/
+class BackProjectorByBinUsingInterpolationTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  shared_ptr<DiscretisedDensity<3,float> > density_sptr;
+  shared_ptr<ProjDataInMemory> proj_data_sptr;
+
+  //! back project all related viewgrams one by one, using \a num_threads threads
+  void back_project_related_viewgrams(DiscretisedDensity<3,float>& image,
+                                      BackProjectorByBin& back_projector,
+                                      const int num_threads);
+  void run_tests_for_interpolation(const bool use_piecewise_linear_interpolation);
+};
+
+void
+BackProjectorByBinUsingInterpolationTests::
+back_project_related_viewgrams(DiscretisedDensity<3,float>& image,
+                               BackProjectorByBin& back_projector,
+                               const int num_threads)
+{
+  set_num_threads(num_threads);
+  shared_ptr<DataSymmetriesForViewSegmentNumbers>
+    symmetries_sptr(back_projector.get_symmetries_used()->clone());
+  image.fill(0.F);
+  for (int segment_num = proj_data_sptr->get_min_segment_num();
+       segment_num <= proj_data_sptr->get_max_segment_num();
+       ++segment_num)
+    for (int view_num = proj_data_sptr->get_min_view_num();
+         view_num <= proj_data_sptr->get_max_view_num();
+         ++view_num)
+      {
+        const ViewSegmentNumbers vs(view_num, segment_num);
+        if (!symmetries_sptr->is_basic(vs))
+          continue;
+        const RelatedViewgrams<float> viewgrams =
+          proj_data_sptr->get_related_viewgrams(vs, symmetries_sptr);
+        back_projector.back_project(image, viewgrams);
+      }
+}
+
+void
+BackProjectorByBinUsingInterpolationTests::
+run_tests_for_interpolation(const bool use_piecewise_linear_interpolation)
+{
+  BackProjectorByBinUsingInterpolation back_projector(use_piecewise_linear_interpolation);
+  back_projector.set_up(proj_data_info_sptr, density_sptr);
+
+  shared_ptr<DiscretisedDensity<3,float> > serial_sptr(density_sptr->get_empty_copy());
+  shared_ptr<DiscretisedDensity<3,float> > parallel_sptr(density_sptr->get_empty_copy());
+  back_project_related_viewgrams(*serial_sptr, back_projector, 1);
+  if (!check(serial_sptr->find_max() > 0, "back projection should not be zero"))
+    return;
+#ifdef STIR_OPENMP
+  back_project_related_viewgrams(*parallel_sptr, back_projector, 4);
+  check_if_equal(*parallel_sptr, *serial_sptr, "back projection of related viewgrams (4 threads)");
+#endif
+  set_default_num_threads();
+  parallel_sptr->fill(0.F);
+  back_projector.back_project(*parallel_sptr, *proj_data_sptr);
+  check_if_equal(*parallel_sptr, *serial_sptr, "back projection of the projection data");
+}
+
+void
+BackProjectorByBinUsingInterpolationTests::run_tests()
+{
+  std::cerr << "Tests for multi-threading in BackProjectorByBinUsingInterpolation\n";
+  // use enough rings and a few oblique segments, such that the axial positions are split in several blocks
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E966));
+  proj_data_info_sptr.reset(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/1,
+                                  /*max_delta=*/2,
+                                  /*num_views=*/24,
+                                  /*num_tang_poss=*/64,
+                                  /*arc_corrected=*/true));
+  density_sptr.reset(new VoxelsOnCartesianGrid<float>(*proj_data_info_sptr, 1.F,
+                                                      CartesianCoordinate3D<float>(0,0,0)));
+
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  proj_data_sptr.reset(new ProjDataInMemory(exam_info_sptr, proj_data_info_sptr));
+  for (int segment_num = proj_data_sptr->get_min_segment_num();
+       segment_num <= proj_data_sptr->get_max_segment_num();
+       ++segment_num)
+    for (int view_num = proj_data_sptr->get_min_view_num();
+         view_num <= proj_data_sptr->get_max_view_num();
+         ++view_num)
+      {
+        Viewgram<float> viewgram = proj_data_sptr->get_empty_viewgram(view_num, segment_num);
+        for (int a = viewgram.get_min_axial_pos_num(); a <= viewgram.get_max_axial_pos_num(); ++a)
+          for (int t = viewgram.get_min_tangential_pos_num(); t <= viewgram.get_max_tangential_pos_num(); ++t)
+            viewgram[a][t] = static_cast<float>(1 + (a + 2*t + 3*view_num + segment_num + 100)%7);
+        proj_data_sptr->set_viewgram(viewgram);
+      }
+
+  std::cerr << "\tpiecewise linear interpolation\n";
+  run_tests_for_interpolation(true);
+  std::cerr << "\tlinear interpolation\n";
+  run_tests_for_interpolation(false);
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+
+int main()
+{
+  BackProjectorByBinUsingInterpolationTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
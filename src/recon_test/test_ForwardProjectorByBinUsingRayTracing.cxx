@@ -0,0 +1,120 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for stir::ForwardProjectorByBinUsingRayTracing
+*/
+
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/Viewgram.h"
+#include "stir/recon_buildblock/ForwardProjectorByBinUsingRayTracing.h"
+#include "stir/RunTests.h"
+#include <boost/format.hpp>
+#include <iostream>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for ForwardProjectorByBinUsingRayTracing
+
+  Forward projects a uniform image that is symmetric in z. The projections
+  in segment 0 should then be symmetric in the axial direction.
+
+  The image has half the axial sampling of the projection data (i.e. 2 planes
+  per axial position), and the projection data have views that are not a
+  multiple of 45 degrees, such that all code paths for 2 planes per axial
+  position are used, including the one for tangential position 0.
+  The image has an extra plane at both ends, such that a missing contribution
+  at the first or last axial position breaks the symmetry.
+*/
+class ForwardProjectorByBinUsingRayTracingTests : public RunTests
+{
+public:
+  void run_tests();
+};
+
+void
+ForwardProjectorByBinUsingRayTracingTests::run_tests()
+{
+  std::cerr << "Tests for ForwardProjectorByBinUsingRayTracing\n";
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  shared_ptr<ProjDataInfo> proj_data_info_sptr(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/1,
+                                  /*max_delta=*/0,
+                                  /*num_views=*/16,
+                                  /*num_tang_poss=*/16));
+  // default image has z voxel size equal to half the ring spacing
+  const VoxelsOnCartesianGrid<float> default_image(*proj_data_info_sptr, 1.F,
+                                                   CartesianCoordinate3D<float>(0,0,0));
+  check_if_equal(default_image.get_voxel_size().z()*2,
+                 proj_data_info_sptr->get_sampling_in_m(Bin(0,0,0,0)),
+                 "image should have 2 planes per axial position");
+  // add a plane at both ends, such that the LORs at the first and last axial position
+  // go through non-zero voxels for all planes that they intersect
+  // (the centre of the image is not changed, as the origin is still 0)
+  shared_ptr<VoxelsOnCartesianGrid<float> >
+    image_sptr(new VoxelsOnCartesianGrid<float>(IndexRange3D(default_image.get_min_z(), default_image.get_max_z()+2,
+                                                             default_image.get_min_y(), default_image.get_max_y(),
+                                                             default_image.get_min_x(), default_image.get_max_x()),
+                                                default_image.get_origin(),
+                                                default_image.get_voxel_size()));
+  image_sptr->fill(1.F);
+
+  ForwardProjectorByBinUsingRayTracing forward_projector;
+  forward_projector.set_up(proj_data_info_sptr, image_sptr);
+  ProjDataInMemory proj_data(shared_ptr<ExamInfo>(new ExamInfo), proj_data_info_sptr);
+  forward_projector.forward_project(proj_data, *image_sptr);
+
+  const int min_ax = proj_data.get_min_axial_pos_num(0);
+  const int max_ax = proj_data.get_max_axial_pos_num(0);
+  for (int view_num = proj_data.get_min_view_num(); view_num <= proj_data.get_max_view_num(); ++view_num)
+    {
+      const Viewgram<float> viewgram = proj_data.get_viewgram(view_num, 0);
+      check(viewgram.find_max() > 0, "forward projection should not be zero");
+      for (int tang_pos_num = viewgram.get_min_tangential_pos_num();
+           tang_pos_num <= viewgram.get_max_tangential_pos_num();
+           ++tang_pos_num)
+        for (int ax_pos_num = min_ax; ax_pos_num <= max_ax; ++ax_pos_num)
+          check_if_equal(viewgram[ax_pos_num][tang_pos_num],
+                         viewgram[max_ax - (ax_pos_num - min_ax)][tang_pos_num],
+                         boost::str(boost::format("axial symmetry for view %1%, axial position %2%, tangential position %3%")
+                                    % view_num % ax_pos_num % tang_pos_num));
+      if (!is_everything_ok())
+        break;
+    }
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  ForwardProjectorByBinUsingRayTracingTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,303 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for parallel binning in stir::LmToProjData
+
+  \par Usage
+  \verbatim
+  test_LmToProjData list_mode_header template_projdata
+  \endverbatim
+  The recon_test_pack contains suitable files (PET_ACQ_small.l.hdr.STIR
+  and Siemens_mMR_seg2.hs).
+*/
+
+#include "stir/listmode/LmToProjData.h"
+#include "stir/listmode/SegmentAccumulator.h"
+#include "stir/ProjData.h"
+#include "stir/SegmentByView.h"
+#include "stir/RunTests.h"
+#include "stir/FilePath.h"
+#include "stir/is_null_ptr.h"
+#include <boost/format.hpp>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef STIR_OPENMP
+#include <omp.h>
+#endif
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Removes the output of LmToProjData (and the output directory) when it goes out of scope
+*/
+class LmToProjDataOutputRemover
+{
+public:
+  explicit LmToProjDataOutputRemover(const std::string& directory)
+    : directory(directory)
+  {}
+
+  ~LmToProjDataOutputRemover()
+  {
+    for (std::size_t i=0; i<filenames.size(); ++i)
+      std::remove(filenames[i].c_str());
+    // note: this only works if the directory is empty
+    std::remove(directory.c_str());
+  }
+
+  //! register the files written by LmToProjData for a single time frame
+  void add_output_filename_prefix(const std::string& output_filename_prefix)
+  {
+    filenames.push_back(output_filename_prefix + "_f1g1d0b0.hs");
+    filenames.push_back(output_filename_prefix + "_f1g1d0b0.s");
+  }
+
+private:
+  std::string directory;
+  std::vector<std::string> filenames;
+};
+
+/*!
+  \ingroup test
+  \brief Test class for parallel binning in LmToProjData
+
+  Bins the list mode data with and without parallel binning (using
+  several threads if OpenMP is enabled) and checks that the results
+  are identical. This is done for all accumulator types.
+
+  As events are only stored until \c num_events_to_store is reached,
+  and delayeds decrement this count, a run with only part of the events
+  checks that the events are still stored in the order of the list mode file.
+
+  A run with a limit on the memory for the segments checks that
+  processing the data in several passes gives identical results.
+  Finally, a run with a limit on the number of histograms checks that
+  threads can share histograms.
+
+  All output is written in a temporary directory, which is removed at the end.
+*/
+class LmToProjDataTests : public RunTests
+{
+public:
+  LmToProjDataTests(const std::string& input_filename,
+                    const std::string& template_filename)
+    : input_filename(input_filename), template_filename(template_filename)
+  {}
+
+  void run_tests();
+private:
+  std::string input_filename;
+  std::string template_filename;
+  //! directory for the output (including a trailing separator)
+  std::string output_directory;
+  shared_ptr<LmToProjDataOutputRemover> output_remover_sptr;
+
+  //! run LmToProjData and return the resulting projection data
+  shared_ptr<ProjData> bin_list_mode_data(const std::string& output_filename_prefix,
+                                          const bool parallel_binning,
+                                          const std::string& accumulator_type,
+                                          const long num_events_to_store,
+                                          const int max_segment_num = 0,
+                                          const double max_memory_for_segments_in_MB = 0,
+                                          const int max_num_histograms_for_threads = 0);
+  void check_if_identical(const ProjData& serial, const ProjData& parallel);
+  void run_tests_for_one_case(const std::string& accumulator_type,
+                              const long num_events_to_store);
+  void run_tests_for_multiple_passes();
+  void run_tests_for_shared_histograms();
+};
+
+shared_ptr<ProjData>
+LmToProjDataTests::
+bin_list_mode_data(const std::string& output_filename_prefix,
+                   const bool parallel_binning,
+                   const std::string& accumulator_type,
+                   const long num_events_to_store,
+                   const int max_segment_num,
+                   const double max_memory_for_segments_in_MB,
+                   const int max_num_histograms_for_threads)
+{
+  const std::string full_output_filename_prefix = output_directory + output_filename_prefix;
+  output_remover_sptr->add_output_filename_prefix(full_output_filename_prefix);
+  std::stringstream par;
+  par << "lm_to_projdata Parameters:=\n"
+      << "input file := " << input_filename << '\n'
+      << "output filename prefix := " << full_output_filename_prefix << '\n'
+      << "template_projdata := " << template_filename << '\n'
+      << "maximum absolute segment number to process := " << max_segment_num << '\n'
+      << "maximum memory for segments in MB := " << max_memory_for_segments_in_MB << '\n'
+      << "num_events_to_store := " << num_events_to_store << '\n'
+      << "store prompts := 1\n"
+      << "store delayeds := 1\n"
+      << "accumulator type := " << accumulator_type << '\n'
+      << "parallel binning := " << (parallel_binning ? 1 : 0) << '\n'
+      << "maximum number of histograms for multi-threading := " << max_num_histograms_for_threads << '\n'
+      << "End :=\n";
+
+  LmToProjData application;
+  if (!application.parse(par))
+    {
+      check(false, "parsing LmToProjData parameters");
+      return shared_ptr<ProjData>();
+    }
+  application.process_data();
+  return ProjData::read_from_file(full_output_filename_prefix + "_f1g1d0b0.hs");
+}
+
+void
+LmToProjDataTests::
+run_tests_for_one_case(const std::string& accumulator_type,
+                       const long num_events_to_store)
+{
+  std::cerr << "\nTesting accumulator type " << accumulator_type
+            << " with num_events_to_store " << num_events_to_store << '\n';
+
+  const std::string prefix =
+    boost::str(boost::format("%s_%d_") % accumulator_type % num_events_to_store);
+
+  shared_ptr<ProjData> serial_sptr =
+    bin_list_mode_data(prefix + "serial", false, accumulator_type, num_events_to_store);
+  shared_ptr<ProjData> parallel_sptr =
+    bin_list_mode_data(prefix + "parallel", true, accumulator_type, num_events_to_store);
+  if (is_null_ptr(serial_sptr) || is_null_ptr(parallel_sptr))
+    return;
+  check_if_identical(*serial_sptr, *parallel_sptr);
+}
+
+void
+LmToProjDataTests::
+check_if_identical(const ProjData& serial, const ProjData& parallel)
+{
+  check_if_equal(serial.get_min_segment_num(), parallel.get_min_segment_num(), "min segment number");
+  check_if_equal(serial.get_max_segment_num(), parallel.get_max_segment_num(), "max segment number");
+  double total_counts = 0;
+  for (int segment_num = serial.get_min_segment_num();
+       segment_num <= serial.get_max_segment_num();
+       ++segment_num)
+    {
+      const SegmentByView<float> serial_segment =
+        serial.get_segment_by_view(segment_num);
+      const SegmentByView<float> parallel_segment =
+        parallel.get_segment_by_view(segment_num);
+      // we require identical results, so don't use check_if_equal with a tolerance
+      check(serial_segment == parallel_segment,
+            boost::str(boost::format("parallel and serial binning should give identical results for segment %d")
+                       % segment_num));
+      total_counts += serial_segment.sum();
+    }
+  check(total_counts != 0, "there should be some counts in the projection data");
+}
+
+void
+LmToProjDataTests::
+run_tests_for_multiple_passes()
+{
+  std::cerr << "\nTesting binning in multiple passes\n";
+  // set the limit such that segment 0 needs its own pass, and we have 3 passes
+  const int max_segment_num = 1;
+  shared_ptr<ProjData> template_sptr = ProjData::read_from_file(template_filename);
+  const double max_memory_in_MB =
+    SegmentAccumulator::get_initial_memory_usage_in_bytes("float", *template_sptr->get_proj_data_info_ptr(), 0)
+    / 1024. / 1024.;
+
+  shared_ptr<ProjData> one_pass_sptr =
+    bin_list_mode_data("one_pass", false, "float", -1L, max_segment_num);
+  shared_ptr<ProjData> multiple_passes_sptr =
+    bin_list_mode_data("multiple_passes", true, "float", -1L, max_segment_num, max_memory_in_MB);
+  if (is_null_ptr(one_pass_sptr) || is_null_ptr(multiple_passes_sptr))
+    return;
+  check_if_identical(*one_pass_sptr, *multiple_passes_sptr);
+}
+
+void
+LmToProjDataTests::
+run_tests_for_shared_histograms()
+{
+  std::cerr << "\nTesting binning with 2 histograms for all threads\n";
+  shared_ptr<ProjData> serial_sptr =
+    bin_list_mode_data("serial", false, "integer", -1L, 1);
+  shared_ptr<ProjData> shared_sptr =
+    bin_list_mode_data("shared_histograms", true, "integer", -1L, 1, 0., 2);
+  if (is_null_ptr(serial_sptr) || is_null_ptr(shared_sptr))
+    return;
+  check_if_identical(*serial_sptr, *shared_sptr);
+}
+
+void
+LmToProjDataTests::
+run_tests()
+{
+  output_directory =
+    FilePath(FilePath::get_current_working_directory()).append("test_LmToProjData_output").get_as_string();
+  // note: the output is removed at the end of this function (also when a check fails,
+  // or when error() is called)
+  output_remover_sptr.reset(new LmToProjDataOutputRemover(output_directory));
+
+#ifdef STIR_OPENMP
+  // make sure we have several threads, even on a single core machine
+  const int old_num_threads = omp_get_max_threads();
+  omp_set_num_threads(std::max(old_num_threads, 4));
+#endif
+
+  try
+    {
+      const char * accumulator_types[] = { "float", "integer", "sparse" };
+      for (unsigned int i=0; i<sizeof(accumulator_types)/sizeof(accumulator_types[0]); ++i)
+        run_tests_for_one_case(accumulator_types[i], -1L);
+
+      // only part of the events, such that the order of the events matters
+      run_tests_for_one_case("float", 1000L);
+
+      run_tests_for_multiple_passes();
+      run_tests_for_shared_histograms();
+    }
+  catch (const std::string&)
+    {
+      // error() throws a string (which it has already printed)
+      check(false, "LmToProjData called error()");
+    }
+
+#ifdef STIR_OPENMP
+  omp_set_num_threads(old_num_threads);
+#endif
+  output_remover_sptr.reset();
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      std::cerr << "Usage : " << argv[0] << " list_mode_header template_projdata\n";
+      return EXIT_FAILURE;
+    }
+  LmToProjDataTests tests(argv[1], argv[2]);
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,189 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup recon_test
+
+  \brief Test program for the cache of list mode events in
+  stir::PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin
+
+  \par Usage
+  \verbatim
+  test_PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin list_mode_header
+  \endverbatim
+  The recon_test_pack contains a suitable file (PET_ACQ_small.l.hdr.STIR).
+*/
+
+#include "stir/recon_buildblock/PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin.h"
+#include "stir/DiscretisedDensity.h"
+#include "stir/RunTests.h"
+#include "stir/Succeeded.h"
+#include "stir/num_threads.h"
+#include "stir/unique_ptr.h"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <string>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for the cache of list mode events in
+  PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin
+
+  Computes the gradient for a subset by reading the list mode data for every
+  call, and from the events stored in memory. This is done with 1 thread and
+  (if OpenMP is enabled) with several threads, and the gradients are compared.
+  When the maximum memory for the cache is too small, the objective function
+  should read the list mode data, giving the same result.
+
+  The matrix cache stores all bins, such that the rows with linear offsets
+  stored in the cache are used (see ProjMatrixByBin).
+*/
+class PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests : public RunTests
+{
+public:
+  typedef DiscretisedDensity<3,float> target_type;
+  typedef PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin<target_type>
+    objective_function_type;
+
+  explicit
+    PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests(const std::string& list_mode_filename)
+    : list_mode_filename(list_mode_filename)
+  {}
+
+  void run_tests();
+private:
+  std::string list_mode_filename;
+
+  //! construct and set-up the objective function, returns 0 on failure
+  objective_function_type * construct_objective_function(const bool cache_lm_events,
+                                                         const double max_memory_for_events_cache_in_MB = 0);
+  //! compute the gradient for subset 1 with the given number of threads
+  void compute_gradient(target_type& gradient,
+                        objective_function_type& objective_function,
+                        const int num_threads);
+};
+
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests::objective_function_type *
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests::
+construct_objective_function(const bool cache_lm_events,
+                             const double max_memory_for_events_cache_in_MB)
+{
+  std::stringstream par;
+  par << "PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin Parameters:=\n"
+      << "list mode filename := " << list_mode_filename << '\n'
+      << "max ring difference num to process := 0\n"
+      << "num_events_to_use := 10000\n"
+      << "cache list mode events in memory := " << (cache_lm_events ? 1 : 0) << '\n'
+      << "maximum memory for list mode events cache in MB := " << max_memory_for_events_cache_in_MB << '\n'
+      << "Matrix type := Ray Tracing\n"
+      << "Ray tracing matrix parameters :=\n"
+      << "  store_only_basic_bins_in_cache := 0\n"
+      << "End Ray tracing matrix parameters :=\n"
+      << "zoom := 1\n"
+      << "xy output image size (in pixels) := 81\n"
+      << "use subset sensitivities := 0\n"
+      << "sensitivity filename := 1\n"
+      << "End PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBin Parameters:=\n";
+
+  unique_ptr<objective_function_type> objective_function_ptr(new objective_function_type);
+  if (!check(objective_function_ptr->parse(par), "parsing objective function parameters"))
+    return 0;
+  objective_function_ptr->set_num_subsets(2);
+  shared_ptr<target_type> target_sptr(objective_function_ptr->construct_target_ptr());
+  if (!check(objective_function_ptr->set_up(target_sptr) == Succeeded::yes,
+             "set-up of objective function"))
+    return 0;
+  return objective_function_ptr.release();
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests::
+compute_gradient(target_type& gradient,
+                 objective_function_type& objective_function,
+                 const int num_threads)
+{
+  set_num_threads(num_threads);
+  unique_ptr<target_type> estimate_ptr(objective_function.construct_target_ptr());
+  estimate_ptr->fill(1.F);
+  gradient.fill(0.F);
+  objective_function.compute_sub_gradient_without_penalty_plus_sensitivity(gradient, *estimate_ptr, 1);
+}
+
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests::
+run_tests()
+{
+  std::cerr << "Tests for the cache of list mode events\n";
+  try
+    {
+      unique_ptr<objective_function_type> streaming_ptr(construct_objective_function(false));
+      unique_ptr<objective_function_type> cache_ptr(construct_objective_function(true));
+      unique_ptr<objective_function_type> too_small_cache_ptr(construct_objective_function(true, .01));
+      if (streaming_ptr.get() == 0 || cache_ptr.get() == 0 || too_small_cache_ptr.get() == 0)
+        return;
+
+      unique_ptr<target_type> streaming_gradient_ptr(streaming_ptr->construct_target_ptr());
+      unique_ptr<target_type> gradient_ptr(streaming_ptr->construct_target_ptr());
+      compute_gradient(*streaming_gradient_ptr, *streaming_ptr, 1);
+      check(streaming_gradient_ptr->find_max() > 0, "gradient should not be zero");
+
+      std::cerr << "\twith 1 thread\n";
+      compute_gradient(*gradient_ptr, *cache_ptr, 1);
+      check_if_equal(*gradient_ptr, *streaming_gradient_ptr, "gradient when filling the cache (1 thread)");
+      compute_gradient(*gradient_ptr, *cache_ptr, 1);
+      check_if_equal(*gradient_ptr, *streaming_gradient_ptr, "gradient from the cache (1 thread)");
+
+#ifdef STIR_OPENMP
+      std::cerr << "\twith 4 threads\n";
+      compute_gradient(*gradient_ptr, *streaming_ptr, 4);
+      check_if_equal(*gradient_ptr, *streaming_gradient_ptr, "gradient from the list mode data (4 threads)");
+      compute_gradient(*gradient_ptr, *cache_ptr, 4);
+      check_if_equal(*gradient_ptr, *streaming_gradient_ptr, "gradient from the cache (4 threads)");
+#endif
+
+      std::cerr << "\twith a too small maximum memory for the cache\n";
+      compute_gradient(*gradient_ptr, *too_small_cache_ptr, 1);
+      check_if_equal(*gradient_ptr, *streaming_gradient_ptr, "gradient when the cache is too small");
+      compute_gradient(*gradient_ptr, *too_small_cache_ptr, 1);
+      check_if_equal(*gradient_ptr, *streaming_gradient_ptr, "gradient when the cache is too small (2nd time)");
+    }
+  catch (const std::string&)
+    {
+      // error() has written the message already
+      check(false, "unexpected error");
+    }
+  set_default_num_threads();
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main(int argc, char **argv)
+{
+  if (argc != 2)
+    {
+      std::cerr << "Usage : " << argv[0] << " list_mode_header\n";
+      return EXIT_FAILURE;
+    }
+  PoissonLogLikelihoodWithLinearModelForMeanAndListModeDataWithProjMatrixByBinTests tests(argv[1]);
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -62,8 +62,76 @@
 
 #include "stir/IO/OutputFileFormat.h"
 #include "stir/recon_buildblock/distributable_main.h"
+#include "stir/FilePath.h"
+#include <vector>
+#include <string>
+#include <cstdio>
+#if defined(__OS_WIN__)
+#include <io.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
 START_NAMESPACE_STIR
 
+/*!
+  \ingroup test
+  \brief A directory that is removed (with all files in it) when this object goes out of scope
+
+  This is used by the test to avoid leaving files behind, whatever files are
+  written (and also when a check fails). Sub-directories are not supported.
+*/
+class TemporaryDirectory
+{
+public:
+  //! create the directory \a name in the current directory
+  explicit TemporaryDirectory(const std::string& name)
+    : path(FilePath(FilePath::get_current_working_directory()).append(name).get_as_string())
+  {}
+
+  ~TemporaryDirectory()
+  {
+    std::vector<std::string> filenames;
+#if defined(__OS_WIN__)
+    _finddata_t file_info;
+    const intptr_t handle = _findfirst((path + "*").c_str(), &file_info);
+    if (handle != -1)
+      {
+        do
+          filenames.push_back(file_info.name);
+        while (_findnext(handle, &file_info) == 0);
+        _findclose(handle);
+      }
+#else
+    if (DIR * dir = opendir(path.c_str()))
+      {
+        while (const dirent * entry = readdir(dir))
+          filenames.push_back(entry->d_name);
+        closedir(dir);
+      }
+#endif
+    for (std::vector<std::string>::const_iterator iter = filenames.begin(); iter != filenames.end(); ++iter)
+      if (*iter != "." && *iter != "..")
+        std::remove((path + *iter).c_str());
+#if defined(__OS_WIN__)
+    _rmdir(path.c_str());
+#else
+    rmdir(path.c_str());
+#endif
+  }
+
+  //! get the path of the directory (including a trailing separator)
+  const std::string& get_path() const { return path; }
+
+private:
+  std::string path;
+
+  // copying is not supported (the directory would be removed twice)
+  TemporaryDirectory(const TemporaryDirectory&);
+  TemporaryDirectory& operator=(const TemporaryDirectory&);
+};
+
 
 /*!
   \ingroup test
@@ -112,6 +180,13 @@ protected:
   /*! Note that this function is not specific to PoissonLogLikelihoodWithLinearModelForMeanAndProjData */
   void run_tests_for_objective_function(GeneralisedObjectiveFunction<target_type>& objective_function,
                                         target_type& target);
+
+  //! test the sensitivity cache
+  /*! Constructs new objective functions with the same parameters as \c objective_function_sptr,
+      writes their sensitivities to the cache in \a cache_directory and reads them back.
+  */
+  void run_tests_for_sensitivity_cache(const shared_ptr<target_type>& density_sptr,
+                                       const std::string& cache_directory);
 };
 
 PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
@@ -165,6 +240,37 @@ run_tests_for_objective_function(GeneralisedObjectiveFunction<PoissonLogLikeliho
 
 }
 
+void
+PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
+run_tests_for_sensitivity_cache(const shared_ptr<target_type>& density_sptr,
+                                const std::string& cache_directory)
+{
+  typedef PoissonLogLikelihoodWithLinearModelForMeanAndProjData<target_type> objective_function_type;
+  const objective_function_type& reference =
+    dynamic_cast<const objective_function_type&>(*this->objective_function_sptr);
+
+  // first recompute (to make sure we do not use an entry from a previous run), then read
+  for (int recompute=1; recompute>=0; --recompute)
+    {
+      objective_function_type objective_function;
+      objective_function.set_proj_data_sptr(reference.get_proj_data_sptr());
+      objective_function.set_projector_pair_sptr(reference.get_projector_pair_sptr());
+      objective_function.set_normalisation_sptr(reference.get_normalisation_sptr());
+      objective_function.set_additive_proj_data_sptr(reference.get_additive_proj_data_sptr());
+      objective_function.set_num_subsets(reference.get_num_subsets());
+      objective_function.set_use_subset_sensitivities(true);
+      objective_function.set_recompute_sensitivity(recompute!=0);
+      objective_function.set_sensitivity_cache_directory(cache_directory);
+      if (!check(objective_function.set_up(density_sptr)==Succeeded::yes, "set-up of objective function with sensitivity cache"))
+        return;
+      if (!recompute)
+        check(!objective_function.get_recompute_sensitivity(), "sensitivity should have been read from the cache");
+      set_tolerance(reference.get_sensitivity().find_max()/1000);
+      check_if_equal(reference.get_subset_sensitivity(1), objective_function.get_subset_sensitivity(1),
+                     "subset sensitivity with sensitivity cache");
+    }
+}
+
 void
 PoissonLogLikelihoodWithLinearModelForMeanAndProjDataTests::
 construct_input_data(shared_ptr<target_type>& density_sptr)
@@ -320,6 +426,11 @@ run_tests()
 #if 1
   shared_ptr<target_type> density_sptr;
   construct_input_data(density_sptr);
+  {
+    // the cache directory (and the cache entries in it) are removed at the end of this block
+    const TemporaryDirectory cache_directory("test_sensitivity_cache");
+    this->run_tests_for_sensitivity_cache(density_sptr, cache_directory.get_path());
+  }
   this->run_tests_for_objective_function(*this->objective_function_sptr, *density_sptr);
 #else
   // alternative that gets the objective function from an OSMAPOSL .par file
@@ -0,0 +1,374 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for the cache in stir::ProjMatrixByBin
+
+  Uses stir::ProjMatrixByBinUsingRayTracing.
+*/
+
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/Scanner.h"
+#include "stir/Bin.h"
+#include "stir/recon_buildblock/ProjMatrixByBinUsingRayTracing.h"
+#include "stir/recon_buildblock/ProjMatrixByBinFromFile.h"
+#include "stir/Succeeded.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBinWithOffsets.h"
+#include "stir/RunTests.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief Test class for the cache in ProjMatrixByBin
+
+  Compares rows of the matrix computed without cache with those obtained
+  from the cache (storing only basic bins or all bins). All bins are
+  accessed (in parallel if OpenMP is enabled) a few times, such that
+  both cache misses and hits are tested. Also checks that the maximum
+  cache size is respected. Rows with linear offsets stored in the cache are
+  checked by comparing their forward projection with a freshly converted row.
+
+  Checks forward and back projection of a single row against a
+  straightforward implementation.
+
+  Also writes the matrix to file (using ProjMatrixByBinFromFile) and checks if
+  it is read back correctly.
+*/
+class ProjMatrixByBinTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  shared_ptr<DiscretisedDensity<3,float> > density_sptr;
+  std::vector<Bin> bins;
+
+  //! returns the number of bins where the matrix rows are different
+  int num_different_rows(const ProjMatrixByBin& proj_matrix,
+                         const ProjMatrixByBin& proj_matrix_no_cache,
+                         const bool use_ref);
+  //! returns the number of bins where the cached row with offsets is different
+  int num_different_rows_with_offsets(const ProjMatrixByBin& proj_matrix,
+                                      const DiscretisedDensity<3,float>& image,
+                                      int& num_rows_with_offsets);
+  void run_tests_for_cache_mode(const ProjMatrixByBin& proj_matrix_no_cache,
+                                const bool store_only_basic_bins);
+  void run_tests_for_maximum_cache_size(const ProjMatrixByBin& proj_matrix_no_cache);
+  void run_tests_for_projection(const ProjMatrixByBin& proj_matrix_no_cache);
+  void run_tests_for_file_format(const ProjMatrixByBin& proj_matrix_no_cache,
+                                 const int format_version,
+                                 const bool preload_all_data);
+};
+
+int
+ProjMatrixByBinTests::
+num_different_rows(const ProjMatrixByBin& proj_matrix,
+                   const ProjMatrixByBin& proj_matrix_no_cache,
+                   const bool use_ref)
+{
+  int num_different = 0;
+  const int num_bins = static_cast<int>(bins.size());
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:num_different)
+#endif
+  for (int i=0; i<num_bins; ++i)
+    {
+      ProjMatrixElemsForOneBin elems_no_cache;
+      ProjMatrixElemsForOneBin elems;
+      ProjMatrixElemsForOneBin tmp;
+      proj_matrix_no_cache.get_proj_matrix_elems_for_one_bin(elems_no_cache, bins[i]);
+      if (use_ref)
+        elems = proj_matrix.get_proj_matrix_elems_for_one_bin_ref(tmp, bins[i]);
+      else
+        proj_matrix.get_proj_matrix_elems_for_one_bin(elems, bins[i]);
+      elems_no_cache.sort();
+      elems.sort();
+      if (!(elems == elems_no_cache) || !(elems.get_bin() == bins[i]))
+        ++num_different;
+    }
+  return num_different;
+}
+
+int
+ProjMatrixByBinTests::
+num_different_rows_with_offsets(const ProjMatrixByBin& proj_matrix,
+                                const DiscretisedDensity<3,float>& image,
+                                int& num_rows_with_offsets)
+{
+  BasicCoordinate<3,int> min_indices, max_indices;
+  image.get_regular_range(min_indices, max_indices);
+  const float * const image_data_ptr = image.get_const_full_data_ptr();
+  int num_different = 0;
+  int num_with_offsets = 0;
+  const int num_bins = static_cast<int>(bins.size());
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:num_different,num_with_offsets)
+#endif
+  for (int i=0; i<num_bins; ++i)
+    {
+      ProjMatrixElemsForOneBin tmp;
+      const ProjMatrixElemsForOneBinWithOffsets * cached_elems_with_offsets_ptr;
+      const ProjMatrixElemsForOneBin& elems =
+        proj_matrix.get_proj_matrix_elems_for_one_bin_ref(tmp, cached_elems_with_offsets_ptr, bins[i]);
+      if (cached_elems_with_offsets_ptr == 0)
+        continue;
+      ++num_with_offsets;
+      ProjMatrixElemsForOneBinWithOffsets elems_with_offsets(min_indices, max_indices);
+      elems_with_offsets.set_elements(elems);
+      Bin bin = bins[i];
+      bin.set_bin_value(0.F);
+      elems_with_offsets.forward_project(bin, image_data_ptr);
+      Bin cached_bin = bins[i];
+      cached_bin.set_bin_value(0.F);
+      cached_elems_with_offsets_ptr->forward_project(cached_bin, image_data_ptr);
+      if (cached_elems_with_offsets_ptr->size() != elems_with_offsets.size() ||
+          cached_bin.get_bin_value() != bin.get_bin_value())
+        ++num_different;
+    }
+  num_rows_with_offsets = num_with_offsets;
+  return num_different;
+}
+
+void
+ProjMatrixByBinTests::
+run_tests_for_cache_mode(const ProjMatrixByBin& proj_matrix_no_cache,
+                         const bool store_only_basic_bins)
+{
+  ProjMatrixByBinUsingRayTracing proj_matrix;
+  proj_matrix.enable_cache(true);
+  proj_matrix.store_only_basic_bins_in_cache(store_only_basic_bins);
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, false), 0,
+                 "rows when filling the cache");
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, false), 0,
+                 "rows from the cache");
+  check(proj_matrix.get_num_cache_hits() > 0, "cache should have been used");
+  check_if_equal(proj_matrix.get_num_cache_rejections(), 0UL, "no rejections without maximum cache size");
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, true), 0,
+                 "rows from the cache (no copy)");
+  {
+    BasicCoordinate<3,int> min_indices, max_indices;
+    shared_ptr<DiscretisedDensity<3,float> > image_sptr(density_sptr->get_empty_copy());
+    check(image_sptr->get_regular_range(min_indices, max_indices) &&
+          proj_matrix.cache_stores_elems_with_offsets_for(min_indices, max_indices),
+          "cache should store rows with offsets");
+    for (int z=image_sptr->get_min_index(); z<=image_sptr->get_max_index(); ++z)
+      for (int y=(*image_sptr)[z].get_min_index(); y<=(*image_sptr)[z].get_max_index(); ++y)
+        for (int x=(*image_sptr)[z][y].get_min_index(); x<=(*image_sptr)[z][y].get_max_index(); ++x)
+          (*image_sptr)[z][y][x] = static_cast<float>(1 + (z+2*y+3*x)%7);
+    int num_rows_with_offsets = 0;
+    check_if_equal(num_different_rows_with_offsets(proj_matrix, *image_sptr, num_rows_with_offsets), 0,
+                   "rows with offsets from the cache");
+    if (store_only_basic_bins)
+      check(num_rows_with_offsets > 0, "cache should return rows with offsets for basic bins");
+    else
+      check_if_equal(num_rows_with_offsets, static_cast<int>(bins.size()),
+                     "cache should return rows with offsets for all bins");
+  }
+  proj_matrix.clear_cache();
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, true), 0,
+                 "rows after clearing the cache (no copy)");
+  // set_up again should clear the cache
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, false), 0,
+                 "rows after calling set_up again");
+}
+
+void
+ProjMatrixByBinTests::
+run_tests_for_maximum_cache_size(const ProjMatrixByBin& proj_matrix_no_cache)
+{
+  ProjMatrixByBinUsingRayTracing proj_matrix;
+  proj_matrix.enable_cache(true);
+  proj_matrix.store_only_basic_bins_in_cache(false);
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+  // find size of the full cache
+  num_different_rows(proj_matrix, proj_matrix_no_cache, false);
+  const std::size_t full_cache_size = proj_matrix.get_cache_size();
+  check(full_cache_size > 0, "cache size should be positive");
+  proj_matrix.clear_cache();
+  check_if_equal(proj_matrix.get_cache_size(), std::size_t(0), "cache size after clear_cache()");
+
+  proj_matrix.set_maximum_cache_size(full_cache_size/3);
+  proj_matrix.reset_cache_statistics();
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, false), 0,
+                 "rows when filling the cache with maximum size");
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, true), 0,
+                 "rows from the cache with maximum size");
+  // allow for some overshoot when threads store rows simultaneously
+  check(proj_matrix.get_cache_size() < full_cache_size/2, "cache size should be limited");
+  check(proj_matrix.get_num_cache_rejections() > 0, "some rows should not have been stored");
+  check(proj_matrix.get_num_cache_hits() > 0, "cache should have been used");
+}
+
+void
+ProjMatrixByBinTests::
+run_tests_for_projection(const ProjMatrixByBin& proj_matrix_no_cache)
+{
+  // fill image with some values
+  shared_ptr<DiscretisedDensity<3,float> > image_sptr(density_sptr->get_empty_copy());
+  for (int z=image_sptr->get_min_index(); z<=image_sptr->get_max_index(); ++z)
+    for (int y=(*image_sptr)[z].get_min_index(); y<=(*image_sptr)[z].get_max_index(); ++y)
+      for (int x=(*image_sptr)[z][y].get_min_index(); x<=(*image_sptr)[z][y].get_max_index(); ++x)
+        (*image_sptr)[z][y][x] = static_cast<float>(1 + (z+2*y+3*x)%7);
+
+  shared_ptr<DiscretisedDensity<3,float> > back_projection_sptr(density_sptr->get_empty_copy());
+  shared_ptr<DiscretisedDensity<3,float> > flat_back_projection_sptr(density_sptr->get_empty_copy());
+  BasicCoordinate<3,int> min_indices, max_indices;
+  if (!check(image_sptr->is_contiguous() && image_sptr->get_regular_range(min_indices, max_indices),
+             "image should be contiguous with a regular range"))
+    return;
+  ProjMatrixElemsForOneBin elems;
+  for (std::size_t i=0; i<bins.size(); i+=7)
+    {
+      proj_matrix_no_cache.get_proj_matrix_elems_for_one_bin(elems, bins[i]);
+      double expected_sum = 0;
+      for (ProjMatrixElemsForOneBin::const_iterator iter = elems.begin(); iter != elems.end(); ++iter)
+        if (iter->coord1() >= image_sptr->get_min_index() && iter->coord1() <= image_sptr->get_max_index())
+          expected_sum += (*image_sptr)[iter->coord1()][iter->coord2()][iter->coord3()] * iter->get_value();
+      Bin bin = bins[i];
+      bin.set_bin_value(0.F);
+      elems.forward_project(bin, *image_sptr);
+      if (!check_if_equal(bin.get_bin_value(), static_cast<float>(expected_sum), "forward projection"))
+        return;
+      const float forward_value = bin.get_bin_value();
+
+      // check back projection via the adjoint: <B y, x> == y <F x>
+      back_projection_sptr->fill(0.F);
+      bin.set_bin_value(2.F);
+      elems.back_project(*back_projection_sptr, bin);
+      double inner_product = 0;
+      for (int z=image_sptr->get_min_index(); z<=image_sptr->get_max_index(); ++z)
+        for (int y=(*image_sptr)[z].get_min_index(); y<=(*image_sptr)[z].get_max_index(); ++y)
+          for (int x=(*image_sptr)[z][y].get_min_index(); x<=(*image_sptr)[z][y].get_max_index(); ++x)
+            inner_product += (*image_sptr)[z][y][x] * (*back_projection_sptr)[z][y][x];
+      if (!check_if_equal(static_cast<float>(inner_product), static_cast<float>(2*expected_sum), "back projection"))
+        return;
+
+      // versions using linear offsets in the contiguous image data should give the same results
+      // (up to rounding for the forward projection, as the compiler might vectorise the sum)
+      {
+        Bin flat_bin = bins[i];
+        flat_bin.set_bin_value(0.F);
+        ProjMatrixElemsForOneBinWithOffsets elems_with_offsets(min_indices, max_indices);
+        elems_with_offsets.set_elements(elems);
+        elems_with_offsets.forward_project(flat_bin, image_sptr->get_const_full_data_ptr());
+        if (!check_if_equal(flat_bin.get_bin_value(), forward_value, "forward projection using the contiguous data"))
+          return;
+        flat_back_projection_sptr->fill(0.F);
+        flat_bin.set_bin_value(2.F);
+        elems_with_offsets.back_project(flat_back_projection_sptr->get_full_data_ptr(), flat_bin);
+        if (!check(*flat_back_projection_sptr == *back_projection_sptr, "back projection using the contiguous data"))
+          return;
+      }
+    }
+}
+
+void
+ProjMatrixByBinTests::
+run_tests_for_file_format(const ProjMatrixByBin& proj_matrix_no_cache,
+                          const int format_version,
+                          const bool preload_all_data)
+{
+  const std::string prefix = "test_ProjMatrixByBin_v" + std::string(format_version==1 ? "1" : "2");
+  if (!check(ProjMatrixByBinFromFile::write_to_file(prefix, proj_matrix_no_cache,
+                                                    proj_data_info_sptr, *density_sptr,
+                                                    format_version) == Succeeded::yes,
+             "writing matrix to file"))
+    return;
+
+  ProjMatrixByBinFromFile proj_matrix;
+  std::string parameters = prefix + ".hpm";
+  if (!check(proj_matrix.parse(parameters.c_str()), "parsing matrix header"))
+    return;
+  if (preload_all_data)
+    {
+      std::stringstream str;
+      str << "Projection Matrix By Bin From File Parameters:=\n"
+          << "preload all data := 1\n"
+          << "End Projection Matrix By Bin From File Parameters:=\n";
+      check(proj_matrix.parse(str), "parsing preload parameter");
+    }
+  proj_matrix.set_up(proj_data_info_sptr, density_sptr);
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, false), 0,
+                 "rows read from file");
+  check_if_equal(num_different_rows(proj_matrix, proj_matrix_no_cache, true), 0,
+                 "rows read from file (no copy)");
+}
+
+void
+ProjMatrixByBinTests::run_tests()
+{
+  std::cerr << "Tests for the ProjMatrixByBin cache\n";
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  proj_data_info_sptr.reset(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/3,
+                                  /*max_delta=*/5,
+                                  /*num_views=*/8,
+                                  /*num_tang_poss=*/16));
+  density_sptr.reset(new VoxelsOnCartesianGrid<float>(*proj_data_info_sptr, 1.F,
+                                                      CartesianCoordinate3D<float>(0,0,0)));
+
+  for (int s=proj_data_info_sptr->get_min_segment_num(); s<=proj_data_info_sptr->get_max_segment_num(); ++s)
+    for (int v=proj_data_info_sptr->get_min_view_num(); v<=proj_data_info_sptr->get_max_view_num(); ++v)
+      for (int a=proj_data_info_sptr->get_min_axial_pos_num(s); a<=proj_data_info_sptr->get_max_axial_pos_num(s); ++a)
+        for (int t=proj_data_info_sptr->get_min_tangential_pos_num(); t<=proj_data_info_sptr->get_max_tangential_pos_num(); ++t)
+          bins.push_back(Bin(s,v,a,t));
+
+  ProjMatrixByBinUsingRayTracing proj_matrix_no_cache;
+  proj_matrix_no_cache.enable_cache(false);
+  proj_matrix_no_cache.set_up(proj_data_info_sptr, density_sptr);
+
+  std::cerr << "\tcaching only basic bins\n";
+  run_tests_for_cache_mode(proj_matrix_no_cache, true);
+  std::cerr << "\tcaching all bins\n";
+  run_tests_for_cache_mode(proj_matrix_no_cache, false);
+  std::cerr << "\tmaximum cache size\n";
+  run_tests_for_maximum_cache_size(proj_matrix_no_cache);
+  std::cerr << "\tprojection of a single row\n";
+  run_tests_for_projection(proj_matrix_no_cache);
+  std::cerr << "\tfile format version 1.0\n";
+  run_tests_for_file_format(proj_matrix_no_cache, 1, true);
+  std::cerr << "\tfile format version 2.0\n";
+  run_tests_for_file_format(proj_matrix_no_cache, 2, false);
+  std::cerr << "\tfile format version 2.0 (preloading all data)\n";
+  run_tests_for_file_format(proj_matrix_no_cache, 2, true);
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+
+int main()
+{
+  ProjMatrixByBinTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,238 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup recon_test
+
+  \brief Test program for the incremental activity integrals in stir::ScatterEstimationByBin
+*/
+
+#include "stir/scatter/ScatterEstimationByBin.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/ExamInfo.h"
+#include "stir/Scanner.h"
+#include "stir/SegmentByView.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/Succeeded.h"
+#include "stir/RunTests.h"
+#include <iostream>
+#include <string>
+
+START_NAMESPACE_STIR
+
+/*!
+  \ingroup test
+  \brief ScatterEstimationByBin that can be set-up without files
+
+  The scatter points are not moved randomly, such that results can be compared.
+  The output is kept in memory and no log file is written.
+*/
+class ScatterEstimationByBinForTests : public ScatterEstimationByBin
+{
+public:
+  ScatterEstimationByBinForTests(const bool use_incremental_activity_integrals,
+                                 const float activity_change_tolerance)
+  {
+    this->random = false;
+    this->use_incremental_activity_integrals = use_incremental_activity_integrals;
+    this->activity_change_tolerance = activity_change_tolerance;
+  }
+
+  void set_output_proj_data_sptr(const shared_ptr<ProjData>& new_sptr)
+  {
+    this->output_proj_data_sptr = new_sptr;
+  }
+
+  virtual void write_log(const double, const float)
+  {}
+};
+
+/*!
+  \ingroup test
+  \brief Test class for the incremental activity integrals in ScatterEstimationByBin
+
+  The scatter is estimated for a uniform cylinder. Then one voxel of the activity image
+  is changed. The scatter estimate with \c use_incremental_activity_integrals (which
+  only recomputes the cached integrals through the changed voxel) is compared with
+  a full recomputation. When the change is smaller than \c activity_change_tolerance,
+  the cached integrals should all be reused, giving the same result as before.
+*/
+class ScatterEstimationByBinTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+  shared_ptr<DiscretisedDensity<3,float> > density_sptr;
+  shared_ptr<DiscretisedDensity<3,float> > density_for_scatter_points_sptr;
+  shared_ptr<DiscretisedDensity<3,float> > activity_sptr;
+
+  //! set all images and projection data
+  void set_up(ScatterEstimationByBinForTests& scatter_estimation,
+              const shared_ptr<ProjData>& output_sptr);
+  //! run the scatter estimation and check that the result is not zero
+  void process_data(ScatterEstimationByBinForTests& scatter_estimation,
+                    const ProjDataInMemory& output,
+                    const std::string& str);
+  //! compare the segments of the projection data
+  void check_if_equal_proj_data(const ProjData& proj_data, const ProjData& reference,
+                                const std::string& str);
+};
+
+void
+ScatterEstimationByBinTests::
+set_up(ScatterEstimationByBinForTests& scatter_estimation, const shared_ptr<ProjData>& output_sptr)
+{
+  scatter_estimation.set_template_proj_data_info_sptr(proj_data_info_sptr);
+  scatter_estimation.set_output_proj_data_sptr(output_sptr);
+  scatter_estimation.set_density_image_sptr(density_sptr);
+  scatter_estimation.set_density_image_for_scatter_points_sptr(density_for_scatter_points_sptr);
+  scatter_estimation.set_activity_image_sptr(activity_sptr);
+}
+
+void
+ScatterEstimationByBinTests::
+process_data(ScatterEstimationByBinForTests& scatter_estimation,
+             const ProjDataInMemory& output,
+             const std::string& str)
+{
+  check(scatter_estimation.process_data() == Succeeded::yes, "process_data " + str);
+  check(output.get_segment_by_view(0).find_max() > 0, "scatter estimate should not be zero " + str);
+}
+
+void
+ScatterEstimationByBinTests::
+check_if_equal_proj_data(const ProjData& proj_data, const ProjData& reference,
+                         const std::string& str)
+{
+  for (int segment_num=reference.get_min_segment_num();
+       segment_num<=reference.get_max_segment_num();
+       ++segment_num)
+    {
+      const SegmentByView<float> segment = proj_data.get_segment_by_view(segment_num);
+      const SegmentByView<float> reference_segment = reference.get_segment_by_view(segment_num);
+      check_if_equal(segment, reference_segment, str);
+    }
+}
+
+void
+ScatterEstimationByBinTests::run_tests()
+{
+  std::cerr << "Tests for the incremental activity integrals in ScatterEstimationByBin\n";
+
+  // a small scanner similar to the one in recon_test_pack/scatter_cylinder.hs
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::User_defined_scanner, "test scanner",
+                                               /*num_detectors_per_ring=*/64, /*num_rings=*/8,
+                                               /*max_num_non_arccorrected_bins=*/35,
+                                               /*default_num_arccorrected_bins=*/35,
+                                               /*inner_ring_radius=*/443.1F,
+                                               /*average_depth_of_interaction=*/8.4F,
+                                               /*ring_spacing=*/19.62F, /*bin_size=*/22.15F,
+                                               /*intrinsic_tilt=*/0.F,
+                                               1, 1, 8, 8, 8, 8, 1));
+  proj_data_info_sptr.reset(
+    ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                  /*span=*/1,
+                                  /*max_delta=*/1,
+                                  /*num_views=*/32,
+                                  /*num_tang_poss=*/35,
+                                  /*arc_corrected=*/false));
+
+  // cylinder of water, with activity 1
+  const CartesianCoordinate3D<float> origin(0.F,0.F,0.F);
+  const CartesianCoordinate3D<float> voxel_size(9.81F,12.F,12.F);
+  const IndexRange3D range(0,15, -12,12, -12,12);
+  density_sptr.reset(new VoxelsOnCartesianGrid<float>(range, origin, voxel_size));
+  activity_sptr.reset(density_sptr->get_empty_copy());
+  for (int z=range.get_min_index(); z<=range.get_max_index(); ++z)
+    for (int y=range[z].get_min_index(); y<=range[z].get_max_index(); ++y)
+      for (int x=range[z][y].get_min_index(); x<=range[z][y].get_max_index(); ++x)
+        if (square(x*voxel_size.x()) + square(y*voxel_size.y()) <= square(100.F))
+          {
+            (*density_sptr)[z][y][x] = .096F;
+            (*activity_sptr)[z][y][x] = 1.F;
+          }
+  // use a coarse grid for the scatter points to keep the test fast
+  const CartesianCoordinate3D<float> coarse_voxel_size(39.24F,40.F,40.F);
+  const IndexRange3D coarse_range(0,3, -3,3, -3,3);
+  density_for_scatter_points_sptr.reset(new VoxelsOnCartesianGrid<float>(coarse_range, origin, coarse_voxel_size));
+  for (int z=coarse_range.get_min_index(); z<=coarse_range.get_max_index(); ++z)
+    for (int y=coarse_range[z].get_min_index(); y<=coarse_range[z].get_max_index(); ++y)
+      for (int x=coarse_range[z][y].get_min_index(); x<=coarse_range[z][y].get_max_index(); ++x)
+        if (square(x*coarse_voxel_size.x()) + square(y*coarse_voxel_size.y()) <= square(100.F))
+          (*density_for_scatter_points_sptr)[z][y][x] = .096F;
+
+  // activity image with one voxel changed (by more than the tolerance)
+  shared_ptr<DiscretisedDensity<3,float> > changed_activity_sptr(activity_sptr->clone());
+  (*changed_activity_sptr)[5][4][-3] = 10.F;
+  // activity image with one voxel changed by less than the tolerance
+  shared_ptr<DiscretisedDensity<3,float> > slightly_changed_activity_sptr(activity_sptr->clone());
+  (*slightly_changed_activity_sptr)[5][4][-3] = 1.05F;
+
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+  shared_ptr<ProjDataInMemory> incremental_output_sptr(new ProjDataInMemory(exam_info_sptr, proj_data_info_sptr));
+  shared_ptr<ProjDataInMemory> full_output_sptr(new ProjDataInMemory(exam_info_sptr, proj_data_info_sptr));
+  ProjDataInMemory original_output(exam_info_sptr, proj_data_info_sptr);
+  const ProjDataInMemory& incremental_output = *incremental_output_sptr;
+  const ProjDataInMemory& full_output = *full_output_sptr;
+
+  ScatterEstimationByBinForTests incremental_scatter_estimation(/*use_incremental_activity_integrals=*/true, .1F);
+  set_up(incremental_scatter_estimation, incremental_output_sptr);
+  process_data(incremental_scatter_estimation, incremental_output, "for the original activity image");
+  original_output.fill(incremental_output);
+
+  std::cerr << "\tone voxel changed by less than the tolerance\n";
+  incremental_scatter_estimation.set_activity_image_sptr(slightly_changed_activity_sptr);
+  process_data(incremental_scatter_estimation, incremental_output, "(incremental, change smaller than tolerance)");
+  check_if_equal_proj_data(incremental_output, original_output,
+                           "incremental scatter estimate should reuse all integrals when the change is below the tolerance");
+
+  std::cerr << "\tone voxel changed by more than the tolerance\n";
+  incremental_scatter_estimation.set_activity_image_sptr(changed_activity_sptr);
+  process_data(incremental_scatter_estimation, incremental_output, "(incremental)");
+  {
+    ScatterEstimationByBinForTests scatter_estimation(/*use_incremental_activity_integrals=*/false, .1F);
+    set_up(scatter_estimation, full_output_sptr);
+    scatter_estimation.set_activity_image_sptr(changed_activity_sptr);
+    process_data(scatter_estimation, full_output, "(full recompute)");
+  }
+  check(full_output.get_segment_by_view(0).sum() > original_output.get_segment_by_view(0).sum(),
+        "scatter estimate should increase when increasing the activity");
+  check_if_equal_proj_data(incremental_output, full_output,
+                           "incremental scatter estimate should be equal to full recompute");
+
+  std::cerr << "\tback to the original image\n";
+  incremental_scatter_estimation.set_activity_image_sptr(activity_sptr);
+  process_data(incremental_scatter_estimation, incremental_output, "(incremental, original image)");
+  check_if_equal_proj_data(incremental_output, original_output,
+                           "incremental scatter estimate after going back to the original image");
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+
+int main()
+{
+  ScatterEstimationByBinTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,469 @@
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+/*!
+
+  \file
+  \ingroup recon_test
+
+  \brief Test program for stir::QuadraticPrior and stir::PLSPrior
+
+  These priors loop over whole image rows. This test compares them with
+  a straightforward implementation looping over every voxel and its neighbours
+  (as in previous versions of STIR).
+*/
+
+#include "stir/recon_buildblock/QuadraticPrior.h"
+#include "stir/recon_buildblock/PLSPrior.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/IndexRange3D.h"
+#include "stir/Succeeded.h"
+#include "stir/is_null_ptr.h"
+#include "stir/RunTests.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+START_NAMESPACE_STIR
+
+typedef DiscretisedDensity<3,float> image_type;
+
+/*****************************************************************
+   reference implementations looping over every voxel
+*****************************************************************/
+
+/* Quadratic prior: sum over the neighbourhood of
+   weights[dz][dy][dx] * kappa[z][y][x] * kappa[z+dz][y+dy][x+dx] * term(z,y,x,dz,dy,dx)
+   where the neighbours have to be inside the image.
+*/
+static double
+quadratic_prior_value_voxel_by_voxel(const image_type& image, const Array<3,float>& weights,
+                                     const image_type * const kappa_ptr)
+{
+  double result = 0;
+  const int min_z = image.get_min_index();
+  const int max_z = image.get_max_index();
+  for (int z=min_z; z<=max_z; z++)
+    {
+      const int min_dz = std::max(weights.get_min_index(), min_z-z);
+      const int max_dz = std::min(weights.get_max_index(), max_z-z);
+      const int min_y = image[z].get_min_index();
+      const int max_y = image[z].get_max_index();
+      for (int y=min_y; y<=max_y; y++)
+        {
+          const int min_dy = std::max(weights[0].get_min_index(), min_y-y);
+          const int max_dy = std::min(weights[0].get_max_index(), max_y-y);
+          const int min_x = image[z][y].get_min_index();
+          const int max_x = image[z][y].get_max_index();
+          for (int x=min_x; x<=max_x; x++)
+            {
+              const int min_dx = std::max(weights[0][0].get_min_index(), min_x-x);
+              const int max_dx = std::min(weights[0][0].get_max_index(), max_x-x);
+              for (int dz=min_dz; dz<=max_dz; ++dz)
+                for (int dy=min_dy; dy<=max_dy; ++dy)
+                  for (int dx=min_dx; dx<=max_dx; ++dx)
+                    {
+                      float current =
+                        weights[dz][dy][dx] * square(image[z][y][x] - image[z+dz][y+dy][x+dx])/4;
+                      if (!is_null_ptr(kappa_ptr))
+                        current *= (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+                      result += static_cast<double>(current);
+                    }
+            }
+        }
+    }
+  return result;
+}
+
+//! which of the quadratic prior functions to compute in quadratic_prior_voxel_by_voxel()
+enum QuadraticPriorFunction { do_gradient, do_curvature, do_Hessian_times_input };
+
+/* Computes the gradient, the parabolic surrogate curvature or the multiplication of
+   the approximate Hessian with \a input (without the penalisation factor).
+*/
+static void
+quadratic_prior_voxel_by_voxel(image_type& output,
+                               const image_type& input, const Array<3,float>& weights,
+                               const image_type * const kappa_ptr,
+                               const QuadraticPriorFunction function)
+{
+  const int min_z = input.get_min_index();
+  const int max_z = input.get_max_index();
+  for (int z=min_z; z<=max_z; z++)
+    {
+      const int min_dz = std::max(weights.get_min_index(), min_z-z);
+      const int max_dz = std::min(weights.get_max_index(), max_z-z);
+      const int min_y = input[z].get_min_index();
+      const int max_y = input[z].get_max_index();
+      for (int y=min_y; y<=max_y; y++)
+        {
+          const int min_dy = std::max(weights[0].get_min_index(), min_y-y);
+          const int max_dy = std::min(weights[0].get_max_index(), max_y-y);
+          const int min_x = input[z][y].get_min_index();
+          const int max_x = input[z][y].get_max_index();
+          for (int x=min_x; x<=max_x; x++)
+            {
+              const int min_dx = std::max(weights[0][0].get_min_index(), min_x-x);
+              const int max_dx = std::min(weights[0][0].get_max_index(), max_x-x);
+              float result = 0;
+              for (int dz=min_dz; dz<=max_dz; ++dz)
+                for (int dy=min_dy; dy<=max_dy; ++dy)
+                  for (int dx=min_dx; dx<=max_dx; ++dx)
+                    {
+                      float current = weights[dz][dy][dx];
+                      switch (function)
+                        {
+                        case do_gradient:
+                          current *= input[z][y][x] - input[z+dz][y+dy][x+dx]; break;
+                        case do_curvature:
+                          break;
+                        case do_Hessian_times_input:
+                          current *= input[z+dz][y+dy][x+dx]; break;
+                        }
+                      if (!is_null_ptr(kappa_ptr))
+                        current *= (*kappa_ptr)[z][y][x] * (*kappa_ptr)[z+dz][y+dy][x+dx];
+                      result += current;
+                    }
+              output[z][y][x] = result;
+            }
+        }
+    }
+}
+
+/* PLS prior: image gradients use forward differences, leaving the last
+   plane/row/column (depending on direction) at 0.
+*/
+static void
+image_gradient_voxel_by_voxel(image_type& image_gradient, const int direction, const image_type& image)
+{
+  image_gradient.fill(0.F);
+  const int min_z = image.get_min_index();
+  const int max_z = image.get_max_index();
+  for (int z=min_z; z<=max_z; z++)
+    {
+      const int min_y = image[z].get_min_index();
+      const int max_y = image[z].get_max_index();
+      for (int y=min_y; y<=max_y; y++)
+        {
+          const int min_x = image[z][y].get_min_index();
+          const int max_x = image[z][y].get_max_index();
+          for (int x=min_x; x<=max_x; x++)
+            {
+              if (direction==0 && z+1<=max_z)
+                image_gradient[z][y][x] = image[z+1][y][x] - image[z][y][x];
+              if (direction==1 && y+1<=max_y)
+                image_gradient[z][y][x] = image[z][y+1][x] - image[z][y][x];
+              if (direction==2 && x+1<=max_x)
+                image_gradient[z][y][x] = image[z][y][x+1] - image[z][y][x];
+            }
+        }
+    }
+}
+
+//! images needed for the value and gradient of the PLS prior
+class PLSPriorTerms
+{
+public:
+  PLSPriorTerms(const image_type& image, const image_type& anatomical_image,
+                const bool only_2D, const double eta, const double alpha);
+
+  const bool only_2D;
+  // indexed by direction as in PLSPrior (0: z, 1: y, 2: x)
+  shared_ptr<image_type> pet_grad_sptrs[3];
+  shared_ptr<image_type> anatomical_grad_sptrs[3];
+  shared_ptr<image_type> norm_sptr;
+  shared_ptr<image_type> inner_product_sptr;
+  shared_ptr<image_type> penalty_sptr;
+
+  //! (pet_im_grad - anatomical_im_grad*inner_product/norm)/penalty
+  float divergence_term(const int direction, const int z, const int y, const int x) const
+  {
+    return ((*pet_grad_sptrs[direction])[z][y][x] -
+            (*anatomical_grad_sptrs[direction])[z][y][x]*(*inner_product_sptr)[z][y][x]/(*norm_sptr)[z][y][x])/
+      (*penalty_sptr)[z][y][x];
+  }
+};
+
+PLSPriorTerms::
+PLSPriorTerms(const image_type& image, const image_type& anatomical_image,
+              const bool only_2D, const double eta, const double alpha)
+  : only_2D(only_2D)
+{
+  const int min_direction = only_2D ? 1 : 0;
+  for (int direction=min_direction; direction<=2; ++direction)
+    {
+      pet_grad_sptrs[direction].reset(image.get_empty_copy());
+      image_gradient_voxel_by_voxel(*pet_grad_sptrs[direction], direction, image);
+      anatomical_grad_sptrs[direction].reset(image.get_empty_copy());
+      image_gradient_voxel_by_voxel(*anatomical_grad_sptrs[direction], direction, anatomical_image);
+    }
+  norm_sptr.reset(image.get_empty_copy());
+  inner_product_sptr.reset(image.get_empty_copy());
+  penalty_sptr.reset(image.get_empty_copy());
+
+  for (int z=image.get_min_index(); z<=image.get_max_index(); z++)
+    for (int y=image[z].get_min_index(); y<=image[z].get_max_index(); y++)
+      for (int x=image[z][y].get_min_index(); x<=image[z][y].get_max_index(); x++)
+        {
+          double norm2 = square(eta);
+          double pet_grad2 = square(alpha);
+          double inner_product = 0;
+          for (int direction=min_direction; direction<=2; ++direction)
+            {
+              norm2 += square((*anatomical_grad_sptrs[direction])[z][y][x]);
+              pet_grad2 += square((*pet_grad_sptrs[direction])[z][y][x]);
+            }
+          (*norm_sptr)[z][y][x] = static_cast<float>(std::sqrt(norm2));
+          for (int direction=min_direction; direction<=2; ++direction)
+            inner_product +=
+              (*pet_grad_sptrs[direction])[z][y][x]*(*anatomical_grad_sptrs[direction])[z][y][x]/(*norm_sptr)[z][y][x];
+          (*inner_product_sptr)[z][y][x] = static_cast<float>(inner_product);
+          (*penalty_sptr)[z][y][x] = static_cast<float>(std::sqrt(pet_grad2 - square(inner_product)));
+        }
+}
+
+static double
+PLS_prior_value_voxel_by_voxel(const PLSPriorTerms& terms, const image_type * const kappa_ptr)
+{
+  const image_type& penalty = *terms.penalty_sptr;
+  double result = 0;
+  for (int z=penalty.get_min_index(); z<=penalty.get_max_index(); z++)
+    for (int y=penalty[z].get_min_index(); y<=penalty[z].get_max_index(); y++)
+      for (int x=penalty[z][y].get_min_index(); x<=penalty[z][y].get_max_index(); x++)
+        result += penalty[z][y][x] * (is_null_ptr(kappa_ptr) ? 1.F : (*kappa_ptr)[z][y][x]);
+  return result;
+}
+
+/* The gradient is minus the divergence, computed with backward differences of
+   the divergence terms. The voxels with x, y or z (in 3D) at the end of the range
+   do not contribute.
+*/
+static void
+PLS_prior_gradient_voxel_by_voxel(image_type& prior_gradient,
+                                  const PLSPriorTerms& terms, const image_type * const kappa_ptr)
+{
+  const bool only_2D = terms.only_2D;
+  const int min_direction = only_2D ? 1 : 0;
+  shared_ptr<image_type> divergence_sptrs[3];
+  for (int direction=min_direction; direction<=2; ++direction)
+    divergence_sptrs[direction].reset(prior_gradient.get_empty_copy());
+
+  const int min_z = prior_gradient.get_min_index();
+  const int max_z = prior_gradient.get_max_index();
+  for (int z=min_z; z<=max_z; z++)
+    {
+      const int max_y = prior_gradient[z].get_max_index();
+      for (int y=prior_gradient[z].get_min_index(); y<=max_y; y++)
+        {
+          const int max_x = prior_gradient[z][y].get_max_index();
+          for (int x=prior_gradient[z][y].get_min_index(); x<=max_x; x++)
+            {
+              if (x+1>max_x || y+1>max_y || (z+1>max_z && !only_2D))
+                continue;
+              (*divergence_sptrs[2])[z][y][x+1] =
+                terms.divergence_term(2,z,y,x+1) - terms.divergence_term(2,z,y,x);
+              (*divergence_sptrs[1])[z][y+1][x] =
+                terms.divergence_term(1,z,y+1,x) - terms.divergence_term(1,z,y,x);
+              if (!only_2D)
+                (*divergence_sptrs[0])[z+1][y][x] =
+                  terms.divergence_term(0,z+1,y,x) - terms.divergence_term(0,z,y,x);
+            }
+        }
+    }
+
+  prior_gradient.fill(0.F);
+  for (int direction=min_direction; direction<=2; ++direction)
+    prior_gradient -= *divergence_sptrs[direction];
+  if (!is_null_ptr(kappa_ptr))
+    prior_gradient *= *kappa_ptr;
+}
+
+/*****************************************************************
+   test class
+*****************************************************************/
+
+/*!
+  \ingroup test
+  \brief Test class for QuadraticPrior and PLSPrior
+
+  The value, gradient, parabolic surrogate curvature and multiplication with the
+  approximate Hessian are compared with the reference implementations above.
+  The image is small, with more voxels in x than in y and z, such that the edges
+  of the image are a large part of it. Tests are run with and without a non-uniform
+  kappa image, and (for QuadraticPrior) with the default weights in 2D and 3D, and
+  with non-uniform weights that extend further in x.
+*/
+class PriorTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<image_type> image_sptr;
+  shared_ptr<image_type> other_image_sptr;
+  shared_ptr<image_type> kappa_sptr;
+
+  void run_tests_for_quadratic_prior(QuadraticPrior<float>& prior, const std::string& name);
+  void run_tests_for_PLS_prior(const bool only_2D, const bool use_kappa);
+};
+
+void
+PriorTests::
+run_tests_for_quadratic_prior(QuadraticPrior<float>& prior, const std::string& name)
+{
+  std::cerr << "\tQuadratic prior, " << name << '\n';
+  const float penalisation_factor = 1.3F;
+  prior.set_penalisation_factor(penalisation_factor);
+  check(prior.set_up(image_sptr) == Succeeded::yes, "set-up of quadratic prior " + name);
+
+  // the weights are computed in compute_value() when not set
+  const double value = prior.compute_value(*image_sptr);
+  const Array<3,float> weights = prior.get_weights();
+  const image_type * const kappa_ptr = prior.get_kappa_sptr().get();
+  check_if_equal(value,
+                 penalisation_factor * quadratic_prior_value_voxel_by_voxel(*image_sptr, weights, kappa_ptr),
+                 "value of quadratic prior " + name);
+
+  shared_ptr<image_type> output_sptr(image_sptr->get_empty_copy());
+  shared_ptr<image_type> reference_sptr(image_sptr->get_empty_copy());
+
+  output_sptr->fill(1000.F);
+  prior.compute_gradient(*output_sptr, *image_sptr);
+  quadratic_prior_voxel_by_voxel(*reference_sptr, *image_sptr, weights, kappa_ptr, do_gradient);
+  *reference_sptr *= penalisation_factor;
+  check_if_equal(*output_sptr, *reference_sptr, "gradient of quadratic prior " + name);
+
+  output_sptr->fill(1000.F);
+  prior.parabolic_surrogate_curvature(*output_sptr, *image_sptr);
+  quadratic_prior_voxel_by_voxel(*reference_sptr, *image_sptr, weights, kappa_ptr, do_curvature);
+  *reference_sptr *= penalisation_factor;
+  check_if_equal(*output_sptr, *reference_sptr, "parabolic surrogate curvature of quadratic prior " + name);
+
+  // output is added to
+  output_sptr.reset(other_image_sptr->clone());
+  check(prior.add_multiplication_with_approximate_Hessian(*output_sptr, *image_sptr) == Succeeded::yes,
+        "add_multiplication_with_approximate_Hessian of quadratic prior " + name);
+  quadratic_prior_voxel_by_voxel(*reference_sptr, *image_sptr, weights, kappa_ptr, do_Hessian_times_input);
+  *reference_sptr *= penalisation_factor;
+  *reference_sptr += *other_image_sptr;
+  check_if_equal(*output_sptr, *reference_sptr,
+                 "add_multiplication_with_approximate_Hessian of quadratic prior " + name);
+}
+
+void
+PriorTests::
+run_tests_for_PLS_prior(const bool only_2D, const bool use_kappa)
+{
+  const std::string name =
+    std::string(only_2D ? "2D" : "3D") + (use_kappa ? ", with kappa" : ", without kappa");
+  std::cerr << "\tPLS prior, " << name << '\n';
+  const float penalisation_factor = .7F;
+  const double eta = .5;
+  const double alpha = .3;
+
+  PLSPrior<float> prior;
+  prior.set_only_2D(only_2D);
+  prior.set_eta(eta);
+  prior.set_alpha(alpha);
+  prior.set_penalisation_factor(penalisation_factor);
+  // use the other image as the anatomical image
+  prior.set_anatomical_image_sptr(other_image_sptr);
+  if (use_kappa)
+    prior.set_kappa_sptr(kappa_sptr);
+  check(prior.set_up(image_sptr) == Succeeded::yes, "set-up of PLS prior " + name);
+
+  const PLSPriorTerms terms(*image_sptr, *other_image_sptr, only_2D, eta, alpha);
+  const image_type * const kappa_ptr = use_kappa ? kappa_sptr.get() : 0;
+
+  check_if_equal(prior.compute_value(*image_sptr),
+                 penalisation_factor * PLS_prior_value_voxel_by_voxel(terms, kappa_ptr),
+                 "value of PLS prior " + name);
+
+  shared_ptr<image_type> gradient_sptr(image_sptr->get_empty_copy());
+  shared_ptr<image_type> reference_sptr(image_sptr->get_empty_copy());
+  gradient_sptr->fill(1000.F);
+  prior.compute_gradient(*gradient_sptr, *image_sptr);
+  PLS_prior_gradient_voxel_by_voxel(*reference_sptr, terms, kappa_ptr);
+  *reference_sptr *= penalisation_factor;
+  check_if_equal(*gradient_sptr, *reference_sptr, "gradient of PLS prior " + name);
+}
+
+void
+PriorTests::run_tests()
+{
+  std::cerr << "Tests for QuadraticPrior and PLSPrior\n";
+
+  const IndexRange3D range(-2,2, -3,2, -6,7);
+  const CartesianCoordinate3D<float> origin(0.F,0.F,0.F);
+  const CartesianCoordinate3D<float> grid_spacing(3.F,2.F,2.5F);
+  image_sptr.reset(new VoxelsOnCartesianGrid<float>(range, origin, grid_spacing));
+  other_image_sptr.reset(new VoxelsOnCartesianGrid<float>(range, origin, grid_spacing));
+  kappa_sptr.reset(new VoxelsOnCartesianGrid<float>(range, origin, grid_spacing));
+  for (int z=range.get_min_index(); z<=range.get_max_index(); z++)
+    for (int y=range[z].get_min_index(); y<=range[z].get_max_index(); y++)
+      for (int x=range[z][y].get_min_index(); x<=range[z][y].get_max_index(); x++)
+        {
+          (*image_sptr)[z][y][x] = static_cast<float>(1 + (3*x + 5*y + 7*z + 100)%11);
+          // the anatomical image for the PLS prior has an edge
+          (*other_image_sptr)[z][y][x] = static_cast<float>((x+y>0 ? 4 : 1) + (x*z + 50)%3);
+          (*kappa_sptr)[z][y][x] = static_cast<float>(.5 + .1*((x + 2*y - z + 100)%7));
+        }
+
+  {
+    QuadraticPrior<float> prior(/*only_2D=*/false, 1.F);
+    run_tests_for_quadratic_prior(prior, "3D, without kappa");
+  }
+  {
+    QuadraticPrior<float> prior(/*only_2D=*/false, 1.F);
+    prior.set_kappa_sptr(kappa_sptr);
+    run_tests_for_quadratic_prior(prior, "3D, with kappa");
+  }
+  {
+    QuadraticPrior<float> prior(/*only_2D=*/true, 1.F);
+    prior.set_kappa_sptr(kappa_sptr);
+    run_tests_for_quadratic_prior(prior, "2D, with kappa");
+  }
+  {
+    // non-uniform (and non-symmetric) weights, with some zeroes and a non-zero centre
+    Array<3,float> weights(IndexRange3D(-1,1, -1,1, -2,2));
+    for (int z=-1; z<=1; ++z)
+      for (int y=-1; y<=1; ++y)
+        for (int x=-2; x<=2; ++x)
+          weights[z][y][x] = static_cast<float>((x + 3*y + 5*z + 20)%4) * (1.F + .1F*x);
+    weights[0][0][0] = .2F;
+    QuadraticPrior<float> prior(/*only_2D=*/false, 1.F);
+    prior.set_weights(weights);
+    run_tests_for_quadratic_prior(prior, "non-uniform weights, without kappa");
+    prior.set_kappa_sptr(kappa_sptr);
+    run_tests_for_quadratic_prior(prior, "non-uniform weights, with kappa");
+  }
+
+  run_tests_for_PLS_prior(/*only_2D=*/false, /*use_kappa=*/false);
+  run_tests_for_PLS_prior(/*only_2D=*/false, /*use_kappa=*/true);
+  run_tests_for_PLS_prior(/*only_2D=*/true, /*use_kappa=*/false);
+  run_tests_for_PLS_prior(/*only_2D=*/true, /*use_kappa=*/true);
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+
+int main()
+{
+  PriorTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
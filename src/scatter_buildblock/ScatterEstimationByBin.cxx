@@ -50,6 +50,8 @@ set_defaults()
   this->attenuation_threshold =  0.01 ;
   this->random = true;
   this->use_cache = true;
+  this->use_incremental_activity_integrals = false;
+  this->activity_change_tolerance = .01F;
   this->energy_resolution = .22 ;
   this->reference_energy = 511.F;
   this->lower_energy_threshold = 350 ;
@@ -74,6 +76,8 @@ initialise_keymap()
   this->parser.add_key("random", &this->random);
 
   this->parser.add_key("use_cache", &this->use_cache);
+  this->parser.add_key("use_incremental_activity_integrals", &this->use_incremental_activity_integrals);
+  this->parser.add_key("activity_change_tolerance", &this->activity_change_tolerance);
   this->parser.add_key("energy_resolution", &this->energy_resolution);
   this->parser.add_key("lower_energy_threshold", &this->lower_energy_threshold);
   this->parser.add_key("upper_energy_threshold", &this->upper_energy_threshold);
@@ -118,7 +122,13 @@ ScatterEstimationByBin::
 set_activity_image_sptr(const shared_ptr<DiscretisedDensity<3,float> >& new_sptr)
 {
   this->activity_image_sptr=new_sptr;
-  this->remove_cache_for_integrals_over_activity();
+  if (this->use_incremental_activity_integrals &&
+      this->use_cache &&
+      !is_null_ptr(this->activity_image_for_cache_sptr) &&
+      this->activity_image_for_cache_sptr->has_same_characteristics(*new_sptr))
+    this->remove_cache_for_integrals_over_activity_through_changed_voxels();
+  else
+    this->remove_cache_for_integrals_over_activity();
 }
 
 void
@@ -166,7 +176,9 @@ set_density_image_for_scatter_points_sptr(const shared_ptr<DiscretisedDensity<3,
 {
   this->density_image_for_scatter_points_sptr=new_sptr;
   this->sample_scatter_points();
+  // the scatter points have changed, so all integrals need to be recomputed
   this->remove_cache_for_integrals_over_attenuation();
+  this->remove_cache_for_integrals_over_activity();
 }
 
 void
@@ -203,8 +215,6 @@ set_template_proj_data_info_sptr(const shared_ptr<ProjDataInfo>& new_sptr)
   this->total_detectors = 
     this->proj_data_info_ptr->get_scanner_ptr()->get_num_rings()*
     this->proj_data_info_ptr->get_scanner_ptr()->get_num_detectors_per_ring ();
-  // reserve space to avoid reallocation, but the actual size will grow dynamically
-  this->detection_points_vector.reserve(total_detectors);
 
   // remove any cached values as they'd be incorrect if the sizes changes
   this->remove_cache_for_integrals_over_attenuation();
@@ -249,9 +259,6 @@ Succeeded
 ScatterEstimationByBin::
 process_data()
 {               
-  this->initialise_cache_for_scattpoint_det_integrals_over_attenuation();
-  this->initialise_cache_for_scattpoint_det_integrals_over_activity();
- 
   ViewSegmentNumbers vs_num;
         
   /* ////////////////// SCATTER ESTIMATION TIME ////////////////
@@ -302,6 +309,20 @@ process_data()
 #endif
   this->shift_detector_coordinates_to_origin =
     CartesianCoordinate3D<float>(this->proj_data_info_ptr->get_m(Bin(0,0,0,0)),0, 0);
+  this->initialise_detection_points_vector();
+
+  // compute all integrals before the scatter estimate, such that threads only need to read the cache
+  this->initialise_cache_for_scattpoint_det_integrals_over_attenuation();
+  this->initialise_cache_for_scattpoint_det_integrals_over_activity();
+  {
+    HighResWallClockTimer cache_timer;
+    cache_timer.start();
+    this->fill_cache_for_scattpoint_det_integrals_over_attenuation();
+    this->fill_cache_for_scattpoint_det_integrals_over_activity();
+    cache_timer.stop();
+    info(boost::format("Computed integrals for %1% scatter points and %2% detectors in %3% sec")
+         % this->scatt_points_vector.size() % this->total_detectors % cache_timer.value());
+  }
 
   float total_scatter = 0 ;
 
@@ -343,13 +364,6 @@ process_data()
   wall_clock_timer.stop();
   this->write_log(wall_clock_timer.value(), total_scatter);
 
-  if (detection_points_vector.size() != static_cast<unsigned int>(total_detectors))
-    {
-      warning("Expected num detectors: %d, but found %d\n",
-              total_detectors, detection_points_vector.size());
-      return Succeeded::no;
-    }
-
   return Succeeded::yes;
 }
 
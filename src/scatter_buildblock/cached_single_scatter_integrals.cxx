@@ -29,6 +29,16 @@
 #include "stir/scatter/ScatterEstimationByBin.h"
 #include "stir/IndexRange.h" 
 #include "stir/Coordinate2D.h"
+#include "stir/IndexRange3D.h"
+#include "stir/VoxelsOnCartesianGrid.h"
+#include "stir/recon_buildblock/ProjMatrixElemsForOneBin.h"
+#include "stir/recon_buildblock/RayTraceVoxelsOnCartesianGrid.h"
+#include "stir/is_null_ptr.h"
+#include "stir/info.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cmath>
 
 START_NAMESPACE_STIR
 
@@ -46,6 +56,115 @@ ScatterEstimationByBin::
 remove_cache_for_integrals_over_activity()
 {
   this->cached_activity_integral_scattpoint_det.recycle();
+  this->activity_image_for_cache_sptr.reset();
+}
+
+// size of the blocks of voxels used to check which integrals cross changed voxels
+static const int block_size_for_changed_voxels = 4;
+
+void
+ScatterEstimationByBin::
+remove_cache_for_integrals_over_activity_through_changed_voxels()
+{
+  const VoxelsOnCartesianGrid<float>& image =
+    dynamic_cast<const VoxelsOnCartesianGrid<float>&>(*this->activity_image_sptr);
+  VoxelsOnCartesianGrid<float>& image_for_cache =
+    dynamic_cast<VoxelsOnCartesianGrid<float>&>(*this->activity_image_for_cache_sptr);
+
+  BasicCoordinate<3,int> min_indices, max_indices;
+  if (!image.get_regular_range(min_indices, max_indices))
+    error("ScatterEstimationByBin: activity image should have a regular range");
+
+  // find blocks of voxels that contain a voxel (or a neighbour of a voxel) that changed.
+  // Using neighbours avoids missing rays that only go through the corner of a changed voxel.
+  const int block_size = block_size_for_changed_voxels;
+  BasicCoordinate<3,int> num_blocks;
+  for (int d=1; d<=3; ++d)
+    num_blocks[d] = (max_indices[d] - min_indices[d])/block_size + 1;
+  Array<3,int> changed_blocks(IndexRange3D(0, num_blocks[1]-1, 0, num_blocks[2]-1, 0, num_blocks[3]-1));
+
+  const float tolerance = this->activity_change_tolerance * image.find_max();
+  int num_changed_voxels = 0;
+  BasicCoordinate<3,int> c;
+  for (c[1]=min_indices[1]; c[1]<=max_indices[1]; ++c[1])
+    for (c[2]=min_indices[2]; c[2]<=max_indices[2]; ++c[2])
+      for (c[3]=min_indices[3]; c[3]<=max_indices[3]; ++c[3])
+        {
+          if (std::fabs(image[c] - image_for_cache[c]) <= tolerance)
+            continue;
+          ++num_changed_voxels;
+          image_for_cache[c] = image[c];
+          BasicCoordinate<3,int> n;
+          for (n[1]=std::max(c[1]-1, min_indices[1]); n[1]<=std::min(c[1]+1, max_indices[1]); ++n[1])
+            for (n[2]=std::max(c[2]-1, min_indices[2]); n[2]<=std::min(c[2]+1, max_indices[2]); ++n[2])
+              for (n[3]=std::max(c[3]-1, min_indices[3]); n[3]<=std::min(c[3]+1, max_indices[3]); ++n[3])
+                changed_blocks[(n[1]-min_indices[1])/block_size][(n[2]-min_indices[2])/block_size][(n[3]-min_indices[3])/block_size] = 1;
+        }
+
+  const long num_integrals =
+    static_cast<long>(this->cached_activity_integral_scattpoint_det.size_all());
+  if (num_changed_voxels == 0)
+    {
+      info(boost::format("ScatterEstimationByBin: activity image did not change. Reusing all %1% cached activity integrals")
+           % num_integrals);
+      return;
+    }
+
+  // now find which integrals go through a changed block, using the same coordinates as
+  // integral_between_2_points, but in units of blocks (with block 0 centred at 0)
+  const CartesianCoordinate3D<float> voxel_size = image.get_grid_spacing();
+  CartesianCoordinate3D<float> origin = image.get_origin();
+  const float z_to_middle =
+    (image.get_max_index() + image.get_min_index())*voxel_size.z()/2.F;
+  origin.z() -= z_to_middle;
+  CartesianCoordinate3D<float> block_offset;
+  for (int d=1; d<=3; ++d)
+    block_offset[d] = min_indices[d] + (block_size-1)/2.F;
+  const CartesianCoordinate3D<float> block_size_in_mm = voxel_size * static_cast<float>(block_size);
+
+  const int num_scatter_points = static_cast<int>(this->scatt_points_vector.size());
+  const int num_detectors = this->cached_activity_integral_scattpoint_det.get_length();
+  long num_removed_integrals = 0;
+#ifdef STIR_OPENMP
+#pragma omp parallel for reduction(+:num_removed_integrals) schedule(dynamic)
+#endif
+  for (int det_num=0; det_num<num_detectors; ++det_num)
+    {
+      Array<1,float>& cache_for_det = this->cached_activity_integral_scattpoint_det[det_num];
+      const CartesianCoordinate3D<float> detector_coord_in_blocks =
+        ((this->detection_points_vector[det_num] - origin)/voxel_size - block_offset)/static_cast<float>(block_size);
+      ProjMatrixElemsForOneBin lor;
+      for (int scatter_point_num=0; scatter_point_num<num_scatter_points; ++scatter_point_num)
+        {
+          if (cache_for_det[scatter_point_num] == cache_init_value)
+            continue;
+          lor.erase();
+          RayTraceVoxelsOnCartesianGrid(lor,
+                                        ((this->scatt_points_vector[scatter_point_num].coord - origin)/voxel_size - block_offset)/static_cast<float>(block_size),
+                                        detector_coord_in_blocks,
+                                        block_size_in_mm,
+                                        1.F);
+          for (ProjMatrixElemsForOneBin::const_iterator element_ptr = lor.begin();
+               element_ptr != lor.end();
+               ++element_ptr)
+            {
+              const BasicCoordinate<3,int> coords = element_ptr->get_coords();
+              if (coords[1] >= 0 && coords[1] < num_blocks[1] &&
+                  coords[2] >= 0 && coords[2] < num_blocks[2] &&
+                  coords[3] >= 0 && coords[3] < num_blocks[3] &&
+                  changed_blocks[coords] != 0)
+                {
+                  cache_for_det[scatter_point_num] = cache_init_value;
+                  ++num_removed_integrals;
+                  break;
+                }
+            }
+        }
+    }
+
+  info(boost::format("ScatterEstimationByBin: %1% voxels in the activity image changed by more than %2%. "
+                     "Reusing %3% of %4% cached activity integrals")
+       % num_changed_voxels % tolerance % (num_integrals - num_removed_integrals) % num_integrals);
 }
 
 
@@ -56,9 +175,10 @@ initialise_cache_for_scattpoint_det_integrals_over_attenuation()
   if (!this->use_cache)
     return;
 
+  // note: the cache is stored per detector, such that the sum over scatter points accesses it contiguously
   const IndexRange<2> range (Coordinate2D<int> (0,0), 
-                             Coordinate2D<int> (static_cast<int>(this->scatt_points_vector.size()-1),
-                                                this->total_detectors-1));
+                             Coordinate2D<int> (this->total_detectors-1,
+                                                static_cast<int>(this->scatt_points_vector.size()-1)));
   if (this->cached_attenuation_integral_scattpoint_det.get_index_range() == range)
     return;  // keep cache if correct size
 
@@ -74,124 +194,112 @@ initialise_cache_for_scattpoint_det_integrals_over_activity()
     return;
 
   const IndexRange<2> range (Coordinate2D<int> (0,0), 
-                             Coordinate2D<int> (static_cast<int>(this->scatt_points_vector.size()-1),
-                                                this->total_detectors-1));
+                             Coordinate2D<int> (this->total_detectors-1,
+                                                static_cast<int>(this->scatt_points_vector.size()-1)));
 
   if (this->cached_activity_integral_scattpoint_det.get_index_range() == range)
     return; // keep cache if correct size
 
   this->cached_activity_integral_scattpoint_det.resize(range);
   this->cached_activity_integral_scattpoint_det.fill(cache_init_value);
+  // all integrals will be recomputed, so we need a new copy of the activity image as well
+  this->activity_image_for_cache_sptr.reset();
 }
 
-float 
+void
 ScatterEstimationByBin::
-cached_integral_over_activity_image_between_scattpoint_det(const unsigned scatter_point_num, 
-                                                           const unsigned det_num)
-{                
-  float * location_in_cache = 
-    this->use_cache
-    ? &cached_activity_integral_scattpoint_det[scatter_point_num][det_num]
-    : 0;
-
-  /* OPENMP note:
-     We use atomic read/write to get at the cache. This should ensure validity.
-     Probably we could have 2 threads computing the same value that will be
-     cached later, but this might be better than locking (and it's simpler to write).
-     Sadly, this is only supported from OpenMP 3.1, so we need to add some extra checks.
-  */
-  float value;
-#if defined(STIR_OPENMP)
-# if _OPENMP >=201012
-#  pragma omp atomic read
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONREADCACHE)
-  {
-# endif
-#endif
-  value = *location_in_cache;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
-  }
-#endif
+fill_cache_for_scattpoint_det_integrals_over_attenuation()
+{
+  if (!this->use_cache)
+    return;
 
-  if (this->use_cache && value!=cache_init_value)
+  const int num_scatter_points = static_cast<int>(this->scatt_points_vector.size());
+  // every thread fills the values for different detectors, so the result does not depend on the number of threads
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int det_num=0; det_num<this->total_detectors; ++det_num)
     {
-      return value;
+      Array<1,float>& cache_for_det = this->cached_attenuation_integral_scattpoint_det[det_num];
+      for (int scatter_point_num=0; scatter_point_num<num_scatter_points; ++scatter_point_num)
+        {
+          if (cache_for_det[scatter_point_num] != cache_init_value)
+            continue; // keep previously computed value
+          cache_for_det[scatter_point_num] =
+            exp_integral_over_attenuation_image_between_scattpoint_det
+            (scatt_points_vector[scatter_point_num].coord,
+             detection_points_vector[det_num]);
+        }
     }
-  else
-    {
-      const float result =
-        integral_over_activity_image_between_scattpoint_det
-        (scatt_points_vector[scatter_point_num].coord,
-         detection_points_vector[det_num]
-         );
-      if (this->use_cache)
+}
+
+void
+ScatterEstimationByBin::
+fill_cache_for_scattpoint_det_integrals_over_activity()
+{
+  if (!this->use_cache)
+    return;
+
+  // keep a copy of the image to find out which integrals need to be recomputed when it changes
+  if (this->use_incremental_activity_integrals &&
+      is_null_ptr(this->activity_image_for_cache_sptr))
+    this->activity_image_for_cache_sptr.reset(this->activity_image_sptr->clone());
+
+  const int num_scatter_points = static_cast<int>(this->scatt_points_vector.size());
 #ifdef STIR_OPENMP
-# if _OPENMP >=201012
-#  pragma omp atomic write
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONWRITECACHE)
-        {
-# endif
+#pragma omp parallel for schedule(dynamic)
 #endif
-        *location_in_cache=result;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
+  for (int det_num=0; det_num<this->total_detectors; ++det_num)
+    {
+      Array<1,float>& cache_for_det = this->cached_activity_integral_scattpoint_det[det_num];
+      for (int scatter_point_num=0; scatter_point_num<num_scatter_points; ++scatter_point_num)
+        {
+          if (cache_for_det[scatter_point_num] != cache_init_value)
+            continue; // keep previously computed value
+          cache_for_det[scatter_point_num] =
+            integral_over_activity_image_between_scattpoint_det
+            (scatt_points_vector[scatter_point_num].coord,
+             detection_points_vector[det_num]);
         }
-#endif
-      return result;
     }
 }
 
 float 
 ScatterEstimationByBin::
-cached_exp_integral_over_attenuation_image_between_scattpoint_det(const unsigned scatter_point_num, 
-                                                                  const unsigned det_num)
+cached_integral_over_activity_image_between_scattpoint_det(const unsigned scatter_point_num, 
+                                                           const unsigned det_num)
 {
-  float * location_in_cache = 
-    this->use_cache
-    ? &cached_attenuation_integral_scattpoint_det[scatter_point_num][det_num]
-    : 0;
-
-  float value;
-#if defined(STIR_OPENMP)
-# if _OPENMP >=201012
-#  pragma omp atomic read
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONREADCACHEATTENINT)
-  {
-# endif
-#endif
-  value = *location_in_cache;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
-  }
-#endif
-
-  if (this->use_cache && value!=cache_init_value)
+  // Note: the cache is filled by process_data() before computing the scatter estimate, so
+  // threads only read from it here.
+  if (this->use_cache)
     {
-      return *location_in_cache;
+      const float value = cached_activity_integral_scattpoint_det[det_num][scatter_point_num];
+      if (value != cache_init_value)
+        return value;
     }
-  else
+  return
+    integral_over_activity_image_between_scattpoint_det
+    (scatt_points_vector[scatter_point_num].coord,
+     detection_points_vector[det_num]
+     );
+}
+
+float 
+ScatterEstimationByBin::
+cached_exp_integral_over_attenuation_image_between_scattpoint_det(const unsigned scatter_point_num, 
+                                                                  const unsigned det_num)
+{
+  if (this->use_cache)
     {
-      const float result =
-        exp_integral_over_attenuation_image_between_scattpoint_det
-        (scatt_points_vector[scatter_point_num].coord,
-         detection_points_vector[det_num]
-         );
-      if (this->use_cache)
-#ifdef STIR_OPENMP
-# if _OPENMP >=201012
-#  pragma omp atomic write
-# else
-#  pragma omp critical(STIRSCATTERESTIMATIONREADCACHEATTENINT)
-        {
-# endif
-#endif
-        *location_in_cache=result;
-#if defined(STIR_OPENMP) && (_OPENMP <201012)
-        }
-#endif
-      return result;
+      const float value = cached_attenuation_integral_scattpoint_det[det_num][scatter_point_num];
+      if (value != cache_init_value)
+        return value;
     }
+  return
+    exp_integral_over_attenuation_image_between_scattpoint_det
+    (scatt_points_vector[scatter_point_num].coord,
+     detection_points_vector[det_num]
+     );
 }
-        
+
 END_NAMESPACE_STIR
@@ -27,25 +27,98 @@
 #include "stir/ProjDataInfo.h"
 #include "stir/ExamInfo.h"
 #include "stir/ProjDataInMemory.h"
-#include "stir/inverse_SSRB.h"
-#include "stir/scale_sinograms.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/Sinogram.h"
+#include "stir/Viewgram.h"
+#include "stir/RelatedViewgrams.h"
+#include "stir/Bin.h"
+#include "stir/ViewSegmentNumbers.h"
 #include "stir/scatter/ScatterEstimationByBin.h"
 #include "stir/recon_buildblock/BinNormalisation.h"
+#include "stir/recon_buildblock/TrivialDataSymmetriesForBins.h"
 #include "stir/interpolate_projdata.h"
-#include "stir/utilities.h"
-#include "stir/IndexRange2D.h" 
 #include "stir/stream.h"
 #include "stir/Succeeded.h"
 #include "stir/thresholding.h"
 #include "stir/is_null_ptr.h"
 #include "stir/ArrayFilter1DUsingConvolution.h"
+#include "stir/info.h"
+#include "stir/warning.h"
+#include "stir/error.h"
+#include <boost/format.hpp>
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <cmath>
 /***********************************************************/
 
 START_NAMESPACE_STIR
 
+/* Fill a sinogram of the oblique data from the direct sinograms (as in inverse_SSRB()).
+   Returns false if no direct sinogram corresponds to this sinogram.
+*/
+static bool
+inverse_SSRB_for_one_sinogram(Sinogram<float>& sino_4D,
+                              const ProjDataInfo& proj_data_4D_info,
+                              const SegmentBySinogram<float>& direct_segment,
+                              const ProjDataInfo& proj_data_3D_info)
+{
+  const float out_m =
+    proj_data_4D_info.get_m(Bin(sino_4D.get_segment_num(), 0, sino_4D.get_axial_pos_num(), 0));
+  for (int in_ax_pos_num = direct_segment.get_min_axial_pos_num();
+       in_ax_pos_num  <= direct_segment.get_max_axial_pos_num();
+       ++in_ax_pos_num )
+    {
+      const float in_m =
+        proj_data_3D_info.get_m(Bin(0, 0, in_ax_pos_num, 0));
+      if (fabs(out_m - in_m) < 1E-2)
+        {
+          sino_4D += direct_segment.get_sinogram(in_ax_pos_num);
+          return true;
+        }
+      const float in_m_next = in_ax_pos_num == direct_segment.get_max_axial_pos_num() ?
+        -1000000.F : proj_data_3D_info.get_m(Bin(0, 0, in_ax_pos_num+1, 0));
+
+      if (fabs(out_m - .5F*(in_m + in_m_next)) < 1E-2)
+        {
+          sino_4D += direct_segment.get_sinogram(in_ax_pos_num);
+          sino_4D += direct_segment.get_sinogram(in_ax_pos_num+1);
+          sino_4D *= .5F;
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Find the scale factor for one sinogram (as in get_scale_factors_per_sinogram()).
+   Returns false if the weighted denominator is too small.
+*/
+static bool
+get_scale_factor_for_one_sinogram(float& scale_factor,
+                                  const Sinogram<float>& numerator_sinogram,
+                                  const Sinogram<float>& denominator_sinogram,
+                                  const Sinogram<float>& weights)
+{
+  const Array<2,float> weighted_denominator_sinogram = denominator_sinogram * weights;
+  const Array<2,float> weighted_numerator_sinogram = numerator_sinogram * weights;
+  const float total_in_denominator = weighted_denominator_sinogram.sum();
+  const float total_in_numerator = weighted_numerator_sinogram.sum();
+  const float denominator_sum = denominator_sinogram.sum();
+
+  if (denominator_sum==0)
+    {
+      scale_factor = 0;
+      return true;
+    }
+  if (total_in_denominator <=
+      denominator_sum/(denominator_sinogram.get_num_views() * denominator_sinogram.get_num_tangential_poss()) * .001)
+    {
+      scale_factor = 0;
+      return false;
+    }
+  scale_factor = total_in_numerator/total_in_denominator;
+  return true;
+}
+
 void 
 ScatterEstimationByBin::
 upsample_and_fit_scatter_estimate(ProjData& scaled_scatter_proj_data,
@@ -67,55 +140,114 @@ upsample_and_fit_scatter_estimate(ProjData& scaled_scatter_proj_data,
   ProjDataInMemory interpolated_direct_scatter(emission_proj_data.get_exam_info_sptr(),
 					       interpolated_direct_scatter_proj_data_info_sptr);        
   interpolate_projdata(interpolated_direct_scatter, scatter_proj_data, spline_type, remove_interleaving);
+  const SegmentBySinogram<float> direct_segment =
+    interpolated_direct_scatter.get_segment_by_sinogram(0);
 
   const TimeFrameDefinitions& time_frame_defs =
     emission_proj_data.get_exam_info_sptr()->time_frame_definitions;
 
-  if (min_scale_factor != 1 || max_scale_factor != 1 || !scatter_normalisation.is_trivial())
+  const bool fit_scatter =
+    min_scale_factor != 1 || max_scale_factor != 1 || !scatter_normalisation.is_trivial();
+
+  shared_ptr<ProjDataInfo> proj_data_info_sptr =
+    emission_proj_data.get_proj_data_info_ptr()->create_shared_clone();
+  shared_ptr<DataSymmetriesForViewSegmentNumbers>
+    symmetries_sptr(new TrivialDataSymmetriesForBins(proj_data_info_sptr));
+  if (fit_scatter)
+    scatter_normalisation.set_up(proj_data_info_sptr);
+
+  VectorWithOffset<float> kernel(-static_cast<int>(half_filter_width),half_filter_width);
+  kernel.fill(1.F/(2*half_filter_width+1));
+  ArrayFilter1DUsingConvolution<float> lowpass_filter(kernel, BoundaryConditions::constant);
+
+  // Process one segment at a time, such that only the data for this segment need to be in memory.
+  // The different steps (inverse SSRB, normalisation, finding and applying the scale factors)
+  // are parallelised over the sinograms (or viewgrams) of the segment.
+  for (int segment_num = scaled_scatter_proj_data.get_min_segment_num();
+       segment_num <= scaled_scatter_proj_data.get_max_segment_num();
+       ++segment_num)
     {
-      ProjDataInMemory interpolated_scatter(emission_proj_data.get_exam_info_sptr(),
-					    emission_proj_data.get_proj_data_info_ptr()->create_shared_clone());
-      inverse_SSRB(interpolated_scatter, interpolated_direct_scatter);
-
-      scatter_normalisation.set_up(emission_proj_data.get_proj_data_info_ptr()->create_shared_clone());
-      scatter_normalisation.undo(interpolated_scatter, 
-                                 time_frame_defs.get_start_time(), time_frame_defs.get_end_time());
-      Array<2,float> scale_factors;
-      
-      std::cout << "Finding scale factors by sinogram" << std::endl;
-      scale_factors = get_scale_factors_per_sinogram(
-                                                 emission_proj_data, 
-                                                 interpolated_scatter,
-                                                 weights_proj_data);
-    
-      std::cout << scale_factors;
-      threshold_lower(scale_factors.begin_all(), 
-                      scale_factors.end_all(),
-                      min_scale_factor);
-      threshold_upper(scale_factors.begin_all(), 
-                      scale_factors.end_all(),
-                      max_scale_factor);
-      std::cout << "After thresholding:\n";
-      std::cout << scale_factors;
-      VectorWithOffset<float> kernel(-static_cast<int>(half_filter_width),half_filter_width);
-      kernel.fill(1.F/(2*half_filter_width+1));
-      ArrayFilter1DUsingConvolution<float> lowpass_filter(kernel, BoundaryConditions::constant);
-      std::for_each(scale_factors.begin(), 
-                    scale_factors.end(),
-                    lowpass_filter);
-      std::cout << "After filtering:\n";
-      std::cout << scale_factors;
-      std::cout << "applying scale factors" << std::endl;
-      if (scale_sinograms(scaled_scatter_proj_data, 
-                          interpolated_scatter,
-                          scale_factors) != Succeeded::yes)
+      SegmentBySinogram<float> scatter_segment =
+        scaled_scatter_proj_data.get_empty_segment_by_sinogram(segment_num);
+      const int min_ax_pos_num = scatter_segment.get_min_axial_pos_num();
+      const int max_ax_pos_num = scatter_segment.get_max_axial_pos_num();
+
+      // inverse SSRB
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int ax_pos_num = min_ax_pos_num; ax_pos_num <= max_ax_pos_num; ++ax_pos_num)
         {
-          error("writing of scaled sinograms failed");
+          Sinogram<float> sino_4D = scatter_segment.get_sinogram(ax_pos_num);
+          if (inverse_SSRB_for_one_sinogram(sino_4D, *scaled_scatter_proj_data.get_proj_data_info_ptr(),
+                                            direct_segment, *interpolated_direct_scatter_proj_data_info_sptr))
+            scatter_segment.set_sinogram(sino_4D);
+          else
+            warning(boost::format("upsample_and_fit_scatter_estimate: no sinogram contributes to segment %1%, axial_pos_num %2%")
+                    % segment_num % ax_pos_num);
         }
-    }
-  else // min/max_scale_factor equal to 1
-    {
-      inverse_SSRB(scaled_scatter_proj_data, interpolated_direct_scatter);
+
+      if (fit_scatter)
+        {
+          // undo normalisation
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+          for (int view_num = scatter_segment.get_min_view_num(); view_num <= scatter_segment.get_max_view_num(); ++view_num)
+            {
+              RelatedViewgrams<float> viewgrams =
+                proj_data_info_sptr->get_empty_related_viewgrams(ViewSegmentNumbers(view_num, segment_num), symmetries_sptr);
+              *viewgrams.begin() = scatter_segment.get_viewgram(view_num);
+              scatter_normalisation.undo(viewgrams,
+                                         time_frame_defs.get_start_time(), time_frame_defs.get_end_time());
+              scatter_segment.set_viewgram(*viewgrams.begin());
+            }
+
+          // find scale factors
+          const SegmentBySinogram<float> emission_segment =
+            emission_proj_data.get_segment_by_sinogram(segment_num);
+          const SegmentBySinogram<float> weights_segment =
+            weights_proj_data.get_segment_by_sinogram(segment_num);
+          Array<1,float> scale_factors(min_ax_pos_num, max_ax_pos_num);
+          Array<1,int> scale_factor_ok(min_ax_pos_num, max_ax_pos_num);
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+          for (int ax_pos_num = min_ax_pos_num; ax_pos_num <= max_ax_pos_num; ++ax_pos_num)
+            scale_factor_ok[ax_pos_num] =
+              get_scale_factor_for_one_sinogram(scale_factors[ax_pos_num],
+                                                emission_segment.get_sinogram(ax_pos_num),
+                                                scatter_segment.get_sinogram(ax_pos_num),
+                                                weights_segment.get_sinogram(ax_pos_num))
+              ? 1 : 0;
+          for (int ax_pos_num = min_ax_pos_num; ax_pos_num <= max_ax_pos_num; ++ax_pos_num)
+            if (!scale_factor_ok[ax_pos_num])
+              error(boost::format("Problem at segment %1%, axial pos %2% in finding sinogram scaling factor.\n"
+                                  "Weighted data in denominator too small compared to total in sinogram.\n"
+                                  "Adjust weights?")
+                    % segment_num % ax_pos_num);
+
+          std::cout << "Scale factors for segment " << segment_num << ":\n" << scale_factors;
+          threshold_lower(scale_factors.begin_all(), 
+                          scale_factors.end_all(),
+                          min_scale_factor);
+          threshold_upper(scale_factors.begin_all(), 
+                          scale_factors.end_all(),
+                          max_scale_factor);
+          // filter in axial direction
+          lowpass_filter(scale_factors);
+          std::cout << "After thresholding and filtering:\n" << scale_factors;
+
+          // apply scale factors
+#ifdef STIR_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+          for (int ax_pos_num = min_ax_pos_num; ax_pos_num <= max_ax_pos_num; ++ax_pos_num)
+            scatter_segment[ax_pos_num] *= scale_factors[ax_pos_num];
+        }
+
+      if (scaled_scatter_proj_data.set_segment(scatter_segment) == Succeeded::no)
+        error("writing of scaled sinograms failed");
     }
 }
 
@@ -0,0 +1,196 @@
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for stir::InputStreamWithRecords
+*/
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/IO/InputStreamWithRecords.h"
+#include "stir/RunTests.h"
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <iostream>
+
+START_NAMESPACE_STIR
+
+namespace detail
+{
+  //! a record of variable length, with the first byte giving the length
+  class TestRecord
+  {
+  public:
+    std::size_t
+      size_of_record_at_ptr(const char * const buffer, const std::size_t,
+                            const bool) const
+    { return static_cast<std::size_t>(buffer[0]); }
+
+    Succeeded
+      init_from_data_ptr(const char * const buffer,
+                         const std::size_t size_of_record,
+                         const bool)
+    {
+      length = static_cast<int>(size_of_record);
+      id = static_cast<int>(buffer[size_of_record-1]);
+      return Succeeded::yes;
+    }
+    int length;
+    int id;
+  };
+}
+
+/*!
+  \brief Test class for InputStreamWithRecords
+  \ingroup test
+
+  Writes records of varying length to a stream and checks that they are
+  read back correctly, including when records straddle buffer boundaries,
+  and after save_get_position()/set_get_position() and reset(). This is
+  done for a stream and a (memory-mapped) file.
+*/
+class InputStreamWithRecordsTests : public RunTests
+{
+public:
+  void run_tests();
+private:
+  void run_tests_for_buffer_size(const std::size_t buffer_size);
+  void run_tests_for_memory_mapped_file();
+  void check_reading(InputStreamWithRecords<detail::TestRecord, bool>& input);
+  void write_records(std::ostream& s);
+  static int length_of_record(const int id) { return 1 + id%5; }
+  static const int num_records = 1000;
+};
+
+void
+InputStreamWithRecordsTests::
+write_records(std::ostream& s)
+{
+  for (int id=0; id<num_records; ++id)
+    {
+      const int length = length_of_record(id);
+      s.put(static_cast<char>(length));
+      for (int i=1; i<length; ++i)
+        s.put(static_cast<char>(id%100));
+    }
+}
+
+void
+InputStreamWithRecordsTests::
+check_reading(InputStreamWithRecords<detail::TestRecord, bool>& input)
+{
+  detail::TestRecord record;
+  InputStreamWithRecords<detail::TestRecord, bool>::SavedPosition pos_at_100 = 0;
+  for (int id=0; id<num_records; ++id)
+    {
+      if (id==100)
+        pos_at_100 = input.save_get_position();
+      if (!check(input.get_next_record(record) == Succeeded::yes, "reading record"))
+        return;
+      check_if_equal(record.length, length_of_record(id), "record length");
+      if (record.length>1)
+        check_if_equal(record.id, id%100, "record contents");
+    }
+  check(input.get_next_record(record) == Succeeded::no, "reading beyond EOF should fail");
+  check_if_equal(input.get_num_records_read(), static_cast<unsigned long>(num_records), "number of records read");
+  const InputStreamWithRecords<detail::TestRecord, bool>::SavedPosition pos_at_eof =
+    input.save_get_position();
+
+  // go back
+  check(input.set_get_position(pos_at_100) == Succeeded::yes, "set_get_position");
+  for (int id=100; id<num_records; ++id)
+    {
+      if (!check(input.get_next_record(record) == Succeeded::yes, "reading record after set_get_position"))
+        return;
+      check_if_equal(record.length, length_of_record(id), "record length after set_get_position");
+    }
+  check(input.set_get_position(pos_at_eof) == Succeeded::yes, "set_get_position at EOF");
+  check(input.get_next_record(record) == Succeeded::no, "reading at EOF should fail");
+
+  check(input.reset() == Succeeded::yes, "reset");
+  check(input.get_next_record(record) == Succeeded::yes, "reading after reset");
+  check_if_equal(record.length, length_of_record(0), "record length after reset");
+  check_if_equal(input.get_num_records_read(), 1UL, "number of records read after reset");
+}
+
+void
+InputStreamWithRecordsTests::
+run_tests_for_buffer_size(const std::size_t buffer_size)
+{
+  std::cerr << "\tbuffer size " << buffer_size << '\n';
+  shared_ptr<std::stringstream> stream_sptr(new std::stringstream);
+  // some junk at the start, which should be skipped
+  *stream_sptr << "junk";
+  write_records(*stream_sptr);
+  stream_sptr->seekg(4);
+
+  shared_ptr<std::istream> istream_sptr(stream_sptr);
+  InputStreamWithRecords<detail::TestRecord, bool>
+    input(istream_sptr, 1, 5, false);
+  input.set_buffer_size(buffer_size);
+  check(input.get_buffer_size() >= 5, "buffer size should be at least max_size_of_record");
+  check(!input.is_memory_mapped(), "stream should not be memory-mapped");
+  check_reading(input);
+}
+
+void
+InputStreamWithRecordsTests::
+run_tests_for_memory_mapped_file()
+{
+  std::cerr << "\tmemory-mapped file\n";
+  const std::string filename = "test_InputStreamWithRecords.tmp";
+  {
+    std::ofstream s(filename.c_str(), std::ios::out | std::ios::binary);
+    s << "junk";
+    write_records(s);
+  }
+  {
+    InputStreamWithRecords<detail::TestRecord, bool>
+      input(filename, 1, 5, false, static_cast<std::streampos>(4));
+    check(input.is_memory_mapped(), "file should be memory-mapped");
+    check_reading(input);
+  }
+  {
+    InputStreamWithRecords<detail::TestRecord, bool>
+      input(filename, 1, 5, false, static_cast<std::streampos>(4), /* use_memory_map = */ false);
+    check(!input.is_memory_mapped(), "file should not be memory-mapped");
+    check_reading(input);
+  }
+  std::remove(filename.c_str());
+}
+
+void
+InputStreamWithRecordsTests::run_tests()
+{
+  std::cerr << "Tests for InputStreamWithRecords\n";
+  run_tests_for_buffer_size(5);
+  run_tests_for_buffer_size(13);
+  run_tests_for_buffer_size(1024*1024);
+  run_tests_for_memory_mapped_file();
+}
+
+END_NAMESPACE_STIR
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  InputStreamWithRecordsTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
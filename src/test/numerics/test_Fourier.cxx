@@ -25,6 +25,7 @@
 #include "stir/IndexRange3D.h"
 #include "stir/numerics/norm.h"
 #include "stir/numerics/fourier.h"
+#include <boost/format.hpp>
 #include <iostream>
 #include <algorithm>
 
@@ -70,8 +71,35 @@ public:
 private:
   template <int num_dimensions>
   void test_single_dimension(const IndexRange<num_dimensions>& index_range);
+  void test_against_direct_DFT(const int length);
 };
 
+//! compare with the straightforward (and slow) implementation of the DFT
+void FourierTests::test_against_direct_DFT(const int length)
+{
+  ArrayC1 c(length);
+  for (int i=0; i<length; ++i)
+    c[i] = std::complex<float>(rand1(), rand1());
+  for (int sign=-1; sign<=1; sign+=2)
+    {
+      ArrayC1 direct(length);
+      for (int s=0; s<length; ++s)
+        {
+          std::complex<double> sum(0);
+          for (int r=0; r<length; ++r)
+            sum += std::complex<double>(c[r]) *
+              std::polar(1., (sign*2*_PI*((static_cast<long>(r)*s) % length))/length);
+          direct[s] = std::complex<float>(sum);
+        }
+      ArrayC1 fft(c);
+      fourier(fft, sign);
+      fft -= direct;
+      const double residual =
+        norm(fft.begin_all(), fft.end_all())/norm(direct.begin_all(), direct.end_all());
+      check(residual < 1.E-5, boost::str(boost::format("comparison with direct DFT for length %1%") % length));
+    }
+}
+
 template <int num_dimensions>
 void FourierTests::test_single_dimension(const IndexRange<num_dimensions>& index_range)
 {
@@ -102,15 +130,26 @@ void FourierTests::test_single_dimension(const IndexRange<num_dimensions>& index
   //cout << all_frequencies << complex_array;
   //cout << '\n' << complex_array-all_frequencies;
   complex_array -= all_frequencies;
-  cout << "\nReal FT Residual norm "  <<
-    norm(complex_array.begin_all(), complex_array.end_all())/norm(real_array.begin_all(), real_array.end_all());
+  {
+    const double residual =
+      norm(complex_array.begin_all(), complex_array.end_all())/norm(real_array.begin_all(), real_array.end_all());
+    cout << "\nReal FT Residual norm "  << residual;
+    // the norm of the DFT grows with the number of elements, so compare relative to that
+    check(norm(complex_array.begin_all(), complex_array.end_all()) <
+          1.E-5*norm(all_frequencies.begin_all(), all_frequencies.end_all()),
+          "fourier_for_real_data vs fourier");
+  }
 
   real_type test_inverse_real =
     inverse_fourier_for_real_data(pos_frequencies,sign);
   //cout <<"\nv,test "<< v << test_inverse_real << test_inverse_real/v;
   test_inverse_real -= real_array;
-  cout << "\ninverse Real FT Residual norm "  <<
-    norm(test_inverse_real.begin_all(), test_inverse_real.end_all())/norm(real_array.begin_all(), real_array.end_all());
+  {
+    const double residual =
+      norm(test_inverse_real.begin_all(), test_inverse_real.end_all())/norm(real_array.begin_all(), real_array.end_all());
+    cout << "\ninverse Real FT Residual norm "  << residual;
+    check(residual < 1.E-4, "inverse_fourier_for_real_data");
+  }
 
   // fill
   {
@@ -124,8 +163,12 @@ void FourierTests::test_single_dimension(const IndexRange<num_dimensions>& index
   fourier(complex_array,sign);
   inverse_fourier(complex_array,sign);
   complex_array -= array_copy;
-  cout << "\ninverse  FT Residual norm "  <<
-    norm(complex_array.begin_all(), complex_array.end_all())/norm(array_copy.begin_all(), array_copy.end_all());
+  {
+    const double residual =
+      norm(complex_array.begin_all(), complex_array.end_all())/norm(array_copy.begin_all(), array_copy.end_all());
+    cout << "\ninverse  FT Residual norm "  << residual << '\n';
+    check(residual < 1.E-4, "inverse_fourier");
+  }
 }
 
 void FourierTests::run_tests()
@@ -138,6 +181,23 @@ void FourierTests::run_tests()
   test_single_dimension(IndexRange2D(128,256));
   std::cerr << "... Testing 3D\n";
   test_single_dimension(IndexRange3D(128,256,16));
+
+  std::cerr << "... Testing lengths which are not a power of 2\n";
+  test_single_dimension(IndexRange<1>(90));
+  test_single_dimension(IndexRange2D(34,30));
+  test_single_dimension(IndexRange3D(12,7,22));
+  {
+    // include lengths with radix 3, 5, 7 and 13 and some using Bluestein's algorithm
+    const int lengths[] = { 1, 2, 3, 5, 6, 12, 15, 49, 60, 64, 96, 17, 97, 2*13*19, 1000 };
+    for (unsigned int i=0; i<sizeof(lengths)/sizeof(lengths[0]); ++i)
+      test_against_direct_DFT(lengths[i]);
+  }
+
+  std::cerr << "... Testing efficient_fourier_length\n";
+  check_if_equal(efficient_fourier_length(0), 2, "efficient_fourier_length(0)");
+  check_if_equal(efficient_fourier_length(7), 8, "efficient_fourier_length(7)");
+  check_if_equal(efficient_fourier_length(129), 144, "efficient_fourier_length(129)");
+  check_if_equal(efficient_fourier_length(192), 192, "efficient_fourier_length(192)");
 }
 
 END_NAMESPACE_STIR
@@ -58,6 +58,7 @@
 #include <stdio.h>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include <boost/format.hpp>
 #ifndef STIR_NO_NAMESPACES
 using std::ofstream;
@@ -732,6 +733,54 @@ ArrayTests::run_tests()
     }
   }
 
+  {
+    cerr << "Testing contiguous storage" << endl;
+    const IndexRange<3> range(Coordinate3D<int>(-1,2,-3),Coordinate3D<int>(3,4,5));
+    Array<3,float> test(range);
+    check(test.is_contiguous(), "Array constructed from an IndexRange should be contiguous");
+    {
+      // fill with numbers in sequence and check the memory layout
+      float value = 0.F;
+      for (Array<3,float>::full_iterator iter = test.begin_all(); iter != test.end_all(); ++iter)
+        *iter = value++;
+      const float * const data_ptr = test.get_const_full_data_ptr();
+      check_if_equal(data_ptr[0], test[-1][2][-3], "contiguous storage: first element");
+      check_if_equal(data_ptr[test.size_all()-1], test[3][4][5], "contiguous storage: last element");
+      check_if_equal(&test[0][3][1] - data_ptr, static_cast<ptrdiff_t>(1*3*9 + 1*9 + 4), "contiguous storage: pointer offset");
+      check_if_equal(test.find_max(), value-1, "contiguous storage: find_max");
+      check_if_equal(test.sum(), value*(value-1)/2, "contiguous storage: sum");
+    }
+    Array<3,float> copy(test);
+    check(copy.is_contiguous(), "copy of contiguous Array should be contiguous");
+    check(copy.get_const_full_data_ptr() != test.get_const_full_data_ptr(), "copy of Array should use different memory");
+    check_if_equal(copy, test, "copy of contiguous Array");
+
+    // using existing data
+    {
+      std::vector<float> data(range.size_all(), 2.F);
+      Array<3,float> wrapper(range, &data[0], /* copy_data = */ false);
+      check(wrapper.get_full_data_ptr() == &data[0], "Array using existing data should use that memory");
+      wrapper[0][3][1] = 5.F;
+      check_if_equal(data[1*3*9 + 1*9 + 4], 5.F, "Array using existing data should modify that memory");
+      wrapper = test;
+      check(wrapper.get_full_data_ptr() == &data[0], "assignment should preserve memory when the range is the same");
+      check_if_equal(data[3], test[-1][2][0], "assignment with the same range should copy into existing memory");
+      Array<3,float> copied_wrapper(range, &data[0], /* copy_data = */ true);
+      check(copied_wrapper.get_full_data_ptr() != &data[0], "Array copying existing data should allocate new memory");
+      check_if_equal(copied_wrapper, test, "Array copying existing data");
+    }
+
+    // a resize of a row makes the array non-contiguous
+    copy[0][3].resize(1,5);
+    check(!copy.is_contiguous(), "Array should not be contiguous after resizing a row");
+    copy.fill(1.F);
+    check_if_equal(copy.sum(), static_cast<float>(copy.size_all()), "fill and sum of non-contiguous Array");
+    // assignment makes it contiguous again
+    copy = test;
+    check(copy.is_contiguous(), "Array should be contiguous after assignment");
+    check_if_equal(copy, test, "assignment of contiguous Array");
+  }
+
 #if 1
   {
     cerr << "Testing 1D float IO" << endl;
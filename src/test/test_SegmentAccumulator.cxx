@@ -0,0 +1,289 @@
+//
+//
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for stir::SegmentAccumulator and derived classes
+
+*/
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/listmode/SegmentAccumulator.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/SegmentByView.h"
+#include "stir/Bin.h"
+#include "stir/RunTests.h"
+#include "stir/Scanner.h"
+#include "stir/shared_ptr.h"
+#include <iostream>
+
+START_NAMESPACE_STIR
+
+
+/*!
+  \ingroup test
+  \brief Test class for SegmentAccumulator
+
+  Checks the promotion (per view) of IntegerSegmentAccumulator from 16-bit to 32-bit
+  integers and then to float, and that the sparse storage of
+  SparseSegmentAccumulator gives the same segment as FloatSegmentAccumulator.
+  It also checks adding accumulators of different types, as used by
+  SegmentAccumulators for parallel binning.
+*/
+class SegmentAccumulatorTests: public RunTests
+{
+public:
+  void run_tests();
+private:
+  shared_ptr<ProjDataInfo> proj_data_info_sptr;
+
+  void run_tests_for_integer_promotion(const int segment_num);
+  void run_tests_for_sparse(const int segment_num);
+  void run_tests_for_adding(const int segment_num);
+  void run_tests_for_segment_accumulators();
+};
+
+void
+SegmentAccumulatorTests::
+run_tests_for_integer_promotion(const int segment_num)
+{
+  std::cerr << "Testing IntegerSegmentAccumulator for segment " << segment_num << '\n';
+  IntegerSegmentAccumulator accumulator(proj_data_info_sptr, segment_num);
+  FloatSegmentAccumulator reference(proj_data_info_sptr, segment_num);
+
+  const Bin bin1(segment_num, proj_data_info_sptr->get_min_view_num(),
+                 proj_data_info_sptr->get_min_axial_pos_num(segment_num),
+                 proj_data_info_sptr->get_min_tangential_pos_num());
+  const Bin bin2(segment_num, proj_data_info_sptr->get_max_view_num(),
+                 proj_data_info_sptr->get_max_axial_pos_num(segment_num),
+                 proj_data_info_sptr->get_max_tangential_pos_num());
+  const Bin bin3(segment_num, 3, proj_data_info_sptr->get_min_axial_pos_num(segment_num)+1, 2);
+
+  check_if_equal(accumulator.get_num_bytes_per_bin(bin1.view_num()), 2, "initial storage should be 16-bit");
+  check_if_equal(accumulator.get_memory_usage_in_bytes()*2, reference.get_memory_usage_in_bytes(),
+                 "16-bit storage should use half the memory of float");
+
+  // prompts and delayeds, staying within 16-bit range
+  for (int i=0; i<30000; ++i)
+    {
+      accumulator.add(bin1, 1.F);
+      reference.add(bin1, 1.F);
+    }
+  accumulator.add(bin2, -1.F);
+  reference.add(bin2, -1.F);
+  check_if_equal(accumulator.get_num_bytes_per_bin(bin1.view_num()), 2, "storage should still be 16-bit");
+  check(accumulator.get_segment() == reference.get_segment(), "get_segment with 16-bit storage");
+
+  // go beyond the 16-bit range
+  for (int i=0; i<5000; ++i)
+    {
+      accumulator.add(bin1, 1.F);
+      reference.add(bin1, 1.F);
+    }
+  check_if_equal(accumulator.get_num_bytes_per_bin(bin1.view_num()), 4, "storage should be promoted to 32-bit");
+  check_if_equal(accumulator.get_num_bytes_per_bin(bin2.view_num()), 2, "storage of other views should still be 16-bit");
+  const std::size_t num_bins_per_view =
+    static_cast<std::size_t>(proj_data_info_sptr->get_num_axial_poss(segment_num)) *
+    proj_data_info_sptr->get_num_tangential_poss();
+  check_if_equal(accumulator.get_memory_usage_in_bytes(),
+                 reference.get_memory_usage_in_bytes()/2 + num_bins_per_view*2,
+                 "only one view should be promoted to 32-bit");
+  check_if_equal(accumulator.get_segment()[bin1.view_num()][bin1.axial_pos_num()][bin1.tangential_pos_num()],
+                 35000.F, "value after promotion to 32-bit");
+  check(accumulator.get_segment() == reference.get_segment(), "get_segment with 32-bit storage");
+
+  // non-integer value (e.g. from normalisation)
+  accumulator.add(bin3, 1.5F);
+  reference.add(bin3, 1.5F);
+  accumulator.add(bin1, 2.F);
+  reference.add(bin1, 2.F);
+  check_if_equal(accumulator.get_num_bytes_per_bin(bin3.view_num()), 4, "storage should be promoted to float");
+  check_if_equal(accumulator.get_num_bytes_per_bin(bin2.view_num()), 2, "storage of other views should still be 16-bit");
+  check(accumulator.get_segment() == reference.get_segment(), "get_segment with float storage");
+
+  // straight from 16-bit to float
+  {
+    IntegerSegmentAccumulator accumulator(proj_data_info_sptr, segment_num);
+    accumulator.add(bin2, 3.F);
+    accumulator.add(bin3, .25F);
+    const SegmentByView<float> segment = accumulator.get_segment();
+    check_if_equal(segment[bin2.view_num()][bin2.axial_pos_num()][bin2.tangential_pos_num()],
+                   3.F, "value after promotion from 16-bit to float");
+    check_if_equal(segment[bin3.view_num()][bin3.axial_pos_num()][bin3.tangential_pos_num()],
+                   .25F, "non-integer value after promotion from 16-bit to float");
+    check_if_equal(segment.sum(), 3.25F, "sum after promotion from 16-bit to float");
+  }
+}
+
+void
+SegmentAccumulatorTests::
+run_tests_for_sparse(const int segment_num)
+{
+  std::cerr << "Testing SparseSegmentAccumulator for segment " << segment_num << '\n';
+  SparseSegmentAccumulator accumulator(proj_data_info_sptr, segment_num);
+  FloatSegmentAccumulator reference(proj_data_info_sptr, segment_num);
+
+  check(accumulator.get_segment() == reference.get_segment(), "empty sparse segment should be zero");
+
+  // add values to a regular subset of bins, including bins at the edges
+  int num_bins_added = 0;
+  for (int view_num = proj_data_info_sptr->get_min_view_num();
+       view_num <= proj_data_info_sptr->get_max_view_num();
+       view_num += 5)
+    for (int axial_pos_num = proj_data_info_sptr->get_min_axial_pos_num(segment_num);
+         axial_pos_num <= proj_data_info_sptr->get_max_axial_pos_num(segment_num);
+         axial_pos_num += 3)
+      for (int tangential_pos_num = proj_data_info_sptr->get_min_tangential_pos_num();
+           tangential_pos_num <= proj_data_info_sptr->get_max_tangential_pos_num();
+           tangential_pos_num += 7)
+        {
+          const Bin bin(segment_num, view_num, axial_pos_num, tangential_pos_num);
+          const float value = static_cast<float>(view_num + 2*axial_pos_num - tangential_pos_num) + .5F;
+          accumulator.add(bin, value);
+          reference.add(bin, value);
+          // add a prompt and subtract a delayed
+          accumulator.add(bin, 1.F);
+          reference.add(bin, 1.F);
+          accumulator.add(bin, -1.F);
+          reference.add(bin, -1.F);
+          ++num_bins_added;
+        }
+  check(num_bins_added > 0, "there should be some bins in the test");
+
+  const SegmentByView<float> segment = accumulator.get_segment();
+  check(segment == reference.get_segment(), "sparse to dense conversion in get_segment");
+  check_if_equal(segment.get_segment_num(), segment_num, "segment number of get_segment");
+  check(accumulator.get_memory_usage_in_bytes() < reference.get_memory_usage_in_bytes(),
+        "sparse storage should use less memory for low-count data");
+}
+
+void
+SegmentAccumulatorTests::
+run_tests_for_adding(const int segment_num)
+{
+  std::cerr << "Testing adding accumulators for segment " << segment_num << '\n';
+  const Bin bin1(segment_num, proj_data_info_sptr->get_min_view_num(),
+                 proj_data_info_sptr->get_min_axial_pos_num(segment_num),
+                 proj_data_info_sptr->get_min_tangential_pos_num());
+  const Bin bin2(segment_num, proj_data_info_sptr->get_max_view_num(),
+                 proj_data_info_sptr->get_max_axial_pos_num(segment_num),
+                 proj_data_info_sptr->get_max_tangential_pos_num());
+
+  const char * types[] = { "float", "integer", "sparse" };
+  const int num_types = static_cast<int>(sizeof(types)/sizeof(types[0]));
+  for (int output_type=0; output_type<num_types; ++output_type)
+    for (int input_type=0; input_type<num_types; ++input_type)
+      {
+        shared_ptr<SegmentAccumulator> output_sptr
+          (SegmentAccumulator::create(types[output_type], proj_data_info_sptr, segment_num));
+        shared_ptr<SegmentAccumulator> input_sptr
+          (SegmentAccumulator::create(types[input_type], proj_data_info_sptr, segment_num));
+        FloatSegmentAccumulator reference(proj_data_info_sptr, segment_num);
+
+        output_sptr->add(bin1, 30000.F);
+        reference.add(bin1, 30000.F);
+        output_sptr->add(bin2, -1.F);
+        reference.add(bin2, -1.F);
+        // the sum for bin1 does not fit in 16 bits
+        input_sptr->add(bin1, 5000.F);
+        reference.add(bin1, 5000.F);
+        input_sptr->add(bin2, 1.F);
+        reference.add(bin2, 1.F);
+
+        *output_sptr += *input_sptr;
+        check(output_sptr->get_segment() == reference.get_segment(),
+              std::string("adding ") + types[input_type] + " to " + types[output_type]);
+      }
+}
+
+void
+SegmentAccumulatorTests::
+run_tests_for_segment_accumulators()
+{
+  std::cerr << "Testing SegmentAccumulators\n";
+  const int min_segment_num = proj_data_info_sptr->get_min_segment_num();
+  const int max_segment_num = proj_data_info_sptr->get_max_segment_num();
+  SegmentAccumulators accumulators("integer", proj_data_info_sptr, min_segment_num, max_segment_num);
+  check_if_equal(accumulators.get_min_index(), min_segment_num, "SegmentAccumulators::get_min_index");
+  check_if_equal(accumulators.get_max_index(), max_segment_num, "SegmentAccumulators::get_max_index");
+  shared_ptr<SegmentAccumulators> copy_sptr(accumulators.get_empty_copy());
+  check_if_equal(copy_sptr->get_memory_usage_in_bytes(), accumulators.get_memory_usage_in_bytes(),
+                 "SegmentAccumulators::get_empty_copy should use the same type");
+
+  for (int segment_num = min_segment_num; segment_num <= max_segment_num; ++segment_num)
+    {
+      const Bin bin(segment_num, 2, proj_data_info_sptr->get_min_axial_pos_num(segment_num), 1);
+      accumulators.add(bin, 1.F);
+      copy_sptr->add(bin, static_cast<float>(segment_num));
+    }
+  for (int segment_num = min_segment_num; segment_num <= max_segment_num; ++segment_num)
+    {
+      accumulators[segment_num] += (*copy_sptr)[segment_num];
+      check_if_equal(accumulators[segment_num].get_segment().sum(), static_cast<float>(segment_num + 1),
+                     "SegmentAccumulators: sum after adding the copy");
+    }
+}
+
+void
+SegmentAccumulatorTests::
+run_tests()
+{
+  std::cerr << "-------- Testing SegmentAccumulator --------\n";
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+
+  proj_data_info_sptr.reset
+    (ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                   /*span*/1, 2,/*views*/ 48, /*tang_pos*/64, /*arc_corrected*/ true)
+     );
+
+  check(SegmentAccumulator::is_valid_type("float"), "is_valid_type(float)");
+  check(SegmentAccumulator::is_valid_type("integer"), "is_valid_type(integer)");
+  check(SegmentAccumulator::is_valid_type("sparse"), "is_valid_type(sparse)");
+  check(!SegmentAccumulator::is_valid_type("double"), "is_valid_type(double) should be false");
+
+  {
+    shared_ptr<SegmentAccumulator> accumulator_sptr
+      (SegmentAccumulator::create("sparse", proj_data_info_sptr, 1));
+    check(dynamic_cast<SparseSegmentAccumulator *>(accumulator_sptr.get()) != 0,
+          "create(sparse) should return a SparseSegmentAccumulator");
+    check_if_equal(accumulator_sptr->get_segment_num(), 1, "get_segment_num");
+  }
+
+  for (int segment_num = proj_data_info_sptr->get_min_segment_num();
+       segment_num <= proj_data_info_sptr->get_max_segment_num();
+       segment_num += 2)
+    {
+      run_tests_for_integer_promotion(segment_num);
+      run_tests_for_sparse(segment_num);
+      run_tests_for_adding(segment_num);
+    }
+  run_tests_for_segment_accumulators();
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  SegmentAccumulatorTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
@@ -0,0 +1,172 @@
+//
+//
+/*!
+
+  \file
+  \ingroup test
+
+  \brief Test program for reading from stir::ProjDataFromStream with multiple threads
+
+*/
+/*
+    This file is part of STIR.
+
+    This file is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This file is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    See STIR/LICENSE.txt for details
+*/
+
+#include "stir/ProjDataInterfile.h"
+#include "stir/ProjDataInMemory.h"
+#include "stir/ExamInfo.h"
+#include "stir/ProjDataInfo.h"
+#include "stir/SegmentBySinogram.h"
+#include "stir/Sinogram.h"
+#include "stir/Viewgram.h"
+#include "stir/Succeeded.h"
+#include "stir/Bin.h"
+#include "stir/RunTests.h"
+#include "stir/Scanner.h"
+#include <cstdio>
+
+START_NAMESPACE_STIR
+
+
+/*!
+  \ingroup test
+  \brief Test class for reading ProjDataFromStream from multiple threads
+
+  The data are written to file using ProjDataInterfile, and then read back
+  in parallel (when compiled with OpenMP), both with streams per thread and
+  with a single shared stream.
+*/
+class ProjDataFromStreamTests: public RunTests
+{
+public:
+  void run_tests();
+private:
+  void run_tests_for_one_storage_order(const ProjDataFromStream::StorageOrder storage_order);
+  void test_concurrent_reading(const ProjDataFromStream& proj_data,
+                               const ProjDataInMemory& reference,
+                               const std::string& str);
+};
+
+void
+ProjDataFromStreamTests::
+test_concurrent_reading(const ProjDataFromStream& proj_data,
+                        const ProjDataInMemory& reference,
+                        const std::string& str)
+{
+  int num_viewgram_errors = 0;
+  int num_sinogram_errors = 0;
+  int num_bin_errors = 0;
+  for (int segment_num=proj_data.get_min_segment_num(); segment_num<=proj_data.get_max_segment_num(); ++segment_num)
+    {
+#ifdef STIR_OPENMP
+#pragma omp parallel for reduction(+:num_viewgram_errors,num_bin_errors) schedule(dynamic)
+#endif
+      for (int view_num=proj_data.get_min_view_num(); view_num<=proj_data.get_max_view_num(); ++view_num)
+        {
+          const Viewgram<float> viewgram = proj_data.get_viewgram(view_num, segment_num);
+          if (viewgram != reference.get_viewgram(view_num, segment_num))
+            ++num_viewgram_errors;
+          const Bin bin(segment_num, view_num, proj_data.get_min_axial_pos_num(segment_num), 0);
+          if (proj_data.get_bin_value(bin) != reference.get_bin_value(bin))
+            ++num_bin_errors;
+        }
+#ifdef STIR_OPENMP
+#pragma omp parallel for reduction(+:num_sinogram_errors) schedule(dynamic)
+#endif
+      for (int ax_pos_num=proj_data.get_min_axial_pos_num(segment_num); ax_pos_num<=proj_data.get_max_axial_pos_num(segment_num); ++ax_pos_num)
+        {
+          const Sinogram<float> sinogram = proj_data.get_sinogram(ax_pos_num, segment_num);
+          if (sinogram != reference.get_sinogram(ax_pos_num, segment_num))
+            ++num_sinogram_errors;
+        }
+    }
+  check_if_equal(num_viewgram_errors, 0, "get_viewgram " + str);
+  check_if_equal(num_sinogram_errors, 0, "get_sinogram " + str);
+  check_if_equal(num_bin_errors, 0, "get_bin_value " + str);
+}
+
+void
+ProjDataFromStreamTests::
+run_tests_for_one_storage_order(const ProjDataFromStream::StorageOrder storage_order)
+{
+  shared_ptr<Scanner> scanner_sptr(new Scanner(Scanner::E953));
+  shared_ptr<ProjDataInfo> proj_data_info_sptr
+    (ProjDataInfo::ProjDataInfoCTI(scanner_sptr,
+                                   /*span*/3, 5,/*views*/ 48, /*tang_pos*/64, /*arc_corrected*/ true)
+     );
+  shared_ptr<ExamInfo> exam_info_sptr(new ExamInfo);
+
+  // fill reference data with values that differ for every bin
+  ProjDataInMemory reference(exam_info_sptr, proj_data_info_sptr, false);
+  for (int segment_num=reference.get_min_segment_num(); segment_num<=reference.get_max_segment_num(); ++segment_num)
+    {
+      SegmentBySinogram<float> segment = reference.get_empty_segment_by_sinogram(segment_num);
+      float value = 1000.F*segment_num;
+      for (SegmentBySinogram<float>::full_iterator iter = segment.begin_all(); iter != segment.end_all(); ++iter)
+        *iter = value++;
+      reference.set_segment(segment);
+    }
+
+  const std::string filename = "test_proj_data_from_stream.hs";
+  {
+    ProjDataInterfile proj_data(exam_info_sptr, proj_data_info_sptr, filename,
+                                std::ios::in | std::ios::out | std::ios::trunc,
+                                storage_order);
+    for (int segment_num=reference.get_min_segment_num(); segment_num<=reference.get_max_segment_num(); ++segment_num)
+      check(proj_data.set_segment(reference.get_segment_by_sinogram(segment_num)) == Succeeded::yes,
+            "test set_segment");
+
+    check(proj_data.supports_concurrent_reading(), "supports_concurrent_reading");
+    test_concurrent_reading(proj_data, reference, "(stream per thread)");
+
+    // now disable the streams per thread, such that the shared stream is used
+    proj_data.set_filename_for_concurrent_reading("");
+    test_concurrent_reading(proj_data, reference, "(shared stream)");
+  }
+
+  // read via the Interfile header
+  {
+    shared_ptr<ProjData> proj_data_sptr = ProjData::read_from_file(filename);
+    const ProjDataFromStream* proj_data_ptr =
+      dynamic_cast<const ProjDataFromStream*>(proj_data_sptr.get());
+    if (check(proj_data_ptr != 0, "read_from_file should return a ProjDataFromStream"))
+      test_concurrent_reading(*proj_data_ptr, reference, "(after read_from_file)");
+  }
+  remove(filename.c_str());
+  remove("test_proj_data_from_stream.s");
+}
+
+void
+ProjDataFromStreamTests::
+run_tests()
+{
+  std::cerr << "-------- Testing ProjDataFromStream --------\n";
+  std::cerr << "Storage order Segment_View_AxialPos_TangPos\n";
+  run_tests_for_one_storage_order(ProjDataFromStream::Segment_View_AxialPos_TangPos);
+  std::cerr << "Storage order Segment_AxialPos_View_TangPos\n";
+  run_tests_for_one_storage_order(ProjDataFromStream::Segment_AxialPos_View_TangPos);
+}
+
+END_NAMESPACE_STIR
+
+
+USING_NAMESPACE_STIR
+
+int main()
+{
+  ProjDataFromStreamTests tests;
+  tests.run_tests();
+  return tests.main_return_value();
+}
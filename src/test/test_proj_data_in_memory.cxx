@@ -33,6 +33,7 @@
 #include "stir/Sinogram.h"
 #include "stir/Viewgram.h"
 #include "stir/Succeeded.h"
+#include "stir/Bin.h"
 #include "stir/RunTests.h"
 #include "stir/Scanner.h"
 
@@ -95,6 +96,30 @@ run_tests()
                    "test set/get_viewgram");
   }
 
+  // test set_sinogram and consistency with get_viewgram and get_bin_value
+  {
+    Sinogram<float> sinogram = proj_data.get_empty_sinogram(2,-1);
+    for (int view_num=sinogram.get_min_view_num(); view_num<=sinogram.get_max_view_num(); ++view_num)
+      for (int tang_pos_num=sinogram.get_min_tangential_pos_num(); tang_pos_num<=sinogram.get_max_tangential_pos_num(); ++tang_pos_num)
+        sinogram[view_num][tang_pos_num] = static_cast<float>(view_num*1000 + tang_pos_num);
+    check(proj_data.set_sinogram(sinogram) == Succeeded::yes,
+          "test set_sinogram succeeded");
+    check_if_equal(proj_data.get_sinogram(2,-1), static_cast<const Array<2,float>&>(sinogram),
+                   "test set/get_sinogram");
+    const Viewgram<float> viewgram = proj_data.get_viewgram(5,-1);
+    check_if_equal(viewgram[2][3], 5*1000.F + 3, "test get_viewgram after set_sinogram");
+    check_if_equal(viewgram[3][3], value, "test get_viewgram after set_sinogram (other axial position)");
+    check_if_equal(proj_data.get_bin_value(Bin(-1,7,2,-4)), 7*1000.F - 4, "test get_bin_value");
+    const SegmentBySinogram<float> segment = proj_data.get_segment_by_sinogram(-1);
+    check_if_equal(segment[2][5][3], 5*1000.F + 3, "test get_segment_by_sinogram");
+    // set it again in a different segment
+    SegmentBySinogram<float> segment2 = proj_data.get_empty_segment_by_sinogram(1);
+    segment2 += segment;
+    check(proj_data.set_segment(segment2) == Succeeded::yes, "test set_segment(SegmentBySinogram)");
+    check_if_equal(proj_data.get_sinogram(2,1), static_cast<const Array<2,float>&>(sinogram),
+                   "test set_segment(SegmentBySinogram) and get_sinogram");
+  }
+
   // test making a copy 
   {
     ProjDataInMemory proj_data2(proj_data);
@@ -104,6 +129,20 @@ run_tests()
     check_if_equal(proj_data2.get_viewgram(1,1).find_max(),
                    proj_data.get_viewgram(1,1).find_max(),
                    "test 1 for copy-constructor and get_viewgram");
+    // check that the copy has its own data
+    proj_data2.fill(value*3);
+    check_if_equal(proj_data.get_viewgram(0,0).find_max(),
+                   value,
+                   "test copy-constructor copies the data");
+    // test assignment
+    proj_data2 = proj_data;
+    check_if_equal(proj_data2.get_viewgram(0,0).find_max(),
+                   value,
+                   "test assignment operator and get_viewgram");
+    proj_data2.fill(value*3);
+    check_if_equal(proj_data.get_viewgram(0,0).find_max(),
+                   value,
+                   "test assignment operator copies the data");
   }
 
   // test fill with larger input